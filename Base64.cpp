@@ -0,0 +1,165 @@
+// Base64 encoding and decoding: see Base64.h.
+
+#include <cstring>
+#include "Base64.h"
+
+static const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Marks a character that isn't in the alphabet, in the decoding table
+static const uint8_t NotBase64 = 0x80;
+
+/// <summary>
+/// Lookup tables, built once: the two characters for each 12-bit value, and the value of each character
+/// </summary>
+struct Base64Tables_t
+{
+    wchar_t pairs[4096][2];
+    uint8_t values[256];
+
+    Base64Tables_t()
+    {
+        for (size_t ix = 0; ix < 4096; ++ix)
+        {
+            pairs[ix][0] = wchar_t(Alphabet[ix >> 6]);
+            pairs[ix][1] = wchar_t(Alphabet[ix & 0x3f]);
+        }
+        memset(values, NotBase64, sizeof(values));
+        for (uint8_t ix = 0; ix < 64; ++ix)
+            values[uint8_t(Alphabet[ix])] = ix;
+    }
+};
+
+static const Base64Tables_t& Tables()
+{
+    static const Base64Tables_t tables;
+    return tables;
+}
+
+void Base64Encode(const uint8_t* pData, size_t cbData, wchar_t* pOutput)
+{
+    const Base64Tables_t& tables = Tables();
+    const uint8_t* p = pData;
+    const uint8_t* const pWholeEnd = pData + cbData / 3 * 3;
+    // Four groups of three bytes per iteration, then one group at a time
+    for (; pWholeEnd - p >= 12; p += 12, pOutput += 16)
+    {
+        for (int ix = 0; ix < 4; ++ix)
+        {
+            const uint32_t dw = (uint32_t(p[3 * ix]) << 16) | (uint32_t(p[3 * ix + 1]) << 8) | p[3 * ix + 2];
+            memcpy(pOutput + 4 * ix, tables.pairs[dw >> 12], 2 * sizeof(wchar_t));
+            memcpy(pOutput + 4 * ix + 2, tables.pairs[dw & 0xfff], 2 * sizeof(wchar_t));
+        }
+    }
+    for (; p < pWholeEnd; p += 3, pOutput += 4)
+    {
+        const uint32_t dw = (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+        memcpy(pOutput, tables.pairs[dw >> 12], 2 * sizeof(wchar_t));
+        memcpy(pOutput + 2, tables.pairs[dw & 0xfff], 2 * sizeof(wchar_t));
+    }
+
+    // One or two bytes left over: padded
+    const size_t cbLeft = size_t(pData + cbData - p);
+    if (cbLeft > 0)
+    {
+        const uint32_t dw = (uint32_t(p[0]) << 16) | ((2 == cbLeft) ? (uint32_t(p[1]) << 8) : 0);
+        pOutput[0] = wchar_t(Alphabet[dw >> 18]);
+        pOutput[1] = wchar_t(Alphabet[(dw >> 12) & 0x3f]);
+        pOutput[2] = (2 == cbLeft) ? wchar_t(Alphabet[(dw >> 6) & 0x3f]) : L'=';
+        pOutput[3] = L'=';
+    }
+}
+
+void Base64Encode(const uint8_t* pData, size_t cbData, std::wstring& sOutput)
+{
+    sOutput.resize(Base64EncodedLength(cbData));
+    if (!sOutput.empty())
+        Base64Encode(pData, cbData, &sOutput[0]);
+}
+
+/// <summary>
+/// Value of a Base64 character; NotBase64 if it isn't one
+/// </summary>
+static inline uint8_t ValueOf(const Base64Tables_t& tables, wchar_t ch)
+{
+    return (uint32_t(ch) < 256) ? tables.values[uint32_t(ch)] : NotBase64;
+}
+
+/// <summary>
+/// Index of the first character that isn't valid where it is: one that isn't in the alphabet, or an '=' that isn't
+/// part of the padding (the last one or two characters, all '='). An '=' followed by anything but padding is
+/// reported itself, not the character before or after it.
+/// </summary>
+/// <returns>Index of the character; cchText if there's none</returns>
+static size_t FindInvalidChar(const Base64Tables_t& tables, const wchar_t* pText, size_t cchText)
+{
+    for (size_t ix = 0; ix < cchText; ++ix)
+    {
+        if (NotBase64 != ValueOf(tables, pText[ix]))
+            continue;
+        if (L'=' != pText[ix] || ix + 2 < cchText)
+            return ix;
+        for (size_t ixPad = ix + 1; ixPad < cchText; ++ixPad)
+            if (L'=' != pText[ixPad])
+                return ix;
+        break;
+    }
+    return cchText;
+}
+
+bool Base64Decode(const wchar_t* pText, size_t cchText, std::vector<uint8_t>& decoded, size_t& ixError)
+{
+    const Base64Tables_t& tables = Tables();
+    decoded.clear();
+    ixError = 0;
+    if (0 != cchText % 4)
+    {
+        ixError = cchText;
+        return false;
+    }
+    if (0 == cchText)
+        return true;
+
+    // All groups but the last have no padding
+    const size_t nGroups = cchText / 4;
+    decoded.resize(nGroups * 3);
+    uint8_t* pOut = decoded.data();
+    for (size_t ixGroup = 0; ixGroup + 1 < nGroups; ++ixGroup, pOut += 3)
+    {
+        const wchar_t* const pGroup = pText + 4 * ixGroup;
+        const uint8_t v0 = ValueOf(tables, pGroup[0]), v1 = ValueOf(tables, pGroup[1]), v2 = ValueOf(tables, pGroup[2]), v3 = ValueOf(tables, pGroup[3]);
+        if (0 != ((v0 | v1 | v2 | v3) & NotBase64))
+        {
+            ixError = FindInvalidChar(tables, pText, cchText);
+            decoded.clear();
+            return false;
+        }
+        const uint32_t dw = (uint32_t(v0) << 18) | (uint32_t(v1) << 12) | (uint32_t(v2) << 6) | v3;
+        pOut[0] = uint8_t(dw >> 16);
+        pOut[1] = uint8_t(dw >> 8);
+        pOut[2] = uint8_t(dw);
+    }
+
+    // The last group: "xxxx", "xxx=", or "xx=="
+    const size_t ixLast = cchText - 4;
+    const wchar_t* const pGroup = pText + ixLast;
+    size_t nPadding = 0;
+    if (L'=' == pGroup[3])
+        nPadding = (L'=' == pGroup[2]) ? 2 : 1;
+    uint8_t values[4] = { 0, 0, 0, 0 };
+    for (size_t ix = 0; ix < 4 - nPadding; ++ix)
+    {
+        values[ix] = ValueOf(tables, pGroup[ix]);
+        if (NotBase64 == values[ix])
+        {
+            ixError = FindInvalidChar(tables, pText, cchText);
+            decoded.clear();
+            return false;
+        }
+    }
+    const uint32_t dw = (uint32_t(values[0]) << 18) | (uint32_t(values[1]) << 12) | (uint32_t(values[2]) << 6) | values[3];
+    pOut[0] = uint8_t(dw >> 16);
+    pOut[1] = uint8_t(dw >> 8);
+    pOut[2] = uint8_t(dw);
+    decoded.resize(decoded.size() - nPadding);
+    return true;
+}
@@ -0,0 +1,48 @@
+// Base64 (RFC 4648, standard alphabet, with padding, no line breaks): encoding of PowerShell -EncodedCommand
+// command lines (-pe), and checking and decoding of command lines that are already encoded (-pb64).
+//
+// Encodes straight into a caller-provided wide-character buffer, two output characters per table lookup, and decodes
+// four characters at a time with a single validity check per group, so that a large script costs a few milliseconds
+// at most and no intermediate copies.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Number of characters Base64 encoding produces for cbData bytes (padding included)
+/// </summary>
+inline size_t Base64EncodedLength(size_t cbData)
+{
+    return (cbData + 2) / 3 * 4;
+}
+
+/// <summary>
+/// Base64-encodes data into a buffer
+/// </summary>
+/// <param name="pData">Input: data to encode</param>
+/// <param name="cbData">Input: size of the data</param>
+/// <param name="pOutput">Output: the encoding; must have room for Base64EncodedLength(cbData) characters (no terminator is written)</param>
+void Base64Encode(const uint8_t* pData, size_t cbData, wchar_t* pOutput);
+
+/// <summary>
+/// Base64-encodes data into a string
+/// </summary>
+/// <param name="pData">Input: data to encode</param>
+/// <param name="cbData">Input: size of the data</param>
+/// <param name="sOutput">Output: the encoding</param>
+void Base64Encode(const uint8_t* pData, size_t cbData, std::wstring& sOutput);
+
+/// <summary>
+/// Checks and decodes Base64 text. The text must be a whole number of four-character groups, with padding only at
+/// its end; whitespace isn't allowed.
+/// </summary>
+/// <param name="pText">Input: text to decode</param>
+/// <param name="cchText">Input: number of characters in the text</param>
+/// <param name="decoded">Output: the decoded data, if successful</param>
+/// <param name="ixError">Output: on failure, index of the first character that isn't valid, including an '=' that isn't at the end (cchText if the text is cut off)</param>
+/// <returns>true if the text is valid Base64; false otherwise</returns>
+bool Base64Decode(const wchar_t* pText, size_t cchText, std::vector<uint8_t>& decoded, size_t& ixError);
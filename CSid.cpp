@@ -5,8 +5,14 @@
 
 
 // ------------------------------------------------------------------------------------------
-// Create a local singleton instance of MachineSid for later comparisons
-static MachineSid machineSid;
+// Local singleton instance of MachineSid for later comparisons.
+// Created on first use rather than at process startup, as retrieving it requires an LSA query
+// and most runs never need it.
+static const MachineSid& TheMachineSid()
+{
+	static const MachineSid machineSid;
+	return machineSid;
+}
 
 // ------------------------------------------------------------------------------------------
 
@@ -141,7 +147,7 @@ bool CSid::IsMachineLocal() const
 		return false;
 
 	BOOL bEqual = FALSE;
-	return (0 != EqualDomainSid(machineSid.Get(), psid(), &bEqual)) && bEqual;
+	return (0 != EqualDomainSid(TheMachineSid().Get(), psid(), &bEqual)) && bEqual;
 }
 
 //static
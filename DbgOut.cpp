@@ -1,6 +1,8 @@
+#ifdef _WIN32
 #include <Windows.h>
 #include <WtsApi32.h>
 #pragma comment(lib, "wtsapi32.lib")
+#endif
 #include "FileOutput.h"
 #include "DbgOut.h"
 #include "WofstreamManager.h"
@@ -14,15 +16,34 @@
 DbgOut_t dbgOut;
 
 // Single instance of a managed collection of shareable std::wofstream instances.
-// Heap-allocated when the first instance of DbgOut_InternalBufferImpl is created, and never deleted,
+// Heap-allocated the first time it's needed (most processes never log to a file), and never deleted,
 // to ensure that the destructors of global instances of DbgOut_InternalBufferImpl defined in arbitrary
-// other compilation units always have a valid WofstreamManager_t to access.
-WofstreamManager_t* DbgOut_InternalBufferImpl::st_pWofstreamMgr = nullptr;
+// other compilation units always have a valid WofstreamManager_t to access. (Any instance that holds a
+// file has already caused it to be created.) Initialization of the function-local static is thread-safe.
+WofstreamManager_t& DbgOut_InternalBufferImpl::WofstreamMgr()
+{
+	static WofstreamManager_t* const pWofstreamMgr = new WofstreamManager_t;
+	return *pWofstreamMgr;
+}
 
-// Singleton instances of critical section objects to serialize access to std::wcout and std::wcerr.
-// Bool to indicate whether they've been initialized.
-static CRITICAL_SECTION gb_critsecWCout, gb_critsecWCerr;
-static bool gb_bCritSecsInitialized = false;
+// Number of distinct log files currently open across all instances
+size_t DbgOut_InternalBufferImpl::OpenLogFileCount()
+{
+	return WofstreamMgr().Count();
+}
+
+// Singleton instances of mutexes to serialize access to std::wcout and std::wcerr.
+// Initialized the first time output is written to either, and never deleted, for the same reason
+// as the WofstreamManager_t.
+struct StdStreamMutexes_t
+{
+	PlatformMutex_t m_mutexWCout, m_mutexWCerr;
+};
+static StdStreamMutexes_t& StdStreamMutexes()
+{
+	static StdStreamMutexes_t* const pMutexes = new StdStreamMutexes_t;
+	return *pMutexes;
+}
 
 // ------------------------------------------------------------------------------------------
 
@@ -32,86 +53,61 @@ DbgOut_InternalBufferImpl::DbgOut_InternalBufferImpl() :
 	m_bWriteToWCout(false),
 	m_bWriteToWCerr(false),
 	m_bWriteToWtsMsgBox(false),
-	m_bWriteToFile(false),
-	m_bAcquiredOutput(false),
-	m_bPrependTimestamp(false)
+	m_bWriteToFile(false)
 {
-	// First one in instantiates a heap-allocated instance of the WofstreamManager_t for which the
-	// destructor never gets called. This ensures that global instances of DbgOut_InternalBufferImpl
-	// defined in other compilation units always have a valid WofstreamManager_t to use when their
-	// destructors are invoked
-	if (nullptr == st_pWofstreamMgr)
-	{
-		st_pWofstreamMgr = new WofstreamManager_t;
-	}
-
-	// Initialize this instance's synchronization mechanisms.
-	InitializeCriticalSection(&m_critsecConfig);
-	InitializeCriticalSection(&m_critsecOutput);
-
-	// and initialize the global wcout/wcerr critical sections if not already done
-	if (!gb_bCritSecsInitialized)
-	{
-		gb_bCritSecsInitialized = true;
-		InitializeCriticalSection(&gb_critsecWCout);
-		InitializeCriticalSection(&gb_critsecWCerr);
-	}
-
+	// Global instances are constructed at process startup; PlatformMutex_t skips the debug-info
+	// allocation that InitializeCriticalSection would do.
 }
 
 DbgOut_InternalBufferImpl::~DbgOut_InternalBufferImpl()
 {
 	// Serialize configuration changes
-	EnterCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Lock();
 	// Push out anything that was still left in the buffer
 	sync();
 	// Release any file that this instance happens to have open
 	releaseFile();
-	LeaveCriticalSection(&m_critsecConfig);
-
-	// Done with these now
-	DeleteCriticalSection(&m_critsecConfig);
-	DeleteCriticalSection(&m_critsecOutput);
+	m_mutexConfig.Unlock();
 }
 
 void DbgOut_InternalBufferImpl::WriteToDebugStream(bool bWriteToDebugStream)
 {
 	// Serialize configuration changes
-	EnterCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Lock();
 	m_bWriteToDebugStream = bWriteToDebugStream;
-	LeaveCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Unlock();
 }
 
 void DbgOut_InternalBufferImpl::WriteToWCout(bool bWriteToWCout)
 {
 	// Serialize configuration changes
-	EnterCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Lock();
 	m_bWriteToWCout = bWriteToWCout;
-	LeaveCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Unlock();
 }
 
 void DbgOut_InternalBufferImpl::WriteToWCerr(bool bWriteToWCerr)
 {
 	// Serialize configuration changes
-	EnterCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Lock();
 	m_bWriteToWCerr = bWriteToWCerr;
-	LeaveCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Unlock();
 }
 
 void DbgOut_InternalBufferImpl::WriteToWtsMsgBox(bool bWriteToWtsMsgBox)
 {
 	// Serialize configuration changes
-	EnterCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Lock();
 	m_bWriteToWtsMsgBox = bWriteToWtsMsgBox;
-	LeaveCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Unlock();
 }
 
 bool DbgOut_InternalBufferImpl::WriteToFile(const wchar_t* szFilename, bool bAppend /*= false*/, uint64_t uSizeThreshold /* = 0*/)
 {
 	bool retval = true;
 	// Serialize configuration changes
-	EnterCriticalSection(&m_critsecConfig);
-	// try/catch block to ensure that the LeaveCriticalSection call gets made.
+	m_mutexConfig.Lock();
+	// try/catch block to ensure that the mutex gets released.
 	try
 	{
 		// Release any existing file if one is referenced.
@@ -119,7 +115,7 @@ bool DbgOut_InternalBufferImpl::WriteToFile(const wchar_t* szFilename, bool bApp
 		if (szFilename && *szFilename)
 		{
 			// Try to get a pointer to a (possibly shared) std::wofstream instance.
-			if (st_pWofstreamMgr->GetWofstream(szFilename, &m_pStreamSync, bAppend, uSizeThreshold))
+			if (WofstreamMgr().GetWofstream(szFilename, &m_pStreamSync, bAppend, uSizeThreshold))
 			{
 				m_bWriteToFile = true;
 				retval = true;
@@ -131,11 +127,11 @@ bool DbgOut_InternalBufferImpl::WriteToFile(const wchar_t* szFilename, bool bApp
 		}
 	}
 	catch (...) {}
-	LeaveCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Unlock();
 	return retval;
 }
 
-void DbgOut_InternalBufferImpl::WriteToHANDLE(HANDLE handle)
+void DbgOut_InternalBufferImpl::WriteToHANDLE(PlatformFile_t handle)
 {
 	m_handle = handle;
 }
@@ -143,41 +139,41 @@ void DbgOut_InternalBufferImpl::WriteToHANDLE(HANDLE handle)
 void DbgOut_InternalBufferImpl::PrependTimestamp(bool bPrependTimestamp)
 {
 	// Serialize configuration changes
-	EnterCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Lock();
 	m_bPrependTimestamp = bPrependTimestamp;
-	LeaveCriticalSection(&m_critsecConfig);
+	m_mutexConfig.Unlock();
 }
 
-// Acquire access to this instance's critical section.
+// Acquire access to this instance's output mutex.
 void DbgOut_InternalBufferImpl::acquireOutput()
 {
-	EnterCriticalSection(&m_critsecOutput);
-	// After acquiring, set the flag that can be checked on release.
-	m_bAcquiredOutput = true;
+	m_mutexOutput.Lock();
+	// After acquiring, count the acquisition so that release can undo all of them.
+	++m_nAcquiredOutput;
 }
 
 void DbgOut_InternalBufferImpl::releaseOutput()
 {
-	// Don't do anything with the critical section if it wasn't acquired.
+	// Don't do anything with the mutex if it wasn't acquired.
 	//TODO: This works only if all threads are using the synch mechanism; consider putting this value in thread-local storage.
-	if (m_bAcquiredOutput)
+	if (m_nAcquiredOutput > 0)
 	{
-		// Clear the flag while still holding the critical section.
-		m_bAcquiredOutput = false;
 		// If this thread called acquireOutput more than once, release them all.
-		// Get the recursion count before beginning to release them.
-		LONG releaseCount = m_critsecOutput.RecursionCount;
-		for (LONG ix = 0; ix < releaseCount; ++ix)
+		// Get the count and clear it while still holding the mutex.
+		size_t releaseCount = m_nAcquiredOutput;
+		m_nAcquiredOutput = 0;
+		for (size_t ix = 0; ix < releaseCount; ++ix)
 		{
-			LeaveCriticalSection(&m_critsecOutput);
+			m_mutexOutput.Unlock();
 		}
 	}
 }
 
 // Local function that puts a message box on the desktop of all active WTS sessions.
-// If it fails, it fails silently.
+// If it fails, it fails silently. (No-op other than on Windows.)
 static void ToWtsMsgBox(const std::wstring& str)
 {
+#ifdef _WIN32
 	PWTS_SESSION_INFOW pSessionInfo = NULL;
 	DWORD dwSessionCount = 0;
 	BOOL ret = WTSEnumerateSessionsW(WTS_CURRENT_SERVER_HANDLE, 0, 1, &pSessionInfo, &dwSessionCount);
@@ -208,6 +204,9 @@ static void ToWtsMsgBox(const std::wstring& str)
 		}
 	}
 	WTSFreeMemory(pSessionInfo);
+#else
+	(void)str;
+#endif
 }
 
 // Override of wstringbuf member function that triggers write to destination(s)
@@ -254,23 +253,23 @@ int DbgOut_InternalBufferImpl::sync()
 			// debug stream is threadsafe
 			if (m_bWriteToDebugStream)
 			{
-				OutputDebugStringW(sOutput.c_str());
+				PlatformDebugOutput(sOutput);
 			}
 			if (m_bWriteToWCout)
 			{
 				// Serialize access to std::wcout
-				EnterCriticalSection(&gb_critsecWCout);
-				// Exception handling to ensure that the Leave API gets called
+				StdStreamMutexes().m_mutexWCout.Lock();
+				// Exception handling to ensure that the mutex gets released
 				try { std::wcout << sOutput << std::flush; } catch(...) {}
-				LeaveCriticalSection(&gb_critsecWCout);
+				StdStreamMutexes().m_mutexWCout.Unlock();
 			}
 			if (m_bWriteToWCerr)
 			{
 				// Serialize access to std::wcerr
-				EnterCriticalSection(&gb_critsecWCerr);
-				// Exception handling to ensure that the Leave API gets called
+				StdStreamMutexes().m_mutexWCerr.Lock();
+				// Exception handling to ensure that the mutex gets released
 				try { std::wcerr << sOutput << std::flush; } catch(...) {}
-				LeaveCriticalSection(&gb_critsecWCerr);
+				StdStreamMutexes().m_mutexWCerr.Unlock();
 			}
 			// WTS message box doesn't need serialization
 			if (m_bWriteToWtsMsgBox)
@@ -280,18 +279,19 @@ int DbgOut_InternalBufferImpl::sync()
 			if (m_bWriteToFile && m_pStreamSync)
 			{
 				// Serialize access to this (possibly shared) std::wofstream
-				EnterCriticalSection(&m_pStreamSync->m_critsec);
-				// Exception handling to ensure that the Leave API gets called
+				m_pStreamSync->m_mutex.Lock();
+				// Exception handling to ensure that the mutex gets released
 				try { m_pStreamSync->m_fstream << sOutput << std::flush; } catch(...) {}
 				// Also enforce the file size threshold
 				try { m_pStreamSync->EnforceSizeThreshold(); } catch (...) {}
-				LeaveCriticalSection(&m_pStreamSync->m_critsec);
+				m_pStreamSync->m_mutex.Unlock();
 			}
-			if (m_handle)
+			if (PlatformInvalidFile != m_handle)
 			{
 				// Not serializing, just raw writes.
-				DWORD dwBytes = DWORD(sOutput.length() * sizeof(wchar_t));
-				WriteFile(m_handle, sOutput.c_str(), dwBytes, &dwBytes, nullptr);
+				size_t cbWritten = 0;
+				uint32_t dwError = 0;
+				PlatformWrite(m_handle, sOutput.c_str(), sOutput.length() * sizeof(wchar_t), cbWritten, dwError);
 			}
 		}
 		catch (...) {}
@@ -314,7 +314,7 @@ void DbgOut_InternalBufferImpl::releaseFile()
 		{
 			// WofstreamManager_t is responsible for allocating/deallocating instances.
 			// We don't delete it here. Just don't reference it anymore.
-			st_pWofstreamMgr->ReleaseWofstream(m_pStreamSync);
+			WofstreamMgr().ReleaseWofstream(m_pStreamSync);
 			m_pStreamSync = nullptr;
 		}
 		m_bWriteToFile = false;
@@ -361,7 +361,7 @@ bool DbgOut_t::WriteToFile(const wchar_t* szFilename, bool bAppend /*= false*/,
 	return m_buf.WriteToFile(szFilename, bAppend, uSizeThreshold);
 }
 
-void DbgOut_t::WriteToHANDLE(HANDLE handle)
+void DbgOut_t::WriteToHANDLE(PlatformFile_t handle)
 {
 	m_buf.WriteToHANDLE(handle);
 }
@@ -370,3 +370,11 @@ void DbgOut_t::PrependTimestamp(bool bPrependTimestamp)
 {
 	m_buf.PrependTimestamp(bPrependTimestamp);
 }
+
+/// <summary>
+/// Number of distinct log files currently open across all instances (for leak detection).
+/// </summary>
+size_t DbgOut_t::OpenLogFileCount()
+{
+	return DbgOut_InternalBufferImpl::OpenLogFileCount();
+}
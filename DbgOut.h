@@ -59,10 +59,10 @@ PREPEND TIMESTAMPS:
 
 #pragma once
 
-#include <Windows.h>
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include "Platform.h"
 #include "WofstreamManager.h"
 
 // ------------------------------------------------------------------------------------------
@@ -87,25 +87,28 @@ public:
 	// Optional size threshold.
 	bool WriteToFile(const wchar_t* szFilename, bool bAppend = false, uint64_t uSizeThreshold = 0);
 
-	void WriteToHANDLE(HANDLE handle);
+	void WriteToHANDLE(PlatformFile_t handle);
 
 	// Prepend timestamp to output lines
 	void PrependTimestamp(bool bPrependTimestamp);
 
-	// Acquire/release exclusive access to the object's critical section for output.
-	// A single call to the "releaseOutput" function fully releases access to the critical
-	// section, even if acquireOutput had been called multiple times. This helps minimize
+	// Acquire/release exclusive access to the object's mutex for output.
+	// A single call to the "releaseOutput" function fully releases access to the mutex,
+	// even if acquireOutput had been called multiple times. This helps minimize
 	// the risk of deadlock (at the potential cost of thread unsafety).
 	void acquireOutput();
 	void releaseOutput();
 
+	// Number of distinct log files currently open across all instances
+	static size_t OpenLogFileCount();
+
 private:
-	// Two critical sections to serialize access:
-	// m_critsecConfig serializes configuration changes to this instance;
-	// m_critsecOutput serializes access to writing the output buffer.
-	// m_bAcquiredOutput is used to indicate whether output has been locked one or more times.
-	CRITICAL_SECTION m_critsecConfig, m_critsecOutput;
-	bool m_bAcquiredOutput = false;
+	// Two mutexes to serialize access:
+	// m_mutexConfig serializes configuration changes to this instance;
+	// m_mutexOutput serializes access to writing the output buffer.
+	// m_nAcquiredOutput is the number of times output has been locked and not yet released.
+	PlatformMutex_t m_mutexConfig, m_mutexOutput;
+	size_t m_nAcquiredOutput = 0;
 	bool m_bPrependTimestamp = false;
 
 private:
@@ -119,14 +122,14 @@ private:
 	bool m_bWriteToDebugStream, m_bWriteToWCout, m_bWriteToWCerr, m_bWriteToWtsMsgBox, m_bWriteToFile;
 	// Synchronized-access file stream if writing to a file
 	WofstreamSync_t* m_pStreamSync = nullptr;
-	HANDLE m_handle = nullptr;
+	PlatformFile_t m_handle = PlatformInvalidFile;
 
 	// Single instance of a managed collection of shareable std::wofstream instances.
 	// Not supportable for two wofstreams to write to the same file at the same time.
-	// Heap-allocated when first class instance is created, never destroyed. Reason is that
+	// Heap-allocated the first time any instance writes to a file, never destroyed. Reason is that
 	// we can't control the ctor/dtor order of global instances of DbgOut_InternalBufferImpl
 	// vs. the destruction of a static instance of WofstreamManager_t.
-	static WofstreamManager_t* st_pWofstreamMgr;
+	static WofstreamManager_t& WofstreamMgr();
 
 private:
 	// Not implemented
@@ -182,11 +185,16 @@ public:
 	// Optional size threshold.
 	bool WriteToFile(const wchar_t* szFilename, bool bAppend = false, uint64_t uSizeThreshold = 0);
 
-	void WriteToHANDLE(HANDLE handle);
+	void WriteToHANDLE(PlatformFile_t handle);
 
 	// Prepend timestamp to output lines
 	void PrependTimestamp(bool bPrependTimestamp);
 
+	/// <summary>
+	/// Number of distinct log files currently open across all instances (for leak detection).
+	/// </summary>
+	static size_t OpenLogFileCount();
+
 private:
 	DbgOut_t(const DbgOut_t&) = delete;
 	DbgOut_t& operator = (const DbgOut_t&) = delete;
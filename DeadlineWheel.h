@@ -0,0 +1,168 @@
+// Hashed timer wheel for scheduling per-process deadline events.
+//
+// Items are scheduled at an absolute time (in MonotonicMicroseconds() units) and retrieved once that
+// time has passed. Time is divided into ticks of a fixed granularity; each tick maps to one slot in a
+// circular array of slots, so scheduling is constant-time and advancing costs one slot per elapsed tick
+// (bounded by one pass over the wheel no matter how much time has passed). Events that are more than
+// one rotation away share slots with nearer ones and are recognized by their absolute tick number.
+// Events fire at the first tick boundary at or after their scheduled time, so they can be late by up to
+// one tick but are never early.
+//
+// Not thread-safe; intended to be driven from the single monitoring thread.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+template <typename T>
+class DeadlineWheel_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="ullGranularity">Input: tick length, in microseconds</param>
+    /// <param name="nSlots">Input: number of slots in the wheel (one rotation = nSlots ticks)</param>
+    explicit DeadlineWheel_t(uint64_t ullGranularity = 10 * 1000, size_t nSlots = 4096)
+        : m_slots(nSlots > 0 ? nSlots : 1),
+        m_ullGranularity(ullGranularity > 0 ? ullGranularity : 1)
+    {
+    }
+
+    /// <summary>
+    /// Schedule an item to become due at the specified time.
+    /// Times that have already passed become due at the next tick.
+    /// </summary>
+    /// <param name="ullWhen">Input: time the item becomes due, in microseconds</param>
+    /// <param name="item">Input: item to return from Advance</param>
+    void Schedule(uint64_t ullWhen, const T& item)
+    {
+        // Round up to the tick boundary at or after ullWhen, so items are never returned early.
+        uint64_t ullTick = ullWhen / m_ullGranularity + ((ullWhen % m_ullGranularity) ? 1 : 0);
+        if (ullTick <= m_ullCursor)
+            ullTick = m_ullCursor + 1;
+        m_slots[size_t(ullTick % m_slots.size())].push_back(Entry_t{ ullTick, item });
+        ++m_nPending;
+    }
+
+    /// <summary>
+    /// Remove all items that have become due as of the specified time and append them to vDue.
+    /// </summary>
+    /// <param name="ullNow">Input: current time, in microseconds</param>
+    /// <param name="vDue">Output: items appended in tick order (unordered within a tick)</param>
+    void Advance(uint64_t ullNow, std::vector<T>& vDue)
+    {
+        const uint64_t ullNowTick = ullNow / m_ullGranularity;
+        if (ullNowTick <= m_ullCursor)
+            return;
+
+        if (m_nPending > 0)
+        {
+            if (ullNowTick - m_ullCursor >= m_slots.size())
+            {
+                // At least a full rotation has elapsed; every slot needs to be looked at once.
+                for (size_t ixSlot = 0; ixSlot < m_slots.size(); ++ixSlot)
+                    TakeDue(m_slots[ixSlot], ullNowTick, vDue);
+            }
+            else
+            {
+                for (uint64_t ullTick = m_ullCursor + 1; ullTick <= ullNowTick && m_nPending > 0; ++ullTick)
+                    TakeDue(m_slots[size_t(ullTick % m_slots.size())], ullNowTick, vDue);
+            }
+        }
+        m_ullCursor = ullNowTick;
+    }
+
+    /// <summary>
+    /// Get the earliest time at which Advance will return at least one item.
+    /// </summary>
+    /// <param name="ullWhen">Output: time, in microseconds</param>
+    /// <returns>true if any items are scheduled; false if the wheel is empty</returns>
+    bool NextDue(uint64_t& ullWhen) const
+    {
+        if (0 == m_nPending)
+            return false;
+
+        // Look for the nearest occupied tick within one rotation
+        for (uint64_t ullTick = m_ullCursor + 1; ullTick <= m_ullCursor + m_slots.size(); ++ullTick)
+        {
+            const std::vector<Entry_t>& slot = m_slots[size_t(ullTick % m_slots.size())];
+            for (const Entry_t& entry : slot)
+            {
+                if (entry.ullTick == ullTick)
+                {
+                    ullWhen = ullTick * m_ullGranularity;
+                    return true;
+                }
+            }
+        }
+
+        // Everything is more than a rotation away; find the nearest.
+        uint64_t ullMinTick = ~uint64_t(0);
+        for (const std::vector<Entry_t>& slot : m_slots)
+            for (const Entry_t& entry : slot)
+                if (entry.ullTick < ullMinTick)
+                    ullMinTick = entry.ullTick;
+        ullWhen = ullMinTick * m_ullGranularity;
+        return true;
+    }
+
+    /// <summary>
+    /// Number of items scheduled and not yet returned by Advance
+    /// </summary>
+    size_t Size() const { return m_nPending; }
+
+    /// <summary>
+    /// Remove all scheduled items
+    /// </summary>
+    void Clear()
+    {
+        for (std::vector<Entry_t>& slot : m_slots)
+            slot.clear();
+        m_nPending = 0;
+    }
+
+private:
+    struct Entry_t
+    {
+        // Absolute tick number at which the item becomes due
+        uint64_t ullTick;
+        T item;
+    };
+
+    /// <summary>
+    /// Move the items in a slot that are due as of ullNowTick to vDue
+    /// </summary>
+    void TakeDue(std::vector<Entry_t>& slot, uint64_t ullNowTick, std::vector<T>& vDue)
+    {
+        size_t ixKeep = 0;
+        for (size_t ix = 0; ix < slot.size(); ++ix)
+        {
+            if (slot[ix].ullTick <= ullNowTick)
+            {
+                vDue.push_back(slot[ix].item);
+                --m_nPending;
+            }
+            else
+            {
+                if (ixKeep != ix)
+                    slot[ixKeep] = slot[ix];
+                ++ixKeep;
+            }
+        }
+        slot.resize(ixKeep);
+    }
+
+private:
+    std::vector<std::vector<Entry_t>> m_slots;
+    const uint64_t m_ullGranularity;
+    // Last tick processed by Advance
+    uint64_t m_ullCursor = 0;
+    // Number of items in all slots
+    size_t m_nPending = 0;
+
+private:
+    DeadlineWheel_t(const DeadlineWheel_t&) = delete;
+    DeadlineWheel_t& operator = (const DeadlineWheel_t&) = delete;
+};
@@ -0,0 +1,267 @@
+// Environment blocks for target processes: see EnvBlock.h.
+
+#include <algorithm>
+#include <cwchar>
+#include <cwctype>
+#include "EnvBlock.h"
+
+int CompareEnvNames(const std::wstring& sName1, const std::wstring& sName2)
+{
+    const size_t cchCommon = std::min(sName1.length(), sName2.length());
+    for (size_t ix = 0; ix < cchCommon; ++ix)
+    {
+        const wint_t ch1 = towupper(wint_t(sName1[ix])), ch2 = towupper(wint_t(sName2[ix]));
+        if (ch1 != ch2)
+            return (ch1 < ch2) ? -1 : 1;
+    }
+    return (sName1.length() == sName2.length()) ? 0 : ((sName1.length() < sName2.length()) ? -1 : 1);
+}
+
+static bool EnvNameLess(const EnvVar_t& var1, const EnvVar_t& var2)
+{
+    return CompareEnvNames(var1.sName, var2.sName) < 0;
+}
+
+void SortEnvVars(vecEnvVars_t& vars)
+{
+    // Stable, so that of variables with the same name, the last one set is last
+    std::stable_sort(vars.begin(), vars.end(), EnvNameLess);
+    vecEnvVars_t::iterator iterOut = vars.begin();
+    for (vecEnvVars_t::iterator iter = vars.begin(); iter != vars.end(); ++iter)
+    {
+        if (vars.end() != iter + 1 && 0 == CompareEnvNames(iter->sName, (iter + 1)->sName))
+            continue;
+        if (iterOut != iter)
+            *iterOut = std::move(*iter);
+        ++iterOut;
+    }
+    vars.erase(iterOut, vars.end());
+}
+
+/// <summary>
+/// Returns true if the variable holds a list of directories that a user's value is appended to
+/// </summary>
+static bool IsPathList(const std::wstring& sName)
+{
+    return 0 == CompareEnvNames(sName, L"Path") || 0 == CompareEnvNames(sName, L"LibPath") || 0 == CompareEnvNames(sName, L"Os2LibPath");
+}
+
+/// <summary>
+/// Combine a layer's value of a variable with the value from the layers before it
+/// </summary>
+/// <param name="var">Input: the layer's variable</param>
+/// <param name="merge">Input: how the layer combines</param>
+/// <param name="bDefined">Input/output: whether the variable is defined so far</param>
+/// <param name="sValue">Input/output: its value so far</param>
+static void CombineEnvValue(const EnvVar_t& var, EnvMerge_t merge, bool& bDefined, std::wstring& sValue)
+{
+    switch (merge)
+    {
+    case EnvMerge_t::Replace:
+        sValue = var.sValue;
+        bDefined = true;
+        break;
+
+    case EnvMerge_t::AppendPathLists:
+        if (bDefined && IsPathList(var.sName) && !sValue.empty())
+        {
+            if (L';' != sValue.back())
+                sValue += L';';
+            sValue += var.sValue;
+        }
+        else
+            sValue = var.sValue;
+        bDefined = true;
+        break;
+
+    case EnvMerge_t::Overlay:
+        if (var.sValue.empty())
+        {
+            sValue.clear();
+            bDefined = false;
+        }
+        else
+        {
+            // %NAME% stands for the value so far
+            const std::wstring sReference = L"%" + var.sName + L"%";
+            std::wstring sNewValue;
+            size_t ixStart = 0;
+            for (;;)
+            {
+                const size_t ixPercent = var.sValue.find(L'%', ixStart);
+                if (std::wstring::npos == ixPercent)
+                    break;
+                if (0 == CompareEnvNames(var.sValue.substr(ixPercent, sReference.length()), sReference))
+                {
+                    sNewValue.append(var.sValue, ixStart, ixPercent - ixStart);
+                    sNewValue += sValue;
+                    ixStart = ixPercent + sReference.length();
+                }
+                else
+                {
+                    sNewValue.append(var.sValue, ixStart, ixPercent + 1 - ixStart);
+                    ixStart = ixPercent + 1;
+                }
+            }
+            sNewValue.append(var.sValue, ixStart, std::wstring::npos);
+            sValue.swap(sNewValue);
+            bDefined = true;
+        }
+        break;
+    }
+}
+
+void MergeEnvLayers(const std::vector<EnvLayer_t>& layers, std::vector<wchar_t>& block)
+{
+    block.clear();
+    size_t cchEstimate = 1;
+    for (const EnvLayer_t& layer : layers)
+        for (const EnvVar_t& var : *layer.pVars)
+            cchEstimate += var.sName.length() + var.sValue.length() + 2;
+    block.reserve(cchEstimate);
+
+    // The next variable of each layer; each step takes the lowest name among them, from every layer that has it
+    std::vector<size_t> vNext(layers.size(), 0);
+    std::wstring sValue;
+    for (;;)
+    {
+        const std::wstring* pName = nullptr;
+        for (size_t ixLayer = 0; ixLayer < layers.size(); ++ixLayer)
+        {
+            const vecEnvVars_t& vars = *layers[ixLayer].pVars;
+            if (vNext[ixLayer] < vars.size() && (nullptr == pName || CompareEnvNames(vars[vNext[ixLayer]].sName, *pName) < 0))
+                pName = &vars[vNext[ixLayer]].sName;
+        }
+        if (nullptr == pName)
+            break;
+
+        // The name is written as the layer that first defines it spells it, as setting a variable that's already
+        // defined keeps its name
+        const std::wstring* pSpelling = pName;
+        bool bDefined = false;
+        sValue.clear();
+        const std::wstring sName = *pName;
+        for (size_t ixLayer = 0; ixLayer < layers.size(); ++ixLayer)
+        {
+            const vecEnvVars_t& vars = *layers[ixLayer].pVars;
+            if (vNext[ixLayer] < vars.size() && 0 == CompareEnvNames(vars[vNext[ixLayer]].sName, sName))
+            {
+                const bool bWasDefined = bDefined;
+                CombineEnvValue(vars[vNext[ixLayer]], layers[ixLayer].merge, bDefined, sValue);
+                if (!bWasDefined)
+                    pSpelling = &vars[vNext[ixLayer]].sName;
+                ++vNext[ixLayer];
+            }
+        }
+        if (!bDefined)
+            continue;
+        block.insert(block.end(), pSpelling->begin(), pSpelling->end());
+        block.push_back(L'=');
+        block.insert(block.end(), sValue.begin(), sValue.end());
+        block.push_back(L'\0');
+    }
+    // An empty block is two nulls
+    if (block.empty())
+        block.push_back(L'\0');
+    block.push_back(L'\0');
+}
+
+bool LookUpEnvVar(const std::vector<EnvLayer_t>& layers, const std::wstring& sName, std::wstring& sValue)
+{
+    bool bDefined = false;
+    sValue.clear();
+    const EnvVar_t key = { sName, std::wstring() };
+    for (const EnvLayer_t& layer : layers)
+    {
+        vecEnvVars_t::const_iterator iter = std::lower_bound(layer.pVars->begin(), layer.pVars->end(), key, EnvNameLess);
+        if (layer.pVars->end() != iter && 0 == CompareEnvNames(iter->sName, sName))
+            CombineEnvValue(*iter, layer.merge, bDefined, sValue);
+    }
+    return bDefined;
+}
+
+std::wstring ExpandEnvReferences(const std::wstring& sValue, const std::vector<EnvLayer_t>& layers)
+{
+    std::wstring sExpanded, sReferenced;
+    size_t ixStart = 0;
+    for (;;)
+    {
+        const size_t ixOpen = sValue.find(L'%', ixStart);
+        const size_t ixClose = (std::wstring::npos == ixOpen) ? std::wstring::npos : sValue.find(L'%', ixOpen + 1);
+        if (std::wstring::npos == ixClose)
+            break;
+        sExpanded.append(sValue, ixStart, ixOpen - ixStart);
+        if (ixClose > ixOpen + 1 && LookUpEnvVar(layers, sValue.substr(ixOpen + 1, ixClose - ixOpen - 1), sReferenced))
+        {
+            sExpanded += sReferenced;
+            ixStart = ixClose + 1;
+        }
+        else
+        {
+            // Not a reference: keep the first %, and look for one starting at the second
+            sExpanded += L'%';
+            ixStart = ixOpen + 1;
+        }
+    }
+    sExpanded.append(sValue, ixStart, std::wstring::npos);
+    return sExpanded;
+}
+
+void ParseEnvBlock(const wchar_t* pBlock, vecEnvVars_t& vars)
+{
+    vars.clear();
+    if (nullptr == pBlock)
+        return;
+    while (L'\0' != *pBlock)
+    {
+        const size_t cchEntry = wcslen(pBlock);
+        // The first character is never the separator: per-drive current directories are named "=C:"
+        const wchar_t* pEquals = (cchEntry > 1) ? wcschr(pBlock + 1, L'=') : nullptr;
+        if (nullptr != pEquals)
+            vars.push_back(EnvVar_t{ std::wstring(pBlock, pEquals), std::wstring(pEquals + 1) });
+        else
+            vars.push_back(EnvVar_t{ std::wstring(pBlock), std::wstring() });
+        pBlock += cchEntry + 1;
+    }
+}
+
+bool ParseEnvOverlay(const wchar_t* szOverlay, EnvVar_t& var)
+{
+    const wchar_t* pEquals = wcschr(szOverlay, L'=');
+    if (nullptr == pEquals || pEquals == szOverlay)
+        return false;
+    var.sName.assign(szOverlay, pEquals);
+    var.sValue.assign(pEquals + 1);
+    return true;
+}
+
+bool CompareEnvVars(const vecEnvVars_t& expected, const vecEnvVars_t& actual, std::vector<std::wstring>& vDifferences)
+{
+    vDifferences.clear();
+    size_t ixExpected = 0, ixActual = 0;
+    while (ixExpected < expected.size() || ixActual < actual.size())
+    {
+        const int nCompare =
+            (ixExpected >= expected.size()) ? 1 :
+            (ixActual >= actual.size()) ? -1 :
+            CompareEnvNames(expected[ixExpected].sName, actual[ixActual].sName);
+        if (nCompare < 0)
+        {
+            vDifferences.push_back(expected[ixExpected].sName + L": missing; expected " + expected[ixExpected].sValue);
+            ++ixExpected;
+        }
+        else if (nCompare > 0)
+        {
+            vDifferences.push_back(actual[ixActual].sName + L": " + actual[ixActual].sValue + L"; not expected");
+            ++ixActual;
+        }
+        else
+        {
+            if (expected[ixExpected].sValue != actual[ixActual].sValue)
+                vDifferences.push_back(actual[ixActual].sName + L": " + actual[ixActual].sValue + L"; expected " + expected[ixExpected].sValue);
+            ++ixExpected;
+            ++ixActual;
+        }
+    }
+    return vDifferences.empty();
+}
@@ -0,0 +1,104 @@
+// Environment blocks for target processes: merging layers of variables (system, user, volatile, -env overlays)
+// into a block in one pass, and comparing blocks (-envBlock verify). The Windows sources of the layers are in
+// TargetEnvironment.
+//
+// Each layer is kept sorted by name, as Windows sorts an environment block (case-insensitively), so that merging is a
+// k-way merge that writes each variable once, and a lookup is a binary search.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// <summary>
+/// One environment variable
+/// </summary>
+struct EnvVar_t
+{
+    std::wstring sName;
+    std::wstring sValue;
+};
+typedef std::vector<EnvVar_t> vecEnvVars_t;
+
+/// <summary>
+/// How a layer's variables combine with the same variables in the layers before it
+/// </summary>
+enum class EnvMerge_t
+{
+    // Its value replaces the earlier one
+    Replace,
+    // As Replace, except for Path, LibPath, and Os2LibPath, whose values are appended to the earlier ones with a
+    // semicolon: how CreateEnvironmentBlock adds a user's variables to the system's
+    AppendPathLists,
+    // As Replace, except that an empty value removes the variable, and %NAME% in the value of NAME stands for the
+    // earlier value (-env NAME=VALUE)
+    Overlay
+};
+
+/// <summary>
+/// A layer of variables to merge: sorted with SortEnvVars
+/// </summary>
+struct EnvLayer_t
+{
+    const vecEnvVars_t* pVars;
+    EnvMerge_t merge;
+};
+
+/// <summary>
+/// Compare variable names as Windows does: case-insensitively
+/// </summary>
+/// <returns>Less than, equal to, or greater than 0, as wcscmp</returns>
+int CompareEnvNames(const std::wstring& sName1, const std::wstring& sName2);
+
+/// <summary>
+/// Sort variables by name, keeping only the last of any with the same name
+/// </summary>
+void SortEnvVars(vecEnvVars_t& vars);
+
+/// <summary>
+/// Merge layers into an environment block: "name=value" strings in name order, each null-terminated, and a final
+/// null. Later layers take precedence, as their EnvMerge_t says.
+/// </summary>
+/// <param name="layers">Input: the layers, earliest first; each sorted with SortEnvVars</param>
+/// <param name="block">Output: the environment block</param>
+void MergeEnvLayers(const std::vector<EnvLayer_t>& layers, std::vector<wchar_t>& block);
+
+/// <summary>
+/// Look up a variable's value as MergeEnvLayers would compute it
+/// </summary>
+/// <param name="layers">Input: the layers, earliest first; each sorted with SortEnvVars</param>
+/// <param name="sName">Input: the variable's name</param>
+/// <param name="sValue">Output: its value, if it's defined</param>
+/// <returns>true if it's defined; false otherwise</returns>
+bool LookUpEnvVar(const std::vector<EnvLayer_t>& layers, const std::wstring& sName, std::wstring& sValue);
+
+/// <summary>
+/// Expand %NAME% references in a value (of a REG_EXPAND_SZ registry value), as ExpandEnvironmentStrings does;
+/// references to undefined variables are left as they are
+/// </summary>
+/// <param name="sValue">Input: the value to expand</param>
+/// <param name="layers">Input: the layers to look variables up in, earliest first; each sorted with SortEnvVars</param>
+/// <returns>The expanded value</returns>
+std::wstring ExpandEnvReferences(const std::wstring& sValue, const std::vector<EnvLayer_t>& layers);
+
+/// <summary>
+/// Parse an environment block into variables, in block order
+/// </summary>
+/// <param name="pBlock">Input: the environment block</param>
+/// <param name="vars">Output: its variables</param>
+void ParseEnvBlock(const wchar_t* pBlock, vecEnvVars_t& vars);
+
+/// <summary>
+/// Parse the argument of -env: NAME=VALUE (an empty value removes NAME)
+/// </summary>
+/// <returns>true if valid; false otherwise</returns>
+bool ParseEnvOverlay(const wchar_t* szOverlay, EnvVar_t& var);
+
+/// <summary>
+/// Compare two sets of variables, such as the blocks built by CreateEnvironmentBlock and by MergeEnvLayers
+/// </summary>
+/// <param name="expected">Input: the expected variables; sorted with SortEnvVars</param>
+/// <param name="actual">Input: the variables to check; sorted with SortEnvVars</param>
+/// <param name="vDifferences">Output: a description of each difference, e.g., "TEMP: C:\x, expected C:\y"</param>
+/// <returns>true if they're the same; false otherwise</returns>
+bool CompareEnvVars(const vecEnvVars_t& expected, const vecEnvVars_t& actual, std::vector<std::wstring>& vDifferences);
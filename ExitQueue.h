@@ -0,0 +1,82 @@
+// Queue of notifications that target processes have exited.
+//
+// Exits are detected on other threads (thread-pool wait callbacks on Windows; whatever observes the
+// process ending elsewhere) and posted here; the monitoring thread waits on the queue and picks up every
+// notification that has arrived. Unlike WaitForMultipleObjects, there is no limit on the number of
+// processes that can be monitored, and the cost of a wakeup doesn't depend on how many are still running.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Platform.h"
+#include "MonotonicClock.h"
+
+template <typename T>
+class ExitQueue_t
+{
+public:
+    ExitQueue_t() = default;
+
+    /// <summary>
+    /// Add an item to the queue and wake the waiting thread. Can be called from any thread.
+    /// </summary>
+    void Post(const T& item)
+    {
+        PlatformLock_t lock(m_mutex);
+        m_items.push_back(item);
+        m_cond.NotifyAll();
+    }
+
+    /// <summary>
+    /// Waits up to dwTimeoutMs milliseconds for at least one item to be posted, then removes and returns
+    /// all items that have been posted.
+    /// </summary>
+    /// <param name="dwTimeoutMs">Input: maximum time to wait, in milliseconds; PlatformWaitForever for no limit</param>
+    /// <param name="vItems">Output: the items that had been posted, in the order they were posted</param>
+    /// <returns>true if any items were returned; false if the timeout elapsed first</returns>
+    bool Wait(uint32_t dwTimeoutMs, std::vector<T>& vItems)
+    {
+        vItems.clear();
+        const Deadline_t deadline = (PlatformWaitForever == dwTimeoutMs) ? Deadline_t() : Deadline_t::AfterMilliseconds(dwTimeoutMs);
+
+        PlatformLock_t lock(m_mutex);
+        // Recompute the remaining time after each wakeup, as wakeups can be spurious
+        uint32_t dwWait = dwTimeoutMs;
+        while (m_items.empty() && dwWait > 0)
+        {
+            m_cond.Wait(m_mutex, dwWait);
+            dwWait = deadline.WaitMilliseconds();
+        }
+        vItems.swap(m_items);
+        return !vItems.empty();
+    }
+
+    /// <summary>
+    /// Number of items posted and not yet returned by Wait
+    /// </summary>
+    size_t Size()
+    {
+        PlatformLock_t lock(m_mutex);
+        return m_items.size();
+    }
+
+    /// <summary>
+    /// Discard any items that haven't been returned by Wait
+    /// </summary>
+    void Clear()
+    {
+        PlatformLock_t lock(m_mutex);
+        m_items.clear();
+    }
+
+private:
+    PlatformMutex_t m_mutex;
+    PlatformCondition_t m_cond;
+    std::vector<T> m_items;
+
+private:
+    // Not implemented
+    ExitQueue_t(const ExitQueue_t&) = delete;
+    ExitQueue_t& operator = (const ExitQueue_t&) = delete;
+};
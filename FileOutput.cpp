@@ -1,7 +1,7 @@
 #include "FileOutput.h"
 #include <locale>
 #include <codecvt>
-#include <Windows.h>
+#include "Platform.h"
 
 /// <summary>
 /// Ensure that output stream produces UTF-8 with optional BOM
@@ -12,15 +12,13 @@ void ImbueStreamUtf8(std::wostream& stream, bool bGenerateHeader)
     // Ensure that stream output is UTF-8.
     // Note that the heap-allocated std::codecvt_utf8 will eventually be deleted by the std::locale
     // it's initializing, so we MUST NOT match that "new" with a "delete" here.
+    std::locale loc(std::locale(), new std::codecvt_utf8<wchar_t, 0x10ffff>);
+    stream.imbue(loc);
+    // Write the BOM explicitly rather than with std::generate_header: some implementations of
+    // codecvt_utf8 (e.g., libstdc++'s) emit the header on every conversion, not just the first.
     if (bGenerateHeader)
     {
-        std::locale loc(std::locale(), new std::codecvt_utf8<wchar_t, 0x10ffff, std::generate_header>);
-        stream.imbue(loc);
-    }
-    else
-    {
-        std::locale loc(std::locale(), new std::codecvt_utf8<wchar_t, 0x10ffff>);
-        stream.imbue(loc);
+        stream << wchar_t(0xFEFF);
     }
 }
 
@@ -39,24 +37,24 @@ bool CreateFileOutput(const wchar_t* szFilename, std::wofstream & fOutput, bool
     // generate the BOM.
     if (bAppend)
     {
-        WIN32_FILE_ATTRIBUTE_DATA data = { 0 };
-        if (GetFileAttributesExW(szFilename, GetFileExInfoStandard, &data))
+        uint64_t ullSize = 0;
+        uint32_t dwError = 0;
+        if (PlatformGetFileSize(szFilename, ullSize, dwError))
         {
-            if (0 == data.nFileSizeHigh && 0 == data.nFileSizeLow)
+            if (0 == ullSize)
             {
                 bAppend = false;
             }
         }
         else
         {
-            DWORD dwLastErr = GetLastError();
-            if (ERROR_FILE_NOT_FOUND == dwLastErr)
+            if (PlatformErrorFileNotFound == dwError)
             {
                 bAppend = false;
             }
         }
     }
-    fOutput.open(szFilename, (bAppend ? (std::ios_base::out | std::ios_base::app) : std::ios_base::out));
+    PlatformOpenFileStream(fOutput, szFilename, (bAppend ? (std::ios_base::out | std::ios_base::app) : std::ios_base::out));
     if (fOutput.fail())
     {
         return false;
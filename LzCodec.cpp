@@ -0,0 +1,376 @@
+// Fast LZ77-class compression of blocks of captured output, in the LZ4 block format.
+//
+// A block is a series of sequences, each a run of literal bytes followed by a copy of earlier output:
+//   token      : high 4 bits literal count, low 4 bits match length - 4 (15 means more length bytes follow)
+//   [lengths]  : literal count - 15, as bytes of 255 plus a final byte < 255
+//   literals
+//   offset     : 2 bytes, how far back the match starts (1 - 65535)
+//   [lengths]  : match length - 19, encoded the same way
+// The last sequence has literals only. As the format requires, the last 5 bytes of a block are always
+// literals and no match starts in the last 12 bytes.
+
+#include <cstring>
+#include <memory>
+#include "LzCodec.h"
+
+static const size_t MinMatch = 4;
+static const size_t LastLiterals = 5;
+static const size_t MatchFindLimit = 12;
+static const uint32_t MaxOffset = 65535;
+// Matches are sought for 4-byte sequences, hashed into this many bits
+static const int FastHashBits = 14;
+static const int ChainHashBits = 16;
+// When nothing matches, the step between positions tried grows every 2^SkipShift misses
+static const int SkipShift = 6;
+// Decompression copies short runs this many bytes at a time
+static const size_t WideCopy = 16;
+// Marks an empty hash-chain head
+static const uint32_t NoPosition = 0xFFFFFFFF;
+
+static inline uint32_t Read32(const uint8_t* p)
+{
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    return n;
+}
+
+static inline uint32_t Hash4(const uint8_t* p, int nBits)
+{
+    return (Read32(p) * 2654435761u) >> (32 - nBits);
+}
+
+/// <summary>
+/// Number of bytes that match at p1 and p2, not going past pLimit (p1 < pLimit)
+/// </summary>
+static inline size_t CountMatch(const uint8_t* p1, const uint8_t* p2, const uint8_t* pLimit)
+{
+    const uint8_t* pStart = p1;
+    while (p1 + sizeof(uint64_t) <= pLimit)
+    {
+        uint64_t n1, n2;
+        memcpy(&n1, p1, sizeof(n1));
+        memcpy(&n2, p2, sizeof(n2));
+        const uint64_t diff = n1 ^ n2;
+        if (0 != diff)
+        {
+            // Little-endian: the lowest differing byte is the first mismatch
+            size_t nSame = 0;
+            for (uint64_t d = diff; 0 == (d & 0xFF); d >>= 8)
+                ++nSame;
+            return size_t(p1 - pStart) + nSame;
+        }
+        p1 += sizeof(uint64_t);
+        p2 += sizeof(uint64_t);
+    }
+    while (p1 < pLimit && *p1 == *p2)
+    {
+        ++p1;
+        ++p2;
+    }
+    return size_t(p1 - pStart);
+}
+
+/// <summary>
+/// Writes a length of 15 or more as the extra bytes that follow the token
+/// </summary>
+static inline uint8_t* WriteLength(uint8_t* op, size_t nLength)
+{
+    for (; nLength >= 255; nLength -= 255)
+        *op++ = 255;
+    *op++ = uint8_t(nLength);
+    return op;
+}
+
+/// <summary>
+/// Writes one sequence: literals from pLiterals, then (if nMatch isn't 0) a match of nMatch bytes nOffset back.
+/// </summary>
+/// <returns>New output position; nullptr if the sequence doesn't fit</returns>
+static uint8_t* WriteSequence(uint8_t* op, const uint8_t* pEnd, const uint8_t* pLiterals, size_t nLiterals, uint32_t nOffset, size_t nMatch)
+{
+    // Worst case: token, literal length bytes, literals, offset, match length bytes
+    const size_t cbNeeded = 1 + nLiterals / 255 + 1 + nLiterals + 2 + nMatch / 255 + 1;
+    if (cbNeeded > size_t(pEnd - op))
+        return nullptr;
+
+    uint8_t* pToken = op++;
+    if (nLiterals >= 15)
+    {
+        *pToken = 15 << 4;
+        op = WriteLength(op, nLiterals - 15);
+    }
+    else
+    {
+        *pToken = uint8_t(nLiterals << 4);
+    }
+    // (With empty input, pLiterals can be null; memcpy mustn't be given a null pointer even for 0 bytes.)
+    if (0 != nLiterals)
+        memcpy(op, pLiterals, nLiterals);
+    op += nLiterals;
+
+    if (0 == nMatch)
+        return op;
+
+    *op++ = uint8_t(nOffset);
+    *op++ = uint8_t(nOffset >> 8);
+    const size_t nMatchCode = nMatch - MinMatch;
+    if (nMatchCode >= 15)
+    {
+        *pToken |= 15;
+        op = WriteLength(op, nMatchCode - 15);
+    }
+    else
+    {
+        *pToken |= uint8_t(nMatchCode);
+    }
+    return op;
+}
+
+/// <summary>
+/// Remembers earlier positions of 4-byte sequences and finds the longest match for the current position.
+/// Level 1 keeps only the most recent position per hash; higher levels keep a chain of earlier positions
+/// within the 64KB window and search up to 2^(level-1) of them.
+/// </summary>
+class MatchFinder_t
+{
+public:
+    MatchFinder_t(const uint8_t* pBase, int nLevel)
+        : m_pBase(pBase),
+        m_bChain(nLevel > LzMinLevel),
+        m_nHashBits(m_bChain ? ChainHashBits : FastHashBits),
+        m_nMaxAttempts(1u << (nLevel - 1)),
+        m_pHead(new uint32_t[size_t(1) << m_nHashBits])
+    {
+        if (m_bChain)
+        {
+            memset(m_pHead.get(), 0xFF, sizeof(uint32_t) << m_nHashBits);
+            // Entries are written before they're read, so the chain table doesn't need clearing
+            m_pChain.reset(new uint16_t[MaxOffset + 1]);
+        }
+        else
+        {
+            // Stale entries are harmless (they fail the content check), but must point inside the block
+            memset(m_pHead.get(), 0, sizeof(uint32_t) << m_nHashBits);
+        }
+    }
+
+    /// <summary>
+    /// Records position p without searching
+    /// </summary>
+    void Insert(const uint8_t* p)
+    {
+        const uint32_t nPos = uint32_t(p - m_pBase);
+        const uint32_t h = Hash4(p, m_nHashBits);
+        if (m_bChain)
+        {
+            const uint32_t nPrev = m_pHead[h];
+            m_pChain[nPos & MaxOffset] = (NoPosition != nPrev && nPos - nPrev <= MaxOffset) ? uint16_t(nPos - nPrev) : 0;
+        }
+        m_pHead[h] = nPos;
+    }
+
+    /// <summary>
+    /// Records position p and returns the length of the longest match for it (0 if none), and where it is
+    /// </summary>
+    size_t Find(const uint8_t* p, const uint8_t* pMatchLimit, const uint8_t*& pMatch)
+    {
+        const uint32_t nPos = uint32_t(p - m_pBase);
+        const uint32_t h = Hash4(p, m_nHashBits);
+        uint32_t nCandidate = m_pHead[h];
+        Insert(p);
+
+        const uint32_t n4 = Read32(p);
+        size_t nBest = 0;
+        if (!m_bChain)
+        {
+            if (nCandidate < nPos && nPos - nCandidate <= MaxOffset && Read32(m_pBase + nCandidate) == n4)
+            {
+                pMatch = m_pBase + nCandidate;
+                nBest = MinMatch + CountMatch(p + MinMatch, pMatch + MinMatch, pMatchLimit);
+            }
+            return nBest;
+        }
+
+        for (uint32_t nAttempts = m_nMaxAttempts; NoPosition != nCandidate && nCandidate < nPos && nPos - nCandidate <= MaxOffset && nAttempts > 0; --nAttempts)
+        {
+            const uint8_t* pCandidate = m_pBase + nCandidate;
+            // A candidate can only do better if it also matches at the byte where the best one so far stopped
+            if (Read32(pCandidate) == n4 && (0 == nBest || pCandidate[nBest] == p[nBest]))
+            {
+                const size_t nLength = MinMatch + CountMatch(p + MinMatch, pCandidate + MinMatch, pMatchLimit);
+                if (nLength > nBest)
+                {
+                    nBest = nLength;
+                    pMatch = pCandidate;
+                    if (p + nBest >= pMatchLimit)
+                        break;
+                }
+            }
+            const uint16_t nDelta = m_pChain[nCandidate & MaxOffset];
+            if (0 == nDelta)
+                break;
+            nCandidate -= nDelta;
+        }
+        return nBest;
+    }
+
+    bool Chained() const { return m_bChain; }
+
+private:
+    const uint8_t* m_pBase;
+    const bool m_bChain;
+    const int m_nHashBits;
+    const uint32_t m_nMaxAttempts;
+    std::unique_ptr<uint32_t[]> m_pHead;
+    std::unique_ptr<uint16_t[]> m_pChain;
+};
+
+size_t LzCompress(const uint8_t* pSource, size_t cbSource, uint8_t* pDest, size_t cbDestCapacity, int nLevel)
+{
+    if (cbSource > LzMaxBlockSize)
+        return 0;
+    if (nLevel < LzMinLevel)
+        nLevel = LzMinLevel;
+    else if (nLevel > LzMaxLevel)
+        nLevel = LzMaxLevel;
+
+    const uint8_t* ip = pSource;
+    const uint8_t* pAnchor = pSource;
+    const uint8_t* const pEnd = pSource + cbSource;
+    uint8_t* op = pDest;
+    uint8_t* const pDestEnd = pDest + cbDestCapacity;
+
+    // Blocks too small to hold a match are all literals
+    if (cbSource > MatchFindLimit)
+    {
+        const uint8_t* const pFindLimit = pEnd - MatchFindLimit;
+        const uint8_t* const pMatchLimit = pEnd - LastLiterals;
+        MatchFinder_t finder(pSource, nLevel);
+        uint32_t nMisses = 0;
+
+        while (ip <= pFindLimit)
+        {
+            const uint8_t* pMatch = nullptr;
+            size_t nMatch = finder.Find(ip, pMatchLimit, pMatch);
+            if (0 == nMatch)
+            {
+                ip += 1 + (nMisses++ >> SkipShift);
+                continue;
+            }
+            nMisses = 0;
+
+            // The match might start before the position where it was found
+            while (ip > pAnchor && pMatch > pSource && ip[-1] == pMatch[-1])
+            {
+                --ip;
+                --pMatch;
+                ++nMatch;
+            }
+
+            op = WriteSequence(op, pDestEnd, pAnchor, size_t(ip - pAnchor), uint32_t(ip - pMatch), nMatch);
+            if (nullptr == op)
+                return 0;
+
+            // Remember positions inside the match, so that later data can refer to them
+            const uint8_t* const pMatchEnd = ip + nMatch;
+            if (finder.Chained())
+            {
+                for (const uint8_t* p = ip + 1; p < pMatchEnd && p <= pFindLimit; ++p)
+                    finder.Insert(p);
+            }
+            else if (pMatchEnd - 2 <= pFindLimit)
+            {
+                finder.Insert(pMatchEnd - 2);
+            }
+            ip = pAnchor = pMatchEnd;
+        }
+    }
+
+    op = WriteSequence(op, pDestEnd, pAnchor, size_t(pEnd - pAnchor), 0, 0);
+    if (nullptr == op)
+        return 0;
+    return size_t(op - pDest);
+}
+
+/// <summary>
+/// Reads the extra bytes of a length that was 15 in the token
+/// </summary>
+/// <returns>false if the input ends first or the length is implausibly large</returns>
+static inline bool ReadLength(const uint8_t*& ip, const uint8_t* pEnd, size_t& nLength)
+{
+    uint8_t b = 0;
+    do
+    {
+        if (ip >= pEnd || nLength > LzMaxBlockSize)
+            return false;
+        b = *ip++;
+        nLength += b;
+    } while (255 == b);
+    return true;
+}
+
+bool LzDecompress(const uint8_t* pSource, size_t cbSource, uint8_t* pDest, size_t cbDest)
+{
+    const uint8_t* ip = pSource;
+    const uint8_t* const pEnd = pSource + cbSource;
+    uint8_t* op = pDest;
+    uint8_t* const pDestEnd = pDest + cbDest;
+
+    for (;;)
+    {
+        if (ip >= pEnd)
+            return false;
+        const uint8_t token = *ip++;
+
+        size_t nLiterals = token >> 4;
+        if (15 == nLiterals && !ReadLength(ip, pEnd, nLiterals))
+            return false;
+        if (nLiterals > size_t(pEnd - ip) || nLiterals > size_t(pDestEnd - op))
+            return false;
+        // Short runs are copied as one fixed-size piece when there's room; the excess is overwritten later
+        if (nLiterals <= WideCopy && size_t(pEnd - ip) >= WideCopy && size_t(pDestEnd - op) >= WideCopy)
+            memcpy(op, ip, WideCopy);
+        else if (0 != nLiterals)
+            memcpy(op, ip, nLiterals);
+        ip += nLiterals;
+        op += nLiterals;
+
+        // The last sequence has no match
+        if (ip == pEnd)
+            return op == pDestEnd;
+
+        if (pEnd - ip < 2)
+            return false;
+        const size_t nOffset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+        ip += 2;
+        if (0 == nOffset || nOffset > size_t(op - pDest))
+            return false;
+
+        size_t nMatch = token & 15;
+        if (15 == nMatch && !ReadLength(ip, pEnd, nMatch))
+            return false;
+        nMatch += MinMatch;
+        if (nMatch > size_t(pDestEnd - op))
+            return false;
+
+        const uint8_t* const pMatch = op - nOffset;
+        if (nOffset >= WideCopy && size_t(pDestEnd - op) >= nMatch + WideCopy)
+        {
+            // Fixed-size pieces, each reading only bytes already written; may write past the match
+            uint8_t* const pMatchEnd = op + nMatch;
+            for (const uint8_t* pFrom = pMatch; op < pMatchEnd; op += WideCopy, pFrom += WideCopy)
+                memcpy(op, pFrom, WideCopy);
+            op = pMatchEnd;
+            continue;
+        }
+        // An offset shorter than the match repeats the last nOffset bytes. Copy in pieces that don't overlap;
+        // each piece doubles the repeated run that the next one can copy from.
+        while (nMatch > 0)
+        {
+            const size_t nAvailable = size_t(op - pMatch);
+            const size_t nPiece = (nMatch < nAvailable) ? nMatch : nAvailable;
+            memcpy(op, pMatch, nPiece);
+            op += nPiece;
+            nMatch -= nPiece;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+// Fast LZ77-class compression of blocks of captured output, in the LZ4 block format.
+//
+// Each block is compressed on its own, with no references into earlier blocks, so that any block can be
+// decompressed without the ones before it. See RedirCompress.h for how blocks are framed in a file.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/// <summary>
+/// Compression levels. Level 1 looks for one match candidate per position and skips ahead faster through
+/// incompressible data; each higher level searches twice as many earlier occurrences for a longer match.
+/// </summary>
+const int LzMinLevel = 1, LzMaxLevel = 9, LzDefaultLevel = 1;
+
+/// <summary>
+/// Largest block that can be compressed in one call
+/// </summary>
+const size_t LzMaxBlockSize = 0x7E000000;
+
+/// <summary>
+/// Largest possible compressed size of a block of cbSource bytes (incompressible data grows slightly)
+/// </summary>
+inline size_t LzCompressBound(size_t cbSource)
+{
+    return cbSource + cbSource / 255 + 16;
+}
+
+/// <summary>
+/// Compresses a block.
+/// </summary>
+/// <param name="pSource">Input: data to compress</param>
+/// <param name="cbSource">Input: number of bytes to compress; no more than LzMaxBlockSize</param>
+/// <param name="pDest">Output: compressed data</param>
+/// <param name="cbDestCapacity">Input: size of the output buffer; LzCompressBound(cbSource) is always enough</param>
+/// <param name="nLevel">Input: compression level, LzMinLevel through LzMaxLevel</param>
+/// <returns>Size of the compressed data; 0 if it doesn't fit in the output buffer</returns>
+size_t LzCompress(const uint8_t* pSource, size_t cbSource, uint8_t* pDest, size_t cbDestCapacity, int nLevel);
+
+/// <summary>
+/// Decompresses a block, checking that the compressed data stays within the input and output buffers.
+/// </summary>
+/// <param name="pSource">Input: compressed data</param>
+/// <param name="cbSource">Input: size of the compressed data</param>
+/// <param name="pDest">Output: decompressed data</param>
+/// <param name="cbDest">Input: exact size of the decompressed data</param>
+/// <returns>true if the block decompressed to exactly cbDest bytes; false if the data is invalid</returns>
+bool LzDecompress(const uint8_t* pSource, size_t cbSource, uint8_t* pDest, size_t cbDest);
@@ -0,0 +1,120 @@
+<#
+.SYNOPSIS
+Measures RunAsUsers.exe startup cost, time to first launch, and per-session setup time.
+
+.DESCRIPTION
+Runs RunAsUsers.exe repeatedly with -s first and -phaseTimes, and reports the distribution of the
+run-wide startup phases recorded in each run's CSV file:
+  startup      - process creation until RunAsUsers' code starts running (loader, static initializers)
+  init         - command-line processing and the SYSTEM check
+  enumerate    - session enumeration
+  firstLaunch  - process creation until the first target process is started
+and of the per-session phases recorded for each target process:
+  sessionQuery - session information queries
+  token        - getting the user's token
+  envBlock     - building the environment block (see -EnvBlock)
+  create       - creating the target process, through resuming it
+  sessionSetup - sessionQuery, token, and envBlock together
+Also reports the total elapsed time of each RunAsUsers.exe process as measured from this script.
+
+Must be run as SYSTEM (e.g., psexec -s), with at least one active user session.
+
+.PARAMETER Exe
+Path to RunAsUsers.exe.
+
+.PARAMETER Iterations
+Number of runs to measure. The first (warm-up) run is not included in the results.
+
+.PARAMETER CommandLine
+Command line to run in the user's session. Should exit quickly and not display UI.
+
+.PARAMETER Sessions
+Which sessions to run the command line in, as RunAsUsers.exe -s: first, active, all, or a session ID.
+
+.PARAMETER EnvBlock
+How to build environment blocks, as RunAsUsers.exe -envBlock; with more than one (e.g., system,cached), each is
+measured in turn, for a before-and-after comparison.
+
+.EXAMPLE
+.\Measure-Startup.ps1 -Exe .\Release\RunAsUsers.exe -Iterations 50
+
+.EXAMPLE
+.\Measure-Startup.ps1 -Exe .\Release\RunAsUsers.exe -Sessions all -EnvBlock system,cached
+#>
+param(
+    [string]$Exe = ".\Release\RunAsUsers.exe",
+    [int]$Iterations = 20,
+    [string]$CommandLine = "cmd.exe /c exit 0",
+    [string]$Sessions = "first",
+    [string[]]$EnvBlock = @("system")
+)
+
+if (-not [System.Security.Principal.WindowsIdentity]::GetCurrent().IsSystem)
+{
+    Write-Error "This script must be run as SYSTEM."
+    return
+}
+
+$csvFile = Join-Path $env:TEMP "RunAsUsers-startup-$PID.csv"
+$phases = "startup", "init", "enumerate", "firstLaunch"
+$sessionPhases = "sessionQuery", "token", "envBlock", "create"
+
+# Nearest-rank percentile
+function Percentile([double[]]$sorted, [double]$pct)
+{
+    if ($sorted.Count -eq 0) { return $null }
+    $rank = [Math]::Ceiling($pct / 100.0 * $sorted.Count)
+    return $sorted[[Math]::Max(0, $rank - 1)]
+}
+
+foreach ($mode in $EnvBlock)
+{
+    $results = [ordered]@{}
+    foreach ($phase in $phases + $sessionPhases + "sessionSetup" + "elapsed") { $results[$phase] = New-Object System.Collections.Generic.List[double] }
+
+    for ($ix = 0; $ix -le $Iterations; $ix++)
+    {
+        Remove-Item $csvFile -ErrorAction SilentlyContinue
+        $sw = [System.Diagnostics.Stopwatch]::StartNew()
+        & $Exe -s $Sessions -hide -q -envBlock $mode -phaseTimes $csvFile -c $CommandLine | Out-Null
+        $sw.Stop()
+        # Discard the warm-up run
+        if ($ix -eq 0) { continue }
+
+        # The first row holds the run-wide phases; the rest, one per target process, the per-session phases
+        $rows = @(Import-Csv $csvFile)
+        foreach ($phase in $phases)
+        {
+            $value = $rows[0]."$($phase)Duration_us"
+            if ($value) { $results[$phase].Add([double]$value / 1000.0) }
+        }
+        foreach ($row in ($rows | Select-Object -Skip 1))
+        {
+            $setup = 0.0
+            foreach ($phase in $sessionPhases)
+            {
+                $value = $row."$($phase)Duration_us"
+                if (-not $value) { continue }
+                $results[$phase].Add([double]$value / 1000.0)
+                if ($phase -ne "create") { $setup += [double]$value / 1000.0 }
+            }
+            $results["sessionSetup"].Add($setup)
+        }
+        $results["elapsed"].Add($sw.Elapsed.TotalMilliseconds)
+    }
+    Remove-Item $csvFile -ErrorAction SilentlyContinue
+
+    foreach ($phase in $results.Keys)
+    {
+        $sorted = [double[]]($results[$phase] | Sort-Object)
+        [PSCustomObject]@{
+            EnvBlock = $mode
+            Phase = $phase
+            Count = $sorted.Count
+            MinMs = Percentile $sorted 0
+            P50Ms = Percentile $sorted 50
+            P90Ms = Percentile $sorted 90
+            MaxMs = Percentile $sorted 100
+        }
+    }
+}
@@ -0,0 +1,127 @@
+// Monotonic, high-resolution time measurement and deadlines.
+//
+// Wall-clock time (GetSystemTimeAsFileTime) can jump forward or backward when the system clock is
+// adjusted (NTP, manual changes), so it must not be used to measure elapsed time or to compute
+// remaining wait time. These functions use QueryPerformanceCounter, which is monotonic, and express
+// time as a 64-bit number of microseconds so there is no practical limit on interval length.
+// On other platforms, CLOCK_MONOTONIC is used. The clock functions are implemented in PlatformWin32.cpp
+// and PlatformPosix.cpp.
+
+#pragma once
+
+#include <cstdint>
+#include "Platform.h"
+
+/// <summary>
+/// Current monotonic time, in microseconds since an arbitrary fixed point (typically system boot).
+/// Only differences between values are meaningful.
+/// </summary>
+uint64_t MonotonicMicroseconds();
+
+/// <summary>
+/// Approximate time this process was created, in MonotonicMicroseconds() units.
+/// Lets startup costs incurred before any of this program's code runs (loader, static initializers) be
+/// measured on the same timeline as everything else. Accuracy is limited by the system clock's resolution.
+/// </summary>
+uint64_t ProcessCreationMonotonicMicroseconds();
+
+/// <summary>
+/// Convert a number of microseconds to (fractional) milliseconds
+/// </summary>
+inline double MicrosecondsToMilliseconds(uint64_t ullMicroseconds)
+{
+    return double(ullMicroseconds) / 1000.0;
+}
+
+/// <summary>
+/// A point in monotonic time by which something should have happened, or "never" (infinite).
+/// </summary>
+class Deadline_t
+{
+public:
+    /// <summary>
+    /// Default constructor: infinite deadline (never expires)
+    /// </summary>
+    Deadline_t() : m_ullDeadline(Infinite) {}
+
+    /// <summary>
+    /// Deadline a number of milliseconds after a starting point.
+    /// </summary>
+    /// <param name="ullMilliseconds">Input: milliseconds from the starting point</param>
+    /// <param name="ullFrom">Input: starting point, from MonotonicMicroseconds()</param>
+    static Deadline_t AfterMilliseconds(uint64_t ullMilliseconds, uint64_t ullFrom)
+    {
+        Deadline_t deadline;
+        // Anything that would overflow is effectively infinite
+        if (ullMilliseconds < (Infinite - ullFrom) / 1000)
+            deadline.m_ullDeadline = ullFrom + ullMilliseconds * 1000;
+        return deadline;
+    }
+
+    /// <summary>
+    /// Deadline at a specific point in time.
+    /// </summary>
+    /// <param name="ullMicroseconds">Input: time, in MonotonicMicroseconds() units</param>
+    static Deadline_t At(uint64_t ullMicroseconds)
+    {
+        Deadline_t deadline;
+        deadline.m_ullDeadline = ullMicroseconds;
+        return deadline;
+    }
+
+    /// <summary>
+    /// Deadline a number of milliseconds from now.
+    /// </summary>
+    static Deadline_t AfterMilliseconds(uint64_t ullMilliseconds)
+    {
+        return AfterMilliseconds(ullMilliseconds, MonotonicMicroseconds());
+    }
+
+    /// <summary>
+    /// Returns true if this deadline never expires
+    /// </summary>
+    bool IsInfinite() const { return Infinite == m_ullDeadline; }
+
+    /// <summary>
+    /// The deadline, in MonotonicMicroseconds() units. Not meaningful if IsInfinite().
+    /// </summary>
+    uint64_t Microseconds() const { return m_ullDeadline; }
+
+    /// <summary>
+    /// Returns true if the deadline has passed.
+    /// </summary>
+    /// <param name="ullNow">Input: current time, from MonotonicMicroseconds()</param>
+    bool HasExpired(uint64_t ullNow) const { return !IsInfinite() && ullNow >= m_ullDeadline; }
+    bool HasExpired() const { return HasExpired(MonotonicMicroseconds()); }
+
+    /// <summary>
+    /// Returns the number of milliseconds to pass to a wait function to wait until this deadline:
+    /// INFINITE (PlatformWaitForever) if the deadline is infinite; 0 if it has passed. Rounds up so that a
+    /// wait doesn't end just before the deadline and cause the caller to spin. Waits longer than the wait
+    /// functions support are clamped; the caller recomputes after each wait.
+    /// </summary>
+    /// <param name="ullNow">Input: current time, from MonotonicMicroseconds()</param>
+    uint32_t WaitMilliseconds(uint64_t ullNow) const
+    {
+        if (IsInfinite())
+            return PlatformWaitForever;
+        if (ullNow >= m_ullDeadline)
+            return 0;
+        uint64_t ullMs = (m_ullDeadline - ullNow + 999) / 1000;
+        return (ullMs >= PlatformWaitForever) ? (PlatformWaitForever - 1) : uint32_t(ullMs);
+    }
+    uint32_t WaitMilliseconds() const { return WaitMilliseconds(MonotonicMicroseconds()); }
+
+    /// <summary>
+    /// Returns whichever of two deadlines comes first
+    /// </summary>
+    static const Deadline_t& Earlier(const Deadline_t& a, const Deadline_t& b)
+    {
+        return (a.m_ullDeadline <= b.m_ullDeadline) ? a : b;
+    }
+
+private:
+    static const uint64_t Infinite = ~uint64_t(0);
+    // Deadline in MonotonicMicroseconds() units; Infinite if none
+    uint64_t m_ullDeadline;
+};
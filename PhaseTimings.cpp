@@ -0,0 +1,25 @@
+// Timing instrumentation for the phases of launching and monitoring target processes
+
+#include "PhaseTimings.h"
+
+/// <summary>
+/// Returns the name of a phase, suitable for reports and column headers
+/// </summary>
+const wchar_t* PhaseName(Phase_t phase)
+{
+    switch (phase)
+    {
+    case Phase_t::Startup: return L"startup";
+    case Phase_t::Init: return L"init";
+    case Phase_t::Enumerate: return L"enumerate";
+    case Phase_t::FirstLaunch: return L"firstLaunch";
+    case Phase_t::SessionQuery: return L"sessionQuery";
+    case Phase_t::Token: return L"token";
+    case Phase_t::EnvBlock: return L"envBlock";
+    case Phase_t::Create: return L"create";
+    case Phase_t::Held: return L"held";
+    case Phase_t::FirstOutput: return L"firstOutput";
+    case Phase_t::Exit: return L"exit";
+    default: return L"unknown";
+    }
+}
@@ -0,0 +1,83 @@
+// Timing instrumentation for the phases of launching and monitoring target processes
+
+#pragma once
+
+#include <cstdint>
+#include "Platform.h"
+
+/// <summary>
+/// Phases that are timed.
+/// Startup, Init, Enumerate, and FirstLaunch are measured once per run; the others are measured per target process.
+/// Startup and FirstLaunch are measured from the creation of this process.
+/// FirstOutput and Exit are measured from the moment the target's primary thread is resumed (see ResumeTime).
+/// </summary>
+enum class Phase_t
+{
+    Startup,        // Process creation until wmain is entered (loader, static initializers)
+    Init,           // wmain entry until ready to enumerate sessions (command line, SYSTEM check)
+    Enumerate,      // WTSEnumerateSessionsW
+    FirstLaunch,    // Process creation until the first target process is resumed
+    SessionQuery,   // WTSQuerySessionInformationW for one session
+    Token,          // WTSQueryUserToken, and the linked token if elevated
+    EnvBlock,       // CreateEnvironmentBlock
+    Create,         // CreateProcessAsUserW, redirection setup, ResumeThread
+    Held,           // With -gang: created and suspended, until resumed with the rest of the targets
+    FirstOutput,    // Resume until first byte of redirected output received
+    Exit,           // Resume until process exit detected
+    NumPhases
+};
+
+/// <summary>
+/// Returns the name of a phase, suitable for reports and column headers
+/// </summary>
+const wchar_t* PhaseName(Phase_t phase);
+
+/// <summary>
+/// Start and end times of each phase, in MonotonicMicroseconds() units. Zero means not recorded.
+/// </summary>
+struct PhaseTimings_t
+{
+    uint64_t ullStart[size_t(Phase_t::NumPhases)] = { 0 };
+    uint64_t ullEnd[size_t(Phase_t::NumPhases)] = { 0 };
+
+    /// <summary>
+    /// Record the start and end times of a phase
+    /// </summary>
+    void Record(Phase_t phase, uint64_t ullStartTime, uint64_t ullEndTime)
+    {
+        ullStart[size_t(phase)] = ullStartTime;
+        ullEnd[size_t(phase)] = ullEndTime;
+    }
+
+    /// <summary>
+    /// Record the start and end times of a phase only if it hasn't already been recorded.
+    /// Safe to call from multiple threads at once; the first caller wins.
+    /// </summary>
+    void RecordOnce(Phase_t phase, uint64_t ullStartTime, uint64_t ullEndTime)
+    {
+        if (0 == PlatformCompareExchange64(&ullEnd[size_t(phase)], ullEndTime, 0))
+            ullStart[size_t(phase)] = ullStartTime;
+    }
+
+    /// <summary>
+    /// Returns true if the phase has been recorded
+    /// </summary>
+    bool IsRecorded(Phase_t phase) const { return 0 != ullEnd[size_t(phase)]; }
+
+    /// <summary>
+    /// When the target's primary thread was resumed: the end of the Held phase if it was held for a gang start,
+    /// otherwise the end of the Create phase
+    /// </summary>
+    uint64_t ResumeTime() const
+    {
+        return IsRecorded(Phase_t::Held) ? ullEnd[size_t(Phase_t::Held)] : ullEnd[size_t(Phase_t::Create)];
+    }
+
+    /// <summary>
+    /// Duration of the phase in microseconds; 0 if not recorded
+    /// </summary>
+    uint64_t Duration(Phase_t phase) const
+    {
+        return IsRecorded(phase) ? ullEnd[size_t(phase)] - ullStart[size_t(phase)] : 0;
+    }
+};
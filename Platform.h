@@ -0,0 +1,428 @@
+// Thin operating-system abstraction for the platform-independent parts of RunAsUsers.
+//
+// The code that selects sessions, monitors target processes for exit, and copies redirected output
+// needs only a handful of operating-system services: mutexes and condition variables, threads, pipes
+// and files, child processes, the debug stream, the time of day, counters, and a monotonic clock
+// (MonotonicClock.h). Those are declared here and implemented
+// in PlatformWin32.cpp and PlatformPosix.cpp, so that the same code can be built, benchmarked, and
+// profiled on Linux (see CMakeLists.txt and RunAsUsersBench.cpp). Code that is inherently Windows-specific
+// (WTS sessions, tokens, CreateProcessAsUserW, job objects) continues to use Win32 directly.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sys/types.h>
+#endif
+
+/// <summary>
+/// Timeout value meaning "wait indefinitely" (same value as the Win32 INFINITE)
+/// </summary>
+const uint32_t PlatformWaitForever = 0xFFFFFFFF;
+
+// ------------------------------------------------------------------------------------------
+// Synchronization
+
+/// <summary>
+/// Recursive mutual-exclusion lock: a CRITICAL_SECTION on Windows; a recursive pthread mutex elsewhere.
+/// </summary>
+class PlatformMutex_t
+{
+public:
+    PlatformMutex_t();
+    ~PlatformMutex_t();
+    void Lock();
+    void Unlock();
+
+private:
+#ifdef _WIN32
+    CRITICAL_SECTION m_critsec;
+#else
+    pthread_mutex_t m_mutex;
+#endif
+    friend class PlatformCondition_t;
+
+private:
+    // Not implemented
+    PlatformMutex_t(const PlatformMutex_t&) = delete;
+    PlatformMutex_t& operator = (const PlatformMutex_t&) = delete;
+};
+
+/// <summary>
+/// Holds a PlatformMutex_t for the lifetime of the object.
+/// </summary>
+class PlatformLock_t
+{
+public:
+    explicit PlatformLock_t(PlatformMutex_t& mutex) : m_mutex(mutex) { m_mutex.Lock(); }
+    ~PlatformLock_t() { m_mutex.Unlock(); }
+
+private:
+    PlatformMutex_t& m_mutex;
+
+private:
+    // Not implemented
+    PlatformLock_t(const PlatformLock_t&) = delete;
+    PlatformLock_t& operator = (const PlatformLock_t&) = delete;
+};
+
+/// <summary>
+/// Condition variable, used together with a PlatformMutex_t that the waiting thread holds exactly once.
+/// </summary>
+class PlatformCondition_t
+{
+public:
+    PlatformCondition_t();
+    ~PlatformCondition_t();
+
+    /// <summary>
+    /// Releases the mutex, waits to be notified or for the timeout to elapse, and reacquires the mutex.
+    /// Wakeups can be spurious; callers must recheck their condition.
+    /// </summary>
+    /// <param name="mutex">Input: mutex held by the caller</param>
+    /// <param name="dwTimeoutMs">Input: maximum time to wait, in milliseconds; PlatformWaitForever for no limit</param>
+    /// <returns>false if the timeout elapsed; true otherwise</returns>
+    bool Wait(PlatformMutex_t& mutex, uint32_t dwTimeoutMs);
+
+    /// <summary>
+    /// Wakes all waiting threads
+    /// </summary>
+    void NotifyAll();
+
+private:
+#ifdef _WIN32
+    CONDITION_VARIABLE m_cv;
+#else
+    pthread_cond_t m_cond;
+#endif
+
+private:
+    // Not implemented
+    PlatformCondition_t(const PlatformCondition_t&) = delete;
+    PlatformCondition_t& operator = (const PlatformCondition_t&) = delete;
+};
+
+/// <summary>
+/// Atomically sets *pullDest to ullExchange if it is equal to ullComparand.
+/// </summary>
+/// <returns>The initial value of *pullDest</returns>
+uint64_t PlatformCompareExchange64(volatile uint64_t* pullDest, uint64_t ullExchange, uint64_t ullComparand);
+
+// ------------------------------------------------------------------------------------------
+// Threads
+
+/// <summary>
+/// A thread started with PlatformStartThread; must be joined with PlatformJoinThread.
+/// </summary>
+struct PlatformThread_t
+{
+    bool bStarted = false;
+#ifdef _WIN32
+    HANDLE hThread = NULL;
+#else
+    pthread_t thread;
+#endif
+};
+
+/// <summary>
+/// Thread function: receives the pointer passed to PlatformStartThread
+/// </summary>
+typedef void (*PlatformThreadProc_t)(void* pvParam);
+
+/// <summary>
+/// Starts a thread.
+/// </summary>
+/// <param name="thread">Output: the new thread</param>
+/// <param name="pfnThreadProc">Input: function to run in the new thread</param>
+/// <param name="pvParam">Input: parameter to pass to the thread function</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if the thread was started; false otherwise</returns>
+bool PlatformStartThread(PlatformThread_t& thread, PlatformThreadProc_t pfnThreadProc, void* pvParam, uint32_t& dwError);
+
+/// <summary>
+/// Waits for a thread started with PlatformStartThread to end, and releases its resources.
+/// </summary>
+void PlatformJoinThread(PlatformThread_t& thread);
+
+/// <summary>
+/// Suspends the current thread for at least the specified number of milliseconds
+/// </summary>
+void PlatformSleepMilliseconds(uint32_t dwMilliseconds);
+
+// ------------------------------------------------------------------------------------------
+// Pipes and files
+
+#ifdef _WIN32
+typedef HANDLE PlatformFile_t;
+const PlatformFile_t PlatformInvalidFile = NULL;
+#else
+typedef int PlatformFile_t;
+const PlatformFile_t PlatformInvalidFile = -1;
+#endif
+
+/// <summary>
+/// Outcome of a read operation
+/// </summary>
+enum class PlatformIoResult_t
+{
+    Success,    // Data was read
+    EndOfFile,  // End of file, or the write end of the pipe has been closed
+    Canceled,   // The operation was canceled by another thread
+    Error       // Any other failure
+};
+
+/// <summary>
+/// Creates an anonymous pipe. On Windows the handles are not inheritable; the caller can make one inheritable.
+/// </summary>
+/// <param name="hRead">Output: read end of the pipe</param>
+/// <param name="hWrite">Output: write end of the pipe</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformCreatePipe(PlatformFile_t& hRead, PlatformFile_t& hWrite, uint32_t& dwError);
+
+/// <summary>
+/// Creates (or truncates) a file and opens it for writing.
+/// </summary>
+/// <param name="sPath">Input: path to the file</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>File handle if successful; PlatformInvalidFile otherwise</returns>
+PlatformFile_t PlatformCreateFile(const std::wstring& sPath, uint32_t& dwError);
+
+/// <summary>
+/// Opens the null device (NUL or /dev/null) for writing.
+/// </summary>
+PlatformFile_t PlatformOpenNullDevice(uint32_t& dwError);
+
+/// <summary>
+/// Opens an existing file for reading. Other processes can still write to it.
+/// </summary>
+/// <param name="sPath">Input: path to the file</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>File handle if successful; PlatformInvalidFile otherwise</returns>
+PlatformFile_t PlatformOpenFile(const std::wstring& sPath, uint32_t& dwError);
+
+/// <summary>
+/// Moves a file's read/write position to an absolute offset.
+/// </summary>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformSetFilePosition(PlatformFile_t hFile, uint64_t ullOffset, uint32_t& dwError);
+
+/// <summary>
+/// Reads up to cbBuffer bytes from a file or pipe. Blocks until at least one byte is available or the read ends.
+/// </summary>
+/// <param name="hFile">Input: file or pipe to read from</param>
+/// <param name="pBuffer">Output: buffer to receive data</param>
+/// <param name="cbBuffer">Input: size of the buffer, in bytes</param>
+/// <param name="cbRead">Output: number of bytes read</param>
+/// <param name="dwError">Output: error code, if the result is Error</param>
+PlatformIoResult_t PlatformRead(PlatformFile_t hFile, void* pBuffer, size_t cbBuffer, size_t& cbRead, uint32_t& dwError);
+
+/// <summary>
+/// Writes bytes to a file or pipe.
+/// </summary>
+/// <param name="hFile">Input: file or pipe to write to</param>
+/// <param name="pBuffer">Input: data to write</param>
+/// <param name="cbBuffer">Input: number of bytes to write</param>
+/// <param name="cbWritten">Output: number of bytes written</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if all the bytes were written; false otherwise</returns>
+bool PlatformWrite(PlatformFile_t hFile, const void* pBuffer, size_t cbBuffer, size_t& cbWritten, uint32_t& dwError);
+
+/// <summary>
+/// Closes a file or pipe handle if it is valid, and sets it to PlatformInvalidFile.
+/// </summary>
+void PlatformClose(PlatformFile_t& hFile);
+
+/// <summary>
+/// Returns a description of an error code returned by one of these functions.
+/// </summary>
+std::wstring PlatformErrorMessage(uint32_t dwError);
+
+/// <summary>
+/// Error code reported when a file doesn't exist (ERROR_FILE_NOT_FOUND or ENOENT)
+/// </summary>
+extern const uint32_t PlatformErrorFileNotFound;
+
+/// <summary>
+/// Error code reported when a file's contents aren't in the expected format (ERROR_INVALID_DATA or EILSEQ)
+/// </summary>
+extern const uint32_t PlatformErrorInvalidData;
+
+/// <summary>
+/// Whether file names that differ only in case refer to the same file, and the path of the null device.
+/// </summary>
+#ifdef _WIN32
+const bool PlatformPathsAreCaseInsensitive = true;
+const wchar_t* const PlatformNullDevicePath = L"NUL";
+#else
+const bool PlatformPathsAreCaseInsensitive = false;
+const wchar_t* const PlatformNullDevicePath = L"/dev/null";
+#endif
+
+/// <summary>
+/// Gets the size of a file.
+/// </summary>
+/// <param name="sPath">Input: path to the file</param>
+/// <param name="ullSize">Output: size of the file, in bytes</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformGetFileSize(const std::wstring& sPath, uint64_t& ullSize, uint32_t& dwError);
+
+/// <summary>
+/// A read-only view of a whole file, mapped into memory
+/// </summary>
+struct PlatformMappedFile_t
+{
+    const uint8_t* pData = nullptr;
+    uint64_t cbData = 0;
+#ifdef _WIN32
+    HANDLE hMapping = NULL;
+#endif
+};
+
+/// <summary>
+/// Maps a whole file into memory for reading. Other processes can still write to it; the view's size is the
+/// file's size when it was mapped. An empty file is mapped as no data.
+/// </summary>
+/// <param name="sPath">Input: path to the file</param>
+/// <param name="mapped">Output: the view; release it with PlatformUnmapFile</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformMapFile(const std::wstring& sPath, PlatformMappedFile_t& mapped, uint32_t& dwError);
+
+/// <summary>
+/// Releases a view created by PlatformMapFile, if any
+/// </summary>
+void PlatformUnmapFile(PlatformMappedFile_t& mapped);
+
+/// <summary>
+/// Renames a file. Fails if a file with the new name already exists.
+/// </summary>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformRenameFile(const std::wstring& sFrom, const std::wstring& sTo, uint32_t& dwError);
+
+/// <summary>
+/// Converts a path that might be relative, or (on Windows) contain short names, into an absolute path
+/// in its long form, so that different names for the same file can be recognized. The file doesn't
+/// need to exist. Case is preserved.
+/// </summary>
+/// <param name="sPath">Input: path to convert</param>
+/// <param name="sFullPath">Output: absolute path</param>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformFullPath(const std::wstring& sPath, std::wstring& sFullPath);
+
+/// <summary>
+/// Opens a std::wofstream on a file with a wide-character name (which the standard library
+/// supports directly only on Windows).
+/// </summary>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformOpenFileStream(std::wofstream& fStream, const std::wstring& sPath, std::ios_base::openmode mode);
+
+/// <summary>
+/// The standard output or standard error of the current process. Not to be closed.
+/// </summary>
+PlatformFile_t PlatformStandardOutput(bool bStderr);
+
+// ------------------------------------------------------------------------------------------
+// Processes
+
+/// <summary>
+/// A child process started with PlatformStartProcess; must be released with PlatformCloseProcess.
+/// </summary>
+struct PlatformProcess_t
+{
+    bool bStarted = false;
+    uint32_t dwPID = 0;
+    // Set once the process' exit has been observed by PlatformWaitForProcess
+    bool bExited = false;
+    uint32_t dwExitCode = 0;
+#ifdef _WIN32
+    HANDLE hProcess = NULL;
+#else
+    pid_t pid = 0;
+#endif
+};
+
+/// <summary>
+/// Starts a child process with its standard output and standard error connected to the specified
+/// files or pipes, and its standard input connected to the null device.
+/// </summary>
+/// <param name="process">Output: the new process</param>
+/// <param name="vArgs">Input: the program to run, followed by its arguments</param>
+/// <param name="hStdout">Input: file or pipe for the child's standard output</param>
+/// <param name="hStderr">Input: file or pipe for the child's standard error; PlatformInvalidFile to merge it into hStdout</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if the process was started; false otherwise</returns>
+bool PlatformStartProcess(PlatformProcess_t& process, const std::vector<std::wstring>& vArgs, PlatformFile_t hStdout, PlatformFile_t hStderr, uint32_t& dwError);
+
+/// <summary>
+/// Waits for a child process to exit. Can be called from a different thread than the other process functions,
+/// but only one thread may wait on a given process.
+/// </summary>
+/// <param name="process">Input/output: the process; bExited and dwExitCode are set when it has exited</param>
+/// <param name="dwTimeoutMs">Input: maximum time to wait, in milliseconds; 0 to poll; PlatformWaitForever for no limit</param>
+/// <returns>true if the process has exited; false if it's still running</returns>
+bool PlatformWaitForProcess(PlatformProcess_t& process, uint32_t dwTimeoutMs);
+
+/// <summary>
+/// Forcibly terminates a child process. Has no effect if it has already exited.
+/// </summary>
+/// <returns>true if successful; false otherwise</returns>
+bool PlatformTerminateProcess(PlatformProcess_t& process, uint32_t& dwError);
+
+/// <summary>
+/// Releases the resources associated with a child process. On POSIX systems, a process that hasn't been
+/// waited for remains a zombie until this process exits.
+/// </summary>
+void PlatformCloseProcess(PlatformProcess_t& process);
+
+// ------------------------------------------------------------------------------------------
+// Debug stream and time of day
+
+/// <summary>
+/// Writes text to the debugger's output stream (OutputDebugStringW). No-op where there is no such stream.
+/// </summary>
+void PlatformDebugOutput(const std::wstring& sText);
+
+/// <summary>
+/// Calendar date and time of day, with the same fields as the Win32 SYSTEMTIME.
+/// </summary>
+struct PlatformDateTime_t
+{
+    unsigned int nYear = 0, nMonth = 0, nDay = 0;
+    unsigned int nHour = 0, nMinute = 0, nSecond = 0, nMilliseconds = 0;
+};
+
+/// <summary>
+/// Gets the current date and time, in UTC.
+/// </summary>
+void PlatformGetUtcDateTime(PlatformDateTime_t& dt);
+
+// ------------------------------------------------------------------------------------------
+// Resource counters
+
+/// <summary>
+/// Resources held by the current process
+/// </summary>
+struct PlatformProcessCounters_t
+{
+    // Open handles (Windows) or file descriptors (POSIX)
+    uint64_t nHandles = 0;
+    // Threads in the process
+    uint64_t nThreads = 0;
+    // Peak resident memory (peak working set), in bytes
+    uint64_t ullPeakMemory = 0;
+};
+
+/// <summary>
+/// Captures resource counters for the current process. Best-effort: values that can't be retrieved are 0.
+/// </summary>
+void PlatformGetProcessCounters(PlatformProcessCounters_t& counters);
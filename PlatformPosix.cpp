@@ -0,0 +1,690 @@
+// POSIX implementation of the operating-system abstraction declared in Platform.h and of the
+// monotonic clock declared in MonotonicClock.h. Used for building and benchmarking the
+// platform-independent code on Linux; not part of RunAsUsers.exe.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "Platform.h"
+#include "MonotonicClock.h"
+
+// ------------------------------------------------------------------------------------------
+// Synchronization
+
+PlatformMutex_t::PlatformMutex_t()
+{
+    // Recursive, like a CRITICAL_SECTION
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&m_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+PlatformMutex_t::~PlatformMutex_t()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void PlatformMutex_t::Lock()
+{
+    pthread_mutex_lock(&m_mutex);
+}
+
+void PlatformMutex_t::Unlock()
+{
+    pthread_mutex_unlock(&m_mutex);
+}
+
+PlatformCondition_t::PlatformCondition_t()
+{
+    // Timed waits are measured against the monotonic clock, so they're unaffected by system clock changes
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+PlatformCondition_t::~PlatformCondition_t()
+{
+    pthread_cond_destroy(&m_cond);
+}
+
+bool PlatformCondition_t::Wait(PlatformMutex_t& mutex, uint32_t dwTimeoutMs)
+{
+    if (PlatformWaitForever == dwTimeoutMs)
+        return 0 == pthread_cond_wait(&m_cond, &mutex.m_mutex);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += dwTimeoutMs / 1000;
+    ts.tv_nsec += long(dwTimeoutMs % 1000) * 1000 * 1000;
+    if (ts.tv_nsec >= 1000 * 1000 * 1000)
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000 * 1000 * 1000;
+    }
+    return ETIMEDOUT != pthread_cond_timedwait(&m_cond, &mutex.m_mutex, &ts);
+}
+
+void PlatformCondition_t::NotifyAll()
+{
+    pthread_cond_broadcast(&m_cond);
+}
+
+uint64_t PlatformCompareExchange64(volatile uint64_t* pullDest, uint64_t ullExchange, uint64_t ullComparand)
+{
+    return __sync_val_compare_and_swap(pullDest, ullComparand, ullExchange);
+}
+
+// ------------------------------------------------------------------------------------------
+// Threads
+
+/// <summary>
+/// Function and parameter passed from PlatformStartThread to the new thread
+/// </summary>
+struct PlatformThreadStart_t
+{
+    PlatformThreadProc_t pfnThreadProc;
+    void* pvParam;
+};
+
+static void* PlatformThreadTrampoline(void* pvParam)
+{
+    PlatformThreadStart_t* pStart = (PlatformThreadStart_t*)pvParam;
+    PlatformThreadStart_t start = *pStart;
+    delete pStart;
+    start.pfnThreadProc(start.pvParam);
+    return nullptr;
+}
+
+bool PlatformStartThread(PlatformThread_t& thread, PlatformThreadProc_t pfnThreadProc, void* pvParam, uint32_t& dwError)
+{
+    PlatformThreadStart_t* pStart = new PlatformThreadStart_t{ pfnThreadProc, pvParam };
+    int ret = pthread_create(&thread.thread, nullptr, PlatformThreadTrampoline, pStart);
+    dwError = uint32_t(ret);
+    thread.bStarted = (0 == ret);
+    if (!thread.bStarted)
+        delete pStart;
+    return thread.bStarted;
+}
+
+void PlatformJoinThread(PlatformThread_t& thread)
+{
+    if (thread.bStarted)
+    {
+        pthread_join(thread.thread, nullptr);
+        thread.bStarted = false;
+    }
+}
+
+void PlatformSleepMilliseconds(uint32_t dwMilliseconds)
+{
+    struct timespec ts;
+    ts.tv_sec = dwMilliseconds / 1000;
+    ts.tv_nsec = long(dwMilliseconds % 1000) * 1000 * 1000;
+    while (0 != nanosleep(&ts, &ts) && EINTR == errno)
+        ;
+}
+
+// ------------------------------------------------------------------------------------------
+// Pipes and files
+
+bool PlatformCreatePipe(PlatformFile_t& hRead, PlatformFile_t& hWrite, uint32_t& dwError)
+{
+    dwError = 0;
+    hRead = hWrite = PlatformInvalidFile;
+    int fds[2];
+    // Not inherited by child processes, like the Win32 default. Where possible, set atomically, so that
+    // a process started by another thread can't inherit the pipe and keep it from reporting end-of-file.
+#ifdef __linux__
+    if (0 != pipe2(fds, O_CLOEXEC))
+    {
+        dwError = uint32_t(errno);
+        return false;
+    }
+#else
+    if (0 != pipe(fds))
+    {
+        dwError = uint32_t(errno);
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+    hRead = fds[0];
+    hWrite = fds[1];
+    return true;
+}
+
+/// <summary>
+/// Convert a wide-character path to the UTF-8 form POSIX file APIs expect
+/// </summary>
+static std::string PathToUtf8(const std::wstring& sPath)
+{
+    std::string sUtf8;
+    for (wchar_t wc : sPath)
+    {
+        uint32_t cp = uint32_t(wc);
+        if (cp < 0x80)
+            sUtf8 += char(cp);
+        else if (cp < 0x800)
+        {
+            sUtf8 += char(0xC0 | (cp >> 6));
+            sUtf8 += char(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000)
+        {
+            sUtf8 += char(0xE0 | (cp >> 12));
+            sUtf8 += char(0x80 | ((cp >> 6) & 0x3F));
+            sUtf8 += char(0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            sUtf8 += char(0xF0 | (cp >> 18));
+            sUtf8 += char(0x80 | ((cp >> 12) & 0x3F));
+            sUtf8 += char(0x80 | ((cp >> 6) & 0x3F));
+            sUtf8 += char(0x80 | (cp & 0x3F));
+        }
+    }
+    return sUtf8;
+}
+
+/// <summary>
+/// Opens a file for writing with the specified flags
+/// </summary>
+static PlatformFile_t PlatformOpenForWrite(const std::string& sPath, int flags, uint32_t& dwError)
+{
+    dwError = 0;
+    int fd = open(sPath.c_str(), O_WRONLY | O_CLOEXEC | flags, 0644);
+    if (fd < 0)
+    {
+        dwError = uint32_t(errno);
+        return PlatformInvalidFile;
+    }
+    return fd;
+}
+
+PlatformFile_t PlatformCreateFile(const std::wstring& sPath, uint32_t& dwError)
+{
+    return PlatformOpenForWrite(PathToUtf8(sPath), O_CREAT | O_TRUNC, dwError);
+}
+
+PlatformFile_t PlatformOpenNullDevice(uint32_t& dwError)
+{
+    return PlatformOpenForWrite("/dev/null", 0, dwError);
+}
+
+PlatformFile_t PlatformOpenFile(const std::wstring& sPath, uint32_t& dwError)
+{
+    dwError = 0;
+    int fd = open(PathToUtf8(sPath).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        dwError = uint32_t(errno);
+        return PlatformInvalidFile;
+    }
+    return fd;
+}
+
+bool PlatformSetFilePosition(PlatformFile_t hFile, uint64_t ullOffset, uint32_t& dwError)
+{
+    dwError = 0;
+    if (lseek(hFile, off_t(ullOffset), SEEK_SET) < 0)
+    {
+        dwError = uint32_t(errno);
+        return false;
+    }
+    return true;
+}
+
+PlatformIoResult_t PlatformRead(PlatformFile_t hFile, void* pBuffer, size_t cbBuffer, size_t& cbRead, uint32_t& dwError)
+{
+    cbRead = 0;
+    dwError = 0;
+    for (;;)
+    {
+        ssize_t ret = read(hFile, pBuffer, cbBuffer);
+        if (ret > 0)
+        {
+            cbRead = size_t(ret);
+            return PlatformIoResult_t::Success;
+        }
+        if (0 == ret)
+            return PlatformIoResult_t::EndOfFile;
+        if (EINTR == errno)
+            continue;
+        dwError = uint32_t(errno);
+        // A descriptor closed by another thread to abandon the read
+        return (EBADF == errno) ? PlatformIoResult_t::Canceled : PlatformIoResult_t::Error;
+    }
+}
+
+bool PlatformWrite(PlatformFile_t hFile, const void* pBuffer, size_t cbBuffer, size_t& cbWritten, uint32_t& dwError)
+{
+    cbWritten = 0;
+    dwError = 0;
+    const uint8_t* pNext = (const uint8_t*)pBuffer;
+    while (cbWritten < cbBuffer)
+    {
+        ssize_t ret = write(hFile, pNext + cbWritten, cbBuffer - cbWritten);
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            dwError = uint32_t(errno);
+            return false;
+        }
+        cbWritten += size_t(ret);
+    }
+    return true;
+}
+
+void PlatformClose(PlatformFile_t& hFile)
+{
+    if (PlatformInvalidFile != hFile)
+        close(hFile);
+    hFile = PlatformInvalidFile;
+}
+
+std::wstring PlatformErrorMessage(uint32_t dwError)
+{
+    std::wstringstream str;
+    const char* szMessage = strerror(int(dwError));
+    for (const char* pc = szMessage; pc && *pc; ++pc)
+        str << wchar_t(*pc);
+    str << L" (errno " << dwError << L")";
+    return str.str();
+}
+
+const uint32_t PlatformErrorFileNotFound = ENOENT;
+const uint32_t PlatformErrorInvalidData = EILSEQ;
+
+/// <summary>
+/// Converts a UTF-8 path returned by the system to a wide-character string
+/// </summary>
+static std::wstring Utf8ToPath(const std::string& sUtf8)
+{
+    std::wstring sPath;
+    for (size_t ix = 0; ix < sUtf8.length(); )
+    {
+        const unsigned char c = (unsigned char)sUtf8[ix];
+        // Number of continuation bytes, and the bits from the lead byte
+        size_t nMore = 0;
+        uint32_t cp = c;
+        if (c >= 0xF0) { nMore = 3; cp = c & 0x07; }
+        else if (c >= 0xE0) { nMore = 2; cp = c & 0x0F; }
+        else if (c >= 0xC0) { nMore = 1; cp = c & 0x1F; }
+        ++ix;
+        for (; nMore > 0 && ix < sUtf8.length(); --nMore, ++ix)
+            cp = (cp << 6) | ((unsigned char)sUtf8[ix] & 0x3F);
+        sPath += wchar_t(cp);
+    }
+    return sPath;
+}
+
+bool PlatformGetFileSize(const std::wstring& sPath, uint64_t& ullSize, uint32_t& dwError)
+{
+    ullSize = 0;
+    dwError = 0;
+    struct stat st;
+    if (0 != stat(PathToUtf8(sPath).c_str(), &st))
+    {
+        dwError = uint32_t(errno);
+        return false;
+    }
+    ullSize = uint64_t(st.st_size);
+    return true;
+}
+
+bool PlatformMapFile(const std::wstring& sPath, PlatformMappedFile_t& mapped, uint32_t& dwError)
+{
+    dwError = 0;
+    mapped = PlatformMappedFile_t();
+    int fd = open(PathToUtf8(sPath).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        dwError = uint32_t(errno);
+        return false;
+    }
+    struct stat st;
+    bool bOk = (0 == fstat(fd, &st));
+    if (!bOk)
+        dwError = uint32_t(errno);
+    else if (uint64_t(st.st_size) > SIZE_MAX)
+    {
+        dwError = ENOMEM;
+        bOk = false;
+    }
+    else if (0 != st.st_size)
+    {
+        // The mapping keeps the file open
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (MAP_FAILED == p)
+        {
+            dwError = uint32_t(errno);
+            bOk = false;
+        }
+        else
+        {
+            mapped.pData = static_cast<const uint8_t*>(p);
+            mapped.cbData = uint64_t(st.st_size);
+        }
+    }
+    close(fd);
+    return bOk;
+}
+
+void PlatformUnmapFile(PlatformMappedFile_t& mapped)
+{
+    if (nullptr != mapped.pData)
+        munmap(const_cast<uint8_t*>(mapped.pData), size_t(mapped.cbData));
+    mapped = PlatformMappedFile_t();
+}
+
+bool PlatformRenameFile(const std::wstring& sFrom, const std::wstring& sTo, uint32_t& dwError)
+{
+    dwError = 0;
+    const std::string sToUtf8 = PathToUtf8(sTo);
+    // rename() silently replaces an existing file; MoveFileW doesn't
+    if (0 == access(sToUtf8.c_str(), F_OK))
+    {
+        dwError = EEXIST;
+        return false;
+    }
+    if (0 != rename(PathToUtf8(sFrom).c_str(), sToUtf8.c_str()))
+    {
+        dwError = uint32_t(errno);
+        return false;
+    }
+    return true;
+}
+
+bool PlatformFullPath(const std::wstring& sPath, std::wstring& sFullPath)
+{
+    sFullPath.clear();
+    if (sPath.empty())
+        return false;
+
+    std::string sAbsolute = PathToUtf8(sPath);
+    if ('/' != sAbsolute[0])
+    {
+        char szCwd[PATH_MAX];
+        if (nullptr == getcwd(szCwd, sizeof(szCwd)))
+            return false;
+        sAbsolute = std::string(szCwd) + "/" + sAbsolute;
+    }
+
+    // If the file exists, resolve symbolic links the same way the system will when it's opened
+    char szResolved[PATH_MAX];
+    if (nullptr != realpath(sAbsolute.c_str(), szResolved))
+    {
+        sFullPath = Utf8ToPath(szResolved);
+        return true;
+    }
+
+    // Otherwise, remove "." and ".." components and duplicate separators, as GetFullPathNameW does
+    std::vector<std::string> vComponents;
+    std::stringstream strPath(sAbsolute);
+    std::string sComponent;
+    while (std::getline(strPath, sComponent, '/'))
+    {
+        if (sComponent.empty() || "." == sComponent)
+            continue;
+        if (".." == sComponent)
+        {
+            if (!vComponents.empty())
+                vComponents.pop_back();
+            continue;
+        }
+        vComponents.push_back(sComponent);
+    }
+    std::string sNormalized;
+    for (const std::string& s : vComponents)
+        sNormalized += "/" + s;
+    sFullPath = Utf8ToPath(sNormalized.empty() ? std::string("/") : sNormalized);
+    return true;
+}
+
+bool PlatformOpenFileStream(std::wofstream& fStream, const std::wstring& sPath, std::ios_base::openmode mode)
+{
+    fStream.open(PathToUtf8(sPath).c_str(), mode);
+    return !fStream.fail();
+}
+
+PlatformFile_t PlatformStandardOutput(bool bStderr)
+{
+    return bStderr ? STDERR_FILENO : STDOUT_FILENO;
+}
+
+// ------------------------------------------------------------------------------------------
+// Processes
+
+extern char** environ;
+
+bool PlatformStartProcess(PlatformProcess_t& process, const std::vector<std::wstring>& vArgs, PlatformFile_t hStdout, PlatformFile_t hStderr, uint32_t& dwError)
+{
+    dwError = 0;
+    process = PlatformProcess_t();
+    if (vArgs.empty())
+    {
+        dwError = EINVAL;
+        return false;
+    }
+    std::vector<std::string> vUtf8Args;
+    for (const std::wstring& sArg : vArgs)
+        vUtf8Args.push_back(PathToUtf8(sArg));
+    std::vector<char*> vArgv;
+    for (std::string& sArg : vUtf8Args)
+        vArgv.push_back(&sArg[0]);
+    vArgv.push_back(nullptr);
+
+    // The pipes are close-on-exec; dup2 gives the child inheritable copies as its standard handles.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, hStdout, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, (PlatformInvalidFile != hStderr) ? hStderr : hStdout, STDERR_FILENO);
+    pid_t pid = 0;
+    const int ret = posix_spawnp(&pid, vArgv[0], &actions, nullptr, vArgv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (0 != ret)
+    {
+        dwError = uint32_t(ret);
+        return false;
+    }
+    process.pid = pid;
+    process.dwPID = uint32_t(pid);
+    process.bStarted = true;
+    return true;
+}
+
+bool PlatformWaitForProcess(PlatformProcess_t& process, uint32_t dwTimeoutMs)
+{
+    if (process.bExited || !process.bStarted)
+        return process.bExited;
+
+    // WNOWAIT leaves the process a zombie until PlatformCloseProcess, so that its PID can't be reused
+    // while PlatformTerminateProcess might still be called on it.
+    const Deadline_t deadline = (PlatformWaitForever == dwTimeoutMs) ? Deadline_t() : Deadline_t::AfterMilliseconds(dwTimeoutMs);
+    for (;;)
+    {
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        const int nOptions = WEXITED | WNOWAIT | (deadline.IsInfinite() ? 0 : WNOHANG);
+        if (0 != waitid(P_PID, id_t(process.pid), &info, nOptions))
+        {
+            if (EINTR == errno)
+                continue;
+            return false;
+        }
+        if (0 != info.si_pid)
+        {
+            // Same convention as the shells: 128 + signal number for a process ended by a signal
+            process.dwExitCode = (CLD_EXITED == info.si_code) ? uint32_t(info.si_status) : uint32_t(128 + info.si_status);
+            process.bExited = true;
+            return true;
+        }
+        const uint32_t dwRemaining = deadline.WaitMilliseconds();
+        if (0 == dwRemaining)
+            return false;
+        PlatformSleepMilliseconds(dwRemaining < 10 ? dwRemaining : 10);
+    }
+}
+
+bool PlatformTerminateProcess(PlatformProcess_t& process, uint32_t& dwError)
+{
+    dwError = 0;
+    if (!process.bStarted)
+        return false;
+    if (0 != kill(process.pid, SIGKILL))
+    {
+        dwError = uint32_t(errno);
+        return false;
+    }
+    return true;
+}
+
+void PlatformCloseProcess(PlatformProcess_t& process)
+{
+    if (process.bStarted)
+    {
+        // Reap it if it has exited; otherwise it will be reaped (by init) after this process exits
+        int status = 0;
+        waitpid(process.pid, &status, process.bExited ? 0 : WNOHANG);
+    }
+    process = PlatformProcess_t();
+}
+
+// ------------------------------------------------------------------------------------------
+// Debug stream and time of day
+
+void PlatformDebugOutput(const std::wstring& /*sText*/)
+{
+    // There is no system-wide debug stream to write to
+}
+
+void PlatformGetUtcDateTime(PlatformDateTime_t& dt)
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    const time_t t = tv.tv_sec;
+    struct tm tmUtc;
+    gmtime_r(&t, &tmUtc);
+    dt.nYear = unsigned(tmUtc.tm_year + 1900);
+    dt.nMonth = unsigned(tmUtc.tm_mon + 1);
+    dt.nDay = unsigned(tmUtc.tm_mday);
+    dt.nHour = unsigned(tmUtc.tm_hour);
+    dt.nMinute = unsigned(tmUtc.tm_min);
+    dt.nSecond = unsigned(tmUtc.tm_sec);
+    dt.nMilliseconds = unsigned(tv.tv_usec / 1000);
+}
+
+// ------------------------------------------------------------------------------------------
+// Resource counters
+
+/// <summary>
+/// Number of entries in a directory, not counting "." and ".."
+/// </summary>
+static uint64_t CountDirectoryEntries(const char* szDirectory)
+{
+    uint64_t nEntries = 0;
+    DIR* pDir = opendir(szDirectory);
+    if (nullptr == pDir)
+        return 0;
+    while (struct dirent* pEntry = readdir(pDir))
+    {
+        if (0 != strcmp(pEntry->d_name, ".") && 0 != strcmp(pEntry->d_name, ".."))
+            ++nEntries;
+    }
+    closedir(pDir);
+    return nEntries;
+}
+
+void PlatformGetProcessCounters(PlatformProcessCounters_t& counters)
+{
+    counters = PlatformProcessCounters_t();
+
+    // Don't count the descriptor opendir uses to enumerate them
+    const uint64_t nFds = CountDirectoryEntries("/proc/self/fd");
+    counters.nHandles = (nFds > 0) ? nFds - 1 : 0;
+    counters.nThreads = CountDirectoryEntries("/proc/self/task");
+
+    struct rusage usage;
+    if (0 == getrusage(RUSAGE_SELF, &usage))
+    {
+        // ru_maxrss is in kilobytes on Linux
+        counters.ullPeakMemory = uint64_t(usage.ru_maxrss) * 1024;
+    }
+}
+
+// ------------------------------------------------------------------------------------------
+// Monotonic clock (MonotonicClock.h)
+
+/// <summary>
+/// Current monotonic time, in microseconds since an arbitrary fixed point (typically system boot).
+/// Only differences between values are meaningful.
+/// </summary>
+uint64_t MonotonicMicroseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+}
+
+/// <summary>
+/// Approximate time this process was created, in MonotonicMicroseconds() units.
+/// Lets startup costs incurred before any of this program's code runs (loader, static initializers) be
+/// measured on the same timeline as everything else. Accuracy is limited by the kernel's clock tick.
+/// </summary>
+uint64_t ProcessCreationMonotonicMicroseconds()
+{
+    const uint64_t ullNow = MonotonicMicroseconds();
+
+    // Field 22 of /proc/self/stat is the start time in clock ticks since boot, on the same timeline as
+    // CLOCK_BOOTTIME. The command name (field 2) can contain spaces, so parse from after its closing parenthesis.
+    std::ifstream fStat("/proc/self/stat");
+    std::string sStat;
+    std::getline(fStat, sStat);
+    const size_t ixParen = sStat.rfind(')');
+    if (std::string::npos == ixParen)
+        return ullNow;
+    std::istringstream str(sStat.substr(ixParen + 1));
+    std::string sField;
+    // Fields 3 through 21
+    for (int ixField = 3; ixField <= 21; ++ixField)
+        str >> sField;
+    unsigned long long ullStartTicks = 0;
+    if (!(str >> ullStartTicks))
+        return ullNow;
+
+    const long nTicksPerSecond = sysconf(_SC_CLK_TCK);
+    struct timespec tsBoot;
+    if (nTicksPerSecond <= 0 || 0 != clock_gettime(CLOCK_BOOTTIME, &tsBoot))
+        return ullNow;
+    const uint64_t ullBootNow = uint64_t(tsBoot.tv_sec) * 1000000 + uint64_t(tsBoot.tv_nsec) / 1000;
+    const uint64_t ullBootStart = uint64_t(ullStartTicks) * 1000000 / uint64_t(nTicksPerSecond);
+    if (ullBootNow < ullBootStart)
+        return ullNow;
+    const uint64_t ullElapsed = ullBootNow - ullBootStart;
+    return (ullElapsed < ullNow) ? (ullNow - ullElapsed) : ullNow;
+}
@@ -0,0 +1,601 @@
+// Win32 implementation of the operating-system abstraction declared in Platform.h and of the
+// monotonic clock declared in MonotonicClock.h.
+
+#include <Windows.h>
+#include <TlHelp32.h>
+#include <Psapi.h>
+#include "Platform.h"
+#include "MonotonicClock.h"
+#include "SysErrorMessage.h"
+#include "ProcThreadAttributes.h"
+
+#pragma comment(lib, "psapi.lib")
+
+// ------------------------------------------------------------------------------------------
+// Synchronization
+
+PlatformMutex_t::PlatformMutex_t()
+{
+    InitializeCriticalSectionEx(&m_critsec, 0, CRITICAL_SECTION_NO_DEBUG_INFO);
+}
+
+PlatformMutex_t::~PlatformMutex_t()
+{
+    DeleteCriticalSection(&m_critsec);
+}
+
+void PlatformMutex_t::Lock()
+{
+    EnterCriticalSection(&m_critsec);
+}
+
+void PlatformMutex_t::Unlock()
+{
+    LeaveCriticalSection(&m_critsec);
+}
+
+PlatformCondition_t::PlatformCondition_t()
+{
+    InitializeConditionVariable(&m_cv);
+}
+
+PlatformCondition_t::~PlatformCondition_t()
+{
+    // Condition variables don't need to be deleted
+}
+
+bool PlatformCondition_t::Wait(PlatformMutex_t& mutex, uint32_t dwTimeoutMs)
+{
+    // PlatformWaitForever == INFINITE
+    return FALSE != SleepConditionVariableCS(&m_cv, &mutex.m_critsec, dwTimeoutMs);
+}
+
+void PlatformCondition_t::NotifyAll()
+{
+    WakeAllConditionVariable(&m_cv);
+}
+
+uint64_t PlatformCompareExchange64(volatile uint64_t* pullDest, uint64_t ullExchange, uint64_t ullComparand)
+{
+    return uint64_t(InterlockedCompareExchange64((LONGLONG volatile*)pullDest, LONGLONG(ullExchange), LONGLONG(ullComparand)));
+}
+
+// ------------------------------------------------------------------------------------------
+// Threads
+
+/// <summary>
+/// Function and parameter passed from PlatformStartThread to the new thread
+/// </summary>
+struct PlatformThreadStart_t
+{
+    PlatformThreadProc_t pfnThreadProc;
+    void* pvParam;
+};
+
+static DWORD WINAPI PlatformThreadTrampoline(LPVOID lpvParam)
+{
+    PlatformThreadStart_t* pStart = (PlatformThreadStart_t*)lpvParam;
+    PlatformThreadStart_t start = *pStart;
+    delete pStart;
+    start.pfnThreadProc(start.pvParam);
+    return 0;
+}
+
+bool PlatformStartThread(PlatformThread_t& thread, PlatformThreadProc_t pfnThreadProc, void* pvParam, uint32_t& dwError)
+{
+    dwError = 0;
+    PlatformThreadStart_t* pStart = new PlatformThreadStart_t{ pfnThreadProc, pvParam };
+    thread.hThread = CreateThread(NULL, 0, PlatformThreadTrampoline, pStart, 0, NULL);
+    thread.bStarted = (NULL != thread.hThread);
+    if (!thread.bStarted)
+    {
+        dwError = GetLastError();
+        delete pStart;
+    }
+    return thread.bStarted;
+}
+
+void PlatformJoinThread(PlatformThread_t& thread)
+{
+    if (thread.bStarted)
+    {
+        WaitForSingleObject(thread.hThread, INFINITE);
+        CloseHandle(thread.hThread);
+        thread.hThread = NULL;
+        thread.bStarted = false;
+    }
+}
+
+void PlatformSleepMilliseconds(uint32_t dwMilliseconds)
+{
+    Sleep(dwMilliseconds);
+}
+
+// ------------------------------------------------------------------------------------------
+// Pipes and files
+
+bool PlatformCreatePipe(PlatformFile_t& hRead, PlatformFile_t& hWrite, uint32_t& dwError)
+{
+    dwError = 0;
+    hRead = hWrite = PlatformInvalidFile;
+    if (!CreatePipe(&hRead, &hWrite, NULL, 0))
+    {
+        dwError = GetLastError();
+        hRead = hWrite = PlatformInvalidFile;
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Opens a file for writing with the specified creation disposition
+/// </summary>
+static PlatformFile_t PlatformOpenForWrite(const wchar_t* szPath, DWORD dwCreationDisposition, uint32_t& dwError)
+{
+    dwError = 0;
+    HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, dwCreationDisposition, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        dwError = GetLastError();
+        return PlatformInvalidFile;
+    }
+    return hFile;
+}
+
+PlatformFile_t PlatformCreateFile(const std::wstring& sPath, uint32_t& dwError)
+{
+    return PlatformOpenForWrite(sPath.c_str(), CREATE_ALWAYS, dwError);
+}
+
+PlatformFile_t PlatformOpenNullDevice(uint32_t& dwError)
+{
+    return PlatformOpenForWrite(PlatformNullDevicePath, OPEN_EXISTING, dwError);
+}
+
+PlatformFile_t PlatformOpenFile(const std::wstring& sPath, uint32_t& dwError)
+{
+    dwError = 0;
+    HANDLE hFile = CreateFileW(sPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        dwError = GetLastError();
+        return PlatformInvalidFile;
+    }
+    return hFile;
+}
+
+bool PlatformSetFilePosition(PlatformFile_t hFile, uint64_t ullOffset, uint32_t& dwError)
+{
+    dwError = 0;
+    LARGE_INTEGER liOffset;
+    liOffset.QuadPart = LONGLONG(ullOffset);
+    if (!SetFilePointerEx(hFile, liOffset, NULL, FILE_BEGIN))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    return true;
+}
+
+PlatformIoResult_t PlatformRead(PlatformFile_t hFile, void* pBuffer, size_t cbBuffer, size_t& cbRead, uint32_t& dwError)
+{
+    cbRead = 0;
+    dwError = 0;
+    DWORD dwRead = 0;
+    const DWORD dwToRead = (cbBuffer > MAXDWORD) ? MAXDWORD : DWORD(cbBuffer);
+    if (ReadFile(hFile, pBuffer, dwToRead, &dwRead, NULL))
+    {
+        cbRead = dwRead;
+        return (dwRead > 0) ? PlatformIoResult_t::Success : PlatformIoResult_t::EndOfFile;
+    }
+    dwError = GetLastError();
+    switch (dwError)
+    {
+    case ERROR_BROKEN_PIPE:
+    case ERROR_HANDLE_EOF:
+        // The write end of the pipe was closed (e.g., the process exited)
+        return PlatformIoResult_t::EndOfFile;
+    case ERROR_OPERATION_ABORTED:
+        // CancelSynchronousIo
+        return PlatformIoResult_t::Canceled;
+    default:
+        return PlatformIoResult_t::Error;
+    }
+}
+
+bool PlatformWrite(PlatformFile_t hFile, const void* pBuffer, size_t cbBuffer, size_t& cbWritten, uint32_t& dwError)
+{
+    cbWritten = 0;
+    dwError = 0;
+    const BYTE* pNext = (const BYTE*)pBuffer;
+    while (cbWritten < cbBuffer)
+    {
+        const size_t cbRemaining = cbBuffer - cbWritten;
+        const DWORD dwToWrite = (cbRemaining > MAXDWORD) ? MAXDWORD : DWORD(cbRemaining);
+        DWORD dwWritten = 0;
+        if (!WriteFile(hFile, pNext + cbWritten, dwToWrite, &dwWritten, NULL))
+        {
+            dwError = GetLastError();
+            return false;
+        }
+        cbWritten += dwWritten;
+    }
+    return true;
+}
+
+void PlatformClose(PlatformFile_t& hFile)
+{
+    if (PlatformInvalidFile != hFile && INVALID_HANDLE_VALUE != hFile)
+        CloseHandle(hFile);
+    hFile = PlatformInvalidFile;
+}
+
+std::wstring PlatformErrorMessage(uint32_t dwError)
+{
+    return SysErrorMessageWithCode(dwError);
+}
+
+const uint32_t PlatformErrorFileNotFound = ERROR_FILE_NOT_FOUND;
+const uint32_t PlatformErrorInvalidData = ERROR_INVALID_DATA;
+
+bool PlatformGetFileSize(const std::wstring& sPath, uint64_t& ullSize, uint32_t& dwError)
+{
+    ullSize = 0;
+    dwError = 0;
+    WIN32_FILE_ATTRIBUTE_DATA data = { 0 };
+    if (!GetFileAttributesExW(sPath.c_str(), GetFileExInfoStandard, &data))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    ULARGE_INTEGER ul;
+    ul.HighPart = data.nFileSizeHigh;
+    ul.LowPart = data.nFileSizeLow;
+    ullSize = ul.QuadPart;
+    return true;
+}
+
+bool PlatformMapFile(const std::wstring& sPath, PlatformMappedFile_t& mapped, uint32_t& dwError)
+{
+    dwError = 0;
+    mapped = PlatformMappedFile_t();
+    HANDLE hFile = CreateFileW(sPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    LARGE_INTEGER liSize = { 0 };
+    bool bOk = (FALSE != GetFileSizeEx(hFile, &liSize));
+    if (!bOk)
+        dwError = GetLastError();
+    else if (uint64_t(liSize.QuadPart) > SIZE_MAX)
+    {
+        // Can't be mapped whole into a 32-bit address space
+        dwError = ERROR_NOT_ENOUGH_MEMORY;
+        bOk = false;
+    }
+    else if (0 != liSize.QuadPart)
+    {
+        // The mapping keeps the file open
+        mapped.hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (NULL != mapped.hMapping)
+            mapped.pData = static_cast<const uint8_t*>(MapViewOfFile(mapped.hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (nullptr == mapped.pData)
+        {
+            dwError = GetLastError();
+            bOk = false;
+            PlatformUnmapFile(mapped);
+        }
+        else
+        {
+            mapped.cbData = uint64_t(liSize.QuadPart);
+        }
+    }
+    CloseHandle(hFile);
+    return bOk;
+}
+
+void PlatformUnmapFile(PlatformMappedFile_t& mapped)
+{
+    if (nullptr != mapped.pData)
+        UnmapViewOfFile(mapped.pData);
+    if (NULL != mapped.hMapping)
+        CloseHandle(mapped.hMapping);
+    mapped = PlatformMappedFile_t();
+}
+
+bool PlatformRenameFile(const std::wstring& sFrom, const std::wstring& sTo, uint32_t& dwError)
+{
+    dwError = 0;
+    if (!MoveFileW(sFrom.c_str(), sTo.c_str()))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    return true;
+}
+
+bool PlatformFullPath(const std::wstring& sPath, std::wstring& sFullPath)
+{
+    sFullPath.clear();
+    const DWORD bufsize = MAX_PATH * 2;
+    wchar_t szFullPathName[bufsize] = { 0 }, szLongPathName[bufsize] = { 0 };
+
+    // Convert a relative path to an absolute path. Note that file might or might not exist.
+    DWORD ret = GetFullPathNameW(sPath.c_str(), bufsize, szFullPathName, nullptr);
+    // 0 is failure; ret >= bufsize means the buffer is too small. It *is* possible to create files
+    // with paths longer than MAX_PATH*2, but we're not wasting time on that here. Just fail that.
+    if (0 == ret || ret >= bufsize)
+        return false;
+
+    // If the file exists, get the long path name.
+    ret = GetLongPathNameW(szFullPathName, szLongPathName, bufsize);
+    if (0 < ret && ret < bufsize)
+    {
+        // Got the long path; use that
+        sFullPath = szLongPathName;
+    }
+    else
+    {
+        // No long path - possibly doesn't exist. Use the already-obtained full path
+        sFullPath = szFullPathName;
+    }
+    return true;
+}
+
+bool PlatformOpenFileStream(std::wofstream& fStream, const std::wstring& sPath, std::ios_base::openmode mode)
+{
+    fStream.open(sPath.c_str(), mode);
+    return !fStream.fail();
+}
+
+PlatformFile_t PlatformStandardOutput(bool bStderr)
+{
+    return GetStdHandle(bStderr ? STD_ERROR_HANDLE : STD_OUTPUT_HANDLE);
+}
+
+// ------------------------------------------------------------------------------------------
+// Processes
+
+/// <summary>
+/// Appends an argument to a command line, quoted as CommandLineToArgvW and the C runtime expect
+/// </summary>
+static void AppendQuotedArgument(std::wstring& sCommandLine, const std::wstring& sArg)
+{
+    if (!sCommandLine.empty())
+        sCommandLine += L' ';
+    if (!sArg.empty() && std::wstring::npos == sArg.find_first_of(L" \t\n\v\""))
+    {
+        sCommandLine += sArg;
+        return;
+    }
+    sCommandLine += L'"';
+    size_t nBackslashes = 0;
+    for (wchar_t ch : sArg)
+    {
+        if (L'\\' == ch)
+        {
+            ++nBackslashes;
+            continue;
+        }
+        // Backslashes are literal unless they precede a double quote
+        sCommandLine.append(L'"' == ch ? nBackslashes * 2 + 1 : nBackslashes, L'\\');
+        nBackslashes = 0;
+        sCommandLine += ch;
+    }
+    // Double the trailing backslashes so that the closing quote isn't escaped
+    sCommandLine.append(nBackslashes * 2, L'\\');
+    sCommandLine += L'"';
+}
+
+/// <summary>
+/// Returns an inheritable duplicate of a handle, for a child process' standard handles
+/// </summary>
+static HANDLE InheritableDuplicate(HANDLE hSource)
+{
+    HANDLE hDuplicate = NULL;
+    if (!DuplicateHandle(GetCurrentProcess(), hSource, GetCurrentProcess(), &hDuplicate, 0, TRUE, DUPLICATE_SAME_ACCESS))
+        return NULL;
+    return hDuplicate;
+}
+
+bool PlatformStartProcess(PlatformProcess_t& process, const std::vector<std::wstring>& vArgs, PlatformFile_t hStdout, PlatformFile_t hStderr, uint32_t& dwError)
+{
+    dwError = 0;
+    process = PlatformProcess_t();
+    std::wstring sCommandLine;
+    for (const std::wstring& sArg : vArgs)
+        AppendQuotedArgument(sCommandLine, sArg);
+
+    // The child gets inheritable duplicates of the handles; the caller's handles stay non-inheritable.
+    // Its handle list keeps other children started at the same time from inheriting these, and it from inheriting theirs.
+    HANDLE hStdinDup = CreateFileW(PlatformNullDevicePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    HANDLE hStdoutDup = InheritableDuplicate(hStdout);
+    HANDLE hStderrDup = InheritableDuplicate(PlatformInvalidFile != hStderr ? hStderr : hStdout);
+    if (INVALID_HANDLE_VALUE != hStdinDup)
+        SetHandleInformation(hStdinDup, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+
+    STARTUPINFOEXW siEx = { 0 };
+    STARTUPINFOW& si = siEx.StartupInfo;
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = hStdinDup;
+    si.hStdOutput = hStdoutDup;
+    si.hStdError = hStderrDup;
+    ProcThreadAttributes_t attributes;
+    attributes.SetInheritedHandles({ hStdinDup, hStdoutDup, hStderrDup });
+    DWORD dwAttributeFlags = 0;
+    DWORD dwAttributeError = 0;
+    PROCESS_INFORMATION pi = { 0 };
+    // CreateProcessW can modify the command line buffer
+    std::vector<wchar_t> vCommandLine(sCommandLine.begin(), sCommandLine.end());
+    vCommandLine.push_back(L'\0');
+    const bool bAttributes = attributes.Build(siEx, dwAttributeFlags, dwAttributeError);
+    const BOOL ret = bAttributes && CreateProcessW(NULL, vCommandLine.data(), NULL, NULL, attributes.InheritHandles(), CREATE_NO_WINDOW | dwAttributeFlags, NULL, NULL, &si, &pi);
+    if (!ret)
+        dwError = bAttributes ? GetLastError() : dwAttributeError;
+
+    if (INVALID_HANDLE_VALUE != hStdinDup)
+        CloseHandle(hStdinDup);
+    if (NULL != hStdoutDup)
+        CloseHandle(hStdoutDup);
+    if (NULL != hStderrDup)
+        CloseHandle(hStderrDup);
+    if (!ret)
+        return false;
+
+    CloseHandle(pi.hThread);
+    process.hProcess = pi.hProcess;
+    process.dwPID = pi.dwProcessId;
+    process.bStarted = true;
+    return true;
+}
+
+bool PlatformWaitForProcess(PlatformProcess_t& process, uint32_t dwTimeoutMs)
+{
+    if (process.bExited || !process.bStarted)
+        return process.bExited;
+    if (WAIT_OBJECT_0 != WaitForSingleObject(process.hProcess, dwTimeoutMs))
+        return false;
+    DWORD dwExitCode = 0;
+    GetExitCodeProcess(process.hProcess, &dwExitCode);
+    process.dwExitCode = dwExitCode;
+    process.bExited = true;
+    return true;
+}
+
+bool PlatformTerminateProcess(PlatformProcess_t& process, uint32_t& dwError)
+{
+    dwError = 0;
+    if (!process.bStarted)
+        return false;
+    if (!TerminateProcess(process.hProcess, 1))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    return true;
+}
+
+void PlatformCloseProcess(PlatformProcess_t& process)
+{
+    if (process.bStarted)
+        CloseHandle(process.hProcess);
+    process = PlatformProcess_t();
+}
+
+// ------------------------------------------------------------------------------------------
+// Debug stream and time of day
+
+void PlatformDebugOutput(const std::wstring& sText)
+{
+    OutputDebugStringW(sText.c_str());
+}
+
+void PlatformGetUtcDateTime(PlatformDateTime_t& dt)
+{
+    SYSTEMTIME st;
+    GetSystemTime(&st);
+    dt.nYear = st.wYear;
+    dt.nMonth = st.wMonth;
+    dt.nDay = st.wDay;
+    dt.nHour = st.wHour;
+    dt.nMinute = st.wMinute;
+    dt.nSecond = st.wSecond;
+    dt.nMilliseconds = st.wMilliseconds;
+}
+
+// ------------------------------------------------------------------------------------------
+// Resource counters
+
+void PlatformGetProcessCounters(PlatformProcessCounters_t& counters)
+{
+    counters = PlatformProcessCounters_t();
+
+    DWORD dwHandles = 0;
+    if (GetProcessHandleCount(GetCurrentProcess(), &dwHandles))
+        counters.nHandles = dwHandles;
+
+    PROCESS_MEMORY_COUNTERS pmc = { 0 };
+    pmc.cb = sizeof(pmc);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        counters.ullPeakMemory = pmc.PeakWorkingSetSize;
+
+    // Thread snapshots include all threads in the system; count the ones in this process
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (INVALID_HANDLE_VALUE != hSnapshot)
+    {
+        const DWORD dwPID = GetCurrentProcessId();
+        THREADENTRY32 te = { 0 };
+        te.dwSize = sizeof(te);
+        for (BOOL bMore = Thread32First(hSnapshot, &te); bMore; bMore = Thread32Next(hSnapshot, &te))
+        {
+            if (dwPID == te.th32OwnerProcessID)
+                ++counters.nThreads;
+        }
+        CloseHandle(hSnapshot);
+    }
+}
+
+// ------------------------------------------------------------------------------------------
+// Monotonic clock (MonotonicClock.h)
+
+/// <summary>
+/// Performance counter frequency, in counts per second. Fixed at system boot.
+/// </summary>
+static ULONGLONG QpcFrequency()
+{
+    LARGE_INTEGER liFreq = { 0 };
+    QueryPerformanceFrequency(&liFreq);
+    return ULONGLONG(liFreq.QuadPart);
+}
+
+/// <summary>
+/// Current monotonic time, in microseconds since an arbitrary fixed point (typically system boot).
+/// Only differences between values are meaningful.
+/// </summary>
+uint64_t MonotonicMicroseconds()
+{
+    // Initialized on first use
+    static const ULONGLONG ullFreq = QpcFrequency();
+
+    LARGE_INTEGER liNow = { 0 };
+    QueryPerformanceCounter(&liNow);
+    const ULONGLONG ullCounts = ULONGLONG(liNow.QuadPart);
+    // Split into whole seconds and remainder so that the multiplication can't overflow
+    return (ullCounts / ullFreq) * 1000000 + (ullCounts % ullFreq) * 1000000 / ullFreq;
+}
+
+/// <summary>
+/// Approximate time this process was created, in MonotonicMicroseconds() units.
+/// Lets startup costs incurred before any of this program's code runs (loader, static initializers) be
+/// measured on the same timeline as everything else. Accuracy is limited by the system clock's resolution.
+/// </summary>
+uint64_t ProcessCreationMonotonicMicroseconds()
+{
+    const ULONGLONG ullNow = MonotonicMicroseconds();
+
+    // The process creation time is available only as wall-clock time; subtract the wall-clock time elapsed
+    // since then from the current monotonic time.
+    FILETIME ftCreation = { 0 }, ftExit = { 0 }, ftKernel = { 0 }, ftUser = { 0 }, ftNow = { 0 };
+    if (!GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser))
+        return ullNow;
+    // GetSystemTimePreciseAsFileTime requires Windows 8 or newer; the fallback has 1-16ms resolution.
+    typedef VOID(WINAPI* pfnGetSystemTime_t)(LPFILETIME);
+    pfnGetSystemTime_t pfnGetSystemTime = (pfnGetSystemTime_t)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "GetSystemTimePreciseAsFileTime");
+    if (nullptr == pfnGetSystemTime)
+        pfnGetSystemTime = GetSystemTimeAsFileTime;
+    pfnGetSystemTime(&ftNow);
+
+    ULARGE_INTEGER uliCreation, uliNow;
+    uliCreation.LowPart = ftCreation.dwLowDateTime;
+    uliCreation.HighPart = ftCreation.dwHighDateTime;
+    uliNow.LowPart = ftNow.dwLowDateTime;
+    uliNow.HighPart = ftNow.dwHighDateTime;
+    // Clock adjusted since the process started, or other nonsense
+    if (uliNow.QuadPart < uliCreation.QuadPart)
+        return ullNow;
+    // FILETIME is in 100ns units
+    const ULONGLONG ullElapsed = (uliNow.QuadPart - uliCreation.QuadPart) / 10;
+    return (ullElapsed < ullNow) ? (ullNow - ullElapsed) : ullNow;
+}
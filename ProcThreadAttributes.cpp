@@ -0,0 +1,79 @@
+// Extended startup information for new processes: see ProcThreadAttributes.h.
+
+#include <algorithm>
+#include "ProcThreadAttributes.h"
+
+ProcThreadAttributes_t::~ProcThreadAttributes_t()
+{
+    if (m_bInitialized)
+        DeleteProcThreadAttributeList(reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(m_listBuffer.data()));
+}
+
+void ProcThreadAttributes_t::SetInheritedHandles(std::initializer_list<HANDLE> handles)
+{
+    m_vHandles.clear();
+    for (HANDLE h : handles)
+    {
+        if (NULL != h && INVALID_HANDLE_VALUE != h && m_vHandles.end() == std::find(m_vHandles.begin(), m_vHandles.end(), h))
+            m_vHandles.push_back(h);
+    }
+}
+
+void ProcThreadAttributes_t::SetGroupAffinity(const GROUP_AFFINITY& affinity)
+{
+    m_groupAffinity = affinity;
+    m_bGroupAffinity = true;
+}
+
+void ProcThreadAttributes_t::SetPreferredNode(USHORT usNode)
+{
+    m_usPreferredNode = usNode;
+    m_bPreferredNode = true;
+}
+
+bool ProcThreadAttributes_t::Build(STARTUPINFOEXW& siEx, DWORD& dwCreationFlags, DWORD& dwError)
+{
+    dwError = 0;
+    dwCreationFlags = 0;
+    siEx.StartupInfo.cb = sizeof(siEx);
+    siEx.lpAttributeList = NULL;
+
+    const DWORD nAttributes = (m_vHandles.empty() ? 0 : 1) + (m_bGroupAffinity ? 1 : 0) + (m_bPreferredNode ? 1 : 0);
+    if (0 == nAttributes)
+        return true;
+
+    // The first call reports the size needed (and fails, for lack of a buffer)
+    SIZE_T cbList = 0;
+    InitializeProcThreadAttributeList(NULL, nAttributes, 0, &cbList);
+    m_listBuffer.resize(cbList);
+    LPPROC_THREAD_ATTRIBUTE_LIST pList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(m_listBuffer.data());
+    if (!InitializeProcThreadAttributeList(pList, nAttributes, 0, &cbList))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    m_bInitialized = true;
+
+    if (!m_vHandles.empty() &&
+        !UpdateProcThreadAttribute(pList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, m_vHandles.data(), m_vHandles.size() * sizeof(HANDLE), NULL, NULL))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    if (m_bGroupAffinity &&
+        !UpdateProcThreadAttribute(pList, 0, PROC_THREAD_ATTRIBUTE_GROUP_AFFINITY, &m_groupAffinity, sizeof(m_groupAffinity), NULL, NULL))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    if (m_bPreferredNode &&
+        !UpdateProcThreadAttribute(pList, 0, PROC_THREAD_ATTRIBUTE_PREFERRED_NODE, &m_usPreferredNode, sizeof(m_usPreferredNode), NULL, NULL))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+
+    siEx.lpAttributeList = pList;
+    dwCreationFlags = EXTENDED_STARTUPINFO_PRESENT;
+    return true;
+}
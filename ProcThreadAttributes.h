@@ -0,0 +1,78 @@
+// Extended startup information for new processes: a process/thread attribute list (STARTUPINFOEXW) holding what a
+// launch needs beyond STARTUPINFOW, such as exactly which handles the new process inherits, and which processors
+// and NUMA node it starts on.
+//
+// With bInheritHandles = TRUE and no handle list, a new process inherits every inheritable handle in this process
+// at that moment, including the pipe ends meant for other targets being launched at the same time; a pipe's reader
+// then doesn't see it close until all of those processes have exited, too.
+
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+/// <summary>
+/// Attributes for one process about to be created. Set the attributes, call Build, and pass the STARTUPINFOEXW,
+/// InheritHandles(), and the creation flags from Build to CreateProcessAsUserW or CreateProcessW. The attribute
+/// values are kept in this object, which must outlive that call.
+/// </summary>
+class ProcThreadAttributes_t
+{
+public:
+    ProcThreadAttributes_t() = default;
+    ~ProcThreadAttributes_t();
+
+    /// <summary>
+    /// Have the new process inherit these handles and no others (PROC_THREAD_ATTRIBUTE_HANDLE_LIST). The handles
+    /// must be inheritable. NULL and INVALID_HANDLE_VALUE are left out, as are repeats (such as stdout and stderr
+    /// going to the same pipe), which the list doesn't allow.
+    /// </summary>
+    /// <param name="handles">Input: the handles to inherit</param>
+    void SetInheritedHandles(std::initializer_list<HANDLE> handles);
+
+    /// <summary>
+    /// Value for CreateProcess' bInheritHandles: TRUE only if there are handles to inherit
+    /// </summary>
+    BOOL InheritHandles() const { return m_vHandles.empty() ? FALSE : TRUE; }
+
+    /// <summary>
+    /// Start the new process' primary thread on these processors, in this processor group
+    /// (PROC_THREAD_ATTRIBUTE_GROUP_AFFINITY). Threads the process creates later start in the same group.
+    /// </summary>
+    /// <param name="affinity">Input: the processor group, and the processors in it</param>
+    void SetGroupAffinity(const GROUP_AFFINITY& affinity);
+
+    /// <summary>
+    /// Make this NUMA node the new process' preferred node for memory allocation (PROC_THREAD_ATTRIBUTE_PREFERRED_NODE)
+    /// </summary>
+    /// <param name="usNode">Input: the node number</param>
+    void SetPreferredNode(USHORT usNode);
+
+    /// <summary>
+    /// Build the attribute list, once the attributes are set, and point siEx at it. Call once.
+    /// </summary>
+    /// <param name="siEx">Input/output: extended startup information; its StartupInfo is left as it is, except for cb</param>
+    /// <param name="dwCreationFlags">Output: flags to add to CreateProcess' dwCreationFlags (EXTENDED_STARTUPINFO_PRESENT if there are any attributes)</param>
+    /// <param name="dwError">Output: Win32 error code on failure</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Build(STARTUPINFOEXW& siEx, DWORD& dwCreationFlags, DWORD& dwError);
+
+private:
+    // Handles to inherit, without repeats
+    std::vector<HANDLE> m_vHandles;
+    // Processors to start on, if m_bGroupAffinity; preferred NUMA node, if m_bPreferredNode
+    GROUP_AFFINITY m_groupAffinity = { 0 };
+    bool m_bGroupAffinity = false;
+    USHORT m_usPreferredNode = 0;
+    bool m_bPreferredNode = false;
+    // Storage for the attribute list (opaque, variable size); initialized if m_bInitialized
+    std::vector<uint8_t> m_listBuffer;
+    bool m_bInitialized = false;
+
+private:
+    // Not implemented
+    ProcThreadAttributes_t(const ProcThreadAttributes_t&) = delete;
+    ProcThreadAttributes_t& operator = (const ProcThreadAttributes_t&) = delete;
+};
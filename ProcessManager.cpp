@@ -1,8 +1,14 @@
 // Code to manage processes started in users' sessions
 
 #include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <TlHelp32.h>
 #include "ProcessManager.h"
 #include "SysErrorMessage.h"
+#include "StringUtils.h"
+#include "SoftClose.h"
 
 #include "DbgOut.h"
 
@@ -13,9 +19,17 @@
 /// </summary>
 void ProcessInfo_t::Uninit()
 {
+    // Must stop the exit notification before closing the process handle it's waiting on.
+    if (NULL != hExitWait)
+        UnregisterWaitEx(hExitWait, INVALID_HANDLE_VALUE);
     CloseHandle(hProcess);
     CloseHandle(hPipeStdoutRd);
     CloseHandle(hPipeStderrRd);
+    // The sinks refer to the redir targets and the match results, so release them first
+    pStdoutSink.reset();
+    pStderrSink.reset();
+    pStdoutHash = pStderrHash = nullptr;
+    pMatches.reset();
     // Don't close the redir target if it's this process' stdout handle
     if (GetStdHandle(STD_OUTPUT_HANDLE) != hStdoutRedirTarget)
         CloseHandle(hStdoutRedirTarget);
@@ -24,24 +38,298 @@ void ProcessInfo_t::Uninit()
         CloseHandle(hStderrRedirTarget);
     CloseHandle(hThread_StdoutMonitor);
     CloseHandle(hThread_StderrMonitor);
+    CloseHandle(hPipeStdinWr);
+    CloseHandle(hThread_StdinFeeder);
+    CloseHandle(hConsoleHost);
+    // A process still held for a gang start that never happened isn't left suspended
+    if (NULL != hHeldThread)
+        ResumeThread(hHeldThread);
+    CloseHandle(hHeldThread);
+    pStdinData = nullptr;
+    cbStdinData = 0;
+    // Closing the job doesn't affect the processes in it (no JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE).
+    CloseHandle(hJob);
 
-    hProcess = 
+    hExitWait =
+        hProcess = 
         hPipeStdoutRd = 
         hPipeStderrRd = 
         hStdoutRedirTarget = 
         hStderrRedirTarget = 
         hThread_StdoutMonitor = 
-        hThread_StderrMonitor = NULL;
+        hThread_StderrMonitor = 
+        hPipeStdinWr = 
+        hThread_StdinFeeder = 
+        hConsoleHost = 
+        hHeldThread = 
+        hJob = NULL;
 }
 
 // ------------------------------------------------------------------------------------------
 
 void ProcessManager_t::Clear()
 {
+    // Stop the exit notifications before releasing their contexts. UnregisterWaitEx with INVALID_HANDLE_VALUE
+    // waits for any callback that's already running to complete.
+    for (auto iter = Iter(); !IterAtEnd(iter); iter++)
+    {
+        ProcessInfo_t& process = (*iter)->process;
+        if (NULL != process.hExitWait)
+        {
+            UnregisterWaitEx(process.hExitWait, INVALID_HANDLE_VALUE);
+            process.hExitWait = NULL;
+        }
+    }
+    m_exitWatches.clear();
+    m_exitQueue.Clear();
+    m_held.clear();
     // Empty the collection. When objects' reference counts hit zero, they will be cleaned up.
     m_processes.clear();
 }
 
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Put a newly-created, still-suspended process into its own job object so that it and any processes it
+/// starts can be terminated together.
+/// </summary>
+/// <param name="process">Input/output: the process; its hJob member is set on success</param>
+/// <returns>true if successful; false otherwise (the process itself can still be terminated)</returns>
+bool ProcessManager_t::TrackProcessTree(ProcessInfo_t& process)
+{
+    HANDLE hJob = CreateJobObjectW(NULL, NULL);
+    if (NULL == hJob)
+    {
+        DWORD dwLastErr = GetLastError();
+        dbgOut.locked() << L"CreateJobObjectW failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+        return false;
+    }
+    // The process was started with CREATE_BREAKAWAY_FROM_JOB, so it isn't in any job this process might be in.
+    if (!AssignProcessToJobObject(hJob, process.hProcess))
+    {
+        DWORD dwLastErr = GetLastError();
+        dbgOut.locked() << L"AssignProcessToJobObject for PID " << process.dwPID << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+        CloseHandle(hJob);
+        return false;
+    }
+    process.hJob = hJob;
+    return true;
+}
+
+/// <summary>
+/// Hold a newly-created, still-suspended process, with its redirection set up, until GangStart resumes it along
+/// with the rest, instead of resuming it now.
+/// </summary>
+/// <param name="pSPI">Input: the process, with its Create phase recorded</param>
+/// <param name="hThread">Input: its suspended primary thread; now owned by the process (hHeldThread)</param>
+void ProcessManager_t::HoldForGangStart(const ptrSessionProcessInfo_t& pSPI, HANDLE hThread)
+{
+    pSPI->process.hHeldThread = hThread;
+    m_held.push_back(pSPI);
+}
+
+/// <summary>
+/// Resume the processes being held for the gang start, in order, as close together as possible: all at once,
+/// or in waves of a given size with a pause between them. Each process' Held phase is recorded as it's resumed.
+/// </summary>
+/// <param name="nPerWave">Input: number of processes to resume in each wave; 0 for all of them in one wave</param>
+/// <param name="dwWaveIntervalMilliseconds">Input: time from the start of one wave to the start of the next</param>
+/// <param name="vResumed">Output: the processes resumed, in the order they were resumed</param>
+/// <returns>The start skew achieved</returns>
+GangStartStats_t ProcessManager_t::GangStart(size_t nPerWave, DWORD dwWaveIntervalMilliseconds, vecSessionProcessInfo_t& vResumed)
+{
+    GangStartStats_t stats;
+    vResumed.clear();
+    if (0 == nPerWave)
+        nPerWave = m_held.size();
+    ULONGLONG ullFirstResume = 0, ullLastResume = 0;
+    for (size_t ixWaveStart = 0; ixWaveStart < m_held.size(); ixWaveStart += nPerWave)
+    {
+        const ULONGLONG ullWaveStart = MonotonicMicroseconds();
+        if (0 != ixWaveStart && dwWaveIntervalMilliseconds > 0)
+        {
+            // Each wave starts an interval after the one before it began
+            const ULONGLONG ullNextWave = ullFirstResume + ULONGLONG(stats.nWaves) * dwWaveIntervalMilliseconds * 1000;
+            if (ullNextWave > ullWaveStart)
+                Sleep(DWORD((ullNextWave - ullWaveStart + 999) / 1000));
+        }
+
+        // The tight loop: only the resumes, and the times, which are recorded before each resume because the
+        // process' other phases are measured from it
+        const size_t ixWaveEnd = std::min(ixWaveStart + nPerWave, m_held.size());
+        ULONGLONG ullWaveFirst = 0, ullNow = 0;
+        for (size_t ix = ixWaveStart; ix < ixWaveEnd; ++ix)
+        {
+            ProcessInfo_t& process = m_held[ix]->process;
+            ullNow = MonotonicMicroseconds();
+            process.phaseTimes.Record(Phase_t::Held, process.phaseTimes.ullEnd[size_t(Phase_t::Create)], ullNow);
+            ResumeThread(process.hHeldThread);
+            if (ix == ixWaveStart)
+                ullWaveFirst = ullNow;
+        }
+        if (0 == stats.nWaves)
+            ullFirstResume = ullWaveFirst;
+        ullLastResume = ullNow;
+        stats.ullWaveSkew = std::max(stats.ullWaveSkew, ullNow - ullWaveFirst);
+        ++stats.nWaves;
+    }
+    stats.ullSkew = ullLastResume - ullFirstResume;
+
+    // Then everything else
+    for (auto iter = m_held.begin(); iter != m_held.end(); ++iter)
+    {
+        ProcessInfo_t& process = (*iter)->process;
+        CloseHandle(process.hHeldThread);
+        process.hHeldThread = NULL;
+        stats.ullMaxHeld = std::max(stats.ullMaxHeld, process.phaseTimes.Duration(Phase_t::Held));
+    }
+    stats.nResumed = m_held.size();
+    vResumed.swap(m_held);
+    m_held.clear();
+    return stats;
+}
+
+/// <summary>
+/// Set a process' deadline, measured from when it was resumed, and schedule the action to take when it's reached.
+/// </summary>
+/// <param name="pSPI">Input: the process, resumed, with its Create (and Held) phases already recorded</param>
+/// <param name="ullTimeoutMilliseconds">Input: milliseconds after the process' start; ~0 for no deadline</param>
+void ProcessManager_t::StartDeadline(const ptrSessionProcessInfo_t& pSPI, ULONGLONG ullTimeoutMilliseconds)
+{
+    pSPI->process.deadline = Deadline_t::AfterMilliseconds(ullTimeoutMilliseconds, pSPI->process.phaseTimes.ResumeTime());
+    m_terminationSchedule.Start(pSPI, pSPI->process.deadline);
+}
+
+/// <summary>
+/// Returns the time of the next scheduled deadline action (infinite if none).
+/// </summary>
+Deadline_t ProcessManager_t::NextDeadline() const
+{
+    return m_terminationSchedule.NextDeadline();
+}
+
+/// <summary>
+/// Carry out the deadline actions that are due: stop monitoring, request a graceful exit, or terminate
+/// the process tree, according to the termination policy. Each process' terminationStage is updated.
+/// </summary>
+/// <param name="vAffectedProcesses">Output: processes on which an action was taken</param>
+/// <returns>true if any actions were taken; false otherwise</returns>
+bool ProcessManager_t::HandleDueDeadlines(vecSessionProcessInfo_t& vAffectedProcesses)
+{
+    vAffectedProcesses.clear();
+    std::vector<TerminationSchedule_t<ptrSessionProcessInfo_t>::Action_t> vActions;
+    // Nothing to do for processes that are no longer being monitored, or that have exited but haven't
+    // been picked up by WaitForAProcessToExit yet.
+    m_terminationSchedule.Advance(MonotonicMicroseconds(),
+        [](const ptrSessionProcessInfo_t& pSPI) {
+            const ProcessInfo_t& process = pSPI->process;
+            return !(process.bExited || process.bTimedOut || WAIT_OBJECT_0 == WaitForSingleObject(process.hProcess, 0));
+        },
+        vActions);
+
+    // Soft-close helpers started, and the processes they're for
+    std::vector<std::pair<ptrSessionProcessInfo_t, HANDLE>> vHelpers;
+    for (auto iter = vActions.begin(); iter != vActions.end(); ++iter)
+    {
+        ptrSessionProcessInfo_t& pSPI = iter->item;
+        ProcessInfo_t& process = pSPI->process;
+        switch (iter->stage)
+        {
+        case TerminationStage_t::Released:
+            // Stop monitoring; leave the process running
+            process.bTimedOut = true;
+            StopRedirectionMonitors(process, false);
+            break;
+
+        case TerminationStage_t::SoftClosed:
+        {
+            // Ask it to exit; the helpers for all processes due now are waited for together below.
+            HANDLE hHelper = NULL;
+            if (StartSoftClose(process.dwPID, pSPI->session.dwSessionId, hHelper, process.dwSoftCloseResult))
+            {
+                vHelpers.push_back(std::make_pair(pSPI, hHelper));
+            }
+            else
+            {
+                dbgOut.locked() << L"Could not request soft close of PID " << process.dwPID << L": " << SysErrorMessageWithCode(process.dwSoftCloseResult) << std::endl;
+                m_terminationSchedule.StartGracePeriod(pSPI, MonotonicMicroseconds());
+            }
+            break;
+        }
+
+        case TerminationStage_t::Killed:
+            process.bTimedOut = true;
+            TerminateProcessTree(process);
+            StopRedirectionMonitors(process, false);
+            break;
+
+        case TerminationStage_t::None:
+            continue;
+        }
+        process.terminationStage = iter->stage;
+        vAffectedProcesses.push_back(pSPI);
+    }
+
+    // Wait for the soft-close helpers, up to SoftCloseHelperTimeoutMs for all of them together. Each grace period
+    // starts when its helper has finished, so that it isn't shortened by the time spent waiting.
+    const uint64_t ullHelpersDeadline = MonotonicMicroseconds() + uint64_t(SoftCloseHelperTimeoutMs) * 1000;
+    for (auto& helper : vHelpers)
+    {
+        const uint64_t ullNow = MonotonicMicroseconds();
+        const DWORD dwRemainingMs = (ullNow < ullHelpersDeadline) ? DWORD((ullHelpersDeadline - ullNow + 999) / 1000) : 0;
+        ProcessInfo_t& process = helper.first->process;
+        process.dwSoftCloseResult = FinishSoftClose(process.dwPID, helper.second, dwRemainingMs);
+        m_terminationSchedule.StartGracePeriod(helper.first, MonotonicMicroseconds());
+    }
+    return !vAffectedProcesses.empty();
+}
+
+/// <summary>
+/// Terminate a process and, if it has a job object, all of its descendants.
+/// </summary>
+void ProcessManager_t::TerminateProcessTree(ProcessInfo_t& process, DWORD dwExitCode)
+{
+    if (NULL != process.hJob && TerminateJobObject(process.hJob, dwExitCode))
+        return;
+    TerminateProcess(process.hProcess, dwExitCode);
+}
+
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Thread-pool callback invoked when a watched process exits: queue it for WaitForAProcessToExit
+/// </summary>
+void CALLBACK ProcessManager_t::OnProcessExit(PVOID lpParameter, BOOLEAN /*bTimedOut*/)
+{
+    ExitWatch_t* pWatch = (ExitWatch_t*)lpParameter;
+    ptrSessionProcessInfo_t pSPI = pWatch->wpSPI.lock();
+    if (pSPI)
+        pWatch->pExitQueue->Post(pSPI);
+}
+
+/// <summary>
+/// Start watching a launched process for exit, so that WaitForAProcessToExit reports it when it exits.
+/// </summary>
+/// <param name="pSPI">Input: the process</param>
+/// <returns>true if the process' exit will be reported through the exit queue; false if it will have to be polled</returns>
+bool ProcessManager_t::WatchForExit(const ptrSessionProcessInfo_t& pSPI)
+{
+    if (NULL == pSPI->process.hProcess || NULL != pSPI->process.hExitWait)
+        return false;
+
+    std::unique_ptr<ExitWatch_t> pWatch(new ExitWatch_t{ &m_exitQueue, pSPI });
+    // The callback fires immediately if the process has already exited.
+    if (!RegisterWaitForSingleObject(&pSPI->process.hExitWait, pSPI->process.hProcess, OnProcessExit, pWatch.get(), INFINITE, WT_EXECUTEONLYONCE))
+    {
+        DWORD dwLastErr = GetLastError();
+        dbgOut.locked() << L"RegisterWaitForSingleObject for PID " << pSPI->process.dwPID << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+        pSPI->process.hExitWait = NULL;
+        return false;
+    }
+    m_exitWatches.push_back(std::move(pWatch));
+    return true;
+}
+
 /// <summary>
 /// Waits up to dwTimeout milliseconds for one or more still-running processes in the collection to exit.
 /// Changes the bExited status of those processes and returns information about them in the vExitedProcesses
@@ -54,85 +342,75 @@ void ProcessManager_t::Clear()
 /// <returns>true if one or more processes exited during this wait; false otherwise</returns>
 bool ProcessManager_t::WaitForAProcessToExit(DWORD dwTimeout, DWORD& nRunningProcesses, DWORD& nNowRunning, vecSessionProcessInfo_t& vExitedProcesses)
 {
-    bool retval = false;
     vExitedProcesses.clear();
     nRunningProcesses = nNowRunning = 0;
 
     dbgOut.locked() << L"WaitForAProcessToExit, timeout " << dwTimeout << std::endl;
 
-    if (m_processes.size() == 0)
-        return false;
-
-    // Use std::vector to create a contiguous array of still-running process handles to pass to WaitForMultipleObjects
-    std::vector<HANDLE> vHProcesses;;
+    // Count the still-running processes, and note whether any of them have to be polled because their
+    // exits couldn't be registered with the thread pool.
+    bool bPoll = false;
     for (auto iter = ConstIter(); !IterAtEnd(iter); iter++)
     {
-        // Add handles of running processes to the array
         const ptrSessionProcessInfo_t& pSPI = *iter;
-        if (NULL != pSPI->process.hProcess && !pSPI->process.bExited)
+        if (NULL != pSPI->process.hProcess && !pSPI->process.bExited && !pSPI->process.bTimedOut)
         {
-            vHProcesses.push_back(pSPI->process.hProcess);
             nRunningProcesses++;
+            if (NULL == pSPI->process.hExitWait)
+                bPoll = true;
         }
     }
 
     dbgOut.locked() << L"nRunningProcesses = " << nRunningProcesses << std::endl;
-    
-    if (nRunningProcesses > 0)
+
+    if (0 == nRunningProcesses)
+        return false;
+
+    // Wait for exit notifications
+    if (bPoll && dwTimeout > ExitPollMilliseconds)
+        dwTimeout = ExitPollMilliseconds;
+    vecSessionProcessInfo_t vNotified;
+    m_exitQueue.Wait(dwTimeout, vNotified);
+
+    if (bPoll)
     {
-        // Wait for any of the processes to exit
-        DWORD wfmoRet = WaitForMultipleObjects(nRunningProcesses, vHProcesses.data(), FALSE, dwTimeout);
-        if (WAIT_TIMEOUT == wfmoRet)
+        for (auto iter = Iter(); !IterAtEnd(iter); iter++)
         {
-            // None exited during the timeout period. Update the nNowRunning return parameter.
-            dbgOut.locked() << L"No processes exited during the timeout period" << std::endl;
-            nNowRunning = nRunningProcesses;
-        }
-        else
-        {
-            // One or more exited; identify them
-            for (auto iter = Iter(); !IterAtEnd(iter); iter++)
+            ptrSessionProcessInfo_t& pSPI = *iter;
+            // Use WaitForSingleObject with a timeout of 0 to determine whether a specific process has exited.
+            // Can't use GetExitCodeProcess to determine whether a process has exited:
+            // it doesn't distinguish between a process that has exited and one that exited with 259 (STILL_ACTIVE)
+            if (NULL != pSPI->process.hProcess && NULL == pSPI->process.hExitWait && !pSPI->process.bExited && !pSPI->process.bTimedOut &&
+                WAIT_OBJECT_0 == WaitForSingleObject(pSPI->process.hProcess, 0))
             {
-                // Look only at the processes that had been running this time through
-                ptrSessionProcessInfo_t& pSPI = *iter;
-                if (NULL != pSPI->process.hProcess && !pSPI->process.bExited)
-                {
-                    // Use WaitForSingleObject with a timeout of 0 to determine whether a specific process has exited.
-                    // Can't use GetExitCodeProcess to determine whether a process has exited:
-                    // it doesn't distinguish between a process that has exited and one that exited with 259 (STILL_ACTIVE)
-                    DWORD wfsoRet = WaitForSingleObject(pSPI->process.hProcess, 0);
-                    switch (wfsoRet)
-                    {
-                    case WAIT_OBJECT_0:
-                        // The process has exited; get its exit code
-                        GetExitCodeProcess(pSPI->process.hProcess, &pSPI->process.dwExitCode);
-                        // add it to the vExitedProcesses output collection
-                        vExitedProcesses.push_back(*iter);
-                        // Flag it as having exited so we don't look at it again
-                        pSPI->process.bExited = true;
-                        break;
-
-                    case WAIT_TIMEOUT:
-                        // process is still running
-                        ++nNowRunning;
-                        break;
-
-                    default:
-                        //TODO: how to handle this error (unexpected return value from WaitForSingleObject)
-                        {
-                            DWORD dwLastErr = GetLastError();
-                            std::wcerr << L"WaitForSingleObject for PID " << pSPI->process.dwPID << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
-                        }
-                        break;
-                    }
-                }
+                vNotified.push_back(pSPI);
             }
-
-            retval = true;
         }
     }
 
-    return retval;
+    for (auto iter = vNotified.begin(); iter != vNotified.end(); ++iter)
+    {
+        // Processes that stopped being monitored after their deadlines are no longer reported.
+        ptrSessionProcessInfo_t& pSPI = *iter;
+        if (pSPI->process.bExited || pSPI->process.bTimedOut)
+            continue;
+        // The process has exited; note when that was detected, relative to when it was resumed
+        pSPI->process.phaseTimes.Record(Phase_t::Exit, pSPI->process.phaseTimes.ResumeTime(), MonotonicMicroseconds());
+        // get its exit code
+        GetExitCodeProcess(pSPI->process.hProcess, &pSPI->process.dwExitCode);
+        // Capture the resources it consumed while the handle is still open
+        GetProcessResourceUsage(pSPI->process.hProcess, pSPI->process.resourceUsage);
+        // add it to the vExitedProcesses output collection
+        vExitedProcesses.push_back(pSPI);
+        // Flag it as having exited so we don't look at it again
+        pSPI->process.bExited = true;
+    }
+
+    if (vExitedProcesses.empty())
+        dbgOut.locked() << L"No processes exited during the timeout period" << std::endl;
+
+    nNowRunning = nRunningProcesses - DWORD(vExitedProcesses.size());
+    return !vExitedProcesses.empty();
 }
 
 /// <summary>
@@ -148,22 +426,34 @@ void ProcessManager_t::StopAllRedirectionMonitors(bool bTerminateProcesses)
     // Terminate the process if bTerminateProcesses is true.
     for (auto iter = Iter(); !IterAtEnd(iter); iter++)
     {
-        // Only either CancelIoEx or CancelSynchronousIo is really needed. Doing both anyway.
-        const ptrSessionProcessInfo_t& pSPI = *iter;
-        if (NULL != pSPI->process.hPipeStdoutRd)
-            CancelIoEx(pSPI->process.hPipeStdoutRd, NULL);
-        if (NULL != pSPI->process.hPipeStderrRd)
-            CancelIoEx(pSPI->process.hPipeStderrRd, NULL);
-        if (NULL != pSPI->process.hThread_StdoutMonitor)
-            CancelSynchronousIo(pSPI->process.hThread_StdoutMonitor);
-        if (NULL != pSPI->process.hThread_StderrMonitor)
-            CancelSynchronousIo(pSPI->process.hThread_StderrMonitor);
-
-        if (bTerminateProcesses)
-            TerminateProcess(pSPI->process.hProcess, ERROR_TIMEOUT);
+        StopRedirectionMonitors((*iter)->process, bTerminateProcesses);
     }
 }
 
+/// <summary>
+/// Stop the threads monitoring pipes for one process' redirected output, and optionally terminate the process.
+/// </summary>
+/// <param name="process">Input: the process</param>
+/// <param name="bTerminateProcess">Input: whether to terminate the process if it's still running</param>
+void ProcessManager_t::StopRedirectionMonitors(ProcessInfo_t& process, bool bTerminateProcess)
+{
+    // Only either CancelIoEx or CancelSynchronousIo is really needed. Doing both anyway.
+    if (NULL != process.hPipeStdoutRd)
+        CancelIoEx(process.hPipeStdoutRd, NULL);
+    if (NULL != process.hPipeStderrRd)
+        CancelIoEx(process.hPipeStderrRd, NULL);
+    if (NULL != process.hThread_StdoutMonitor)
+        CancelSynchronousIo(process.hThread_StdoutMonitor);
+    if (NULL != process.hThread_StderrMonitor)
+        CancelSynchronousIo(process.hThread_StderrMonitor);
+    // A process that isn't reading its stdin would otherwise keep the thread writing the script to it waiting
+    if (NULL != process.hThread_StdinFeeder)
+        CancelSynchronousIo(process.hThread_StdinFeeder);
+
+    if (bTerminateProcess && NULL != process.hProcess)
+        TerminateProcess(process.hProcess, ERROR_TIMEOUT);
+}
+
 /// <summary>
 /// Wait for all threads monitoring redirected output to exit
 /// </summary>
@@ -188,8 +478,439 @@ void ProcessManager_t::WaitForRedirectionMonitors()
             vHThreads.push_back(pSPI->process.hThread_StderrMonitor);
             nThreads++;
         }
+        if (NULL != pSPI->process.hThread_StdinFeeder)
+        {
+            vHThreads.push_back(pSPI->process.hThread_StdinFeeder);
+            nThreads++;
+        }
+    }
+    // Wait for all handles to go into the signalled state (indicating the threads have all exited),
+    // at most MAXIMUM_WAIT_OBJECTS at a time, as that's all WaitForMultipleObjects takes
+    for (DWORD ixThread = 0; ixThread < nThreads; ixThread += MAXIMUM_WAIT_OBJECTS)
+    {
+        const DWORD nBatch = (nThreads - ixThread < MAXIMUM_WAIT_OBJECTS) ? nThreads - ixThread : MAXIMUM_WAIT_OBJECTS;
+        WaitForMultipleObjects(nBatch, vHThreads.data() + ixThread, TRUE, INFINITE);
+    }
+}
+
+
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Look for the console hosts (conhost.exe) of running processes that don't have one yet, and hold onto them, so
+/// that the resources they consume are reported with the processes'. A console host is started by its process
+/// shortly after the process is resumed, so this has to be repeated until they've all appeared.
+/// </summary>
+/// <returns>Number of running processes still without a console host</returns>
+size_t ProcessManager_t::FindConsoleHosts()
+{
+    // The processes still without one, by PID. (Holding a process handle keeps its PID from being reused.)
+    std::map<DWORD, ProcessInfo_t*> mapWithout;
+    for (auto iter = Iter(); !IterAtEnd(iter); iter++)
+    {
+        ProcessInfo_t& process = (*iter)->process;
+        if (NULL != process.hProcess && NULL == process.hConsoleHost && !process.bExited && !process.bTimedOut)
+            mapWithout[process.dwPID] = &process;
+    }
+    if (mapWithout.empty())
+        return 0;
+
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (INVALID_HANDLE_VALUE == hSnapshot)
+    {
+        DWORD dwLastErr = GetLastError();
+        dbgOut.locked() << L"FindConsoleHosts: CreateToolhelp32Snapshot failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+        return mapWithout.size();
+    }
+    PROCESSENTRY32W pe = { 0 };
+    pe.dwSize = sizeof(pe);
+    for (BOOL bMore = Process32FirstW(hSnapshot, &pe); bMore; bMore = Process32NextW(hSnapshot, &pe))
+    {
+        auto found = mapWithout.find(pe.th32ParentProcessID);
+        if (mapWithout.end() == found || 0 != _wcsicmp(pe.szExeFile, L"conhost.exe"))
+            continue;
+        // The handle keeps its resource usage available after it exits
+        HANDLE hConsoleHost = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ, FALSE, pe.th32ProcessID);
+        if (NULL != hConsoleHost)
+        {
+            dbgOut.locked() << L"Console host for PID " << found->first << L": PID " << pe.th32ProcessID << std::endl;
+            found->second->hConsoleHost = hConsoleHost;
+            mapWithout.erase(found);
+        }
     }
-    // Wait for all handles to go into the signalled state (indicating the threads have all exited)
-    WaitForMultipleObjects(nThreads, vHThreads.data(), TRUE, INFINITE);
+    CloseHandle(hSnapshot);
+    return mapWithout.size();
 }
 
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Capture resource usage for launched processes that don't have it yet, and return those processes
+/// sorted by CPU time, highest first.
+/// </summary>
+/// <param name="vSorted">Output: launched processes, sorted by cost</param>
+void ProcessManager_t::GetProcessesSortedByCost(vecSessionProcessInfo_t& vSorted)
+{
+    vSorted.clear();
+    for (auto iter = Iter(); !IterAtEnd(iter); iter++)
+    {
+        // Skip sessions in which no process was launched
+        ptrSessionProcessInfo_t& pSPI = *iter;
+        if (NULL == pSPI->process.hProcess)
+            continue;
+        // Processes that haven't been seen to exit (still running, or terminated after monitoring stopped)
+        // haven't had their resource usage captured yet.
+        if (!pSPI->process.resourceUsage.bValid || pSPI->process.resourceUsage.bStillRunning)
+            GetProcessResourceUsage(pSPI->process.hProcess, pSPI->process.resourceUsage);
+        // The same for its console host, which exits after it
+        if (NULL != pSPI->process.hConsoleHost && (!pSPI->process.consoleHostUsage.bValid || pSPI->process.consoleHostUsage.bStillRunning))
+            GetProcessResourceUsage(pSPI->process.hConsoleHost, pSPI->process.consoleHostUsage);
+        vSorted.push_back(pSPI);
+    }
+
+    // Highest CPU time first; wall time breaks ties
+    std::sort(vSorted.begin(), vSorted.end(),
+        [](const ptrSessionProcessInfo_t& a, const ptrSessionProcessInfo_t& b) {
+            const ProcessResourceUsage_t& ua = a->process.resourceUsage;
+            const ProcessResourceUsage_t& ub = b->process.resourceUsage;
+            if (ua.CpuTime() != ub.CpuTime())
+                return ua.CpuTime() > ub.CpuTime();
+            return ua.ullWallTime > ub.ullWallTime;
+        });
+}
+
+/// <summary>
+/// Selectors for the per-process values aggregated into percentiles in the resource usage reports
+/// </summary>
+struct ResourceUsageMetric_t
+{
+    const wchar_t* szName;
+    const wchar_t* szJsonName;
+    ULONGLONG(*pfnValue)(const ProcessResourceUsage_t&);
+    // Divisor to convert to the displayed unit in the text report
+    double divisor;
+};
+
+static const ResourceUsageMetric_t ResourceUsageMetrics[] = {
+    { L"Wall time (s)",         L"wallTime100ns",     [](const ProcessResourceUsage_t& u) { return u.ullWallTime; },       10.0 * 1000.0 * 1000.0 },
+    { L"CPU time (s)",          L"cpuTime100ns",      [](const ProcessResourceUsage_t& u) { return u.CpuTime(); },         10.0 * 1000.0 * 1000.0 },
+    { L"Peak working set (MB)", L"peakWorkingSet",    [](const ProcessResourceUsage_t& u) { return u.ullPeakWorkingSet; }, 1024.0 * 1024.0 },
+    { L"Page faults",           L"pageFaults",        [](const ProcessResourceUsage_t& u) { return u.ullPageFaults; },     1.0 },
+    { L"I/O (KB)",              L"ioBytes",           [](const ProcessResourceUsage_t& u) { return u.IoBytes(); },         1024.0 },
+};
+
+static const double ResourceUsagePercentiles[] = { 50.0, 90.0, 99.0, 100.0 };
+
+/// <summary>
+/// Write the column headings of an aggregate table in the resource usage report
+/// </summary>
+static void WriteAggregateHeadings(std::wostream& os)
+{
+    os << std::left << std::setw(24) << L"" << std::right;
+    for (double pct : ResourceUsagePercentiles)
+    {
+        if (100.0 == pct)
+            os << std::setw(14) << L"max";
+        else
+            os << std::setw(12) << L"p" << std::setw(2) << int(pct);
+    }
+    os << std::setw(16) << L"total" << std::endl;
+}
+
+/// <summary>
+/// Write a row of an aggregate table in the resource usage report: the percentiles and total of values
+/// </summary>
+static void WriteAggregateRow(std::wostream& os, const wchar_t* szName, std::vector<ULONGLONG>& values, double divisor)
+{
+    ULONGLONG ullTotal = 0;
+    for (ULONGLONG ullValue : values)
+        ullTotal += ullValue;
+    os << std::left << std::setw(24) << szName << std::right;
+    for (double pct : ResourceUsagePercentiles)
+        os << std::setw(14) << double(Percentile(values, pct)) / divisor;
+    os << std::setw(16) << double(ullTotal) / divisor << std::endl;
+}
+
+/// <summary>
+/// Write a table of the resources consumed by each launched process, sorted by CPU time (highest first),
+/// followed by aggregate percentiles across all launched processes.
+/// Resource usage is captured at this time for any processes that are still running.
+/// </summary>
+/// <param name="os">Output: stream to write the report to</param>
+void ProcessManager_t::ReportResourceUsage(std::wostream& os)
+{
+    vecSessionProcessInfo_t vSorted;
+    GetProcessesSortedByCost(vSorted);
+    if (vSorted.empty())
+        return;
+
+    const std::ios_base::fmtflags oldFlags = os.flags();
+    const std::streamsize oldPrecision = os.precision();
+    os << std::fixed << std::setprecision(3);
+
+    // With -spread, a column for where each was placed
+    const bool bPlaced = std::any_of(vSorted.begin(), vSorted.end(),
+        [](const ptrSessionProcessInfo_t& pSPI) { return !pSPI->process.sPlacement.empty(); });
+
+    os << std::endl << L"Resource usage by target process (highest CPU time first):" << std::endl;
+    os
+        << std::left << std::setw(8) << L"Session" << std::setw(8) << L"PID" << std::setw(28) << L"User"
+        << std::right << std::setw(11) << L"Wall(s)" << std::setw(11) << L"CPU(s)" << std::setw(11) << L"Kernel(s)" << std::setw(11) << L"User(s)"
+        << std::setw(12) << L"PeakWS(MB)" << std::setw(10) << L"PgFaults" << std::setw(11) << L"Read(KB)" << std::setw(11) << L"Write(KB)";
+    if (bPlaced)
+        os << L"  " << std::left << std::setw(10) << L"Placement" << std::right;
+    os << L"  Exit" << std::endl;
+    for (auto iter = vSorted.begin(); iter != vSorted.end(); ++iter)
+    {
+        const ptrSessionProcessInfo_t& pSPI = *iter;
+        const ProcessResourceUsage_t& usage = pSPI->process.resourceUsage;
+        std::wstring sUser = pSPI->session.sDomain + L"\\" + pSPI->session.sUser;
+        if (sUser.length() > 27)
+            sUser = sUser.substr(0, 24) + L"...";
+        os
+            << std::left << std::setw(8) << pSPI->session.dwSessionId << std::setw(8) << pSPI->process.dwPID << std::setw(28) << sUser
+            << std::right << std::setw(11) << HundredNsToSeconds(usage.ullWallTime) << std::setw(11) << HundredNsToSeconds(usage.CpuTime())
+            << std::setw(11) << HundredNsToSeconds(usage.ullKernelTime) << std::setw(11) << HundredNsToSeconds(usage.ullUserTime)
+            << std::setw(12) << double(usage.ullPeakWorkingSet) / (1024.0 * 1024.0) << std::setw(10) << usage.ullPageFaults
+            << std::setw(11) << double(usage.ullReadBytes) / 1024.0 << std::setw(11) << double(usage.ullWriteBytes) / 1024.0;
+        if (bPlaced)
+            os << L"  " << std::left << std::setw(10) << pSPI->process.sPlacement << std::right;
+        os << L"  ";
+        if (!usage.bValid)
+            os << L"(unavailable)";
+        else if (usage.bStillRunning)
+            os << L"(running)";
+        else if (pSPI->process.bExited)
+            os << pSPI->process.dwExitCode;
+        else if (pSPI->process.bTimedOut)
+            os << L"(timed out)";
+        else
+            os << L"-";
+        os << std::endl;
+    }
+
+    os << std::endl << L"Aggregate across " << vSorted.size() << L" target process(es):" << std::endl;
+    WriteAggregateHeadings(os);
+    for (const ResourceUsageMetric_t& metric : ResourceUsageMetrics)
+    {
+        std::vector<ULONGLONG> values;
+        for (auto iter = vSorted.begin(); iter != vSorted.end(); ++iter)
+            values.push_back(metric.pfnValue((*iter)->process.resourceUsage));
+        WriteAggregateRow(os, metric.szName, values, metric.divisor);
+    }
+
+    // How long each took to launch (CreateProcessAsUserW through ResumeThread), and what its console host cost:
+    // what -noConsole saves
+    std::vector<ULONGLONG> vLaunch, vHostWorkingSet, vHostCpu;
+    for (auto iter = vSorted.begin(); iter != vSorted.end(); ++iter)
+    {
+        const ProcessInfo_t& process = (*iter)->process;
+        if (process.phaseTimes.IsRecorded(Phase_t::Create))
+            vLaunch.push_back(process.phaseTimes.Duration(Phase_t::Create));
+        if (process.consoleHostUsage.bValid)
+        {
+            vHostWorkingSet.push_back(process.consoleHostUsage.ullPeakWorkingSet);
+            vHostCpu.push_back(process.consoleHostUsage.CpuTime());
+        }
+    }
+    os << std::endl << L"Launch, and console hosts (" << vHostWorkingSet.size() << L" of " << vSorted.size() << L" target process(es) had one):" << std::endl;
+    WriteAggregateHeadings(os);
+    WriteAggregateRow(os, L"Launch time (ms)", vLaunch, 1000.0);
+    if (!vHostWorkingSet.empty())
+    {
+        WriteAggregateRow(os, L"Host peak WS (MB)", vHostWorkingSet, 1024.0 * 1024.0);
+        WriteAggregateRow(os, L"Host CPU time (s)", vHostCpu, 10.0 * 1000.0 * 1000.0);
+    }
+
+    // The priorities set on the target processes, if any were asked for; processes on which some couldn't be set
+    // are counted separately
+    std::map<std::wstring, size_t> priorityCounts;
+    for (auto iter = vSorted.begin(); iter != vSorted.end(); ++iter)
+        ++priorityCounts[(*iter)->process.priority.Describe()];
+    if (priorityCounts.size() > 1 || 0 == priorityCounts.count(std::wstring()))
+    {
+        os << std::endl << L"Priorities set:" << std::endl;
+        for (const auto& priorityCount : priorityCounts)
+            os << L"  " << std::left << std::setw(52) << (priorityCount.first.empty() ? L"(none)" : priorityCount.first.c_str())
+               << std::right << std::setw(8) << priorityCount.second << L" target process(es)" << std::endl;
+    }
+
+    os.flags(oldFlags);
+    os.precision(oldPrecision);
+}
+
+/// <summary>
+/// Write the same information as ReportResourceUsage, as a JSON document.
+/// </summary>
+/// <param name="os">Output: stream to write the JSON to</param>
+void ProcessManager_t::ReportResourceUsageJson(std::wostream& os)
+{
+    vecSessionProcessInfo_t vSorted;
+    GetProcessesSortedByCost(vSorted);
+
+    os << L"{" << std::endl << L"  \"targets\": [";
+    bool bFirst = true;
+    for (auto iter = vSorted.begin(); iter != vSorted.end(); ++iter)
+    {
+        const ptrSessionProcessInfo_t& pSPI = *iter;
+        const ProcessResourceUsage_t& usage = pSPI->process.resourceUsage;
+        os << (bFirst ? L"" : L",") << std::endl;
+        bFirst = false;
+        os
+            << L"    { "
+            << L"\"sessionId\": " << pSPI->session.dwSessionId << L", "
+            << L"\"pid\": " << pSPI->process.dwPID << L", "
+            << L"\"domain\": \"" << JsonEscape(pSPI->session.sDomain) << L"\", "
+            << L"\"user\": \"" << JsonEscape(pSPI->session.sUser) << L"\", "
+            << L"\"elevated\": " << (pSPI->process.bElevated ? L"true" : L"false") << L", "
+            << L"\"valid\": " << (usage.bValid ? L"true" : L"false") << L", "
+            << L"\"running\": " << (usage.bStillRunning ? L"true" : L"false") << L", ";
+        if (pSPI->process.bExited)
+            os << L"\"exitCode\": " << pSPI->process.dwExitCode << L", ";
+        else
+            os << L"\"exitCode\": null, ";
+        os
+            << L"\"wallTime100ns\": " << usage.ullWallTime << L", "
+            << L"\"kernelTime100ns\": " << usage.ullKernelTime << L", "
+            << L"\"userTime100ns\": " << usage.ullUserTime << L", "
+            << L"\"peakWorkingSet\": " << usage.ullPeakWorkingSet << L", "
+            << L"\"pageFaults\": " << usage.ullPageFaults << L", "
+            << L"\"readBytes\": " << usage.ullReadBytes << L", "
+            << L"\"writeBytes\": " << usage.ullWriteBytes << L", "
+            << L"\"otherBytes\": " << usage.ullOtherBytes << L", ";
+        if (pSPI->process.phaseTimes.IsRecorded(Phase_t::Create))
+            os << L"\"launchTimeUs\": " << pSPI->process.phaseTimes.Duration(Phase_t::Create) << L", ";
+        else
+            os << L"\"launchTimeUs\": null, ";
+        const ProcessResourceUsage_t& hostUsage = pSPI->process.consoleHostUsage;
+        if (hostUsage.bValid)
+            os << L"\"consoleHost\": { \"peakWorkingSet\": " << hostUsage.ullPeakWorkingSet << L", \"cpuTime100ns\": " << hostUsage.CpuTime() << L" }";
+        else
+            os << L"\"consoleHost\": null";
+        if (pSPI->process.priority.Any())
+            os << L", \"priority\": \"" << JsonEscape(pSPI->process.priority.Describe()) << L"\"";
+        else
+            os << L", \"priority\": null";
+        if (!pSPI->process.sPlacement.empty())
+            os << L", \"placement\": \"" << JsonEscape(pSPI->process.sPlacement) << L"\"";
+        else
+            os << L", \"placement\": null";
+        if (pSPI->process.pMatches)
+        {
+            // Match counts by pattern
+            const PatternSet_t& patterns = pSPI->process.pMatches->Patterns();
+            const std::vector<uint64_t> vCounts = pSPI->process.pMatches->Counts();
+            os << L", \"matches\": {";
+            for (size_t ixPattern = 0; ixPattern < vCounts.size(); ++ixPattern)
+                os << (0 == ixPattern ? L" " : L", ") << L"\"" << JsonEscape(patterns.Label(ixPattern)) << L"\": " << vCounts[ixPattern];
+            os << L" }, \"terminatedOnMatch\": " << (pSPI->process.pMatches->Terminated() ? L"true" : L"false");
+        }
+        os << L" }";
+    }
+    os << std::endl << L"  ]," << std::endl << L"  \"aggregate\": {";
+
+    bFirst = true;
+    for (const ResourceUsageMetric_t& metric : ResourceUsageMetrics)
+    {
+        std::vector<ULONGLONG> values;
+        ULONGLONG ullTotal = 0;
+        for (auto iter = vSorted.begin(); iter != vSorted.end(); ++iter)
+        {
+            ULONGLONG ullValue = metric.pfnValue((*iter)->process.resourceUsage);
+            values.push_back(ullValue);
+            ullTotal += ullValue;
+        }
+        os << (bFirst ? L"" : L",") << std::endl;
+        bFirst = false;
+        os
+            << L"    \"" << metric.szJsonName << L"\": { "
+            << L"\"p50\": " << Percentile(values, 50.0) << L", "
+            << L"\"p90\": " << Percentile(values, 90.0) << L", "
+            << L"\"p99\": " << Percentile(values, 99.0) << L", "
+            << L"\"max\": " << Percentile(values, 100.0) << L", "
+            << L"\"total\": " << ullTotal << L" }";
+    }
+    const size_t nConsoleHosts = size_t(std::count_if(vSorted.begin(), vSorted.end(),
+        [](const ptrSessionProcessInfo_t& pSPI) { return pSPI->process.consoleHostUsage.bValid; }));
+    os << std::endl << L"  }," << std::endl << L"  \"count\": " << vSorted.size() << L"," << std::endl << L"  \"consoleHosts\": " << nConsoleHosts << std::endl << L"}" << std::endl;
+}
+
+/// <summary>
+/// Get an integrity manifest entry for each output file that was hashed as it was written.
+/// </summary>
+/// <param name="vEntries">Output: the entries are appended to this vector</param>
+void ProcessManager_t::GetIntegrityEntries(std::vector<IntegrityEntry_t>& vEntries) const
+{
+    for (auto iter = ConstIter(); !IterAtEnd(iter); ++iter)
+    {
+        const ptrSessionProcessInfo_t& pSPI = *iter;
+        const ProcessInfo_t& process = pSPI->process;
+        auto addEntry = [&](const std::wstring& sFile, const wchar_t* szContent, const RedirHashSink_t* pHash) {
+            if (nullptr == pHash || sFile.empty())
+                return;
+            IntegrityEntry_t entry;
+            entry.sFile = sFile;
+            entry.sContent = szContent;
+            entry.bHasProcess = true;
+            entry.dwSessionId = pSPI->session.dwSessionId;
+            entry.dwPID = process.dwPID;
+            entry.bExited = process.bExited;
+            entry.dwExitCode = process.dwExitCode;
+            entry.hashes = pHash->Hashes();
+            vEntries.push_back(entry);
+        };
+        // (Without a separate stderr file, stderr was merged into stdout)
+        addEntry(process.sStdoutRedirFile, (nullptr != process.pStderrHash) ? L"stdout" : L"stdout+stderr", process.pStdoutHash);
+        addEntry(process.sStderrRedirFile, L"stderr", process.pStderrHash);
+    }
+}
+
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Write the run's phase timings as CSV: one row for the run-wide phases, then one row per target process.
+/// For each phase, the start offset from the beginning of the run and the duration are in microseconds;
+/// both are empty if the phase wasn't recorded.
+/// </summary>
+/// <param name="os">Output: stream to write the CSV to</param>
+void ProcessManager_t::ReportPhaseTimingsCsv(std::wostream& os) const
+{
+    const size_t nPhases = size_t(Phase_t::NumPhases);
+
+    // Header row
+    os << L"sessionId,pid,domain,user";
+    for (size_t ixPhase = 0; ixPhase < nPhases; ++ixPhase)
+    {
+        const wchar_t* szPhase = PhaseName(Phase_t(ixPhase));
+        os << L"," << szPhase << L"Start_us," << szPhase << L"Duration_us";
+    }
+    os << std::endl;
+
+    // Writes the start offset and duration of each phase
+    auto writePhases = [&](const PhaseTimings_t& timings) {
+        for (size_t ixPhase = 0; ixPhase < nPhases; ++ixPhase)
+        {
+            const Phase_t phase = Phase_t(ixPhase);
+            if (timings.IsRecorded(phase))
+                os << L"," << (timings.ullStart[ixPhase] - m_ullRunStart) << L"," << timings.Duration(phase);
+            else
+                os << L",,";
+        }
+        os << std::endl;
+    };
+
+    // Run-wide phases
+    os << L",,,";
+    writePhases(m_runPhaseTimes);
+
+    // Per-process phases, for sessions in which a process was launched (or at least attempted)
+    for (auto iter = ConstIter(); !IterAtEnd(iter); iter++)
+    {
+        const ptrSessionProcessInfo_t& pSPI = *iter;
+        if (!pSPI->process.phaseTimes.IsRecorded(Phase_t::Token))
+            continue;
+        // Domain and user names can't contain commas or quotes, so no CSV quoting is needed.
+        os << pSPI->session.dwSessionId << L"," << pSPI->process.dwPID << L"," << pSPI->session.sDomain << L"," << pSPI->session.sUser;
+        writePhases(pSPI->process.phaseTimes);
+    }
+}
@@ -7,6 +7,16 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <iostream>
+#include "ResourceUsage.h"
+#include "MonotonicClock.h"
+#include "PhaseTimings.h"
+#include "ProcessPriority.h"
+#include "TerminationSchedule.h"
+#include "ExitQueue.h"
+#include "RedirPump.h"
+#include "RedirMatch.h"
+#include "RedirHash.h"
 
 
 /// <summary>
@@ -21,6 +31,10 @@ struct SessionInfo_t
     // From WTSINFOEX_LEVEL1_W SessionFlags
     LONG wtsFlags = 0;
     LARGE_INTEGER logonTime = { 0 };
+    // When the session last received input, and the session's current time (for its idle time and logon age)
+    LARGE_INTEGER lastInputTime = { 0 }, currentTime = { 0 };
+    // Client computer's name; queried only when -filter needs it
+    std::wstring sClientName;
 
 public:
     // Explicitly declare ctor/dtor
@@ -42,6 +56,8 @@ struct ProcessInfo_t
 
     // Handle to the process
     HANDLE hProcess = NULL;
+    // Registered thread-pool wait that reports the process' exit to its ProcessManager_t; NULL if none.
+    HANDLE hExitWait = NULL;
     // process ID
     DWORD dwPID = 0;
     // set to true after the process has exited
@@ -50,6 +66,30 @@ struct ProcessInfo_t
     DWORD dwExitCode = 0;
     // Whether the process is running elevated
     bool bElevated = false;
+    // Resources consumed by the process; captured when the process exits.
+    ProcessResourceUsage_t resourceUsage;
+    // The console host (conhost.exe) started for the process' console, when looked for (see FindConsoleHosts), and
+    // the resources it consumed: what -noConsole saves. NULL if there's none, or it wasn't found.
+    HANDLE hConsoleHost = NULL;
+    ProcessResourceUsage_t consoleHostUsage;
+    // When to stop monitoring the process (and possibly terminate it), measured from when it was resumed;
+    // infinite by default.
+    Deadline_t deadline;
+    // set to true after the deadline has passed and monitoring of the process has stopped
+    bool bTimedOut = false;
+    // Action most recently taken because of the deadline
+    TerminationStage_t terminationStage = TerminationStage_t::None;
+    // With -grace, when the process was asked to exit: 0 if Ctrl+C was delivered; Win32 error code otherwise
+    DWORD dwSoftCloseResult = 0;
+    // Priorities applied to the process before it was resumed (-priority, -ioPriority, -memPriority, -eco,
+    // -background); only those that were successfully set.
+    ProcessPriority_t priority;
+    // With -spread: the processor group or NUMA node the process was placed in, e.g., "node 1"; empty otherwise
+    std::wstring sPlacement;
+    // Job object containing the process and its descendants, so they can be terminated together; NULL if none.
+    HANDLE hJob = NULL;
+    // Timings of the phases of launching and monitoring this process
+    PhaseTimings_t phaseTimes;
 
     // read handles for each process' redirected stdout and stderr
     // Both are NULL if not redirecting the process' stdout/stderr
@@ -61,9 +101,31 @@ struct ProcessInfo_t
     // If hStdoutRedirTarget is non-NULL and hStderrRedirTarget is NULL, stdout/stderr are merged
     HANDLE hStdoutRedirTarget = NULL, hStderrRedirTarget = NULL;
 
+    // Matches of the run's patterns in the redirected output, shared by both sinks; null if there are no
+    // patterns. (Declared before the sinks, which refer to it.)
+    std::unique_ptr<MatchResults_t> pMatches;
+
+    // What the monitor threads write redirected stdout/stderr to: the redirect targets, possibly through
+    // processing stages such as compression. Set up along with the redirect targets.
+    std::unique_ptr<RedirSink_t> pStdoutSink, pStderrSink;
+    // When hashing output files for an integrity manifest: the files' names (without the directory), and the
+    // sinks that hash them (parts of pStdoutSink and pStderrSink); otherwise empty and null.
+    std::wstring sStdoutRedirFile, sStderrRedirFile;
+    RedirHashSink_t* pStdoutHash = nullptr, * pStderrHash = nullptr;
+
     // Handles to the threads monitoring the pipes for redirected stdout/stderr
     HANDLE hThread_StdoutMonitor = NULL, hThread_StderrMonitor = NULL;
 
+    // With -pf or -stdin: the input to write to the process' stdin (one buffer, shared by all processes), the write
+    // end of its stdin pipe (closed by the thread writing to it once the input is written), and that thread
+    const uint8_t* pStdinData = nullptr;
+    size_t cbStdinData = 0;
+    HANDLE hPipeStdinWr = NULL;
+    HANDLE hThread_StdinFeeder = NULL;
+
+    // With -gang: the process' primary thread, still suspended, until the gang start resumes it
+    HANDLE hHeldThread = NULL;
+
     // ------------------------------------------------------------------------------------------
 
     /// <summary>
@@ -150,14 +212,27 @@ inline void ConsumeCrossThreadpSPI(ptrSessionProcessInfo_t& pSPI, LPVOID lpvThre
 typedef std::vector<ptrSessionProcessInfo_t> vecSessionProcessInfo_t;
 
 
+/// <summary>
+/// What a gang start achieved (see ProcessManager_t::GangStart). Times are in microseconds.
+/// </summary>
+struct GangStartStats_t
+{
+    size_t nResumed = 0;
+    size_t nWaves = 0;
+    // From the first process resumed to the last, and the largest such spread within one wave
+    ULONGLONG ullSkew = 0, ullWaveSkew = 0;
+    // Longest time a process was held, suspended, waiting for the rest to be created
+    ULONGLONG ullMaxHeld = 0;
+};
+
 /// <summary>
 /// Class to manage processes started in users' sessions
 /// </summary>
 class ProcessManager_t
 {
 public:
-    // Constructor - not much to do
-    ProcessManager_t() { }
+    // Constructor - note the start of the run (by default, now), for timing reports
+    explicit ProcessManager_t(ULONGLONG ullRunStart = MonotonicMicroseconds()) : m_ullRunStart(ullRunStart) { }
     // Destructor - release acquired resources
     ~ProcessManager_t() { Clear(); }
 
@@ -214,6 +289,72 @@ public:
 
     // ------------------------------------------------------------------------------------------
 
+    /// <summary>
+    /// Set what happens to a process when it reaches its deadline.
+    /// </summary>
+    /// <param name="bTerminate">Input: false to stop monitoring the process and leave it running; true to terminate it and its descendants</param>
+    /// <param name="ullGraceMilliseconds">Input: if terminating and non-zero, first ask the process to exit gracefully, and terminate it this many milliseconds later if it hasn't</param>
+    void SetTerminationPolicy(bool bTerminate, ULONGLONG ullGraceMilliseconds)
+    {
+        m_terminationSchedule.SetPolicy(bTerminate, ullGraceMilliseconds);
+    }
+
+    /// <summary>
+    /// Put a newly-created, still-suspended process into its own job object so that it and any processes it
+    /// starts can be terminated together.
+    /// </summary>
+    /// <param name="process">Input/output: the process; its hJob member is set on success</param>
+    /// <returns>true if successful; false otherwise (the process itself can still be terminated)</returns>
+    static bool TrackProcessTree(ProcessInfo_t& process);
+
+    /// <summary>
+    /// Hold a newly-created, still-suspended process, with its redirection set up, until GangStart resumes it along
+    /// with the rest, instead of resuming it now.
+    /// </summary>
+    /// <param name="pSPI">Input: the process, with its Create phase recorded</param>
+    /// <param name="hThread">Input: its suspended primary thread; now owned by the process (hHeldThread)</param>
+    void HoldForGangStart(const ptrSessionProcessInfo_t& pSPI, HANDLE hThread);
+
+    /// <summary>
+    /// Resume the processes being held for the gang start, in order, as close together as possible: all at once,
+    /// or in waves of a given size with a pause between them. Each process' Held phase is recorded as it's resumed.
+    /// </summary>
+    /// <param name="nPerWave">Input: number of processes to resume in each wave; 0 for all of them in one wave</param>
+    /// <param name="dwWaveIntervalMilliseconds">Input: time from the start of one wave to the start of the next</param>
+    /// <param name="vResumed">Output: the processes resumed, in the order they were resumed</param>
+    /// <returns>The start skew achieved</returns>
+    GangStartStats_t GangStart(size_t nPerWave, DWORD dwWaveIntervalMilliseconds, vecSessionProcessInfo_t& vResumed);
+
+    /// <summary>
+    /// Set a process' deadline, measured from when it was resumed, and schedule the action to take when it's reached.
+    /// </summary>
+    /// <param name="pSPI">Input: the process, resumed, with its Create (and Held) phases already recorded</param>
+    /// <param name="ullTimeoutMilliseconds">Input: milliseconds after the process' start; ~0 for no deadline</param>
+    void StartDeadline(const ptrSessionProcessInfo_t& pSPI, ULONGLONG ullTimeoutMilliseconds);
+
+    /// <summary>
+    /// Returns the time of the next scheduled deadline action (infinite if none).
+    /// </summary>
+    Deadline_t NextDeadline() const;
+
+    /// <summary>
+    /// Carry out the deadline actions that are due: stop monitoring, request a graceful exit, or terminate
+    /// the process tree, according to the termination policy. Each process' terminationStage is updated.
+    /// </summary>
+    /// <param name="vAffectedProcesses">Output: processes on which an action was taken</param>
+    /// <returns>true if any actions were taken; false otherwise</returns>
+    bool HandleDueDeadlines(vecSessionProcessInfo_t& vAffectedProcesses);
+
+    // ------------------------------------------------------------------------------------------
+
+    /// <summary>
+    /// Start watching a launched process for exit, so that WaitForAProcessToExit reports it when it exits.
+    /// Processes that aren't watched (or can't be) are polled.
+    /// </summary>
+    /// <param name="pSPI">Input: the process</param>
+    /// <returns>true if the process' exit will be reported through the exit queue; false if it will have to be polled</returns>
+    bool WatchForExit(const ptrSessionProcessInfo_t& pSPI);
+
     /// <summary>
     /// Waits up to dwTimeout milliseconds for one or more still-running processes in the collection to exit.
     /// Changes the bExited status of those processes and returns information about them in the vExitedProcesses
@@ -235,6 +376,22 @@ public:
     /// <param name="bTerminateProcesses">Input: whether to terminate still-running processes</param>
     void StopAllRedirectionMonitors(bool bTerminateProcesses);
 
+    /// <summary>
+    /// Stop the threads monitoring pipes for one process' redirected output, and optionally terminate the process.
+    /// </summary>
+    /// <param name="process">Input: the process</param>
+    /// <param name="bTerminateProcess">Input: whether to terminate the process if it's still running</param>
+    static void StopRedirectionMonitors(ProcessInfo_t& process, bool bTerminateProcess);
+
+    // ------------------------------------------------------------------------------------------
+
+    /// <summary>
+    /// Terminate a process and, if it has a job object, all of its descendants.
+    /// </summary>
+    /// <param name="process">Input: the process</param>
+    /// <param name="dwExitCode">Input: exit code for the terminated processes</param>
+    static void TerminateProcessTree(ProcessInfo_t& process, DWORD dwExitCode = ERROR_TIMEOUT);
+
     // ------------------------------------------------------------------------------------------
 
     /// <summary>
@@ -244,9 +401,97 @@ public:
 
     // ------------------------------------------------------------------------------------------
 
+    /// <summary>
+    /// Look for the console hosts (conhost.exe) of running processes that don't have one yet, and hold onto them, so
+    /// that the resources they consume are reported with the processes'. A console host is started by its process
+    /// shortly after the process is resumed, so this has to be repeated until they've all appeared.
+    /// </summary>
+    /// <returns>Number of running processes still without a console host</returns>
+    size_t FindConsoleHosts();
+
+    // ------------------------------------------------------------------------------------------
+
+    /// <summary>
+    /// Write a table of the resources consumed by each launched process, sorted by CPU time (highest first),
+    /// followed by aggregate percentiles across all launched processes, and of the time it took to launch them and
+    /// the resources their console hosts consumed.
+    /// Resource usage is captured at this time for any processes that are still running.
+    /// </summary>
+    /// <param name="os">Output: stream to write the report to</param>
+    void ReportResourceUsage(std::wostream& os);
+
+    /// <summary>
+    /// Write the same information as ReportResourceUsage, as a JSON document.
+    /// </summary>
+    /// <param name="os">Output: stream to write the JSON to</param>
+    void ReportResourceUsageJson(std::wostream& os);
+
+    /// <summary>
+    /// Get an integrity manifest entry for each output file that was hashed as it was written.
+    /// Call after WaitForRedirectionMonitors.
+    /// </summary>
+    /// <param name="vEntries">Output: the entries are appended to this vector</param>
+    void GetIntegrityEntries(std::vector<IntegrityEntry_t>& vEntries) const;
+
+    // ------------------------------------------------------------------------------------------
+
+    /// <summary>
+    /// Run-wide phase timings (e.g., session enumeration)
+    /// </summary>
+    PhaseTimings_t& RunPhaseTimes() { return m_runPhaseTimes; }
+
+    /// <summary>
+    /// Write the run's phase timings as CSV: one row for the run-wide phases, then one row per target process.
+    /// For each phase, the start offset from the beginning of the run and the duration are in microseconds;
+    /// both are empty if the phase wasn't recorded.
+    /// </summary>
+    /// <param name="os">Output: stream to write the CSV to</param>
+    void ReportPhaseTimingsCsv(std::wostream& os) const;
+
+    // ------------------------------------------------------------------------------------------
+
+private:
+    // Context for the thread-pool wait that reports a process' exit
+    struct ExitWatch_t
+    {
+        ExitQueue_t<ptrSessionProcessInfo_t>* pExitQueue;
+        // Weak reference, so that a process that's no longer referenced anywhere else can be cleaned up
+        // (which unregisters the wait) even if it never exits.
+        std::weak_ptr<SessionProcessInfo_t> wpSPI;
+    };
+
+    /// <summary>
+    /// Thread-pool callback invoked when a watched process exits: queue it for WaitForAProcessToExit
+    /// </summary>
+    static void CALLBACK OnProcessExit(PVOID lpParameter, BOOLEAN bTimedOut);
+
+    /// <summary>
+    /// Capture resource usage for launched processes that don't have it yet, and return those processes
+    /// sorted by CPU time, highest first.
+    /// </summary>
+    /// <param name="vSorted">Output: launched processes, sorted by cost</param>
+    void GetProcessesSortedByCost(vecSessionProcessInfo_t& vSorted);
+
 private:
     // Vector of pointers to allocated session/process info structures.
     vecSessionProcessInfo_t m_processes;
+    // When this object was created, from MonotonicMicroseconds()
+    const ULONGLONG m_ullRunStart;
+    // Run-wide phase timings
+    PhaseTimings_t m_runPhaseTimes;
+
+    // Processes held for the gang start, in the order they were created
+    vecSessionProcessInfo_t m_held;
+
+    // Pending deadline actions, and the termination policy
+    TerminationSchedule_t<ptrSessionProcessInfo_t> m_terminationSchedule;
+
+    // Processes whose exits have been reported by the thread pool and not yet picked up
+    ExitQueue_t<ptrSessionProcessInfo_t> m_exitQueue;
+    // Contexts for the registered exit waits; released only after the waits are unregistered (see Clear)
+    std::vector<std::unique_ptr<ExitWatch_t>> m_exitWatches;
+    // How often to poll processes whose exits couldn't be registered with the thread pool
+    static const DWORD ExitPollMilliseconds = 100;
 
 private:
     // Copy constructor and assignment operator not implemented
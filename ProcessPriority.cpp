@@ -0,0 +1,179 @@
+// Scheduling and resource priorities for target processes: see ProcessPriority.h.
+
+#include <cwchar>
+#include "ProcessPriority.h"
+#include "SysErrorMessage.h"
+
+/// <summary>
+/// Names of the settings, as used on the command line and in reports
+/// </summary>
+struct PriorityName_t
+{
+    const wchar_t* szOption;
+    const wchar_t* szReport;
+    DWORD dwValue;
+};
+
+static const PriorityName_t PriorityClasses[] = {
+    { L"idle",        L"idle",         IDLE_PRIORITY_CLASS },
+    { L"belowNormal", L"below normal", BELOW_NORMAL_PRIORITY_CLASS },
+    { L"normal",      L"normal",       NORMAL_PRIORITY_CLASS },
+    { L"aboveNormal", L"above normal", ABOVE_NORMAL_PRIORITY_CLASS },
+};
+
+static const PriorityName_t IoPriorities[] = {
+    { L"veryLow", L"very low", 0 },
+    { L"low",     L"low",      1 },
+    { L"normal",  L"normal",   2 },
+};
+
+static const PriorityName_t MemoryPriorities[] = {
+    { L"veryLow",     L"very low",     MEMORY_PRIORITY_VERY_LOW },
+    { L"low",         L"low",          MEMORY_PRIORITY_LOW },
+    { L"medium",      L"medium",       MEMORY_PRIORITY_MEDIUM },
+    { L"belowNormal", L"below normal", MEMORY_PRIORITY_BELOW_NORMAL },
+    { L"normal",      L"normal",       MEMORY_PRIORITY_NORMAL },
+};
+
+template <size_t N>
+static bool LookUpOption(const PriorityName_t (&names)[N], const wchar_t* szValue, DWORD& dwValue)
+{
+    for (const PriorityName_t& name : names)
+    {
+        if (0 == wcscmp(name.szOption, szValue))
+        {
+            dwValue = name.dwValue;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <size_t N>
+static const wchar_t* ReportName(const PriorityName_t (&names)[N], DWORD dwValue)
+{
+    for (const PriorityName_t& name : names)
+    {
+        if (name.dwValue == dwValue)
+            return name.szReport;
+    }
+    return L"?";
+}
+
+std::wstring ProcessPriority_t::Describe() const
+{
+    std::wstring sDescription;
+    auto add = [&sDescription](const std::wstring& sItem) {
+        if (!sDescription.empty())
+            sDescription += L", ";
+        sDescription += sItem;
+    };
+    if (0 != dwPriorityClass)
+        add(ReportName(PriorityClasses, dwPriorityClass));
+    if (-1 != nIoPriority)
+        add(std::wstring(L"I/O ") + ReportName(IoPriorities, DWORD(nIoPriority)));
+    if (0 != ulMemoryPriority)
+        add(std::wstring(L"memory ") + ReportName(MemoryPriorities, ulMemoryPriority));
+    if (bEcoQoS)
+        add(L"EcoQoS");
+    return sDescription;
+}
+
+bool ProcessPriority_t::ParsePriorityClass(const wchar_t* szValue)
+{
+    return LookUpOption(PriorityClasses, szValue, dwPriorityClass);
+}
+
+bool ProcessPriority_t::ParseIoPriority(const wchar_t* szValue)
+{
+    DWORD dwValue = 0;
+    if (!LookUpOption(IoPriorities, szValue, dwValue))
+        return false;
+    nIoPriority = int(dwValue);
+    return true;
+}
+
+bool ProcessPriority_t::ParseMemoryPriority(const wchar_t* szValue)
+{
+    DWORD dwValue = 0;
+    if (!LookUpOption(MemoryPriorities, szValue, dwValue))
+        return false;
+    ulMemoryPriority = dwValue;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Set a process' I/O priority. There's no documented API for setting another process' I/O priority, so this uses
+/// NtSetInformationProcess (ProcessIoPriority), as Task Manager and Process Explorer do.
+/// </summary>
+/// <returns>0 if successful; Win32 error code otherwise</returns>
+static DWORD SetIoPriority(HANDLE hProcess, ULONG ulIoPriority)
+{
+    typedef LONG(NTAPI* pfnNtSetInformationProcess_t)(HANDLE, ULONG, PVOID, ULONG);
+    typedef ULONG(NTAPI* pfnRtlNtStatusToDosError_t)(LONG);
+    const ULONG ProcessIoPriority = 33;
+    static const HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    static const pfnNtSetInformationProcess_t pfnNtSetInformationProcess = (NULL == hNtdll) ? nullptr :
+        (pfnNtSetInformationProcess_t)GetProcAddress(hNtdll, "NtSetInformationProcess");
+    static const pfnRtlNtStatusToDosError_t pfnRtlNtStatusToDosError = (NULL == hNtdll) ? nullptr :
+        (pfnRtlNtStatusToDosError_t)GetProcAddress(hNtdll, "RtlNtStatusToDosError");
+    if (nullptr == pfnNtSetInformationProcess || nullptr == pfnRtlNtStatusToDosError)
+        return ERROR_PROC_NOT_FOUND;
+    const LONG status = pfnNtSetInformationProcess(hProcess, ProcessIoPriority, &ulIoPriority, sizeof(ulIoPriority));
+    return (status >= 0) ? 0 : pfnRtlNtStatusToDosError(status);
+}
+
+bool ApplyProcessPriority(HANDLE hProcess, const ProcessPriority_t& priority, ProcessPriority_t& applied, std::wstring& sErrorInfo)
+{
+    applied = ProcessPriority_t();
+    sErrorInfo.clear();
+    auto fail = [&sErrorInfo](const wchar_t* szWhat, DWORD dwError) {
+        if (!sErrorInfo.empty())
+            sErrorInfo += L"; ";
+        sErrorInfo += std::wstring(szWhat) + L": " + SysErrorMessageWithCode(dwError);
+    };
+
+    if (0 != priority.dwPriorityClass)
+    {
+        if (SetPriorityClass(hProcess, priority.dwPriorityClass))
+            applied.dwPriorityClass = priority.dwPriorityClass;
+        else
+            fail(L"priority class", GetLastError());
+    }
+
+    if (-1 != priority.nIoPriority)
+    {
+        const DWORD dwError = SetIoPriority(hProcess, ULONG(priority.nIoPriority));
+        if (0 == dwError)
+            applied.nIoPriority = priority.nIoPriority;
+        else
+            fail(L"I/O priority", dwError);
+    }
+
+    // Memory priority and power throttling require Windows 8 and Windows 10 1709 or newer
+    if (0 != priority.ulMemoryPriority)
+    {
+        MEMORY_PRIORITY_INFORMATION memoryPriority = { 0 };
+        memoryPriority.MemoryPriority = priority.ulMemoryPriority;
+        if (SetProcessInformation(hProcess, ProcessMemoryPriority, &memoryPriority, sizeof(memoryPriority)))
+            applied.ulMemoryPriority = priority.ulMemoryPriority;
+        else
+            fail(L"memory priority", GetLastError());
+    }
+
+    if (priority.bEcoQoS)
+    {
+        PROCESS_POWER_THROTTLING_STATE throttling = { 0 };
+        throttling.Version = PROCESS_POWER_THROTTLING_CURRENT_VERSION;
+        throttling.ControlMask = PROCESS_POWER_THROTTLING_EXECUTION_SPEED;
+        throttling.StateMask = PROCESS_POWER_THROTTLING_EXECUTION_SPEED;
+        if (SetProcessInformation(hProcess, ProcessPowerThrottling, &throttling, sizeof(throttling)))
+            applied.bEcoQoS = true;
+        else
+            fail(L"EcoQoS", GetLastError());
+    }
+
+    return sErrorInfo.empty();
+}
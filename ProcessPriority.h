@@ -0,0 +1,66 @@
+// Scheduling and resource priorities for target processes (-priority, -ioPriority, -memPriority, -eco, -background),
+// applied while a process is still suspended, so that it never runs at normal priority.
+//
+// Background processing mode (PROCESS_MODE_BACKGROUND_BEGIN) can be entered only by a process itself; for a target,
+// -background sets what it amounts to: very low I/O priority and very low memory priority. The priority class and
+// memory priority are inherited by the processes a target starts; the I/O priority and EcoQoS are not, on all
+// versions of Windows.
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+
+/// <summary>
+/// Priorities to apply to a process. Members left at their defaults aren't changed.
+/// </summary>
+struct ProcessPriority_t
+{
+    // A *_PRIORITY_CLASS value; 0 to leave it
+    DWORD dwPriorityClass = 0;
+    // I/O priority hint: 0 (very low), 1 (low), or 2 (normal); -1 to leave it
+    int nIoPriority = -1;
+    // MEMORY_PRIORITY_VERY_LOW through MEMORY_PRIORITY_NORMAL; 0 to leave it
+    ULONG ulMemoryPriority = 0;
+    // Efficiency mode (EcoQoS): throttle execution speed for power efficiency
+    bool bEcoQoS = false;
+
+    /// <summary>
+    /// Returns true if any of the priorities is to be changed
+    /// </summary>
+    bool Any() const { return 0 != dwPriorityClass || -1 != nIoPriority || 0 != ulMemoryPriority || bEcoQoS; }
+
+    /// <summary>
+    /// Describes the priorities to be changed, e.g., "idle, I/O very low, memory very low, EcoQoS"
+    /// </summary>
+    std::wstring Describe() const;
+
+    /// <summary>
+    /// Parse the argument of -priority: idle, belowNormal, normal, or aboveNormal
+    /// </summary>
+    /// <returns>true if valid; false otherwise</returns>
+    bool ParsePriorityClass(const wchar_t* szValue);
+
+    /// <summary>
+    /// Parse the argument of -ioPriority: veryLow, low, or normal
+    /// </summary>
+    /// <returns>true if valid; false otherwise</returns>
+    bool ParseIoPriority(const wchar_t* szValue);
+
+    /// <summary>
+    /// Parse the argument of -memPriority: veryLow, low, medium, belowNormal, or normal
+    /// </summary>
+    /// <returns>true if valid; false otherwise</returns>
+    bool ParseMemoryPriority(const wchar_t* szValue);
+};
+
+/// <summary>
+/// Apply priorities to a process, before it's resumed. Each one is attempted even if another fails.
+/// The handle must have PROCESS_SET_INFORMATION access.
+/// </summary>
+/// <param name="hProcess">Input: handle to the process</param>
+/// <param name="priority">Input: the priorities to apply</param>
+/// <param name="applied">Output: the priorities that were applied</param>
+/// <param name="sErrorInfo">Output: error information for each one that couldn't be applied</param>
+/// <returns>true if all were applied; false otherwise</returns>
+bool ApplyProcessPriority(HANDLE hProcess, const ProcessPriority_t& priority, ProcessPriority_t& applied, std::wstring& sErrorInfo);
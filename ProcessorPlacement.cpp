@@ -0,0 +1,105 @@
+// Placement of target processes across processor groups or NUMA nodes: see ProcessorPlacement.h.
+
+#include <sstream>
+#include "ProcessorPlacement.h"
+
+/// <summary>
+/// Number of processors in an affinity mask
+/// </summary>
+static DWORD CountProcessors(KAFFINITY mask)
+{
+    DWORD nProcessors = 0;
+    for (; 0 != mask; mask &= mask - 1)
+        ++nProcessors;
+    return nProcessors;
+}
+
+bool ProcessorPlacement_t::Init(PlacementDomain_t domain, PlacementPolicy_t policy, DWORD& dwError)
+{
+    dwError = 0;
+    m_vPlaces.clear();
+    m_domain = domain;
+    m_policy = policy;
+    m_ixNext = 0;
+
+    if (PlacementDomain_t::Group == domain)
+    {
+        const WORD nGroups = GetActiveProcessorGroupCount();
+        for (WORD wGroup = 0; wGroup < nGroups; ++wGroup)
+        {
+            // A group's active processors are numbered from 0
+            const DWORD nProcessors = GetActiveProcessorCount(wGroup);
+            if (0 == nProcessors)
+                continue;
+            Place_t place = { 0 };
+            place.usNumber = wGroup;
+            place.affinity.Group = wGroup;
+            place.affinity.Mask = (nProcessors >= sizeof(KAFFINITY) * 8) ? ~KAFFINITY(0) : ((KAFFINITY(1) << nProcessors) - 1);
+            place.nProcessors = nProcessors;
+            m_vPlaces.push_back(place);
+        }
+    }
+    else if (PlacementDomain_t::Node == domain)
+    {
+        ULONG ulHighestNode = 0;
+        if (!GetNumaHighestNodeNumber(&ulHighestNode))
+        {
+            dwError = GetLastError();
+            return false;
+        }
+        for (ULONG ulNode = 0; ulNode <= ulHighestNode; ++ulNode)
+        {
+            // (A node with more than 64 processors spans groups; this gets its processors in one of them.)
+            Place_t place = { 0 };
+            place.usNumber = USHORT(ulNode);
+            if (!GetNumaNodeProcessorMaskEx(place.usNumber, &place.affinity) || 0 == place.affinity.Mask)
+                continue;
+            place.nProcessors = CountProcessors(place.affinity.Mask);
+            m_vPlaces.push_back(place);
+        }
+    }
+
+    if (m_vPlaces.empty())
+    {
+        dwError = ERROR_NOT_FOUND;
+        return false;
+    }
+    return true;
+}
+
+size_t ProcessorPlacement_t::Next()
+{
+    size_t ixPlace = 0;
+    if (PlacementPolicy_t::RoundRobin == m_policy)
+    {
+        ixPlace = m_ixNext;
+        m_ixNext = (m_ixNext + 1) % m_vPlaces.size();
+    }
+    else
+    {
+        // Fewest targets per processor, comparing nPlaced / nProcessors without dividing; ties go to the first
+        for (size_t ix = 1; ix < m_vPlaces.size(); ++ix)
+        {
+            const Place_t& candidate = m_vPlaces[ix], & best = m_vPlaces[ixPlace];
+            if (ULONGLONG(candidate.nPlaced) * best.nProcessors < ULONGLONG(best.nPlaced) * candidate.nProcessors)
+                ixPlace = ix;
+        }
+    }
+    ++m_vPlaces[ixPlace].nPlaced;
+    return ixPlace;
+}
+
+std::wstring ProcessorPlacement_t::Name(size_t ix) const
+{
+    return (ByNode() ? L"node " : L"group ") + std::to_wstring(m_vPlaces[ix].usNumber);
+}
+
+std::wstring ProcessorPlacement_t::Describe() const
+{
+    std::wstringstream strDescription;
+    strDescription << m_vPlaces.size() << (ByNode() ? L" NUMA node(s) (" : L" processor group(s) (");
+    for (size_t ix = 0; ix < m_vPlaces.size(); ++ix)
+        strDescription << (0 == ix ? L"" : L", ") << m_vPlaces[ix].nProcessors;
+    strDescription << L" processors), " << (PlacementPolicy_t::RoundRobin == m_policy ? L"round robin" : L"least loaded");
+    return strDescription.str();
+}
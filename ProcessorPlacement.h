@@ -0,0 +1,104 @@
+// Placement of target processes across processor groups or NUMA nodes (-spread), so that a fan-out of
+// compute-bound targets doesn't pile onto the one processor group the scheduler starts them in.
+//
+// Each target is started with the processors of its group or node as its primary thread's affinity (and, for a
+// node, as its preferred node for memory), through the process/thread attribute list; the process can still change
+// its own affinity afterwards.
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// What to spread target processes across
+/// </summary>
+enum class PlacementDomain_t
+{
+    None,
+    Group,
+    Node
+};
+
+/// <summary>
+/// How to pick the group or node for each target process
+/// </summary>
+enum class PlacementPolicy_t
+{
+    // Each in turn
+    RoundRobin,
+    // The one with the fewest targets per processor, so that larger ones get proportionately more
+    LeastLoaded
+};
+
+/// <summary>
+/// The processor groups or NUMA nodes of this computer, and how many target processes have been placed in each
+/// </summary>
+class ProcessorPlacement_t
+{
+public:
+    ProcessorPlacement_t() = default;
+
+    /// <summary>
+    /// Look up the processor groups or NUMA nodes. NUMA nodes without processors are left out.
+    /// </summary>
+    /// <param name="domain">Input: groups or nodes</param>
+    /// <param name="policy">Input: how to pick among them</param>
+    /// <param name="dwError">Output: Win32 error code on failure</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Init(PlacementDomain_t domain, PlacementPolicy_t policy, DWORD& dwError);
+
+    /// <summary>
+    /// Pick the group or node for the next target process, and count it as placed there
+    /// </summary>
+    /// <returns>Index of the group or node</returns>
+    size_t Next();
+
+    /// <summary>
+    /// The processors of a group or node
+    /// </summary>
+    const GROUP_AFFINITY& Affinity(size_t ix) const { return m_vPlaces[ix].affinity; }
+
+    /// <summary>
+    /// Returns true if spreading across NUMA nodes (which then are also the targets' preferred nodes)
+    /// </summary>
+    bool ByNode() const { return PlacementDomain_t::Node == m_domain; }
+
+    /// <summary>
+    /// Number of a group or node
+    /// </summary>
+    USHORT Number(size_t ix) const { return m_vPlaces[ix].usNumber; }
+
+    /// <summary>
+    /// Name of a group or node, for reports: "group n" or "node n"
+    /// </summary>
+    std::wstring Name(size_t ix) const;
+
+    /// <summary>
+    /// Describes the placement, e.g., "4 NUMA nodes (16, 16, 16, 16 processors), least loaded"
+    /// </summary>
+    std::wstring Describe() const;
+
+private:
+    struct Place_t
+    {
+        // Group or node number
+        USHORT usNumber;
+        // Its processors
+        GROUP_AFFINITY affinity;
+        DWORD nProcessors;
+        // Target processes placed in it
+        size_t nPlaced;
+    };
+    std::vector<Place_t> m_vPlaces;
+    PlacementDomain_t m_domain = PlacementDomain_t::None;
+    PlacementPolicy_t m_policy = PlacementPolicy_t::RoundRobin;
+    // Index of the next one in turn, for RoundRobin
+    size_t m_ixNext = 0;
+
+private:
+    // Not implemented
+    ProcessorPlacement_t(const ProcessorPlacement_t&) = delete;
+    ProcessorPlacement_t& operator = (const ProcessorPlacement_t&) = delete;
+};
@@ -0,0 +1,388 @@
+// Compressed capture files: redirected output compressed on its way to the file, in blocks that can each be
+// decompressed on their own. See RedirCompress.h for the file layout.
+
+#include <cstring>
+#include "RedirCompress.h"
+
+static const uint8_t HeaderMagic[4] = { 'R', 'A', 'U', 'Z' };
+static const uint8_t TrailerMagic[4] = { 'R', 'A', 'U', 'I' };
+static const uint8_t FormatVersion = 1;
+static const size_t HeaderSize = 16;
+static const size_t BlockHeaderSize = 8;
+static const size_t IndexEntrySize = 16;
+static const size_t TrailerSize = 24;
+// Set in a block's stored size if the block is stored uncompressed
+static const uint32_t StoredRawFlag = 0x80000000;
+// Largest block the format can describe
+static const size_t MaxBlockSize = 0x40000000;
+
+static inline void Put32(uint8_t* p, uint32_t n)
+{
+    for (size_t ix = 0; ix < 4; ++ix)
+        p[ix] = uint8_t(n >> (8 * ix));
+}
+
+static inline void Put64(uint8_t* p, uint64_t n)
+{
+    for (size_t ix = 0; ix < 8; ++ix)
+        p[ix] = uint8_t(n >> (8 * ix));
+}
+
+static inline uint32_t Get32(const uint8_t* p)
+{
+    uint32_t n = 0;
+    for (size_t ix = 0; ix < 4; ++ix)
+        n |= uint32_t(p[ix]) << (8 * ix);
+    return n;
+}
+
+static inline uint64_t Get64(const uint8_t* p)
+{
+    uint64_t n = 0;
+    for (size_t ix = 0; ix < 8; ++ix)
+        n |= uint64_t(p[ix]) << (8 * ix);
+    return n;
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirCompressor_t::RedirCompressor_t(std::unique_ptr<RedirSink_t> pNext, int nLevel, size_t cbBlockSize)
+    : m_pNext(std::move(pNext)),
+    m_nLevel(nLevel),
+    m_cbBlockSize((0 == cbBlockSize) ? RedirCompressDefaultBlockSize : (cbBlockSize > MaxBlockSize ? MaxBlockSize : cbBlockSize))
+{
+}
+
+/// <summary>
+/// Passes data on to the next sink, counting it
+/// </summary>
+bool RedirCompressor_t::WriteNext(const uint8_t* pData, size_t cbData, uint32_t& dwError)
+{
+    size_t cbWritten = 0;
+    const bool bOk = m_pNext->Write(pData, cbData, cbWritten, dwError);
+    m_ullStored += cbWritten;
+    return bOk;
+}
+
+/// <summary>
+/// Compresses one block (storing it as-is if it doesn't compress) and passes it on
+/// </summary>
+bool RedirCompressor_t::CompressBlock(const uint8_t* pData, size_t cbData, uint32_t& dwError)
+{
+    if (m_compressed.empty())
+        m_compressed.resize(BlockHeaderSize + LzCompressBound(m_cbBlockSize));
+
+    // The index records where each block starts, in the original data and in the file
+    m_vIndex.push_back(m_ullBlocked);
+    m_vIndex.push_back(m_ullStored);
+    m_ullBlocked += cbData;
+
+    uint8_t* pHeader = m_compressed.data();
+    size_t cbCompressed = LzCompress(pData, cbData, pHeader + BlockHeaderSize, m_compressed.size() - BlockHeaderSize, m_nLevel);
+    Put32(pHeader, uint32_t(cbData));
+    if (0 == cbCompressed || cbCompressed >= cbData)
+    {
+        Put32(pHeader + 4, uint32_t(cbData) | StoredRawFlag);
+        return WriteNext(pHeader, BlockHeaderSize, dwError) && WriteNext(pData, cbData, dwError);
+    }
+    Put32(pHeader + 4, uint32_t(cbCompressed));
+    return WriteNext(pHeader, BlockHeaderSize + cbCompressed, dwError);
+}
+
+bool RedirCompressor_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    // Everything is consumed, even if passing it on fails; report the first failure.
+    cbWritten = cbData;
+    dwError = 0;
+    bool bOk = true;
+    uint32_t dwThisError = 0;
+    auto noteResult = [&](bool bResult) {
+        if (!bResult && bOk)
+        {
+            bOk = false;
+            dwError = dwThisError;
+        }
+    };
+
+    if (!m_bHeaderWritten)
+    {
+        uint8_t header[HeaderSize] = { 0 };
+        memcpy(header, HeaderMagic, sizeof(HeaderMagic));
+        header[4] = FormatVersion;
+        header[5] = uint8_t(m_nLevel);
+        Put32(header + 8, uint32_t(m_cbBlockSize));
+        m_bHeaderWritten = true;
+        noteResult(WriteNext(header, sizeof(header), dwThisError));
+    }
+
+    m_ullOriginal += cbData;
+    while (cbData > 0)
+    {
+        // Whole blocks are compressed directly from the input, without copying them first
+        if (m_pending.empty() && cbData >= m_cbBlockSize)
+        {
+            noteResult(CompressBlock(pData, m_cbBlockSize, dwThisError));
+            pData += m_cbBlockSize;
+            cbData -= m_cbBlockSize;
+            continue;
+        }
+        const size_t cbCopy = (cbData < m_cbBlockSize - m_pending.size()) ? cbData : m_cbBlockSize - m_pending.size();
+        m_pending.insert(m_pending.end(), pData, pData + cbCopy);
+        pData += cbCopy;
+        cbData -= cbCopy;
+        if (m_pending.size() == m_cbBlockSize)
+        {
+            noteResult(CompressBlock(m_pending.data(), m_pending.size(), dwThisError));
+            m_pending.clear();
+        }
+    }
+    return bOk;
+}
+
+bool RedirCompressor_t::Finish(uint32_t& dwError)
+{
+    bool bOk = true;
+    dwError = 0;
+    uint32_t dwThisError = 0;
+    auto noteResult = [&](bool bResult) {
+        if (!bResult && bOk)
+        {
+            bOk = false;
+            dwError = dwThisError;
+        }
+    };
+
+    // Even a capture with no output gets a header, so that it's recognizable
+    size_t cbUnused = 0;
+    noteResult(Write(nullptr, 0, cbUnused, dwThisError));
+    if (!m_pending.empty())
+    {
+        noteResult(CompressBlock(m_pending.data(), m_pending.size(), dwThisError));
+        m_pending.clear();
+    }
+
+    // End mark, index, and trailer, in one write
+    const uint64_t ullIndexOffset = m_ullStored + BlockHeaderSize;
+    std::vector<uint8_t> tail(BlockHeaderSize + m_vIndex.size() * sizeof(uint64_t) + TrailerSize, 0);
+    uint8_t* p = tail.data() + BlockHeaderSize;
+    for (uint64_t ullEntry : m_vIndex)
+    {
+        Put64(p, ullEntry);
+        p += sizeof(uint64_t);
+    }
+    Put64(p, ullIndexOffset);
+    Put64(p + 8, m_ullOriginal);
+    Put32(p + 16, uint32_t(m_vIndex.size() / 2));
+    memcpy(p + 20, TrailerMagic, sizeof(TrailerMagic));
+    noteResult(WriteNext(tail.data(), tail.size(), dwThisError));
+
+    noteResult(m_pNext->Finish(dwThisError));
+
+    // Release the buffers; this object won't be written to again
+    std::vector<uint8_t>().swap(m_pending);
+    std::vector<uint8_t>().swap(m_compressed);
+    return bOk;
+}
+
+// ------------------------------------------------------------------------------------------
+
+bool CompressedCaptureReader_t::IsCompressedCapture(const std::wstring& sPath)
+{
+    CompressedCaptureReader_t reader;
+    uint32_t dwError = 0;
+    reader.m_hFile = PlatformOpenFile(sPath, dwError);
+    if (PlatformInvalidFile == reader.m_hFile)
+        return false;
+    uint8_t magic[sizeof(HeaderMagic)] = { 0 };
+    return reader.ReadExactly(magic, sizeof(magic), dwError) && 0 == memcmp(magic, HeaderMagic, sizeof(magic));
+}
+
+void CompressedCaptureReader_t::Close()
+{
+    PlatformClose(m_hFile);
+    m_vBlocks.clear();
+    m_ullOriginalSize = 0;
+    m_nLevel = 0;
+    m_bComplete = false;
+}
+
+/// <summary>
+/// Reads exactly cb bytes from the current position; fails with PlatformErrorInvalidData if the file ends first
+/// </summary>
+bool CompressedCaptureReader_t::ReadExactly(void* pBuffer, size_t cb, uint32_t& dwError)
+{
+    uint8_t* p = (uint8_t*)pBuffer;
+    while (cb > 0)
+    {
+        size_t cbRead = 0;
+        switch (PlatformRead(m_hFile, p, cb, cbRead, dwError))
+        {
+        case PlatformIoResult_t::Success:
+            p += cbRead;
+            cb -= cbRead;
+            break;
+        case PlatformIoResult_t::EndOfFile:
+            dwError = PlatformErrorInvalidData;
+            return false;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CompressedCaptureReader_t::Open(const std::wstring& sPath, uint32_t& dwError)
+{
+    Close();
+    uint64_t ullFileSize = 0;
+    if (!PlatformGetFileSize(sPath, ullFileSize, dwError))
+        return false;
+    m_hFile = PlatformOpenFile(sPath, dwError);
+    if (PlatformInvalidFile == m_hFile)
+        return false;
+
+    uint8_t header[HeaderSize];
+    if (!ReadExactly(header, sizeof(header), dwError))
+        return false;
+    if (0 != memcmp(header, HeaderMagic, sizeof(HeaderMagic)) || FormatVersion != header[4])
+    {
+        dwError = PlatformErrorInvalidData;
+        return false;
+    }
+    m_nLevel = header[5];
+
+    // Use the index if the capture is complete; otherwise walk the blocks
+    if (LoadIndex(ullFileSize, dwError))
+        return true;
+    return ScanBlocks(ullFileSize, dwError);
+}
+
+/// <summary>
+/// Loads the block index from the end of a complete capture
+/// </summary>
+/// <returns>false if there's no valid trailer and index</returns>
+bool CompressedCaptureReader_t::LoadIndex(uint64_t ullFileSize, uint32_t& dwError)
+{
+    if (ullFileSize < HeaderSize + BlockHeaderSize + TrailerSize)
+        return false;
+    uint8_t trailer[TrailerSize];
+    if (!PlatformSetFilePosition(m_hFile, ullFileSize - TrailerSize, dwError) || !ReadExactly(trailer, sizeof(trailer), dwError))
+        return false;
+    if (0 != memcmp(trailer + 20, TrailerMagic, sizeof(TrailerMagic)))
+        return false;
+
+    const uint64_t ullIndexOffset = Get64(trailer);
+    const uint64_t ullOriginalSize = Get64(trailer + 8);
+    const uint64_t nBlocks = Get32(trailer + 16);
+    if (ullIndexOffset < HeaderSize + BlockHeaderSize || ullIndexOffset + nBlocks * IndexEntrySize + TrailerSize != ullFileSize)
+        return false;
+
+    std::vector<uint8_t> index(size_t(nBlocks * IndexEntrySize));
+    if (!PlatformSetFilePosition(m_hFile, ullIndexOffset, dwError) || !ReadExactly(index.data(), index.size(), dwError))
+        return false;
+
+    std::vector<Block_t> vBlocks(static_cast<size_t>(nBlocks));
+    for (size_t ix = 0; ix < vBlocks.size(); ++ix)
+    {
+        vBlocks[ix].ullOriginalOffset = Get64(index.data() + ix * IndexEntrySize);
+        vBlocks[ix].ullFileOffset = Get64(index.data() + ix * IndexEntrySize + 8);
+        const uint64_t ullPrevious = (0 == ix) ? 0 : vBlocks[ix - 1].ullOriginalOffset;
+        if ((0 == ix && 0 != vBlocks[ix].ullOriginalOffset) || vBlocks[ix].ullOriginalOffset < ullPrevious || vBlocks[ix].ullFileOffset < HeaderSize || vBlocks[ix].ullFileOffset >= ullIndexOffset)
+            return false;
+    }
+    if (!vBlocks.empty() && vBlocks.back().ullOriginalOffset >= ullOriginalSize)
+        return false;
+
+    m_vBlocks.swap(vBlocks);
+    m_ullOriginalSize = ullOriginalSize;
+    m_bComplete = true;
+    return true;
+}
+
+/// <summary>
+/// Builds the block list by reading each block's header, for a capture without an index
+/// </summary>
+bool CompressedCaptureReader_t::ScanBlocks(uint64_t ullFileSize, uint32_t& dwError)
+{
+    m_vBlocks.clear();
+    m_ullOriginalSize = 0;
+    uint64_t ullOffset = HeaderSize;
+    while (ullOffset + BlockHeaderSize <= ullFileSize)
+    {
+        uint8_t blockHeader[BlockHeaderSize];
+        if (!PlatformSetFilePosition(m_hFile, ullOffset, dwError) || !ReadExactly(blockHeader, sizeof(blockHeader), dwError))
+            return false;
+        const uint32_t cbOriginal = Get32(blockHeader);
+        const uint32_t cbStored = Get32(blockHeader + 4) & ~StoredRawFlag;
+        // End mark
+        if (0 == cbOriginal)
+            break;
+        // A block cut off at the end of the file is lost
+        if (ullOffset + BlockHeaderSize + cbStored > ullFileSize)
+            break;
+        m_vBlocks.push_back(Block_t{ m_ullOriginalSize, ullOffset });
+        m_ullOriginalSize += cbOriginal;
+        ullOffset += BlockHeaderSize + cbStored;
+    }
+    dwError = 0;
+    return true;
+}
+
+size_t CompressedCaptureReader_t::BlockForOffset(uint64_t ullOffset) const
+{
+    if (ullOffset >= m_ullOriginalSize)
+        return m_vBlocks.size();
+    // Last block starting at or before the offset
+    size_t ixLow = 0, ixHigh = m_vBlocks.size();
+    while (ixHigh - ixLow > 1)
+    {
+        const size_t ixMid = ixLow + (ixHigh - ixLow) / 2;
+        if (m_vBlocks[ixMid].ullOriginalOffset <= ullOffset)
+            ixLow = ixMid;
+        else
+            ixHigh = ixMid;
+    }
+    return ixLow;
+}
+
+bool CompressedCaptureReader_t::ReadBlock(size_t ixBlock, std::vector<uint8_t>& data, uint32_t& dwError)
+{
+    dwError = PlatformErrorInvalidData;
+    if (ixBlock >= m_vBlocks.size())
+        return false;
+
+    const uint64_t ullExpected = ((ixBlock + 1 < m_vBlocks.size()) ? m_vBlocks[ixBlock + 1].ullOriginalOffset : m_ullOriginalSize) - m_vBlocks[ixBlock].ullOriginalOffset;
+    uint8_t blockHeader[BlockHeaderSize];
+    if (!PlatformSetFilePosition(m_hFile, m_vBlocks[ixBlock].ullFileOffset, dwError) || !ReadExactly(blockHeader, sizeof(blockHeader), dwError))
+        return false;
+    const uint32_t cbOriginal = Get32(blockHeader);
+    const uint32_t dwStored = Get32(blockHeader + 4);
+    const uint32_t cbStored = dwStored & ~StoredRawFlag;
+    if (cbOriginal != ullExpected || cbOriginal > MaxBlockSize || cbStored > LzCompressBound(MaxBlockSize))
+    {
+        dwError = PlatformErrorInvalidData;
+        return false;
+    }
+
+    data.resize(cbOriginal);
+    if (0 != (dwStored & StoredRawFlag))
+    {
+        if (cbStored != cbOriginal)
+        {
+            dwError = PlatformErrorInvalidData;
+            return false;
+        }
+        return ReadExactly(data.data(), cbOriginal, dwError);
+    }
+
+    m_stored.resize(cbStored);
+    if (!ReadExactly(m_stored.data(), cbStored, dwError))
+        return false;
+    if (!LzDecompress(m_stored.data(), cbStored, data.data(), cbOriginal))
+    {
+        dwError = PlatformErrorInvalidData;
+        return false;
+    }
+    dwError = 0;
+    return true;
+}
@@ -0,0 +1,154 @@
+// Compressed capture files: redirected output compressed on its way to the file, in blocks that can each be
+// decompressed on their own, so that a reader can start anywhere without decompressing what comes before.
+//
+// File layout (integers are little-endian):
+//   Header    : "RAUZ", uint8 version (1), uint8 compression level, uint16 0, uint32 block size
+//   Blocks    : uint32 original size, uint32 stored size (high bit set if stored uncompressed), stored bytes
+//   End mark  : uint32 0, uint32 0
+//   Index     : for each block, uint64 offset in the original data, uint64 file offset of the block header
+//   Trailer   : uint64 file offset of the index, uint64 original size, uint32 block count, "RAUI"
+// A capture that was cut off (e.g., by a reboot) has no end mark, index, or trailer; everything up to its
+// last complete block can still be read by walking the block headers.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "RedirPump.h"
+#include "LzCodec.h"
+
+/// <summary>
+/// File name extension appended to compressed captures
+/// </summary>
+const wchar_t* const szCompressedCaptureExtension = L".rauz";
+
+/// <summary>
+/// Default amount of output compressed as one block
+/// </summary>
+const size_t RedirCompressDefaultBlockSize = 256 * 1024;
+
+/// <summary>
+/// Sink that compresses data into the compressed capture format and passes the result on to the next sink
+/// </summary>
+class RedirCompressor_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="pNext">Input: where the compressed data goes (e.g., a RedirFileSink_t); now owned by this object</param>
+    /// <param name="nLevel">Input: compression level, LzMinLevel through LzMaxLevel</param>
+    /// <param name="cbBlockSize">Input: amount of output compressed as one block</param>
+    RedirCompressor_t(std::unique_ptr<RedirSink_t> pNext, int nLevel, size_t cbBlockSize = RedirCompressDefaultBlockSize);
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override;
+
+    /// <summary>
+    /// Number of bytes received, and number of bytes passed on so far (including framing)
+    /// </summary>
+    uint64_t OriginalBytes() const { return m_ullOriginal; }
+    uint64_t StoredBytes() const { return m_ullStored; }
+
+private:
+    bool WriteNext(const uint8_t* pData, size_t cbData, uint32_t& dwError);
+    bool CompressBlock(const uint8_t* pData, size_t cbData, uint32_t& dwError);
+
+private:
+    std::unique_ptr<RedirSink_t> m_pNext;
+    const int m_nLevel;
+    const size_t m_cbBlockSize;
+    // Output that doesn't yet fill a block; grows only as needed, so captures of short output stay small in memory
+    std::vector<uint8_t> m_pending;
+    // Compression output buffer, allocated on first use
+    std::vector<uint8_t> m_compressed;
+    // Index entries: offset in the original data, and file offset, of each block
+    std::vector<uint64_t> m_vIndex;
+    bool m_bHeaderWritten = false;
+    // Bytes received, bytes of those already compressed into blocks, and bytes passed on
+    uint64_t m_ullOriginal = 0, m_ullBlocked = 0, m_ullStored = 0;
+
+private:
+    // Not implemented
+    RedirCompressor_t(const RedirCompressor_t&) = delete;
+    RedirCompressor_t& operator = (const RedirCompressor_t&) = delete;
+};
+
+/// <summary>
+/// Reads a compressed capture file, sequentially or starting at any offset in the original data.
+/// </summary>
+class CompressedCaptureReader_t
+{
+public:
+    CompressedCaptureReader_t() = default;
+    ~CompressedCaptureReader_t() { Close(); }
+
+    /// <summary>
+    /// Returns true if the named file starts like a compressed capture
+    /// </summary>
+    static bool IsCompressedCapture(const std::wstring& sPath);
+
+    /// <summary>
+    /// Opens a compressed capture and loads its block index (or, if the capture was cut off, rebuilds it
+    /// from the block headers).
+    /// </summary>
+    /// <param name="sPath">Input: path to the file</param>
+    /// <param name="dwError">Output: error code on failure; PlatformErrorInvalidData if it's not a valid compressed capture</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Open(const std::wstring& sPath, uint32_t& dwError);
+    void Close();
+
+    /// <summary>
+    /// Size of the original data, number of blocks, compression level, and whether the capture was complete
+    /// </summary>
+    uint64_t OriginalSize() const { return m_ullOriginalSize; }
+    size_t BlockCount() const { return m_vBlocks.size(); }
+    int Level() const { return m_nLevel; }
+    bool Complete() const { return m_bComplete; }
+
+    /// <summary>
+    /// Returns the block containing an offset in the original data (BlockCount() if it's past the end)
+    /// </summary>
+    size_t BlockForOffset(uint64_t ullOffset) const;
+
+    /// <summary>
+    /// Offset in the original data at which a block starts
+    /// </summary>
+    uint64_t BlockOffset(size_t ixBlock) const { return m_vBlocks[ixBlock].ullOriginalOffset; }
+
+    /// <summary>
+    /// Reads and decompresses one block
+    /// </summary>
+    /// <param name="ixBlock">Input: block number</param>
+    /// <param name="data">Output: the block's original data</param>
+    /// <param name="dwError">Output: error code on failure</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool ReadBlock(size_t ixBlock, std::vector<uint8_t>& data, uint32_t& dwError);
+
+private:
+    struct Block_t
+    {
+        uint64_t ullOriginalOffset;
+        uint64_t ullFileOffset;
+    };
+
+    bool ReadExactly(void* pBuffer, size_t cb, uint32_t& dwError);
+    bool LoadIndex(uint64_t ullFileSize, uint32_t& dwError);
+    bool ScanBlocks(uint64_t ullFileSize, uint32_t& dwError);
+
+private:
+    PlatformFile_t m_hFile = PlatformInvalidFile;
+    std::vector<Block_t> m_vBlocks;
+    uint64_t m_ullOriginalSize = 0;
+    int m_nLevel = 0;
+    bool m_bComplete = false;
+    std::vector<uint8_t> m_stored;
+
+private:
+    // Not implemented
+    CompressedCaptureReader_t(const CompressedCaptureReader_t&) = delete;
+    CompressedCaptureReader_t& operator = (const CompressedCaptureReader_t&) = delete;
+};
@@ -0,0 +1,568 @@
+// Deduplicated captures: a per-run store of distinct chunks of output, and per-process manifests that
+// reference them. See RedirDedup.h for the file layouts.
+
+#include <cstring>
+#include "RedirDedup.h"
+#include "LzCodec.h"
+
+static const uint8_t StoreMagic[4] = { 'R', 'A', 'U', 'S' };
+static const uint8_t ManifestMagic[4] = { 'R', 'A', 'U', 'M' };
+static const uint8_t FormatVersion = 1;
+static const size_t StoreHeaderSize = 8;
+static const size_t RecordHeaderSize = Sha256DigestSize + 8;
+static const size_t ManifestHeaderSize = 8;
+static const size_t ManifestEntrySize = 12;
+// Record offset of the manifest's end mark
+static const uint64_t EndMarkOffset = ~uint64_t(0);
+// Set in a record's stored size if the chunk is stored uncompressed
+static const uint32_t StoredRawFlag = 0x80000000;
+
+static inline void Put32(uint8_t* p, uint32_t n)
+{
+    for (size_t ix = 0; ix < 4; ++ix)
+        p[ix] = uint8_t(n >> (8 * ix));
+}
+
+static inline void Put64(uint8_t* p, uint64_t n)
+{
+    for (size_t ix = 0; ix < 8; ++ix)
+        p[ix] = uint8_t(n >> (8 * ix));
+}
+
+static inline uint32_t Get32(const uint8_t* p)
+{
+    uint32_t n = 0;
+    for (size_t ix = 0; ix < 4; ++ix)
+        n |= uint32_t(p[ix]) << (8 * ix);
+    return n;
+}
+
+static inline uint64_t Get64(const uint8_t* p)
+{
+    uint64_t n = 0;
+    for (size_t ix = 0; ix < 8; ++ix)
+        n |= uint64_t(p[ix]) << (8 * ix);
+    return n;
+}
+
+/// <summary>
+/// Reads exactly cb bytes from a file's current position; fails with PlatformErrorInvalidData if the file ends first
+/// </summary>
+static bool ReadFileExactly(PlatformFile_t hFile, void* pBuffer, size_t cb, uint32_t& dwError)
+{
+    uint8_t* p = (uint8_t*)pBuffer;
+    while (cb > 0)
+    {
+        size_t cbRead = 0;
+        switch (PlatformRead(hFile, p, cb, cbRead, dwError))
+        {
+        case PlatformIoResult_t::Success:
+            p += cbRead;
+            cb -= cbRead;
+            break;
+        case PlatformIoResult_t::EndOfFile:
+            dwError = PlatformErrorInvalidData;
+            return false;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// The part of a path after its last directory separator
+/// </summary>
+static std::wstring FileNamePart(const std::wstring& sPath)
+{
+    const size_t ixSeparator = sPath.find_last_of(L"\\/");
+    return (std::wstring::npos == ixSeparator) ? sPath : sPath.substr(ixSeparator + 1);
+}
+
+// ------------------------------------------------------------------------------------------
+// Content-defined chunk boundaries (FastCDC): a "gear" fingerprint, shifted left one bit per byte and added
+// to a random value for each byte, so that it depends only on the last 64 bytes. A chunk ends where the
+// fingerprint has zeros in all the positions of a mask. Before the typical size, a mask with more bits makes
+// boundaries less likely; after it, a mask with fewer bits makes them more likely, so sizes cluster near
+// the typical size.
+
+// 15 and 11 bits, spread across the upper part of the fingerprint, for an 8KB typical chunk size
+static const uint64_t ChunkMaskSmall = 0x0000d9f003530000ULL;
+static const uint64_t ChunkMaskLarge = 0x0000d90003530000ULL;
+
+/// <summary>
+/// Random value for each byte value; fixed, so that boundaries fall in the same places in every run
+/// </summary>
+struct GearTable_t
+{
+    uint64_t values[256];
+    GearTable_t()
+    {
+        // splitmix64
+        uint64_t ullState = 0x52756e4173557365ULL;
+        for (uint64_t& ullValue : values)
+        {
+            uint64_t z = (ullState += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            ullValue = z ^ (z >> 31);
+        }
+    }
+};
+static const GearTable_t GearTable;
+
+// ------------------------------------------------------------------------------------------
+
+bool ChunkStore_t::Create(const std::wstring& sPath, int nCompressLevel, uint32_t& dwError, IntegrityHash_t hash)
+{
+    Close();
+    // The name goes into every manifest, which records it as ASCII
+    const std::wstring sName = FileNamePart(sPath);
+    for (wchar_t ch : sName)
+    {
+        if (ch < 0x20 || ch > 0x7E)
+        {
+            dwError = PlatformErrorInvalidData;
+            return false;
+        }
+    }
+
+    m_hFile = PlatformCreateFile(sPath, dwError);
+    if (PlatformInvalidFile == m_hFile)
+        return false;
+    m_sFileName.assign(sName.begin(), sName.end());
+    m_nLevel = nCompressLevel;
+
+    uint8_t header[StoreHeaderSize] = { 0 };
+    memcpy(header, StoreMagic, sizeof(StoreMagic));
+    header[4] = FormatVersion;
+    header[5] = uint8_t(nCompressLevel);
+    size_t cbWritten = 0;
+    if (!PlatformWrite(m_hFile, header, sizeof(header), cbWritten, dwError))
+    {
+        PlatformClose(m_hFile);
+        return false;
+    }
+    m_stats.ullStoreSize = sizeof(header);
+    if (IntegrityHash_t::None != hash)
+    {
+        m_pHasher.reset(new OutputHasher_t(hash));
+        m_pHasher->Update(header, sizeof(header));
+    }
+    return true;
+}
+
+void ChunkStore_t::Close()
+{
+    PlatformLock_t lock(m_mutex);
+    PlatformClose(m_hFile);
+    m_records.clear();
+    m_stats = Stats_t();
+    m_pHasher.reset();
+}
+
+bool ChunkStore_t::Hashes(OutputHashes_t& hashes)
+{
+    PlatformLock_t lock(m_mutex);
+    if (!m_pHasher)
+        return false;
+    hashes = m_pHasher->Hashes();
+    return true;
+}
+
+ChunkStore_t::Stats_t ChunkStore_t::Stats()
+{
+    PlatformLock_t lock(m_mutex);
+    return m_stats;
+}
+
+bool ChunkStore_t::Add(const uint8_t* pData, size_t cbData, uint64_t& ullRecordOffset, uint32_t& dwError)
+{
+    Digest_t digest;
+    Sha256_t::Compute(pData, cbData, digest.data());
+
+    // The common case, when many processes write the same output: the chunk is already there
+    {
+        PlatformLock_t lock(m_mutex);
+        ++m_stats.nChunks;
+        m_stats.ullBytes += cbData;
+        auto it = m_records.find(digest);
+        if (m_records.end() != it)
+        {
+            ullRecordOffset = it->second;
+            return true;
+        }
+    }
+
+    // Build the record outside the lock, so that other threads aren't held up by compression
+    std::vector<uint8_t> record(RecordHeaderSize + ((m_nLevel > 0) ? LzCompressBound(cbData) : cbData));
+    memcpy(record.data(), digest.data(), digest.size());
+    Put32(record.data() + Sha256DigestSize, uint32_t(cbData));
+    size_t cbStored = (m_nLevel > 0) ? LzCompress(pData, cbData, record.data() + RecordHeaderSize, record.size() - RecordHeaderSize, m_nLevel) : 0;
+    if (0 == cbStored || cbStored >= cbData)
+    {
+        memcpy(record.data() + RecordHeaderSize, pData, cbData);
+        cbStored = cbData;
+        Put32(record.data() + Sha256DigestSize + 4, uint32_t(cbData) | StoredRawFlag);
+    }
+    else
+    {
+        Put32(record.data() + Sha256DigestSize + 4, uint32_t(cbStored));
+    }
+
+    PlatformLock_t lock(m_mutex);
+    // Another thread might have added the same chunk in the meantime
+    auto it = m_records.find(digest);
+    if (m_records.end() != it)
+    {
+        ullRecordOffset = it->second;
+        return true;
+    }
+    size_t cbWritten = 0;
+    const size_t cbRecord = RecordHeaderSize + cbStored;
+    const bool bOk = PlatformWrite(m_hFile, record.data(), cbRecord, cbWritten, dwError) && cbWritten == cbRecord;
+    if (cbWritten != cbRecord)
+    {
+        // A partial record would make every later offset wrong; put the file position back where it was
+        if (cbWritten > 0)
+        {
+            uint32_t dwSeekError = 0;
+            PlatformSetFilePosition(m_hFile, m_stats.ullStoreSize, dwSeekError);
+        }
+        return false;
+    }
+    if (m_pHasher)
+        m_pHasher->Update(record.data(), cbRecord);
+    ullRecordOffset = m_stats.ullStoreSize;
+    m_records.emplace(digest, ullRecordOffset);
+    m_stats.ullStoreSize += cbRecord;
+    ++m_stats.nUniqueChunks;
+    m_stats.ullUniqueBytes += cbData;
+    return bOk;
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirDedupSink_t::RedirDedupSink_t(ChunkStore_t& store, std::unique_ptr<RedirSink_t> pNext)
+    : m_store(store), m_pNext(std::move(pNext))
+{
+}
+
+/// <summary>
+/// Continues the search for the end of the chunk that starts at p
+/// </summary>
+/// <param name="p">Input: start of the chunk</param>
+/// <param name="cbAvailable">Input: number of bytes available from p on</param>
+/// <param name="bFinal">Input: whether any more data will arrive</param>
+/// <returns>Size of the chunk, or 0 if more data is needed to find where it ends</returns>
+size_t RedirDedupSink_t::FindChunkEnd(const uint8_t* p, size_t cbAvailable, bool bFinal)
+{
+    const size_t cbLimit = (cbAvailable < DedupMaxChunkSize) ? cbAvailable : DedupMaxChunkSize;
+    // No boundaries before the minimum size, so hashing starts there
+    size_t ix = (m_ixScan > DedupMinChunkSize) ? m_ixScan : DedupMinChunkSize;
+    uint64_t ullFingerprint = m_ullFingerprint;
+    size_t cbChunk = 0;
+    for (; ix < cbLimit && ix < DedupAvgChunkSize; ++ix)
+    {
+        ullFingerprint = (ullFingerprint << 1) + GearTable.values[p[ix]];
+        if (0 == (ullFingerprint & ChunkMaskSmall))
+        {
+            cbChunk = ix + 1;
+            break;
+        }
+    }
+    if (0 == cbChunk)
+    {
+        for (; ix < cbLimit; ++ix)
+        {
+            ullFingerprint = (ullFingerprint << 1) + GearTable.values[p[ix]];
+            if (0 == (ullFingerprint & ChunkMaskLarge))
+            {
+                cbChunk = ix + 1;
+                break;
+            }
+        }
+    }
+    if (0 == cbChunk && (cbLimit == DedupMaxChunkSize || bFinal))
+        cbChunk = cbLimit;
+
+    if (0 == cbChunk)
+    {
+        // Pick up here when more data arrives
+        m_ixScan = ix;
+        m_ullFingerprint = ullFingerprint;
+    }
+    else
+    {
+        m_ixScan = 0;
+        m_ullFingerprint = 0;
+    }
+    return cbChunk;
+}
+
+/// <summary>
+/// Adds a chunk to the store and to the manifest
+/// </summary>
+bool RedirDedupSink_t::AddChunk(const uint8_t* pChunk, size_t cbChunk, uint32_t& dwError)
+{
+    uint64_t ullRecordOffset = 0;
+    if (!m_store.Add(pChunk, cbChunk, ullRecordOffset, dwError))
+        return false;
+    uint8_t entry[ManifestEntrySize];
+    Put64(entry, ullRecordOffset);
+    Put32(entry + 8, uint32_t(cbChunk));
+    m_manifest.insert(m_manifest.end(), entry, entry + sizeof(entry));
+    return true;
+}
+
+/// <summary>
+/// Passes the manifest bytes accumulated so far on to the next sink
+/// </summary>
+bool RedirDedupSink_t::FlushManifest(uint32_t& dwError)
+{
+    if (!m_bHeaderWritten)
+    {
+        const std::string& sStoreName = m_store.FileName();
+        uint8_t header[ManifestHeaderSize] = { 0 };
+        memcpy(header, ManifestMagic, sizeof(ManifestMagic));
+        header[4] = FormatVersion;
+        header[6] = uint8_t(sStoreName.length());
+        header[7] = uint8_t(sStoreName.length() >> 8);
+        m_manifest.insert(m_manifest.begin(), sStoreName.begin(), sStoreName.end());
+        m_manifest.insert(m_manifest.begin(), header, header + sizeof(header));
+        m_bHeaderWritten = true;
+    }
+    if (m_manifest.empty())
+        return true;
+    size_t cbWritten = 0;
+    const bool bOk = m_pNext->Write(m_manifest.data(), m_manifest.size(), cbWritten, dwError);
+    m_ullManifestBytes += cbWritten;
+    m_manifest.clear();
+    return bOk;
+}
+
+bool RedirDedupSink_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    // Everything is consumed, even if storing it fails; report the first failure.
+    cbWritten = cbData;
+    dwError = 0;
+    bool bOk = true;
+    uint32_t dwThisError = 0;
+
+    m_pending.insert(m_pending.end(), pData, pData + cbData);
+    size_t ixChunk = 0, cbChunk = 0;
+    while (0 != (cbChunk = FindChunkEnd(m_pending.data() + ixChunk, m_pending.size() - ixChunk, false)))
+    {
+        if (!AddChunk(m_pending.data() + ixChunk, cbChunk, dwThisError) && bOk)
+        {
+            bOk = false;
+            dwError = dwThisError;
+        }
+        ixChunk += cbChunk;
+    }
+    // Keep the start of the next chunk
+    m_pending.erase(m_pending.begin(), m_pending.begin() + ixChunk);
+
+    // Manifest entries are passed on after each write, so they reach the file as promptly as unprocessed output would
+    if (!FlushManifest(dwThisError) && bOk)
+    {
+        bOk = false;
+        dwError = dwThisError;
+    }
+    return bOk;
+}
+
+bool RedirDedupSink_t::Finish(uint32_t& dwError)
+{
+    bool bOk = true;
+    dwError = 0;
+    uint32_t dwThisError = 0;
+    auto noteResult = [&](bool bResult) {
+        if (!bResult && bOk)
+        {
+            bOk = false;
+            dwError = dwThisError;
+        }
+    };
+
+    size_t ixChunk = 0, cbChunk = 0;
+    while (ixChunk < m_pending.size() && 0 != (cbChunk = FindChunkEnd(m_pending.data() + ixChunk, m_pending.size() - ixChunk, true)))
+    {
+        noteResult(AddChunk(m_pending.data() + ixChunk, cbChunk, dwThisError));
+        ixChunk += cbChunk;
+    }
+
+    uint8_t endMark[ManifestEntrySize];
+    Put64(endMark, EndMarkOffset);
+    Put32(endMark + 8, 0);
+    m_manifest.insert(m_manifest.end(), endMark, endMark + sizeof(endMark));
+    noteResult(FlushManifest(dwThisError));
+    noteResult(m_pNext->Finish(dwThisError));
+
+    // Release the buffers; this object won't be written to again
+    std::vector<uint8_t>().swap(m_pending);
+    std::vector<uint8_t>().swap(m_manifest);
+    return bOk;
+}
+
+// ------------------------------------------------------------------------------------------
+
+bool DedupManifest_t::IsManifest(const std::wstring& sPath)
+{
+    uint32_t dwError = 0;
+    PlatformFile_t hFile = PlatformOpenFile(sPath, dwError);
+    if (PlatformInvalidFile == hFile)
+        return false;
+    uint8_t magic[sizeof(ManifestMagic)] = { 0 };
+    const bool bIsManifest = ReadFileExactly(hFile, magic, sizeof(magic), dwError) && 0 == memcmp(magic, ManifestMagic, sizeof(magic));
+    PlatformClose(hFile);
+    return bIsManifest;
+}
+
+bool DedupManifest_t::Read(const std::wstring& sPath, uint32_t& dwError)
+{
+    sStorePath.clear();
+    vEntries.clear();
+    ullOriginalSize = 0;
+    bComplete = false;
+
+    uint64_t ullFileSize = 0;
+    if (!PlatformGetFileSize(sPath, ullFileSize, dwError))
+        return false;
+    PlatformFile_t hFile = PlatformOpenFile(sPath, dwError);
+    if (PlatformInvalidFile == hFile)
+        return false;
+    std::vector<uint8_t> contents(static_cast<size_t>(ullFileSize));
+    const bool bRead = ReadFileExactly(hFile, contents.data(), contents.size(), dwError);
+    PlatformClose(hFile);
+    if (!bRead)
+        return false;
+
+    dwError = PlatformErrorInvalidData;
+    if (contents.size() < ManifestHeaderSize || 0 != memcmp(contents.data(), ManifestMagic, sizeof(ManifestMagic)) || FormatVersion != contents[4])
+        return false;
+    const size_t cchStoreName = size_t(contents[6]) | (size_t(contents[7]) << 8);
+    if (contents.size() < ManifestHeaderSize + cchStoreName)
+        return false;
+
+    // The store is in the manifest's directory
+    const size_t ixSeparator = sPath.find_last_of(L"\\/");
+    if (std::wstring::npos != ixSeparator)
+        sStorePath = sPath.substr(0, ixSeparator + 1);
+    sStorePath.append(contents.begin() + ManifestHeaderSize, contents.begin() + ManifestHeaderSize + cchStoreName);
+
+    // An entry cut off at the end of the file is ignored
+    for (size_t ix = ManifestHeaderSize + cchStoreName; ix + ManifestEntrySize <= contents.size(); ix += ManifestEntrySize)
+    {
+        const Entry_t entry = { Get64(contents.data() + ix), Get32(contents.data() + ix + 8) };
+        if (EndMarkOffset == entry.ullRecordOffset)
+        {
+            bComplete = true;
+            break;
+        }
+        vEntries.push_back(entry);
+        ullOriginalSize += entry.cbChunk;
+    }
+    dwError = 0;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+bool ChunkStoreReader_t::Open(const std::wstring& sPath, uint32_t& dwError)
+{
+    Close();
+    if (!PlatformGetFileSize(sPath, m_ullFileSize, dwError))
+        return false;
+    m_hFile = PlatformOpenFile(sPath, dwError);
+    if (PlatformInvalidFile == m_hFile)
+        return false;
+    uint8_t header[StoreHeaderSize];
+    if (!ReadExactly(header, sizeof(header), dwError))
+        return false;
+    if (0 != memcmp(header, StoreMagic, sizeof(StoreMagic)) || FormatVersion != header[4])
+    {
+        dwError = PlatformErrorInvalidData;
+        return false;
+    }
+    m_nLevel = header[5];
+    return true;
+}
+
+void ChunkStoreReader_t::Close()
+{
+    PlatformClose(m_hFile);
+    m_ullFileSize = 0;
+    m_nLevel = 0;
+}
+
+bool ChunkStoreReader_t::ReadExactly(void* pBuffer, size_t cb, uint32_t& dwError)
+{
+    return ReadFileExactly(m_hFile, pBuffer, cb, dwError);
+}
+
+bool ChunkStoreReader_t::ReadChunk(uint64_t ullRecordOffset, std::vector<uint8_t>& data, uint32_t& dwError)
+{
+    uint8_t recordHeader[RecordHeaderSize];
+    if (!PlatformSetFilePosition(m_hFile, ullRecordOffset, dwError) || !ReadExactly(recordHeader, sizeof(recordHeader), dwError))
+        return false;
+    const uint32_t cbChunk = Get32(recordHeader + Sha256DigestSize);
+    const uint32_t dwStored = Get32(recordHeader + Sha256DigestSize + 4);
+    const uint32_t cbStored = dwStored & ~StoredRawFlag;
+    if (cbChunk > DedupMaxChunkSize || cbStored > LzCompressBound(DedupMaxChunkSize) ||
+        (0 != (dwStored & StoredRawFlag) && cbStored != cbChunk))
+    {
+        dwError = PlatformErrorInvalidData;
+        return false;
+    }
+
+    data.resize(cbChunk);
+    if (0 != (dwStored & StoredRawFlag))
+    {
+        if (!ReadExactly(data.data(), cbChunk, dwError))
+            return false;
+    }
+    else
+    {
+        m_stored.resize(cbStored);
+        if (!ReadExactly(m_stored.data(), cbStored, dwError))
+            return false;
+        if (!LzDecompress(m_stored.data(), cbStored, data.data(), cbChunk))
+        {
+            dwError = PlatformErrorInvalidData;
+            return false;
+        }
+    }
+
+    uint8_t digest[Sha256DigestSize];
+    Sha256_t::Compute(data.data(), data.size(), digest);
+    if (0 != memcmp(digest, recordHeader, Sha256DigestSize))
+    {
+        dwError = PlatformErrorInvalidData;
+        return false;
+    }
+    dwError = 0;
+    return true;
+}
+
+bool ChunkStoreReader_t::Count(uint64_t& nChunks, uint64_t& ullChunkBytes, uint64_t& ullStoredBytes, uint32_t& dwError)
+{
+    nChunks = ullChunkBytes = ullStoredBytes = 0;
+    uint64_t ullOffset = StoreHeaderSize;
+    while (ullOffset + RecordHeaderSize <= m_ullFileSize)
+    {
+        uint8_t recordHeader[RecordHeaderSize];
+        if (!PlatformSetFilePosition(m_hFile, ullOffset, dwError) || !ReadExactly(recordHeader, sizeof(recordHeader), dwError))
+            return false;
+        const uint32_t cbStored = Get32(recordHeader + Sha256DigestSize + 4) & ~StoredRawFlag;
+        // A record cut off at the end of the file is lost
+        if (ullOffset + RecordHeaderSize + cbStored > m_ullFileSize)
+            break;
+        ++nChunks;
+        ullChunkBytes += Get32(recordHeader + Sha256DigestSize);
+        ullStoredBytes += RecordHeaderSize + cbStored;
+        ullOffset += RecordHeaderSize + cbStored;
+    }
+    dwError = 0;
+    return true;
+}
@@ -0,0 +1,248 @@
+// Deduplicated captures: when many target processes write the same output (the same script in hundreds of
+// sessions), each distinct piece of it is stored once in a chunk store shared by the whole run, and each
+// process' output file is a manifest that lists the chunks its output consists of.
+//
+// Output is split into chunks at content-defined boundaries (a rolling hash over the last few dozen bytes;
+// see FastCDC), so that two outputs that are identical from some point on, or that differ only in a few
+// places, still produce mostly identical chunks. Chunks are identified by their SHA-256 digests.
+//
+// Chunk store layout (integers are little-endian):
+//   Header    : "RAUS", uint8 version (1), uint8 compression level (0 for none), uint16 0
+//   Records   : 32-byte SHA-256 of the chunk, uint32 chunk size, uint32 stored size (high bit set if stored
+//               uncompressed), stored bytes (compressed with LzCodec unless the high bit is set)
+// Manifest layout:
+//   Header    : "RAUM", uint8 version (1), uint8 0, uint16 length of the chunk store's file name, then the
+//               name (ASCII, without a directory: the store is in the same directory as the manifest)
+//   Entries   : uint64 file offset of the chunk's record in the store, uint32 chunk size
+//   End mark  : uint64 all bits set, uint32 0
+// Records and entries are written as soon as each chunk is complete, so a run that was cut off leaves
+// manifests that are readable up to their last complete chunk.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Platform.h"
+#include "RedirHash.h"
+#include "RedirPump.h"
+#include "Sha256.h"
+
+/// <summary>
+/// File name extensions of chunk stores and of the manifests that replace redirected output files
+/// </summary>
+const wchar_t* const szChunkStoreExtension = L".raus";
+const wchar_t* const szDedupManifestExtension = L".raum";
+
+/// <summary>
+/// Smallest, typical, and largest chunk sizes. (The last chunk of an output can be smaller than the minimum.)
+/// </summary>
+const size_t DedupMinChunkSize = 2 * 1024, DedupAvgChunkSize = 8 * 1024, DedupMaxChunkSize = 64 * 1024;
+
+/// <summary>
+/// Per-run store of distinct chunks of output. Add can be called from any number of threads.
+/// </summary>
+class ChunkStore_t
+{
+public:
+    ChunkStore_t() = default;
+    ~ChunkStore_t() { Close(); }
+
+    /// <summary>
+    /// Creates the store file
+    /// </summary>
+    /// <param name="sPath">Input: path to the file</param>
+    /// <param name="nCompressLevel">Input: if non-zero, compress chunks at this level (see LzCodec.h)</param>
+    /// <param name="dwError">Output: error code on failure</param>
+    /// <param name="hash">Input: which hashes of the store file to compute as it's written, for an integrity manifest</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Create(const std::wstring& sPath, int nCompressLevel, uint32_t& dwError, IntegrityHash_t hash = IntegrityHash_t::None);
+    void Close();
+
+    /// <summary>
+    /// The store's file name, without its directory
+    /// </summary>
+    const std::string& FileName() const { return m_sFileName; }
+
+    /// <summary>
+    /// Adds a chunk to the store if it isn't already there
+    /// </summary>
+    /// <param name="pData">Input: the chunk</param>
+    /// <param name="cbData">Input: size of the chunk; no more than DedupMaxChunkSize</param>
+    /// <param name="ullRecordOffset">Output: file offset of the chunk's record, for the manifest</param>
+    /// <param name="dwError">Output: error code on failure</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Add(const uint8_t* pData, size_t cbData, uint64_t& ullRecordOffset, uint32_t& dwError);
+
+    /// <summary>
+    /// Statistics: chunks and bytes added, distinct chunks and the bytes they represent, and the store's size
+    /// </summary>
+    struct Stats_t
+    {
+        uint64_t nChunks = 0, ullBytes = 0;
+        uint64_t nUniqueChunks = 0, ullUniqueBytes = 0;
+        uint64_t ullStoreSize = 0;
+    };
+    Stats_t Stats();
+
+    /// <summary>
+    /// The size and hashes of the store file so far
+    /// </summary>
+    /// <returns>true if successful; false if the store wasn't created with hashing</returns>
+    bool Hashes(OutputHashes_t& hashes);
+
+private:
+    typedef std::array<uint8_t, Sha256DigestSize> Digest_t;
+    struct DigestHash_t
+    {
+        // The digest is already uniformly distributed; any part of it will do
+        size_t operator()(const Digest_t& digest) const
+        {
+            size_t nHash = 0;
+            for (size_t ix = 0; ix < sizeof(nHash); ++ix)
+                nHash = (nHash << 8) | digest[ix];
+            return nHash;
+        }
+    };
+
+    PlatformMutex_t m_mutex;
+    PlatformFile_t m_hFile = PlatformInvalidFile;
+    std::string m_sFileName;
+    int m_nLevel = 0;
+    // Record offset of each distinct chunk
+    std::unordered_map<Digest_t, uint64_t, DigestHash_t> m_records;
+    Stats_t m_stats;
+    // If hashing, hashes what's been written to the file
+    std::unique_ptr<OutputHasher_t> m_pHasher;
+
+private:
+    // Not implemented
+    ChunkStore_t(const ChunkStore_t&) = delete;
+    ChunkStore_t& operator = (const ChunkStore_t&) = delete;
+};
+
+/// <summary>
+/// Sink that splits data into chunks, adds them to a chunk store, and writes a manifest to the next sink
+/// </summary>
+class RedirDedupSink_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="store">Input: the run's chunk store; must outlive this object</param>
+    /// <param name="pNext">Input: where the manifest goes (e.g., a RedirFileSink_t); now owned by this object</param>
+    RedirDedupSink_t(ChunkStore_t& store, std::unique_ptr<RedirSink_t> pNext);
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override;
+
+    /// <summary>
+    /// Number of manifest bytes passed on so far
+    /// </summary>
+    uint64_t ManifestBytes() const { return m_ullManifestBytes; }
+
+private:
+    size_t FindChunkEnd(const uint8_t* p, size_t cbAvailable, bool bFinal);
+    bool AddChunk(const uint8_t* pChunk, size_t cbChunk, uint32_t& dwError);
+    bool FlushManifest(uint32_t& dwError);
+
+private:
+    ChunkStore_t& m_store;
+    std::unique_ptr<RedirSink_t> m_pNext;
+    // Data not yet in a chunk, and how far into it the search for a chunk boundary has gotten
+    std::vector<uint8_t> m_pending;
+    size_t m_ixScan = 0;
+    uint64_t m_ullFingerprint = 0;
+    // Manifest bytes not yet passed on
+    std::vector<uint8_t> m_manifest;
+    bool m_bHeaderWritten = false;
+    uint64_t m_ullManifestBytes = 0;
+
+private:
+    // Not implemented
+    RedirDedupSink_t(const RedirDedupSink_t&) = delete;
+    RedirDedupSink_t& operator = (const RedirDedupSink_t&) = delete;
+};
+
+/// <summary>
+/// A manifest's contents
+/// </summary>
+struct DedupManifest_t
+{
+    struct Entry_t
+    {
+        uint64_t ullRecordOffset;
+        uint32_t cbChunk;
+    };
+    // Path to the chunk store (the manifest's directory plus the name it records)
+    std::wstring sStorePath;
+    std::vector<Entry_t> vEntries;
+    // Sum of the chunk sizes
+    uint64_t ullOriginalSize = 0;
+    // Whether the manifest ends with an end mark (otherwise the run was cut off)
+    bool bComplete = false;
+
+    /// <summary>
+    /// Returns true if the named file starts like a manifest
+    /// </summary>
+    static bool IsManifest(const std::wstring& sPath);
+
+    /// <summary>
+    /// Reads a manifest
+    /// </summary>
+    /// <param name="sPath">Input: path to the manifest</param>
+    /// <param name="dwError">Output: error code on failure; PlatformErrorInvalidData if it's not a valid manifest</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Read(const std::wstring& sPath, uint32_t& dwError);
+};
+
+/// <summary>
+/// Reads chunks from a chunk store
+/// </summary>
+class ChunkStoreReader_t
+{
+public:
+    ChunkStoreReader_t() = default;
+    ~ChunkStoreReader_t() { Close(); }
+
+    bool Open(const std::wstring& sPath, uint32_t& dwError);
+    void Close();
+
+    /// <summary>
+    /// Reads a chunk, decompressing it if necessary and verifying its SHA-256 digest
+    /// </summary>
+    /// <param name="ullRecordOffset">Input: file offset of the chunk's record, from a manifest</param>
+    /// <param name="data">Output: the chunk</param>
+    /// <param name="dwError">Output: error code on failure; PlatformErrorInvalidData if the record is damaged</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool ReadChunk(uint64_t ullRecordOffset, std::vector<uint8_t>& data, uint32_t& dwError);
+
+    /// <summary>
+    /// Walks the store's records, counting the chunks, the bytes they represent, and the bytes they occupy
+    /// </summary>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Count(uint64_t& nChunks, uint64_t& ullChunkBytes, uint64_t& ullStoredBytes, uint32_t& dwError);
+
+    /// <summary>
+    /// The compression level recorded in the store's header
+    /// </summary>
+    int Level() const { return m_nLevel; }
+
+private:
+    bool ReadExactly(void* pBuffer, size_t cb, uint32_t& dwError);
+
+private:
+    PlatformFile_t m_hFile = PlatformInvalidFile;
+    uint64_t m_ullFileSize = 0;
+    int m_nLevel = 0;
+    std::vector<uint8_t> m_stored;
+
+private:
+    // Not implemented
+    ChunkStoreReader_t(const ChunkStoreReader_t&) = delete;
+    ChunkStoreReader_t& operator = (const ChunkStoreReader_t&) = delete;
+};
@@ -0,0 +1,75 @@
+// Integrity hashing of redirected output: see RedirHash.h.
+
+#include <algorithm>
+#include "RedirHash.h"
+#include "StringUtils.h"
+
+void OutputHasher_t::Update(const uint8_t* pData, size_t cbData)
+{
+    m_ullSize += cbData;
+    m_xxh64.Update(pData, cbData);
+    if (m_bSha256)
+        m_sha256.Update(pData, cbData);
+}
+
+OutputHashes_t OutputHasher_t::Hashes() const
+{
+    OutputHashes_t hashes;
+    hashes.ullSize = m_ullSize;
+    hashes.ullXxh64 = m_xxh64.Final();
+    hashes.bSha256 = m_bSha256;
+    if (m_bSha256)
+    {
+        // Final ends the digest; finish a copy so that this object can keep going
+        Sha256_t sha256(m_sha256);
+        sha256.Final(hashes.sha256);
+    }
+    return hashes;
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirHashSink_t::RedirHashSink_t(IntegrityHash_t hash, std::unique_ptr<RedirSink_t> pNext)
+    : m_hasher(hash), m_pNext(std::move(pNext))
+{
+}
+
+bool RedirHashSink_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    const bool bOk = m_pNext->Write(pData, cbData, cbWritten, dwError);
+    // Only what reached the file (all of it, unless there was an error)
+    m_hasher.Update(pData, (cbWritten < cbData) ? cbWritten : cbData);
+    return bOk;
+}
+
+// ------------------------------------------------------------------------------------------
+
+void WriteIntegrityManifest(std::wostream& os, const std::wstring& sCreated, std::vector<IntegrityEntry_t> vEntries)
+{
+    std::sort(vEntries.begin(), vEntries.end(), [](const IntegrityEntry_t& a, const IntegrityEntry_t& b) { return a.sFile < b.sFile; });
+    os << L"{" << std::endl
+        << L"  \"manifest\": \"RunAsUsers output integrity\"," << std::endl
+        << L"  \"version\": 1," << std::endl
+        << L"  \"created\": \"" << JsonEscape(sCreated) << L"\"," << std::endl
+        << L"  \"files\": [";
+    bool bFirst = true;
+    for (const IntegrityEntry_t& entry : vEntries)
+    {
+        os << (bFirst ? L"" : L",") << std::endl;
+        bFirst = false;
+        os << L"    { \"file\": \"" << JsonEscape(entry.sFile) << L"\", \"content\": \"" << entry.sContent << L"\", ";
+        if (entry.bHasProcess)
+        {
+            os << L"\"sessionId\": " << entry.dwSessionId << L", \"pid\": " << entry.dwPID << L", ";
+            if (entry.bExited)
+                os << L"\"exitCode\": " << entry.dwExitCode << L", ";
+            else
+                os << L"\"exitCode\": null, ";
+        }
+        os << L"\"size\": " << entry.hashes.ullSize << L", \"xxh64\": \"" << Xxh64ToString(entry.hashes.ullXxh64) << L"\"";
+        if (entry.hashes.bSha256)
+            os << L", \"sha256\": \"" << Sha256ToString(entry.hashes.sha256) << L"\"";
+        os << L" }";
+    }
+    os << std::endl << L"  ]," << std::endl << L"  \"count\": " << vEntries.size() << std::endl << L"}" << std::endl;
+}
@@ -0,0 +1,121 @@
+// Integrity hashing of redirected output: hashes each output file as it's written (the bytes that reach the
+// file, after any compression or deduplication), so that a manifest of the run's output files can be written
+// when the run ends without reading any of them back. The manifest lists each file's name, size, and hashes,
+// and the session, process ID, and exit code of the process that wrote it. It's written in one go, in a fixed
+// order and format, so that it can be signed (with a detached signature) to make the output tamper-evident.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "RedirPump.h"
+#include "Sha256.h"
+#include "Xxh64.h"
+
+/// <summary>
+/// Which hashes to compute
+/// </summary>
+enum class IntegrityHash_t
+{
+    None,
+    Fast,       // XXH64 only
+    Sha256      // XXH64 and SHA-256
+};
+
+/// <summary>
+/// Size and hashes of a file's contents
+/// </summary>
+struct OutputHashes_t
+{
+    uint64_t ullSize = 0;
+    uint64_t ullXxh64 = 0;
+    bool bSha256 = false;
+    uint8_t sha256[Sha256DigestSize] = {};
+};
+
+/// <summary>
+/// Computes the hashes of data supplied in any number of pieces
+/// </summary>
+class OutputHasher_t
+{
+public:
+    explicit OutputHasher_t(IntegrityHash_t hash) : m_bSha256(IntegrityHash_t::Sha256 == hash) {}
+
+    void Update(const uint8_t* pData, size_t cbData);
+
+    /// <summary>
+    /// The size and hashes of the data added so far
+    /// </summary>
+    OutputHashes_t Hashes() const;
+
+private:
+    const bool m_bSha256;
+    uint64_t m_ullSize = 0;
+    Xxh64_t m_xxh64;
+    Sha256_t m_sha256;
+};
+
+/// <summary>
+/// Sink that hashes what the next sink (normally the file) accepts. Put it right in front of the file, so that
+/// the hashes are of the file's contents.
+/// </summary>
+class RedirHashSink_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="hash">Input: which hashes to compute; not None</param>
+    /// <param name="pNext">Input: where the data goes; now owned by this object</param>
+    RedirHashSink_t(IntegrityHash_t hash, std::unique_ptr<RedirSink_t> pNext);
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override { return m_pNext->Finish(dwError); }
+
+    /// <summary>
+    /// The size and hashes of what's been written. Complete once the stream has finished.
+    /// </summary>
+    OutputHashes_t Hashes() const { return m_hasher.Hashes(); }
+
+private:
+    OutputHasher_t m_hasher;
+    std::unique_ptr<RedirSink_t> m_pNext;
+
+private:
+    // Not implemented
+    RedirHashSink_t(const RedirHashSink_t&) = delete;
+    RedirHashSink_t& operator = (const RedirHashSink_t&) = delete;
+};
+
+/// <summary>
+/// One file in an integrity manifest
+/// </summary>
+struct IntegrityEntry_t
+{
+    // File name, without its directory (the manifest is written in the same directory)
+    std::wstring sFile;
+    // What the file holds: stdout, stderr, stdout+stderr, or chunks (a chunk store, which has no process)
+    std::wstring sContent;
+    bool bHasProcess = false;
+    uint32_t dwSessionId = 0, dwPID = 0;
+    // The process' exit code, if it has exited
+    bool bExited = false;
+    uint32_t dwExitCode = 0;
+    OutputHashes_t hashes;
+};
+
+/// <summary>
+/// Manifest file name extension
+/// </summary>
+const wchar_t* const szIntegrityManifestExtension = L".json";
+
+/// <summary>
+/// Writes an integrity manifest as a JSON document, with the files sorted by name
+/// </summary>
+/// <param name="os">Output: stream to write the JSON to</param>
+/// <param name="sCreated">Input: when the run ended (UTC timestamp)</param>
+/// <param name="vEntries">Input: the files</param>
+void WriteIntegrityManifest(std::wostream& os, const std::wstring& sCreated, std::vector<IntegrityEntry_t> vEntries);
@@ -0,0 +1,235 @@
+// Line indexes of redirected output: see RedirLineIndex.h.
+
+#include <algorithm>
+#include <cstring>
+#include "RedirLineIndex.h"
+
+static const uint8_t IndexMagic[4] = { 'R', 'A', 'U', 'L' };
+static const uint8_t FormatVersion = 1;
+static const size_t IndexHeaderSize = 16;
+static const size_t RecordSize = 17;
+static const uint8_t CheckpointRecord = 'L', ChecksumRecord = 'C', EndRecord = 'E';
+
+// Records are written to the index once this much has accumulated (and at the end of the output)
+static const size_t IndexFlushSize = 4096;
+
+static void Put32(uint8_t* p, uint32_t dw)
+{
+    for (int ix = 0; ix < 4; ++ix)
+        p[ix] = uint8_t(dw >> (8 * ix));
+}
+
+static void Put64(uint8_t* p, uint64_t ull)
+{
+    for (int ix = 0; ix < 8; ++ix)
+        p[ix] = uint8_t(ull >> (8 * ix));
+}
+
+static uint32_t Get32(const uint8_t* p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static uint64_t Get64(const uint8_t* p)
+{
+    uint64_t ull = 0;
+    for (int ix = 7; ix >= 0; --ix)
+        ull = (ull << 8) | p[ix];
+    return ull;
+}
+
+/// <summary>
+/// Counts the line breaks in data, eight bytes at a time (std::count isn't vectorized at every optimization level)
+/// </summary>
+static uint64_t CountLineBreaks(const uint8_t* p, const uint8_t* pEnd)
+{
+    const uint64_t Ones = 0x0101010101010101ull, Low7 = 0x7f7f7f7f7f7f7f7full, Breaks = Ones * '\n';
+    const uint64_t EvenBytes = 0x00ff00ff00ff00ffull;
+    uint64_t nBreaks = 0;
+    while (pEnd - p >= 8)
+    {
+        // Up to 255 words per round, so that no byte of the sums overflows
+        const size_t nWords = std::min<size_t>(size_t(pEnd - p) / 8, 255);
+        uint64_t ullSums = 0;
+        for (size_t ix = 0; ix < nWords; ++ix, p += 8)
+        {
+            uint64_t ull;
+            memcpy(&ull, p, 8);
+            ull ^= Breaks;
+            // The high bit of each byte is set if and only if the byte is now 0 (was a line break)
+            ullSums += ~(((ull & Low7) + Low7) | ull | Low7) >> 7;
+        }
+        // Add up the bytes of the sums
+        nBreaks += ((ullSums & EvenBytes) + ((ullSums >> 8) & EvenBytes)) * 0x0001000100010001ull >> 48;
+    }
+    for (; p < pEnd; ++p)
+        nBreaks += ('\n' == *p) ? 1 : 0;
+    return nBreaks;
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirLineIndexSink_t::RedirLineIndexSink_t(uint32_t nInterval, PlatformFile_t hIndex, std::unique_ptr<RedirSink_t> pNext)
+    : m_nInterval(nInterval), m_hIndex(hIndex), m_pNext(std::move(pNext))
+{
+    m_pending.reserve(IndexFlushSize + RecordSize);
+    m_pending.insert(m_pending.end(), IndexMagic, IndexMagic + sizeof(IndexMagic));
+    m_pending.push_back(FormatVersion);
+    m_pending.resize(IndexHeaderSize, 0);
+    Put32(m_pending.data() + 8, m_nInterval);
+    Put32(m_pending.data() + 12, LineIndexBlockSize);
+}
+
+RedirLineIndexSink_t::~RedirLineIndexSink_t()
+{
+    Flush();
+    PlatformClose(m_hIndex);
+}
+
+bool RedirLineIndexSink_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    const bool bOk = m_pNext->Write(pData, cbData, cbWritten, dwError);
+    // Only what was accepted is content
+    Index(pData, cbWritten);
+    return bOk;
+}
+
+bool RedirLineIndexSink_t::Finish(uint32_t& dwError)
+{
+    if (!m_bFinished)
+    {
+        m_bFinished = true;
+        const uint64_t cbLastBlock = m_ullOffset % LineIndexBlockSize;
+        if (0 != cbLastBlock)
+            AddRecord(ChecksumRecord, m_ullOffset / LineIndexBlockSize, m_blockHash.Final());
+        // A last line without a line break is still a line
+        uint64_t ullLines = m_ullLineBreaks;
+        if (m_ullOffset > 0 && !m_bEndsWithBreak)
+            ++ullLines;
+        AddRecord(EndRecord, ullLines, m_ullOffset);
+        Flush();
+    }
+    return m_pNext->Finish(dwError);
+}
+
+void RedirLineIndexSink_t::Index(const uint8_t* pData, size_t cbData)
+{
+    // Block checksums
+    for (size_t ix = 0; ix < cbData; )
+    {
+        const uint64_t cbInBlock = m_ullOffset % LineIndexBlockSize;
+        const size_t cb = size_t(std::min<uint64_t>(LineIndexBlockSize - cbInBlock, cbData - ix));
+        m_blockHash.Update(pData + ix, cb);
+        ix += cb;
+        m_ullOffset += cb;
+        if (0 == m_ullOffset % LineIndexBlockSize)
+        {
+            AddRecord(ChecksumRecord, m_ullOffset / LineIndexBlockSize - 1, m_blockHash.Final());
+            m_blockHash.Reset();
+        }
+    }
+
+    // Line checkpoints: count the line breaks, and find the one before a checkpoint only when the count says it's here
+    const uint64_t ullStart = m_ullOffset - cbData;
+    const uint8_t* p = pData;
+    const uint8_t* const pEnd = pData + cbData;
+    while (p < pEnd)
+    {
+        const uint64_t nToCheckpoint = m_nInterval - m_ullLineBreaks % m_nInterval;
+        const uint64_t nBreaks = CountLineBreaks(p, pEnd);
+        if (nBreaks < nToCheckpoint)
+        {
+            m_ullLineBreaks += nBreaks;
+            break;
+        }
+        for (uint64_t n = 0; n < nToCheckpoint; ++n)
+            p = (const uint8_t*)memchr(p, '\n', size_t(pEnd - p)) + 1;
+        m_ullLineBreaks += nToCheckpoint;
+        AddRecord(CheckpointRecord, m_ullLineBreaks, ullStart + uint64_t(p - pData));
+    }
+    if (cbData > 0)
+        m_bEndsWithBreak = ('\n' == pEnd[-1]);
+}
+
+void RedirLineIndexSink_t::AddRecord(uint8_t type, uint64_t a, uint64_t b)
+{
+    const size_t ix = m_pending.size();
+    m_pending.resize(ix + RecordSize);
+    m_pending[ix] = type;
+    Put64(m_pending.data() + ix + 1, a);
+    Put64(m_pending.data() + ix + 9, b);
+    if (m_pending.size() >= IndexFlushSize)
+        Flush();
+}
+
+void RedirLineIndexSink_t::Flush()
+{
+    // The index is an aid, not part of the output: if it can't be written, stop recording it rather than fail the output
+    if (m_pending.empty() || PlatformInvalidFile == m_hIndex)
+        return;
+    size_t cbWritten = 0;
+    uint32_t dwError = 0;
+    if (PlatformWrite(m_hIndex, m_pending.data(), m_pending.size(), cbWritten, dwError) && cbWritten == m_pending.size())
+        m_cbFlushed += cbWritten;
+    else
+        PlatformClose(m_hIndex);
+    m_pending.clear();
+}
+
+// ------------------------------------------------------------------------------------------
+
+bool LineIndex_t::Read(const std::wstring& sPath, uint32_t& dwError)
+{
+    nInterval = cbBlock = 0;
+    vCheckpoints.clear();
+    vChecksums.clear();
+    bComplete = false;
+    ullLines = ullSize = 0;
+
+    PlatformMappedFile_t mapped;
+    if (!PlatformMapFile(sPath, mapped, dwError))
+        return false;
+    const uint8_t* const pData = mapped.pData;
+    const size_t cbData = size_t(mapped.cbData);
+
+    dwError = PlatformErrorInvalidData;
+    bool bOk = cbData >= IndexHeaderSize && 0 == memcmp(pData, IndexMagic, sizeof(IndexMagic)) && FormatVersion == pData[4];
+    if (bOk)
+    {
+        nInterval = Get32(pData + 8);
+        cbBlock = Get32(pData + 12);
+        bOk = (nInterval > 0 && cbBlock > 0);
+    }
+    if (bOk)
+    {
+        vCheckpoints.push_back(0);
+        // A record cut off at the end of the file is ignored; records must be in order
+        for (size_t ix = IndexHeaderSize; bOk && ix + RecordSize <= cbData && !bComplete; ix += RecordSize)
+        {
+            const uint64_t a = Get64(pData + ix + 1), b = Get64(pData + ix + 9);
+            switch (pData[ix])
+            {
+            case CheckpointRecord:
+                bOk = (a == uint64_t(vCheckpoints.size()) * nInterval && b >= vCheckpoints.back());
+                vCheckpoints.push_back(b);
+                break;
+            case ChecksumRecord:
+                bOk = (a == vChecksums.size());
+                vChecksums.push_back(b);
+                break;
+            case EndRecord:
+                bComplete = true;
+                ullLines = a;
+                ullSize = b;
+                break;
+            default:
+                bOk = false;
+                break;
+            }
+        }
+    }
+    PlatformUnmapFile(mapped);
+    if (bOk)
+        dwError = 0;
+    return bOk;
+}
@@ -0,0 +1,111 @@
+// Line indexes of redirected output: a side file next to each output file that records where every Nth line starts
+// and a checksum of each block of the output, so that a multi-gigabyte capture can be read from any line, or from its
+// end, without reading everything before it (RunAsUsersOutput lines and tail), and what's read can be checked.
+//
+// Offsets, line numbers, and blocks are of the output's original content (before compression or deduplication).
+// Lines end with '\n'. Line numbers start at 0 here; the tool shows them starting at 1.
+//
+// Index layout (integers are little-endian):
+//   Header    : "RAUL", uint8 version (1), uint8 0, uint16 0, uint32 lines per checkpoint, uint32 checksum block size
+//   Records   : uint8 type, uint64 a, uint64 b; one of
+//               'L' (checkpoint) : a = line number (a multiple of the lines per checkpoint), b = offset of its start
+//               'C' (checksum)   : a = block number, b = XXH64 of the block (the last block can be short)
+//               'E' (end)        : a = number of lines (including a last line without a line break), b = content size
+// Records are buffered and written a few kilobytes at a time. A capture that was cut off has no end record; its
+// index can still be used up to its last complete record.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "RedirPump.h"
+#include "Xxh64.h"
+
+/// <summary>
+/// File name extension appended to an output file's name for its line index
+/// </summary>
+const wchar_t* const szLineIndexExtension = L".raul";
+
+/// <summary>
+/// Default and largest number of lines between checkpoints; and amount of content covered by each checksum
+/// </summary>
+const uint32_t LineIndexDefaultInterval = 1000, LineIndexMaxInterval = 1000000;
+const uint32_t LineIndexBlockSize = 1024 * 1024;
+
+/// <summary>
+/// Sink that records where lines start, and block checksums, in a line index, and passes the output on, unchanged,
+/// to the next sink
+/// </summary>
+class RedirLineIndexSink_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="nInterval">Input: number of lines between checkpoints, 1 through LineIndexMaxInterval</param>
+    /// <param name="hIndex">Input: the index file, newly created; now owned by this object</param>
+    /// <param name="pNext">Input: where the output goes; now owned by this object</param>
+    RedirLineIndexSink_t(uint32_t nInterval, PlatformFile_t hIndex, std::unique_ptr<RedirSink_t> pNext);
+    ~RedirLineIndexSink_t();
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override;
+
+    /// <summary>
+    /// Number of line breaks seen, and size of the index so far (including what's still buffered)
+    /// </summary>
+    uint64_t LineBreaks() const { return m_ullLineBreaks; }
+    uint64_t IndexBytes() const { return m_cbFlushed + m_pending.size(); }
+
+private:
+    void Index(const uint8_t* pData, size_t cbData);
+    void AddRecord(uint8_t type, uint64_t a, uint64_t b);
+    void Flush();
+
+private:
+    const uint32_t m_nInterval;
+    PlatformFile_t m_hIndex;
+    std::unique_ptr<RedirSink_t> m_pNext;
+    // Encoded records not yet written to the index
+    std::vector<uint8_t> m_pending;
+    // Content seen, and line breaks in it
+    uint64_t m_ullOffset = 0, m_ullLineBreaks = 0;
+    // Checksum of the current block
+    Xxh64_t m_blockHash;
+    uint64_t m_cbFlushed = 0;
+    // Whether the content so far ends with a line break (so that there's no partial last line)
+    bool m_bEndsWithBreak = false;
+    bool m_bFinished = false;
+
+private:
+    // Not implemented
+    RedirLineIndexSink_t(const RedirLineIndexSink_t&) = delete;
+    RedirLineIndexSink_t& operator = (const RedirLineIndexSink_t&) = delete;
+};
+
+/// <summary>
+/// A line index's contents
+/// </summary>
+struct LineIndex_t
+{
+    uint32_t nInterval = 0;
+    uint32_t cbBlock = 0;
+    // Offset at which line (ix * nInterval) starts; the first is always 0
+    std::vector<uint64_t> vCheckpoints;
+    // Checksum of each block
+    std::vector<uint64_t> vChecksums;
+    // From the end record, if there is one
+    bool bComplete = false;
+    uint64_t ullLines = 0, ullSize = 0;
+
+    /// <summary>
+    /// Reads a line index
+    /// </summary>
+    /// <param name="sPath">Input: path to the index</param>
+    /// <param name="dwError">Output: error code on failure; PlatformErrorInvalidData if it's not a valid line index</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Read(const std::wstring& sPath, uint32_t& dwError);
+};
@@ -5,68 +5,158 @@
 #include "UtilityFunctions.h"
 #include "SysErrorMessage.h"
 #include "RedirManager.h"
+#include "RedirPump.h"
+#include "RedirCompress.h"
+#include "RedirDedup.h"
+#include "RedirQuota.h"
+#include "RedirMatch.h"
+#include "RedirRedact.h"
+#include "RedirHash.h"
+#include "RedirTimeIndex.h"
+#include "RedirLineIndex.h"
 #include "DbgOut.h"
 
 
 /// <summary>
-/// Function to copy data from a named or anonymous pipe to a file object.
+/// Logs the progress of a redirection pump and records when the first output arrives.
 /// </summary>
-/// <param name="hPipe">Handle to a named or anonymous pipe to read from</param>
-/// <param name="hDestination">Handle to a file object to write to</param>
-/// <param name="pSPI">Information about the session/process providing the data (for debugging/diagnostic purposes)</param>
-/// <returns>(Always returns true in current implementation)</returns>
-static bool ReadPipeToFile(HANDLE hPipe, HANDLE hDestination, ptrSessionProcessInfo_t pSPI)
+class RedirPumpLogger_t : public RedirPumpObserver_t
 {
-    // Allocate buffer: read up to 1MB at a time
-    const size_t cbBufSize = 1024 * 1024;
-    uint8_t* buffer = new uint8_t[cbBufSize];
+public:
+    explicit RedirPumpLogger_t(const ptrSessionProcessInfo_t& pSPI) : m_pSPI(pSPI), m_dwPID(pSPI->process.dwPID) {}
 
-    DWORD dwPID = pSPI->process.dwPID;
+    void OnRead(size_t cbRead) override
+    {
+        // ReadFile succeeded for PID dwPID; read cbRead bytes
+        dbgOut.locked() << L"ReadPipeToFile for PID " << m_dwPID << L"; ReadFile read " << cbRead << L" bytes" << std::endl;
+        // Note when the first output arrived (from either stdout or stderr), relative to when the process was resumed
+        m_pSPI->process.phaseTimes.RecordOnce(Phase_t::FirstOutput, m_pSPI->process.phaseTimes.ResumeTime(), MonotonicMicroseconds());
+    }
+
+    void OnWriteError(size_t cbRead, size_t cbWritten, uint32_t dwError) override
+    {
+        if (0 != dwError)
+            std::wcerr << L"WriteFile error: " << SysErrorMessageWithCode(dwError) << std::endl;
+        else
+            std::wcerr << L"WriteFile anomaly: read " << cbRead << L" bytes but wrote " << cbWritten << std::endl;
+    }
 
-    bool bContinue = true;
-    while (bContinue)
+    void OnEnd(PlatformIoResult_t result, uint32_t dwError) override
     {
-        DWORD dwRead = 0;
-        SecureZeroMemory(buffer, cbBufSize);
-        // Read from the pipe until it's empty
-        BOOL rfRet = ReadFile(hPipe, buffer, cbBufSize - 8, &dwRead, NULL);
-        DWORD dwLastErr = GetLastError();
-        if (rfRet)
+        switch (result)
         {
-            // ReadFile succeeded for PID dwPID; read dwRead bytes
-            dbgOut.locked() << L"ReadPipeToFile for PID " << dwPID << L"; ReadFile read " << dwRead << L" bytes" << std::endl;
+        case PlatformIoResult_t::EndOfFile:
+            // ReadFile failed with ERROR_BROKEN_PIPE: should be good now
+            dbgOut.locked() << L"ReadPipeToFile for PID " << m_dwPID << L" ERROR_BROKEN_PIPE - should be good now" << std::endl;
+            break;
+        case PlatformIoResult_t::Canceled:
+            // ReadFile failed with ERROR_OPERATION_ABORTED: time must be up
+            dbgOut.locked() << L"ReadPipeToFile for PID " << m_dwPID << L" ERROR_OPERATION_ABORTED - time must be up" << std::endl;
+            break;
+        default:
+            std::wcerr << L"ReadFile error with PID " << m_dwPID << L": " << SysErrorMessageWithCode(dwError) << std::endl;
+            break;
         }
-        else if (ERROR_BROKEN_PIPE == dwLastErr)
+    }
+
+private:
+    ptrSessionProcessInfo_t m_pSPI;
+    DWORD m_dwPID;
+};
+
+/// <summary>
+/// A process' pattern matches; a match of a Terminate pattern terminates the process and its descendants.
+/// </summary>
+class ProcessMatchResults_t : public MatchResults_t
+{
+public:
+    ProcessMatchResults_t(const PatternSet_t& patterns, ProcessInfo_t& process) : MatchResults_t(patterns), m_process(process) {}
+
+protected:
+    void OnTerminalMatch(size_t ixPattern) override
+    {
+        dbgOut.locked() << L"PID " << m_process.dwPID << L" wrote terminal pattern " << ixPattern << L"; terminating" << std::endl;
+        ProcessManager_t::TerminateProcessTree(m_process, MatchTerminationExitCode);
+    }
+
+private:
+    // The process that owns this object
+    ProcessInfo_t& m_process;
+};
+
+/// <summary>
+/// Function to copy data from a named or anonymous pipe to its destination.
+/// </summary>
+/// <param name="hPipe">Handle to a named or anonymous pipe to read from</param>
+/// <param name="sink">Where the data goes: the redirect target, possibly through processing stages</param>
+/// <param name="pSPI">Information about the session/process providing the data (for debugging/diagnostic purposes)</param>
+/// <returns>(Always returns true in current implementation)</returns>
+static bool ReadPipeToFile(HANDLE hPipe, RedirSink_t& sink, ptrSessionProcessInfo_t pSPI)
+{
+    RedirPumpLogger_t logger(pSPI);
+    PumpPipeToSink(hPipe, sink, logger);
+    return true;
+}
+
+/// <summary>
+/// Creates the sink that a monitor thread writes to: the redirect target, through a deduplicator or a compressor
+/// if requested, behind the time and line indexes, output quota, secret redaction, and the pattern matcher if there are any
+/// </summary>
+/// <param name="hTarget">Input: redirect target</param>
+/// <param name="sTarget">Input: path to the redirect target, if it's an output file</param>
+/// <param name="options">Input: redirection options; deduplication, compression, hashing, and time and line indexes apply only to output files</param>
+/// <param name="pMatches">Input: where the process' pattern matches go; null if there are no patterns</param>
+/// <param name="pHash">Output: the sink that hashes the output file, if hashing; otherwise null</param>
+static RedirSink_t* CreateRedirSink(HANDLE hTarget, const std::wstring& sTarget, const RedirOptions_t& options, MatchResults_t* pMatches, RedirHashSink_t*& pHash)
+{
+    std::unique_ptr<RedirSink_t> pSink(new RedirFileSink_t(hTarget));
+    pHash = nullptr;
+    if (!options.sDirectory.empty())
+    {
+        // Hashes are of what's in the file, so hashing comes right before the file
+        if (IntegrityHash_t::None != options.integrityHash)
         {
-            // ReadFile failed with ERROR_BROKEN_PIPE: should be good now
-            dbgOut.locked() << L"ReadPipeToFile for PID " << dwPID << L" ERROR_BROKEN_PIPE - should be good now" << std::endl;
+            pHash = new RedirHashSink_t(options.integrityHash, std::move(pSink));
+            pSink.reset(pHash);
         }
-        else if (ERROR_OPERATION_ABORTED == dwLastErr)
+        // With deduplication, the chunk store compresses the chunks; the manifest is written as is
+        if (nullptr != options.pChunkStore)
+            pSink.reset(new RedirDedupSink_t(*options.pChunkStore, std::move(pSink)));
+        else if (options.nCompressLevel > 0)
+            pSink.reset(new RedirCompressor_t(std::move(pSink), options.nCompressLevel));
+        // Offsets in the time and line indexes are of the original content, before compression or deduplication,
+        // and of what's kept, after the quota; a missing index costs the timing or the seeking, not the output
+        if (0 != options.nLineIndexInterval)
         {
-            // ReadFile failed with ERROR_OPERATION_ABORTED: time must be up
-            dbgOut.locked() << L"ReadPipeToFile for PID " << dwPID << L" ERROR_OPERATION_ABORTED - time must be up" << std::endl;
+            const std::wstring sIndex = sTarget + szLineIndexExtension;
+            uint32_t dwError = 0;
+            PlatformFile_t hIndex = PlatformCreateFile(sIndex, dwError);
+            if (PlatformInvalidFile != hIndex)
+                pSink.reset(new RedirLineIndexSink_t(options.nLineIndexInterval, hIndex, std::move(pSink)));
+            else
+                std::wcerr << L"Cannot create line index " << sIndex << L": " << SysErrorMessageWithCode(dwError) << std::endl;
         }
-        else
-            std::wcerr << L"ReadFile error with PID " << dwPID << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
-        bContinue = (rfRet && dwRead > 0);
-        if (bContinue)
+        if (nullptr != options.pTimeIndexBase)
         {
-            DWORD dwWritten = 0;
-            BOOL ret = WriteFile(hDestination, buffer, dwRead, &dwWritten, NULL);
-            if (ret)
-            {
-                if (dwRead != dwWritten)
-                    std::wcerr << L"WriteFile anomaly: read " << dwRead << L" bytes but wrote " << dwWritten << std::endl;
-            }
+            const std::wstring sIndex = sTarget + szTimeIndexExtension;
+            uint32_t dwError = 0;
+            PlatformFile_t hIndex = PlatformCreateFile(sIndex, dwError);
+            if (PlatformInvalidFile != hIndex)
+                pSink.reset(new RedirTimeIndexSink_t(*options.pTimeIndexBase, hIndex, std::move(pSink)));
             else
-            {
-                dwLastErr = GetLastError();
-                std::wcerr << L"WriteFile error: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
-            }
+                std::wcerr << L"Cannot create time index " << sIndex << L": " << SysErrorMessageWithCode(dwError) << std::endl;
         }
     }
-    delete[] buffer;
-    return true;
+    // The quota applies to the output itself, before it's processed, so that dropped output costs nothing more
+    if (nullptr != options.pQuota)
+        pSink.reset(new RedirQuotaSink_t(*options.pQuota, std::move(pSink)));
+    // Secrets are masked before anything is kept, shown, or counted against the quota
+    if (nullptr != options.pRedaction)
+        pSink.reset(new RedirRedactSink_t(*options.pRedaction, std::move(pSink)));
+    // Patterns are matched against all of the output, including what the quota drops
+    if (nullptr != pMatches)
+        pSink.reset(new RedirMatchSink_t(*options.pPatterns, *pMatches, std::move(pSink)));
+    return pSink.release();
 }
 
 /// <summary>
@@ -82,7 +172,7 @@ static DWORD WINAPI StderrMonitor(LPVOID lpvThreadParameter)
 
     dbgOut.locked() << L"StderrMonitor start for PID " << pSPI->process.dwPID << std::endl;
 
-    bool ret = ReadPipeToFile(pSPI->process.hPipeStderrRd, pSPI->process.hStderrRedirTarget, pSPI);
+    bool ret = ReadPipeToFile(pSPI->process.hPipeStderrRd, *pSPI->process.pStderrSink, pSPI);
 
     dbgOut.locked() << L"StderrMonitor exit for PID " << pSPI->process.dwPID << L"; ReadPipeToFile returned " << ret << std::endl;
 
@@ -107,7 +197,7 @@ static DWORD WINAPI StdoutMonitor(LPVOID lpvThreadParameter)
         pSPI->process.hThread_StderrMonitor = CreateThread(NULL, 0, StderrMonitor, CreateCrossThreadpSPI(pSPI), 0, NULL);
     }
 
-    bool ret = ReadPipeToFile(pSPI->process.hPipeStdoutRd, pSPI->process.hStdoutRedirTarget, pSPI);
+    bool ret = ReadPipeToFile(pSPI->process.hPipeStdoutRd, *pSPI->process.pStdoutSink, pSPI);
 
     dbgOut.locked() << L"StdoutMonitor exit for PID " << pSPI->process.dwPID << L"; ReadPipeToFile returned " << ret << std::endl;
 
@@ -115,18 +205,45 @@ static DWORD WINAPI StdoutMonitor(LPVOID lpvThreadParameter)
 }
 
 /// <summary>
-/// Sets up everything for redirecting a target process' stdout/stderr to a destination
+/// Thread function to write the run's input (script or -stdin file) to the process' stdin, and then close it so that the process sees its end.
+/// </summary>
+/// <param name="lpvThreadParameter">Input: pointer to ptrSessionProcessInfo_t returned by CreateCrossThreadpSPI, referencing the process to write to</param>
+/// <returns></returns>
+static DWORD WINAPI StdinFeeder(LPVOID lpvThreadParameter)
+{
+    // Use ConsumeCrossThreadpSPI to properly handle object passed via CreateThread.
+    ptrSessionProcessInfo_t pSPI;
+    ConsumeCrossThreadpSPI(pSPI, lpvThreadParameter);
+
+    const size_t cbData = pSPI->process.cbStdinData;
+    size_t cbWritten = 0;
+    uint32_t dwError = 0;
+    const bool ret = FeedPipe(pSPI->process.hPipeStdinWr, pSPI->process.pStdinData, cbData, cbWritten, dwError);
+    CloseHandle(pSPI->process.hPipeStdinWr);
+    pSPI->process.hPipeStdinWr = NULL;
+
+    dbgOut.locked() << L"StdinFeeder exit for PID " << pSPI->process.dwPID << L"; wrote " << cbWritten << L" of " << cbData << L" bytes" << std::endl;
+    // Canceled when monitoring stopped at a deadline; otherwise the process didn't read all of its input (e.g., it exited)
+    if (!ret && ERROR_OPERATION_ABORTED != dwError)
+        std::wcerr << L"Could not write all of its input to PID " << pSPI->process.dwPID << L" (" << cbWritten << L" of " << cbData << L" bytes): " << SysErrorMessageWithCode(dwError) << std::endl;
+
+    return 0;
+}
+
+/// <summary>
+/// Sets up everything for redirecting a target process' stdout/stderr to a destination, and for writing to its stdin
 /// </summary>
 /// <param name="pSPI">ptrSessionProcessInfo_t for the process to monitor</param>
-/// <param name="bRedirStd">Input: whether to redirect stdout/stderr</param>
-/// <param name="bMergeStd">Input: whether to merge stderr into stdout</param>
-/// <param name="sRedirStdDirectory">Input: directory in which to create output file(s) for redirection; if empty, then redirect to this process' stdout/stderr</param>
+/// <param name="options">Input: whether and where to redirect stdout/stderr, and how to process the output on the way</param>
 /// <returns></returns>
-bool SetUpRedirection(ptrSessionProcessInfo_t& pSPI, bool bRedirStd, bool bMergeStd, const std::wstring& sRedirStdDirectory)
+bool SetUpRedirection(ptrSessionProcessInfo_t& pSPI, const RedirOptions_t& options)
 {
     // Nothing to do
-	if (!bRedirStd)
+	if (!options.bRedirStd)
 		return true;
+	const std::wstring& sRedirStdDirectory = options.sDirectory;
+	const bool bMergeStd = options.bMergeStd;
+	std::wstring sStdoutTarget, sStderrTarget;
 
     // Redirecting stdout/stderr to file(s) in the named directory
 	if (sRedirStdDirectory.length() > 0)
@@ -138,6 +255,16 @@ bool SetUpRedirection(ptrSessionProcessInfo_t& pSPI, bool bRedirStd, bool bMerge
 		std::wstring sTimestampForFilename = TimestampUTCforFilepath(false);
 		strFnameStdout << sRedirStdDirectory << L"\\S_" << pSPI->session.dwSessionId << L"_P_" << pSPI->process.dwPID << L"_stdout_" << sTimestampForFilename << L".txt";
 		strFnameStderr << sRedirStdDirectory << L"\\S_" << pSPI->session.dwSessionId << L"_P_" << pSPI->process.dwPID << L"_stderr_" << sTimestampForFilename << L".txt";
+		if (nullptr != options.pChunkStore)
+		{
+			strFnameStdout << szDedupManifestExtension;
+			strFnameStderr << szDedupManifestExtension;
+		}
+		else if (options.nCompressLevel > 0)
+		{
+			strFnameStdout << szCompressedCaptureExtension;
+			strFnameStderr << szCompressedCaptureExtension;
+		}
 
         // Create the file where redirected stdout goes
 		pSPI->process.hStdoutRedirTarget = CreateFileW(
@@ -153,6 +280,12 @@ bool SetUpRedirection(ptrSessionProcessInfo_t& pSPI, bool bRedirStd, bool bMerge
 			DWORD dwLastErr = GetLastError();
 			std::wcerr << L"CreateFileW failed for " << strFnameStdout.str() << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
 		}
+		else
+		{
+			sStdoutTarget = strFnameStdout.str();
+			if (IntegrityHash_t::None != options.integrityHash)
+				pSPI->process.sStdoutRedirFile = GetFileNameFromFilePath(sStdoutTarget);
+		}
 
         // If stderr isn't redirected into stdout, create the file where redirected stderr goes
 		if (!bMergeStd)
@@ -170,6 +303,12 @@ bool SetUpRedirection(ptrSessionProcessInfo_t& pSPI, bool bRedirStd, bool bMerge
 				DWORD dwLastErr = GetLastError();
 				std::wcerr << L"CreateFileW failed for " << strFnameStderr.str() << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
 			}
+			else
+			{
+				sStderrTarget = strFnameStderr.str();
+				if (IntegrityHash_t::None != options.integrityHash)
+					pSPI->process.sStderrRedirFile = GetFileNameFromFilePath(sStderrTarget);
+			}
 		}
 	}
 	else
@@ -180,9 +319,33 @@ bool SetUpRedirection(ptrSessionProcessInfo_t& pSPI, bool bRedirStd, bool bMerge
 			pSPI->process.hStderrRedirTarget = GetStdHandle(STD_ERROR_HANDLE);
 	}
 
+    // What the monitor threads write to
+    if (nullptr != options.pPatterns)
+        pSPI->process.pMatches.reset(new ProcessMatchResults_t(*options.pPatterns, pSPI->process));
+    pSPI->process.pStdoutSink.reset(CreateRedirSink(pSPI->process.hStdoutRedirTarget, sStdoutTarget, options, pSPI->process.pMatches.get(), pSPI->process.pStdoutHash));
+    if (NULL != pSPI->process.hStderrRedirTarget)
+        pSPI->process.pStderrSink.reset(CreateRedirSink(pSPI->process.hStderrRedirTarget, sStderrTarget, options, pSPI->process.pMatches.get(), pSPI->process.pStderrHash));
+
     // Start the thread to monitor the stdout pipe; if necessary it will start another thread to monitor the stderr pipe.
     // Use CreateCrossThreadpSPI to get an address of a ptrSessionProcessInfo_t that is safe to pass via CreateThread.
     pSPI->process.hThread_StdoutMonitor = CreateThread(NULL, 0, StdoutMonitor, CreateCrossThreadpSPI(pSPI), 0, NULL);
 
+    // Write the input to its stdin on a thread of its own, so that the processes all get it at the same time, each
+    // as fast as it reads it: a process that's slow to read blocks only its own thread
+    if (nullptr != options.pStdinData && NULL != pSPI->process.hPipeStdinWr)
+    {
+        pSPI->process.pStdinData = options.pStdinData;
+        pSPI->process.cbStdinData = options.cbStdinData;
+        pSPI->process.hThread_StdinFeeder = CreateThread(NULL, 0, StdinFeeder, CreateCrossThreadpSPI(pSPI), 0, NULL);
+        if (NULL == pSPI->process.hThread_StdinFeeder)
+        {
+            DWORD dwLastErr = GetLastError();
+            std::wcerr << L"Cannot start writing input to PID " << pSPI->process.dwPID << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+            // Closing its stdin ends its input, with nothing in it
+            CloseHandle(pSPI->process.hPipeStdinWr);
+            pSPI->process.hPipeStdinWr = NULL;
+        }
+    }
+
 	return true;
 }
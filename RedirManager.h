@@ -2,17 +2,56 @@
 
 #include "ProcessManager.h"
 
+class ChunkStore_t;
+class OutputQuota_t;
+class PatternSet_t;
+class RedactionRules_t;
+struct TimeIndexBase_t;
+
+/// <summary>
+/// Exit code of a process terminated because its output matched a Terminate pattern (see RedirMatch.h)
+/// </summary>
+const DWORD MatchTerminationExitCode = ERROR_CANCELLED;
+
+/// <summary>
+/// How target processes' stdout/stderr are redirected, from the command line
+/// </summary>
+struct RedirOptions_t
+{
+	// Whether to redirect stdout/stderr, and whether to merge stderr into stdout
+	bool bRedirStd = false;
+	bool bMergeStd = false;
+	// Directory in which to create output file(s) for redirection; if empty, then redirect to this process' stdout/stderr
+	std::wstring sDirectory;
+	// If non-zero, compress the output files at this level (see RedirCompress.h)
+	int nCompressLevel = 0;
+	// If not null, store the output in this run-wide chunk store and write manifests as the output files (see RedirDedup.h)
+	ChunkStore_t* pChunkStore = nullptr;
+	// If not null, limit how much of each process' output is kept (see RedirQuota.h)
+	OutputQuota_t* pQuota = nullptr;
+	// If not null, look for these patterns in each process' output, and act on them (see RedirMatch.h)
+	const PatternSet_t* pPatterns = nullptr;
+	// If not null, mask secrets in each process' output before it's stored or shown (see RedirRedact.h)
+	RedactionRules_t* pRedaction = nullptr;
+	// If not None, hash each output file as it's written, for an integrity manifest (see RedirHash.h)
+	IntegrityHash_t integrityHash = IntegrityHash_t::None;
+	// If not null, record when each output file's content arrives in a time index next to it (see RedirTimeIndex.h)
+	const TimeIndexBase_t* pTimeIndexBase = nullptr;
+	// If non-zero, index each output file's lines, with a checkpoint every this many lines, in a line index next to it (see RedirLineIndex.h)
+	uint32_t nLineIndexInterval = 0;
+	// If not null, write these cbStdinData bytes to each process' stdin, and then close it (-pf, -stdin). Shared by
+	// all processes, not copied; must outlive the redirection monitors.
+	const uint8_t* pStdinData = nullptr;
+	size_t cbStdinData = 0;
+};
+
 /// <summary>
-/// Sets up everything for redirecting a target process' stdout/stderr to a destination
+/// Sets up everything for redirecting a target process' stdout/stderr to a destination, and for writing to its stdin
 /// </summary>
 /// <param name="pSPI">ptrSessionProcessInfo_t for the process to monitor</param>
-/// <param name="bRedirStd">Input: whether to redirect stdout/stderr</param>
-/// <param name="bMergeStd">Input: whether to merge stderr into stdout</param>
-/// <param name="sRedirStdDirectory">Input: directory in which to create output file(s) for redirection; if empty, then redirect to this process' stdout/stderr</param>
+/// <param name="options">Input: whether and where to redirect stdout/stderr, and how to process the output on the way</param>
 /// <returns></returns>
 bool SetUpRedirection(
 	ptrSessionProcessInfo_t& pSPI,
-	bool bRedirStd,
-	bool bMergeStd,
-	const std::wstring& sRedirStdDirectory
+	const RedirOptions_t& options
 );
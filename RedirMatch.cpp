@@ -0,0 +1,244 @@
+// Pattern matching on redirected output: see RedirMatch.h.
+
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include "RedirMatch.h"
+
+bool PatternSet_t::Add(const std::wstring& sLabel, const std::string& sBytes, MatchAction_t action)
+{
+    if (sBytes.empty())
+        return false;
+    m_patterns.push_back(Pattern_t{ sLabel, sBytes, action });
+    return true;
+}
+
+bool PatternSet_t::HasAction(MatchAction_t action) const
+{
+    for (const Pattern_t& pattern : m_patterns)
+    {
+        if (action == pattern.action)
+            return true;
+    }
+    return false;
+}
+
+void PatternSet_t::Build()
+{
+    // The trie of the patterns, in the transition table: state 0 is the root, and while building, 0 also
+    // means "no edge" (no edge leads back to the root)
+    m_transitions.assign(256, 0);
+    std::vector<std::vector<uint32_t>> vOutputs(1);
+    for (size_t ixPattern = 0; ixPattern < m_patterns.size(); ++ixPattern)
+    {
+        uint32_t nState = 0;
+        for (const char ch : m_patterns[ixPattern].sBytes)
+        {
+            uint32_t& nNext = m_transitions[(size_t(nState) << 8) | uint8_t(ch)];
+            if (0 == nNext)
+            {
+                nNext = uint32_t(vOutputs.size());
+                vOutputs.emplace_back();
+                m_transitions.resize(m_transitions.size() + 256, 0);
+            }
+            // (m_transitions might have been reallocated; don't use nNext's reference after this)
+            nState = m_transitions[(size_t(nState) << 8) | uint8_t(ch)];
+        }
+        vOutputs[nState].push_back(uint32_t(ixPattern));
+    }
+
+    // Breadth first, so that each state's failure state (the longest proper suffix of its path that's also
+    // a path in the trie) is complete before the state is: fill in the missing edges with the failure
+    // state's edges, and add the failure state's outputs to the state's own.
+    std::vector<uint32_t> vFailure(vOutputs.size(), 0);
+    std::deque<uint32_t> queue;
+    for (int nByte = 0; nByte < 256; ++nByte)
+    {
+        const uint32_t nChild = m_transitions[nByte];
+        if (0 != nChild)
+            queue.push_back(nChild);
+    }
+    while (!queue.empty())
+    {
+        const uint32_t nState = queue.front();
+        queue.pop_front();
+        const std::vector<uint32_t>& vFailureOutputs = vOutputs[vFailure[nState]];
+        vOutputs[nState].insert(vOutputs[nState].end(), vFailureOutputs.begin(), vFailureOutputs.end());
+        for (int nByte = 0; nByte < 256; ++nByte)
+        {
+            uint32_t& nNext = m_transitions[(size_t(nState) << 8) | nByte];
+            const uint32_t nFailureNext = m_transitions[(size_t(vFailure[nState]) << 8) | nByte];
+            if (0 != nNext)
+            {
+                vFailure[nNext] = nFailureNext;
+                queue.push_back(nNext);
+            }
+            else
+            {
+                nNext = nFailureNext;
+            }
+        }
+    }
+
+    // Flatten the outputs, and flag the edges into states that have them
+    m_outputStart.assign(1, 0);
+    m_outputs.clear();
+    for (const std::vector<uint32_t>& vStateOutputs : vOutputs)
+    {
+        m_outputs.insert(m_outputs.end(), vStateOutputs.begin(), vStateOutputs.end());
+        m_outputStart.push_back(uint32_t(m_outputs.size()));
+    }
+    for (uint32_t& nNext : m_transitions)
+    {
+        if (!vOutputs[nNext].empty())
+            nNext |= OutputFlag;
+    }
+
+    // The bytes that leave the root, for skipping ahead while nothing is partly matched
+    m_vSearchedStartBytes.clear();
+    for (int nByte = 0; nByte < 256; ++nByte)
+    {
+        m_bStartsPattern[nByte] = (0 != m_transitions[nByte]);
+        if (m_bStartsPattern[nByte])
+            m_vSearchedStartBytes.push_back(uint8_t(nByte));
+    }
+    if (m_vSearchedStartBytes.size() > MaxSearchedStartBytes)
+        m_vSearchedStartBytes.clear();
+}
+
+uint64_t PatternSet_t::Scan(uint32_t& nState, const uint8_t* pData, size_t cbData, uint64_t* pCounts) const
+{
+    if (m_transitions.empty())
+        return 0;
+    uint64_t nMatches = 0;
+    uint32_t nCurrent = nState;
+    const uint8_t* p = pData;
+    const uint8_t* const pEnd = pData + cbData;
+    // Next occurrence of each searched start byte (pEnd if none); searched again only once it's been passed,
+    // so that each one's search covers the data once
+    const size_t nSearched = m_vSearchedStartBytes.size();
+    const uint8_t* apNextStart[MaxSearchedStartBytes];
+    for (size_t ix = 0; ix < nSearched; ++ix)
+        apNextStart[ix] = pData;
+    bool bSearchedFirst = false;
+    while (p < pEnd)
+    {
+        if (InitialState == nCurrent)
+        {
+            // Nothing partly matched: skip to the next byte that can start a pattern
+            if (nSearched > 0)
+            {
+                const uint8_t* pNext = pEnd;
+                for (size_t ix = 0; ix < nSearched; ++ix)
+                {
+                    if (apNextStart[ix] < p || !bSearchedFirst)
+                    {
+                        const void* pFound = memchr(p, m_vSearchedStartBytes[ix], size_t(pEnd - p));
+                        apNextStart[ix] = (nullptr != pFound) ? (const uint8_t*)pFound : pEnd;
+                    }
+                    if (apNextStart[ix] < pNext)
+                        pNext = apNextStart[ix];
+                }
+                bSearchedFirst = true;
+                p = pNext;
+                if (p == pEnd)
+                    break;
+            }
+            else
+            {
+                while (p < pEnd && !m_bStartsPattern[*p])
+                    ++p;
+                if (p == pEnd)
+                    break;
+            }
+        }
+        const uint32_t nNext = m_transitions[(size_t(nCurrent) << 8) | *p++];
+        nCurrent = nNext & ~OutputFlag;
+        if (0 != (nNext & OutputFlag))
+        {
+            for (uint32_t ix = m_outputStart[nCurrent]; ix < m_outputStart[nCurrent + 1]; ++ix)
+                ++pCounts[m_outputs[ix]];
+            nMatches += m_outputStart[nCurrent + 1] - m_outputStart[nCurrent];
+        }
+    }
+    nState = nCurrent;
+    return nMatches;
+}
+
+// ------------------------------------------------------------------------------------------
+
+MatchResults_t::MatchResults_t(const PatternSet_t& patterns)
+    : m_patterns(patterns), m_counts(patterns.Size(), 0), m_ixTerminal(patterns.Size())
+{
+}
+
+void MatchResults_t::Add(const uint64_t* pCounts)
+{
+    size_t ixNewTerminal = m_patterns.Size();
+    {
+        PlatformLock_t lock(m_mutex);
+        for (size_t ix = 0; ix < m_counts.size(); ++ix)
+        {
+            m_counts[ix] += pCounts[ix];
+            if (pCounts[ix] > 0 && m_ixTerminal == m_patterns.Size() && MatchAction_t::Terminate == m_patterns.Action(ix))
+                m_ixTerminal = ixNewTerminal = ix;
+        }
+    }
+    // Outside the lock, as it can take a while
+    if (ixNewTerminal < m_patterns.Size())
+        OnTerminalMatch(ixNewTerminal);
+}
+
+std::vector<uint64_t> MatchResults_t::Counts()
+{
+    PlatformLock_t lock(m_mutex);
+    return m_counts;
+}
+
+bool MatchResults_t::Terminated()
+{
+    PlatformLock_t lock(m_mutex);
+    return m_ixTerminal < m_patterns.Size();
+}
+
+std::wstring MatchResults_t::Summary()
+{
+    PlatformLock_t lock(m_mutex);
+    std::wstringstream strSummary;
+    const wchar_t* szSeparator = L"";
+    for (size_t ix = 0; ix < m_counts.size(); ++ix)
+    {
+        if (0 == m_counts[ix])
+            continue;
+        strSummary << szSeparator;
+        szSeparator = L", ";
+        if (ix == m_ixTerminal)
+            strSummary << L"terminated on ";
+        else if (MatchAction_t::Count != m_patterns.Action(ix))
+            strSummary << L"tagged ";
+        strSummary << L"\"" << m_patterns.Label(ix) << L"\"";
+        if (m_counts[ix] > 1)
+            strSummary << L" x" << m_counts[ix];
+    }
+    return strSummary.str();
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirMatchSink_t::RedirMatchSink_t(const PatternSet_t& patterns, MatchResults_t& results, std::unique_ptr<RedirSink_t> pNext)
+    : m_patterns(patterns), m_results(results), m_pNext(std::move(pNext)), m_counts(patterns.Size(), 0)
+{
+}
+
+bool RedirMatchSink_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    const uint64_t nMatches = m_patterns.Scan(m_nState, pData, cbData, m_counts.data());
+    // Pass the data on before acting on the matches, so that the output up to a terminal marker is kept
+    const bool bOk = m_pNext->Write(pData, cbData, cbWritten, dwError);
+    if (nMatches > 0)
+    {
+        m_results.Add(m_counts.data());
+        m_counts.assign(m_counts.size(), 0);
+    }
+    return bOk;
+}
@@ -0,0 +1,192 @@
+// Pattern matching on redirected output: looks for fixed strings in each target process' output as it's
+// redirected, so that the run can report which processes wrote "ERROR" (and how often) or a success marker
+// without anyone having to search the output files afterward, and so that a process that has written a
+// known-final marker can be terminated right away instead of being waited for while it hangs in cleanup.
+//
+// All of a run's patterns are compiled into one automaton (Aho-Corasick, as a full transition table over bytes),
+// so each byte of output is examined once no matter how many patterns there are, and matches that span reads
+// are found. While no pattern is partly matched, the scan skips ahead to the next byte that can start a
+// pattern with memchr (which the C runtime vectorizes), as long as the patterns start with only a few
+// different bytes.
+//
+// Patterns are matched against the output's bytes, case-sensitively; overlapping matches all count.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "RedirPump.h"
+
+/// <summary>
+/// What a match of a pattern does, besides being counted
+/// </summary>
+enum class MatchAction_t
+{
+    Count,      // Nothing more
+    Tag,        // Reports the pattern with the process' result
+    Terminate   // Reports the pattern with the process' result and terminates the process (and its descendants)
+};
+
+/// <summary>
+/// A run's patterns, compiled for scanning. Built once, then shared (read-only) by all the run's sinks.
+/// </summary>
+class PatternSet_t
+{
+public:
+    PatternSet_t() = default;
+
+    /// <summary>
+    /// Adds a pattern. Call before Build.
+    /// </summary>
+    /// <param name="sLabel">Input: how the pattern is shown in reports</param>
+    /// <param name="sBytes">Input: the bytes to look for; must not be empty</param>
+    /// <param name="action">Input: what a match does</param>
+    /// <returns>true if successful; false if sBytes is empty</returns>
+    bool Add(const std::wstring& sLabel, const std::string& sBytes, MatchAction_t action);
+
+    /// <summary>
+    /// Compiles the patterns added so far
+    /// </summary>
+    void Build();
+
+    bool Empty() const { return m_patterns.empty(); }
+    size_t Size() const { return m_patterns.size(); }
+    const std::wstring& Label(size_t ixPattern) const { return m_patterns[ixPattern].sLabel; }
+    MatchAction_t Action(size_t ixPattern) const { return m_patterns[ixPattern].action; }
+
+    /// <summary>
+    /// Returns true if any pattern has the specified action
+    /// </summary>
+    bool HasAction(MatchAction_t action) const;
+
+    /// <summary>
+    /// Scanner state of a stream that hasn't been scanned yet
+    /// </summary>
+    static const uint32_t InitialState = 0;
+
+    /// <summary>
+    /// Scans data, continuing from where the previous call for the same stream left off
+    /// </summary>
+    /// <param name="nState">Input/output: the stream's scanner state; InitialState for a new stream</param>
+    /// <param name="pData">Input: the data</param>
+    /// <param name="cbData">Input: number of bytes</param>
+    /// <param name="pCounts">Input/output: one counter per pattern; incremented for each match</param>
+    /// <returns>Number of matches found</returns>
+    uint64_t Scan(uint32_t& nState, const uint8_t* pData, size_t cbData, uint64_t* pCounts) const;
+
+private:
+    struct Pattern_t
+    {
+        std::wstring sLabel;
+        std::string sBytes;
+        MatchAction_t action;
+    };
+    std::vector<Pattern_t> m_patterns;
+
+    // Transition table: 256 entries per state; the high bit of an entry is set if the state it leads to
+    // completes one or more patterns
+    static const uint32_t OutputFlag = 0x80000000;
+    std::vector<uint32_t> m_transitions;
+    // The patterns each state completes: m_outputs[m_outputStart[state]] up to m_outputs[m_outputStart[state + 1]]
+    std::vector<uint32_t> m_outputStart, m_outputs;
+    // Whether each byte can start a pattern; and the bytes that can, if there are few enough to search for
+    // each with memchr (otherwise none)
+    static const size_t MaxSearchedStartBytes = 4;
+    bool m_bStartsPattern[256] = {};
+    std::vector<uint8_t> m_vSearchedStartBytes;
+
+private:
+    // Not implemented
+    PatternSet_t(const PatternSet_t&) = delete;
+    PatternSet_t& operator = (const PatternSet_t&) = delete;
+};
+
+/// <summary>
+/// Match counts for one target process, shared by the sinks for its stdout and stderr. Derived classes
+/// act on the first match of a Terminate pattern.
+/// </summary>
+class MatchResults_t
+{
+public:
+    /// <param name="patterns">Input: the run's patterns; must outlive this object</param>
+    explicit MatchResults_t(const PatternSet_t& patterns);
+    virtual ~MatchResults_t() {}
+
+    /// <summary>
+    /// Adds a stream's counts. Can be called from any thread. Calls OnTerminalMatch (once per process, on
+    /// the calling thread) when a Terminate pattern is first seen.
+    /// </summary>
+    /// <param name="pCounts">Input: one count per pattern</param>
+    void Add(const uint64_t* pCounts);
+
+    const PatternSet_t& Patterns() const { return m_patterns; }
+
+    /// <summary>
+    /// Count of each pattern's matches so far
+    /// </summary>
+    std::vector<uint64_t> Counts();
+
+    /// <summary>
+    /// Describes the matches for a report: e.g., "ERROR" x3, tagged "Completed", terminated on "Done."
+    /// </summary>
+    /// <returns>The description; empty if nothing matched</returns>
+    std::wstring Summary();
+
+    /// <summary>
+    /// Returns true if a Terminate pattern has been seen
+    /// </summary>
+    bool Terminated();
+
+protected:
+    /// <summary>
+    /// Called once, on a monitor thread, when a Terminate pattern is first seen
+    /// </summary>
+    /// <param name="ixPattern">Input: the pattern</param>
+    virtual void OnTerminalMatch(size_t ixPattern) { (void)ixPattern; }
+
+private:
+    const PatternSet_t& m_patterns;
+    PlatformMutex_t m_mutex;
+    std::vector<uint64_t> m_counts;
+    // The first Terminate pattern seen; Size() of the pattern set if none
+    size_t m_ixTerminal;
+
+private:
+    // Not implemented
+    MatchResults_t(const MatchResults_t&) = delete;
+    MatchResults_t& operator = (const MatchResults_t&) = delete;
+};
+
+/// <summary>
+/// Sink that scans the data for the run's patterns and passes it on, unchanged, to the next sink
+/// </summary>
+class RedirMatchSink_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="patterns">Input: the run's patterns, already built; must outlive this object</param>
+    /// <param name="results">Input: where the process' match counts go; must outlive this object</param>
+    /// <param name="pNext">Input: where the data goes; now owned by this object</param>
+    RedirMatchSink_t(const PatternSet_t& patterns, MatchResults_t& results, std::unique_ptr<RedirSink_t> pNext);
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override { return m_pNext->Finish(dwError); }
+
+private:
+    const PatternSet_t& m_patterns;
+    MatchResults_t& m_results;
+    std::unique_ptr<RedirSink_t> m_pNext;
+    uint32_t m_nState = PatternSet_t::InitialState;
+    // Counts for the current Write, passed on to m_results only if anything matched
+    std::vector<uint64_t> m_counts;
+
+private:
+    // Not implemented
+    RedirMatchSink_t(const RedirMatchSink_t&) = delete;
+    RedirMatchSink_t& operator = (const RedirMatchSink_t&) = delete;
+};
@@ -0,0 +1,86 @@
+// Copying a target process' redirected output from a pipe to its destination, and writing a target process' input
+// (e.g., a script) to a pipe.
+
+#include <memory>
+#include "RedirPump.h"
+
+/// <summary>
+/// Copies data from a named or anonymous pipe to a file object until the write end of the pipe is
+/// closed (e.g., the process exits), the read is canceled, or a read error occurs.
+/// </summary>
+/// <param name="hPipe">Input: pipe to read from</param>
+/// <param name="hDestination">Input: file object to write to</param>
+/// <param name="observer">Input: receives notifications of reads, write errors, and the end of the pump</param>
+/// <returns>Total number of bytes read from the pipe</returns>
+uint64_t PumpPipeToFile(PlatformFile_t hPipe, PlatformFile_t hDestination, RedirPumpObserver_t& observer)
+{
+    RedirFileSink_t sink(hDestination);
+    return PumpPipeToSink(hPipe, sink, observer);
+}
+
+/// <summary>
+/// Copies data from a named or anonymous pipe to a sink until the write end of the pipe is closed, the read
+/// is canceled, or a read error occurs, and then finishes the sink.
+/// </summary>
+/// <param name="hPipe">Input: pipe to read from</param>
+/// <param name="sink">Input: where the data goes</param>
+/// <param name="observer">Input: receives notifications of reads, write errors, and the end of the pump</param>
+/// <returns>Total number of bytes read from the pipe</returns>
+uint64_t PumpPipeToSink(PlatformFile_t hPipe, RedirSink_t& sink, RedirPumpObserver_t& observer)
+{
+    // The buffer contents are passed through as-is and never interpreted as a string, so there's no need
+    // to clear it, initially or between reads; pages that are never filled are never touched.
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[RedirPumpBufferSize]);
+    uint64_t ullTotal = 0;
+
+    for (;;)
+    {
+        size_t cbRead = 0;
+        uint32_t dwError = 0;
+        // Read from the pipe until it's empty
+        PlatformIoResult_t result = PlatformRead(hPipe, buffer.get(), RedirPumpBufferSize, cbRead, dwError);
+        if (PlatformIoResult_t::Success != result)
+        {
+            // Whatever the sink is still holding goes out before the end is reported
+            uint32_t dwFinishError = 0;
+            if (!sink.Finish(dwFinishError))
+                observer.OnWriteError(0, 0, dwFinishError);
+            observer.OnEnd(result, dwError);
+            return ullTotal;
+        }
+
+        ullTotal += cbRead;
+        observer.OnRead(cbRead);
+
+        size_t cbWritten = 0;
+        if (!sink.Write(buffer.get(), cbRead, cbWritten, dwError))
+            observer.OnWriteError(cbRead, cbWritten, dwError);
+    }
+}
+
+/// <summary>
+/// Writes all of a buffer to a pipe (e.g., a script to a target process' stdin), a piece at a time, until it's all
+/// written, the reader closes its end, or the write is canceled. Doesn't close the pipe.
+/// </summary>
+/// <param name="hPipe">Input: pipe to write to</param>
+/// <param name="pData">Input: data to write</param>
+/// <param name="cbData">Input: number of bytes to write</param>
+/// <param name="cbWritten">Output: number of bytes written</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if all of the data was written; false otherwise</returns>
+bool FeedPipe(PlatformFile_t hPipe, const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    cbWritten = 0;
+    dwError = 0;
+    // A piece at a time, so that what the reader got is known if it stops reading partway
+    while (cbWritten < cbData)
+    {
+        const size_t cbPiece = (cbData - cbWritten < FeedPipeWriteSize) ? cbData - cbWritten : FeedPipeWriteSize;
+        size_t cbPieceWritten = 0;
+        const bool bOk = PlatformWrite(hPipe, pData + cbWritten, cbPiece, cbPieceWritten, dwError);
+        cbWritten += cbPieceWritten;
+        if (!bOk)
+            return false;
+    }
+    return true;
+}
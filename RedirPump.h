@@ -0,0 +1,126 @@
+// Copying a target process' redirected output from a pipe to its destination, and writing a target process' input
+// (e.g., a script) to a pipe.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "Platform.h"
+
+/// <summary>
+/// Receives notifications from PumpPipeToFile, for diagnostics and instrumentation.
+/// The default implementations do nothing. Called on the thread running PumpPipeToFile.
+/// </summary>
+class RedirPumpObserver_t
+{
+public:
+    virtual ~RedirPumpObserver_t() {}
+
+    /// <summary>
+    /// Called after each successful read, before the data is written to the destination
+    /// </summary>
+    /// <param name="cbRead">Input: number of bytes read</param>
+    virtual void OnRead(size_t cbRead) { (void)cbRead; }
+
+    /// <summary>
+    /// Called when writing to the destination fails or doesn't write everything. The pump keeps reading.
+    /// (If finishing the sink fails, this is called with cbRead and cbWritten both 0.)
+    /// </summary>
+    /// <param name="cbRead">Input: number of bytes read</param>
+    /// <param name="cbWritten">Input: number of bytes written</param>
+    /// <param name="dwError">Input: error code, if the write failed</param>
+    virtual void OnWriteError(size_t cbRead, size_t cbWritten, uint32_t dwError) { (void)cbRead; (void)cbWritten; (void)dwError; }
+
+    /// <summary>
+    /// Called once, when the pump stops reading
+    /// </summary>
+    /// <param name="result">Input: why the pump stopped: EndOfFile, Canceled, or Error</param>
+    /// <param name="dwError">Input: error code, if result is Error</param>
+    virtual void OnEnd(PlatformIoResult_t result, uint32_t dwError) { (void)result; (void)dwError; }
+};
+
+/// <summary>
+/// Where a pump's data goes: either a file, or a stage that processes the data on its way to the file (e.g.,
+/// compression) and passes the result on to the next sink. Called only on the thread running the pump.
+/// </summary>
+class RedirSink_t
+{
+public:
+    virtual ~RedirSink_t() {}
+
+    /// <summary>
+    /// Consume data read from the pipe
+    /// </summary>
+    /// <param name="pData">Input: the data</param>
+    /// <param name="cbData">Input: number of bytes</param>
+    /// <param name="cbWritten">Output: number of the input bytes consumed</param>
+    /// <param name="dwError">Output: error code on failure</param>
+    /// <returns>true if all the data was consumed; false otherwise</returns>
+    virtual bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) = 0;
+
+    /// <summary>
+    /// Called once, after the last Write: pass on anything still buffered.
+    /// </summary>
+    /// <returns>true if successful; false otherwise</returns>
+    virtual bool Finish(uint32_t& dwError) { dwError = 0; return true; }
+};
+
+/// <summary>
+/// Sink that writes to a file object (which it doesn't own)
+/// </summary>
+class RedirFileSink_t : public RedirSink_t
+{
+public:
+    explicit RedirFileSink_t(PlatformFile_t hFile) : m_hFile(hFile) {}
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override
+    {
+        return PlatformWrite(m_hFile, pData, cbData, cbWritten, dwError) && cbWritten == cbData;
+    }
+
+private:
+    PlatformFile_t m_hFile;
+};
+
+/// <summary>
+/// Number of bytes PumpPipeToFile tries to read at a time
+/// </summary>
+const size_t RedirPumpBufferSize = 1024 * 1024;
+
+/// <summary>
+/// Copies data from a named or anonymous pipe to a file object until the write end of the pipe is
+/// closed (e.g., the process exits), the read is canceled, or a read error occurs.
+/// </summary>
+/// <param name="hPipe">Input: pipe to read from</param>
+/// <param name="hDestination">Input: file object to write to</param>
+/// <param name="observer">Input: receives notifications of reads, write errors, and the end of the pump</param>
+/// <returns>Total number of bytes read from the pipe</returns>
+uint64_t PumpPipeToFile(PlatformFile_t hPipe, PlatformFile_t hDestination, RedirPumpObserver_t& observer);
+
+/// <summary>
+/// Copies data from a named or anonymous pipe to a sink until the write end of the pipe is closed, the read
+/// is canceled, or a read error occurs, and then finishes the sink.
+/// </summary>
+/// <param name="hPipe">Input: pipe to read from</param>
+/// <param name="sink">Input: where the data goes</param>
+/// <param name="observer">Input: receives notifications of reads, write errors, and the end of the pump</param>
+/// <returns>Total number of bytes read from the pipe</returns>
+uint64_t PumpPipeToSink(PlatformFile_t hPipe, RedirSink_t& sink, RedirPumpObserver_t& observer);
+
+/// <summary>
+/// Number of bytes FeedPipe writes at a time
+/// </summary>
+const size_t FeedPipeWriteSize = 64 * 1024;
+
+/// <summary>
+/// Writes all of a buffer to a pipe (e.g., a script to a target process' stdin), a piece at a time, until it's all
+/// written, the reader closes its end, or the write is canceled. The buffer is only read, so that any number of
+/// pipes can be fed from one buffer at the same time. Doesn't close the pipe.
+/// </summary>
+/// <param name="hPipe">Input: pipe to write to</param>
+/// <param name="pData">Input: data to write</param>
+/// <param name="cbData">Input: number of bytes to write</param>
+/// <param name="cbWritten">Output: number of bytes written</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if all of the data was written; false otherwise</returns>
+bool FeedPipe(PlatformFile_t hPipe, const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError);
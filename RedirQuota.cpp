@@ -0,0 +1,188 @@
+// Output quotas: see RedirQuota.h.
+
+#include <cstring>
+#include <string>
+#include "RedirQuota.h"
+
+#ifdef _WIN32
+static const char* const szLineBreak = "\r\n";
+#else
+static const char* const szLineBreak = "\n";
+#endif
+
+OutputQuota_t::OutputQuota_t(uint64_t ullPerStream, QuotaPolicy_t policy, uint64_t ullTotal)
+    : m_ullPerStream(ullPerStream), m_policy(policy), m_bTotalLimited(QuotaUnlimited != ullTotal), m_ullRemaining(ullTotal)
+{
+}
+
+uint64_t OutputQuota_t::Reserve(uint64_t cb)
+{
+    if (!m_bTotalLimited)
+        return cb;
+    // Exchanging 0 for 0 reads the current value atomically; each failed exchange returns the newer value
+    uint64_t ullRemaining = PlatformCompareExchange64(&m_ullRemaining, 0, 0);
+    for (;;)
+    {
+        const uint64_t ullGranted = (cb < ullRemaining) ? cb : ullRemaining;
+        if (0 == ullGranted)
+            return 0;
+        const uint64_t ullSeen = PlatformCompareExchange64(&m_ullRemaining, ullRemaining - ullGranted, ullRemaining);
+        if (ullSeen == ullRemaining)
+            return ullGranted;
+        ullRemaining = ullSeen;
+    }
+}
+
+void OutputQuota_t::NoteTruncated(uint64_t ullOmitted)
+{
+    PlatformLock_t lock(m_mutex);
+    ++m_nTruncated;
+    m_ullOmitted += ullOmitted;
+}
+
+void OutputQuota_t::GetStats(uint64_t& nTruncated, uint64_t& ullOmitted)
+{
+    PlatformLock_t lock(m_mutex);
+    nTruncated = m_nTruncated;
+    ullOmitted = m_ullOmitted;
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirQuotaSink_t::RedirQuotaSink_t(OutputQuota_t& quota, std::unique_ptr<RedirSink_t> pNext)
+    : m_quota(quota), m_pNext(std::move(pNext)), m_ullHeadLimit(QuotaUnlimited), m_cbTailLimit(0)
+{
+    const uint64_t ullLimit = quota.PerStream();
+    if (QuotaUnlimited == ullLimit)
+        return;
+    uint64_t ullTailLimit = 0;
+    switch (quota.Policy())
+    {
+    case QuotaPolicy_t::Head:
+        m_ullHeadLimit = ullLimit;
+        break;
+    case QuotaPolicy_t::Tail:
+        m_ullHeadLimit = 0;
+        ullTailLimit = ullLimit;
+        break;
+    case QuotaPolicy_t::HeadTail:
+        m_ullHeadLimit = ullLimit / 2;
+        ullTailLimit = ullLimit - m_ullHeadLimit;
+        break;
+    }
+    m_cbTailLimit = (ullTailLimit < uint64_t(SIZE_MAX)) ? size_t(ullTailLimit) : SIZE_MAX;
+}
+
+/// <summary>
+/// Keeps the last m_cbTailLimit bytes of the output past the head
+/// </summary>
+void RedirQuotaSink_t::AddToTail(const uint8_t* pData, size_t cbData)
+{
+    if (0 == m_cbTailLimit)
+        return;
+    // Only the last bytes of a large write matter
+    if (cbData >= m_cbTailLimit)
+    {
+        m_tail.assign(pData + cbData - m_cbTailLimit, pData + cbData);
+        m_ixTailOldest = 0;
+        return;
+    }
+    // The buffer grows only as needed, so that short output doesn't cost the full tail size
+    if (m_tail.size() < m_cbTailLimit)
+    {
+        const size_t cbAppend = (cbData < m_cbTailLimit - m_tail.size()) ? cbData : m_cbTailLimit - m_tail.size();
+        m_tail.insert(m_tail.end(), pData, pData + cbAppend);
+        pData += cbAppend;
+        cbData -= cbAppend;
+    }
+    // Once it's full, overwrite the oldest bytes
+    while (cbData > 0)
+    {
+        const size_t cbCopy = (cbData < m_cbTailLimit - m_ixTailOldest) ? cbData : m_cbTailLimit - m_ixTailOldest;
+        memcpy(m_tail.data() + m_ixTailOldest, pData, cbCopy);
+        m_ixTailOldest = (m_ixTailOldest + cbCopy) % m_cbTailLimit;
+        pData += cbCopy;
+        cbData -= cbCopy;
+    }
+}
+
+bool RedirQuotaSink_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    // Everything is consumed, whether it's kept or not
+    cbWritten = cbData;
+    dwError = 0;
+    bool bOk = true;
+    m_ullTotal += cbData;
+
+    // The head is passed on as it arrives, as long as the run-wide budget lasts
+    if (m_ullHeadWritten < m_ullHeadLimit && cbData > 0)
+    {
+        const uint64_t ullHeadRoom = m_ullHeadLimit - m_ullHeadWritten;
+        const size_t cbHead = (cbData < ullHeadRoom) ? cbData : size_t(ullHeadRoom);
+        const size_t cbGranted = size_t(m_quota.Reserve(cbHead));
+        // If the run-wide budget ran out, the head ends here
+        if (cbGranted < cbHead)
+            m_ullHeadLimit = m_ullHeadWritten + cbGranted;
+        if (cbGranted > 0)
+        {
+            size_t cbPassed = 0;
+            bOk = m_pNext->Write(pData, cbGranted, cbPassed, dwError);
+        }
+        m_ullHeadWritten += cbGranted;
+        pData += cbGranted;
+        cbData -= cbGranted;
+    }
+
+    // Anything past the head is kept for the tail, or dropped
+    if (cbData > 0)
+        AddToTail(pData, cbData);
+    return bOk;
+}
+
+/// <summary>
+/// Writes a line saying how much output was omitted
+/// </summary>
+bool RedirQuotaSink_t::WriteOmittedMarker(uint32_t& dwError)
+{
+    const std::string sMarker = std::string(szLineBreak) + "[RunAsUsers: " + std::to_string(m_ullOmitted) + " bytes of output omitted]" + szLineBreak;
+    size_t cbPassed = 0;
+    return m_pNext->Write((const uint8_t*)sMarker.data(), sMarker.length(), cbPassed, dwError);
+}
+
+bool RedirQuotaSink_t::Finish(uint32_t& dwError)
+{
+    bool bOk = true;
+    dwError = 0;
+    uint32_t dwThisError = 0;
+    auto noteResult = [&](bool bResult) {
+        if (!bResult && bOk)
+        {
+            bOk = false;
+            dwError = dwThisError;
+        }
+    };
+
+    // The tail, limited to what's left of the run-wide budget (keeping the newest bytes)
+    const size_t cbTail = m_tail.size();
+    const size_t cbGranted = size_t(m_quota.Reserve(cbTail));
+    m_ullOmitted = m_ullTotal - m_ullHeadWritten - cbGranted;
+    if (m_ullOmitted > 0)
+    {
+        noteResult(WriteOmittedMarker(dwThisError));
+        m_quota.NoteTruncated(m_ullOmitted);
+    }
+    // Oldest first: from m_ixTailOldest to the end of the buffer, then from the start
+    for (size_t ixLogical = cbTail - cbGranted; ixLogical < cbTail; )
+    {
+        const size_t ixPhysical = (m_ixTailOldest + ixLogical) % cbTail;
+        const size_t cbSegment = ((cbTail - ixPhysical) < (cbTail - ixLogical)) ? cbTail - ixPhysical : cbTail - ixLogical;
+        size_t cbPassed = 0;
+        noteResult(m_pNext->Write(m_tail.data() + ixPhysical, cbSegment, cbPassed, dwThisError));
+        ixLogical += cbSegment;
+    }
+    noteResult(m_pNext->Finish(dwThisError));
+
+    // Release the buffer; this object won't be written to again
+    std::vector<uint8_t>().swap(m_tail);
+    return bOk;
+}
@@ -0,0 +1,121 @@
+// Output quotas: limits on how much of a target process' redirected output is kept, per output stream and
+// across the whole run, so that a runaway target can't fill the disk or tie up the disk for everyone else.
+//
+// Output beyond a limit is still read from the pipe (so that the target doesn't block), but it's dropped
+// instead of written. Which part is kept depends on the policy: the beginning (head), the end (tail, held in a
+// ring buffer of the limit's size until the stream ends), or both (head and tail, half the limit each). The
+// middle is never stored. Where output was dropped, a marker line says how many bytes were omitted.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Platform.h"
+#include "RedirPump.h"
+
+/// <summary>
+/// Which part of a stream's output to keep when it exceeds its limit
+/// </summary>
+enum class QuotaPolicy_t
+{
+    Head,       // The beginning
+    Tail,       // The end
+    HeadTail    // Half the limit from the beginning and half from the end
+};
+
+/// <summary>
+/// Value for "no limit"
+/// </summary>
+const uint64_t QuotaUnlimited = ~uint64_t(0);
+
+/// <summary>
+/// Run-wide quota settings, the run-wide budget, and statistics. Shared by all of the run's RedirQuotaSink_t objects.
+/// </summary>
+class OutputQuota_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="ullPerStream">Input: most bytes kept from each output stream; QuotaUnlimited for no limit</param>
+    /// <param name="policy">Input: which part of a stream's output to keep when it exceeds ullPerStream</param>
+    /// <param name="ullTotal">Input: most bytes kept from all output streams together; QuotaUnlimited for no limit.
+    /// Once it's used up, each stream keeps only what it already has.</param>
+    OutputQuota_t(uint64_t ullPerStream, QuotaPolicy_t policy, uint64_t ullTotal);
+
+    uint64_t PerStream() const { return m_ullPerStream; }
+    QuotaPolicy_t Policy() const { return m_policy; }
+
+    /// <summary>
+    /// Takes up to cb bytes from the run-wide budget. Can be called from any thread.
+    /// </summary>
+    /// <returns>Number of bytes granted</returns>
+    uint64_t Reserve(uint64_t cb);
+
+    /// <summary>
+    /// Records that a stream ended with output omitted
+    /// </summary>
+    void NoteTruncated(uint64_t ullOmitted);
+
+    /// <summary>
+    /// Statistics: streams that had output omitted, and the total bytes omitted
+    /// </summary>
+    void GetStats(uint64_t& nTruncated, uint64_t& ullOmitted);
+
+private:
+    const uint64_t m_ullPerStream;
+    const QuotaPolicy_t m_policy;
+    const bool m_bTotalLimited;
+    volatile uint64_t m_ullRemaining;
+    PlatformMutex_t m_mutex;
+    uint64_t m_nTruncated = 0, m_ullOmitted = 0;
+
+private:
+    // Not implemented
+    OutputQuota_t(const OutputQuota_t&) = delete;
+    OutputQuota_t& operator = (const OutputQuota_t&) = delete;
+};
+
+/// <summary>
+/// Sink that applies an OutputQuota_t to one output stream and passes what it keeps on to the next sink
+/// </summary>
+class RedirQuotaSink_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="quota">Input: the run's quota; must outlive this object</param>
+    /// <param name="pNext">Input: where the kept output goes; now owned by this object</param>
+    RedirQuotaSink_t(OutputQuota_t& quota, std::unique_ptr<RedirSink_t> pNext);
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override;
+
+    /// <summary>
+    /// Number of bytes dropped (known only after Finish, for the tail policies)
+    /// </summary>
+    uint64_t OmittedBytes() const { return m_ullOmitted; }
+
+private:
+    void AddToTail(const uint8_t* pData, size_t cbData);
+    bool WriteOmittedMarker(uint32_t& dwError);
+
+private:
+    OutputQuota_t& m_quota;
+    std::unique_ptr<RedirSink_t> m_pNext;
+    // Bytes that are passed on as they arrive, and how many have been
+    uint64_t m_ullHeadLimit;
+    uint64_t m_ullHeadWritten = 0;
+    // The last bytes past the head: a ring buffer that grows to m_cbTailLimit, with m_ixTailOldest the oldest byte once it's full
+    size_t m_cbTailLimit;
+    std::vector<uint8_t> m_tail;
+    size_t m_ixTailOldest = 0;
+    uint64_t m_ullTotal = 0, m_ullOmitted = 0;
+
+private:
+    // Not implemented
+    RedirQuotaSink_t(const RedirQuotaSink_t&) = delete;
+    RedirQuotaSink_t& operator = (const RedirQuotaSink_t&) = delete;
+};
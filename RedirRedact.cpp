@@ -0,0 +1,531 @@
+// Redaction of redirected output: see RedirRedact.h.
+
+#include <cmath>
+#include <cstring>
+#include "RedirRedact.h"
+
+static const uint8_t MaskByte = '*';
+
+/// <summary>
+/// Sets the bytes a shorthand class (\d, \w, \s) stands for; returns false if ch isn't one
+/// </summary>
+static bool AddShorthandClass(char ch, bool* set)
+{
+    switch (ch)
+    {
+    case 'd':
+        for (int n = '0'; n <= '9'; ++n) set[n] = true;
+        return true;
+    case 'w':
+        for (int n = '0'; n <= '9'; ++n) set[n] = true;
+        for (int n = 'A'; n <= 'Z'; ++n) set[n] = true;
+        for (int n = 'a'; n <= 'z'; ++n) set[n] = true;
+        set[uint8_t('_')] = true;
+        return true;
+    case 's':
+        set[uint8_t(' ')] = set[uint8_t('\t')] = true;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool RedactionRules_t::ParsePattern(const std::string& sExpr, Pattern_t& pattern, std::wstring& sError)
+{
+    const size_t cch = sExpr.length();
+    size_t ix = 0;
+    while (ix < cch)
+    {
+        Item_t item = {};
+        item.nMin = item.nMax = 1;
+        const char ch = sExpr[ix++];
+        if ('.' == ch)
+        {
+            for (bool& b : item.set) b = true;
+        }
+        else if ('\\' == ch)
+        {
+            if (ix == cch)
+            {
+                sError = L"pattern ends with \\";
+                return false;
+            }
+            const char chEscaped = sExpr[ix++];
+            if (!AddShorthandClass(chEscaped, item.set))
+                item.set[uint8_t(chEscaped)] = true;
+        }
+        else if ('[' == ch)
+        {
+            const bool bNegated = (ix < cch && '^' == sExpr[ix]);
+            if (bNegated)
+                ++ix;
+            bool bClosed = false;
+            bool bFirst = true;
+            while (ix < cch)
+            {
+                char chMember = sExpr[ix++];
+                // A ] right after [ or [^ is a member, not the end
+                if (']' == chMember && !bFirst)
+                {
+                    bClosed = true;
+                    break;
+                }
+                bFirst = false;
+                if ('\\' == chMember && ix < cch)
+                {
+                    chMember = sExpr[ix++];
+                    if (AddShorthandClass(chMember, item.set))
+                        continue;
+                }
+                if (ix + 1 < cch && '-' == sExpr[ix] && ']' != sExpr[ix + 1])
+                {
+                    const uint8_t nFirst = uint8_t(chMember), nLast = uint8_t(sExpr[ix + 1]);
+                    ix += 2;
+                    if (nLast < nFirst)
+                    {
+                        sError = L"range out of order in pattern";
+                        return false;
+                    }
+                    for (int n = nFirst; n <= nLast; ++n)
+                        item.set[n] = true;
+                }
+                else
+                {
+                    item.set[uint8_t(chMember)] = true;
+                }
+            }
+            if (!bClosed)
+            {
+                sError = L"pattern has [ without ]";
+                return false;
+            }
+            if (bNegated)
+            {
+                for (bool& b : item.set) b = !b;
+            }
+        }
+        else if ('?' == ch || '*' == ch || '+' == ch || '{' == ch)
+        {
+            sError = L"pattern has a repetition with nothing to repeat";
+            return false;
+        }
+        else
+        {
+            item.set[uint8_t(ch)] = true;
+        }
+        // No item matches a line break, so that no match spans lines
+        item.set[uint8_t('\r')] = item.set[uint8_t('\n')] = false;
+
+        // Repetition
+        if (ix < cch)
+        {
+            const char chRepeat = sExpr[ix];
+            if ('?' == chRepeat)
+            {
+                item.nMin = 0;
+                ++ix;
+            }
+            else if ('*' == chRepeat || '+' == chRepeat)
+            {
+                item.nMin = ('*' == chRepeat) ? 0 : 1;
+                item.nMax = UINT32_MAX;
+                ++ix;
+            }
+            else if ('{' == chRepeat)
+            {
+                const size_t ixClose = sExpr.find('}', ix);
+                const std::string sCounts = (std::string::npos != ixClose) ? sExpr.substr(ix + 1, ixClose - ix - 1) : std::string();
+                const size_t ixComma = sCounts.find(',');
+                const std::string sMin = sCounts.substr(0, ixComma);
+                const std::string sMax = (std::string::npos != ixComma) ? sCounts.substr(ixComma + 1) : sMin;
+                auto isNumber = [](const std::string& s) { return !s.empty() && s.length() <= 6 && std::string::npos == s.find_first_not_of("0123456789"); };
+                if (!isNumber(sMin) || !(isNumber(sMax) || (sMax.empty() && std::string::npos != ixComma)))
+                {
+                    sError = L"pattern has an invalid {n,m} repetition";
+                    return false;
+                }
+                item.nMin = uint32_t(std::stoul(sMin));
+                item.nMax = sMax.empty() ? UINT32_MAX : uint32_t(std::stoul(sMax));
+                if (item.nMax < item.nMin || 0 == item.nMax)
+                {
+                    sError = L"pattern has an invalid {n,m} repetition";
+                    return false;
+                }
+                ix = ixClose + 1;
+            }
+        }
+        pattern.vItems.push_back(item);
+    }
+    if (pattern.vItems.empty())
+    {
+        sError = L"empty pattern";
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Works out how candidate matches are found
+/// </summary>
+void RedactionRules_t::FinishPattern(Pattern_t& pattern)
+{
+    pattern.vStartBytes.clear();
+    const Item_t& first = pattern.vItems[0];
+    if (0 == first.nMin)
+        return;
+    for (int nByte = 0; nByte < 256; ++nByte)
+    {
+        if (first.set[nByte])
+            pattern.vStartBytes.push_back(uint8_t(nByte));
+    }
+    if (pattern.vStartBytes.size() > 2)
+        pattern.vStartBytes.clear();
+}
+
+bool RedactionRules_t::Add(const std::string& sRule, std::wstring& sError)
+{
+    const size_t ixEquals = sRule.find('=');
+    const std::string sKind = sRule.substr(0, ixEquals);
+    const std::string sValue = (std::string::npos != ixEquals) ? sRule.substr(ixEquals + 1) : std::string();
+
+    if ("entropy" == sKind)
+    {
+        size_t cchMin = RedactDefaultEntropyLength;
+        if (std::string::npos != ixEquals)
+        {
+            if (sValue.empty() || sValue.length() > 4 || std::string::npos != sValue.find_first_not_of("0123456789"))
+            {
+                sError = L"entropy=n needs a length";
+                return false;
+            }
+            cchMin = std::stoul(sValue);
+            if (cchMin < 8)
+            {
+                sError = L"entropy=n needs a length of at least 8";
+                return false;
+            }
+        }
+        m_cchEntropyMin = cchMin;
+        return true;
+    }
+
+    if (std::string::npos == ixEquals || sValue.empty())
+    {
+        sError = L"expected prefix=text, pattern=expr, or entropy[=n]";
+        return false;
+    }
+
+    Pattern_t pattern;
+    if ("prefix" == sKind)
+    {
+        // The text, without regard to case, then any spaces or tabs (kept), then the value (masked)
+        for (const char ch : sValue)
+        {
+            Item_t item = {};
+            item.nMin = item.nMax = 1;
+            item.set[uint8_t(ch)] = true;
+            if (ch >= 'a' && ch <= 'z')
+                item.set[uint8_t(ch - 'a' + 'A')] = true;
+            else if (ch >= 'A' && ch <= 'Z')
+                item.set[uint8_t(ch - 'A' + 'a')] = true;
+            pattern.vItems.push_back(item);
+        }
+        Item_t spaces = {};
+        spaces.nMin = 0;
+        spaces.nMax = UINT32_MAX;
+        spaces.set[uint8_t(' ')] = spaces.set[uint8_t('\t')] = true;
+        pattern.vItems.push_back(spaces);
+        Item_t value = {};
+        value.nMin = 1;
+        value.nMax = UINT32_MAX;
+        for (bool& b : value.set) b = true;
+        for (const char ch : std::string(" \t\r\n\"',;&<>"))
+            value.set[uint8_t(ch)] = false;
+        pattern.vItems.push_back(value);
+        pattern.ixFirstMasked = pattern.vItems.size() - 1;
+    }
+    else if ("pattern" == sKind)
+    {
+        if (!ParsePattern(sValue, pattern, sError))
+            return false;
+        pattern.ixFirstMasked = 0;
+    }
+    else
+    {
+        sError = L"expected prefix=text, pattern=expr, or entropy[=n]";
+        return false;
+    }
+    FinishPattern(pattern);
+    m_patterns.push_back(std::move(pattern));
+    return true;
+}
+
+/// <summary>
+/// Matches a pattern at p, possessively
+/// </summary>
+/// <returns>The end of the match; nullptr if it doesn't match</returns>
+const uint8_t* RedactionRules_t::MatchAt(const Pattern_t& pattern, const uint8_t* p, const uint8_t* pEnd, const uint8_t*& pMaskStart)
+{
+    pMaskStart = p;
+    for (size_t ixItem = 0; ixItem < pattern.vItems.size(); ++ixItem)
+    {
+        if (ixItem == pattern.ixFirstMasked)
+            pMaskStart = p;
+        const Item_t& item = pattern.vItems[ixItem];
+        const size_t cbLimit = ((pEnd - p) < ptrdiff_t(item.nMax)) ? size_t(pEnd - p) : size_t(item.nMax);
+        size_t cbRun = 0;
+        while (cbRun < cbLimit && item.set[p[cbRun]])
+            ++cbRun;
+        if (cbRun < item.nMin)
+            return nullptr;
+        p += cbRun;
+    }
+    return p;
+}
+
+uint64_t RedactionRules_t::RedactPattern(const Pattern_t& pattern, uint8_t* pData, size_t cbData) const
+{
+    uint64_t nRedactions = 0;
+    uint8_t* p = pData;
+    uint8_t* const pEnd = pData + cbData;
+    const Item_t& first = pattern.vItems[0];
+    // Next occurrence of each start byte (pEnd if none), searched for again only once it's been passed
+    const size_t nStartBytes = pattern.vStartBytes.size();
+    uint8_t* apNextStart[2] = { pData, pData };
+    bool bSearchedFirst = false;
+    while (p < pEnd)
+    {
+        // Skip to the next byte that can start a match
+        if (nStartBytes > 0)
+        {
+            uint8_t* pNext = pEnd;
+            for (size_t ix = 0; ix < nStartBytes; ++ix)
+            {
+                if (apNextStart[ix] < p || !bSearchedFirst)
+                {
+                    void* pFound = memchr(p, pattern.vStartBytes[ix], size_t(pEnd - p));
+                    apNextStart[ix] = (nullptr != pFound) ? (uint8_t*)pFound : pEnd;
+                }
+                if (apNextStart[ix] < pNext)
+                    pNext = apNextStart[ix];
+            }
+            bSearchedFirst = true;
+            p = pNext;
+        }
+        else if (first.nMin > 0)
+        {
+            while (p < pEnd && !first.set[*p])
+                ++p;
+        }
+        if (p == pEnd)
+            break;
+
+        const uint8_t* pMaskStart = nullptr;
+        const uint8_t* pMatchEnd = MatchAt(pattern, p, pEnd, pMaskStart);
+        if (nullptr != pMatchEnd && pMatchEnd > pMaskStart)
+        {
+            memset(pData + (pMaskStart - pData), MaskByte, size_t(pMatchEnd - pMaskStart));
+            ++nRedactions;
+            p = pData + (pMatchEnd - pData);
+        }
+        else
+        {
+            // If the first item is a repeat that stopped by itself (at a byte it doesn't take, or the end), starting
+            // anywhere inside its run fails too: the repeat would end at the same place, and the rest of the pattern
+            // would see the same bytes. So resume after the run, rather than rescanning it from each of its bytes.
+            size_t cbRun = 0;
+            if (first.nMax > 1)
+            {
+                const size_t cbLimit = ((pEnd - p) < ptrdiff_t(first.nMax)) ? size_t(pEnd - p) : size_t(first.nMax);
+                while (cbRun < cbLimit && first.set[p[cbRun]])
+                    ++cbRun;
+                // Stopped at its maximum: from further in, it could take bytes beyond
+                if (cbRun == first.nMax)
+                    cbRun = 0;
+            }
+            p += (cbRun > 0) ? cbRun : 1;
+        }
+    }
+    return nRedactions;
+}
+
+namespace
+{
+    // Classes of bytes for the entropy rule
+    enum : uint8_t { NotWord = 0, WordOther = 1, WordLetter = 2, WordDigit = 4, WordHex = 8 };
+
+    struct WordClassTable_t
+    {
+        uint8_t classes[256];
+        WordClassTable_t()
+        {
+            memset(classes, NotWord, sizeof(classes));
+            for (int n = 'A'; n <= 'Z'; ++n) classes[n] = WordLetter;
+            for (int n = 'a'; n <= 'z'; ++n) classes[n] = WordLetter;
+            for (int n = 'A'; n <= 'F'; ++n) classes[n] |= WordHex;
+            for (int n = 'a'; n <= 'f'; ++n) classes[n] |= WordHex;
+            for (int n = '0'; n <= '9'; ++n) classes[n] = WordDigit | WordHex;
+            classes[uint8_t('+')] = classes[uint8_t('=')] = classes[uint8_t('_')] = WordOther;
+        }
+    };
+    const WordClassTable_t s_wordClasses;
+
+    /// <summary>
+    /// Shannon entropy of a word, in bits per character
+    /// </summary>
+    double WordEntropy(const uint8_t* pWord, size_t cchWord)
+    {
+        uint32_t counts[256] = {};
+        for (size_t ix = 0; ix < cchWord; ++ix)
+            ++counts[pWord[ix]];
+        // H = log2(n) - (sum of c * log2(c)) / n
+        double dSum = 0;
+        for (size_t ix = 0; ix < cchWord; ++ix)
+        {
+            const uint32_t c = counts[pWord[ix]];
+            if (c > 0)
+            {
+                dSum += c * std::log2(double(c));
+                counts[pWord[ix]] = 0;
+            }
+        }
+        return std::log2(double(cchWord)) - dSum / double(cchWord);
+    }
+}
+
+uint64_t RedactionRules_t::RedactHighEntropy(uint8_t* pData, size_t cbData) const
+{
+    const uint8_t* const classes = s_wordClasses.classes;
+    const size_t HexMin = 32;
+    const size_t cchShortest = (m_cchEntropyMin < HexMin) ? m_cchEntropyMin : HexMin;
+    uint64_t nRedactions = 0;
+    // ixWord is always at the start of the data or just after a byte that's not part of a word. Only words of at
+    // least cchShortest characters matter, so rather than examine every byte, look at the last byte that such a
+    // word starting at ixWord would have, and work backward from there to the start of the word it's in (if any):
+    // in ordinary text, most bytes are never examined.
+    size_t ixWord = 0;
+    while (cbData - ixWord >= cchShortest)
+    {
+        // (Accumulating the classes of the bytes seen, for the word's checks)
+        uint8_t nAll = 0xFF, nAny = 0;
+        size_t ix = ixWord + cchShortest;
+        while (ix > ixWord)
+        {
+            const uint8_t nClass = classes[pData[ix - 1]];
+            if (NotWord == nClass)
+                break;
+            nAll &= nClass;
+            nAny |= nClass;
+            --ix;
+        }
+        if (ix > ixWord)
+        {
+            // No word of cchShortest characters starts before ix
+            ixWord = ix;
+            continue;
+        }
+
+        // pData[ixWord] through pData[ixWord + cchShortest - 1] are all part of a word: find its end
+        size_t ixEnd = ixWord + cchShortest;
+        for (; ixEnd < cbData; ++ixEnd)
+        {
+            const uint8_t nClass = classes[pData[ixEnd]];
+            if (NotWord == nClass)
+                break;
+            nAll &= nClass;
+            nAny |= nClass;
+        }
+        const size_t cchWord = ixEnd - ixWord;
+        bool bSecret = false;
+        if (0 != (nAll & WordHex))
+            bSecret = cchWord >= HexMin && WordEntropy(pData + ixWord, cchWord) >= 3.0;
+        else
+            bSecret = cchWord >= m_cchEntropyMin && 0 != (nAny & WordLetter) && 0 != (nAny & WordDigit) && WordEntropy(pData + ixWord, cchWord) >= 4.0;
+        if (bSecret)
+        {
+            memset(pData + ixWord, MaskByte, cchWord);
+            ++nRedactions;
+        }
+        ixWord = ixEnd;
+    }
+    return nRedactions;
+}
+
+uint64_t RedactionRules_t::Redact(uint8_t* pData, size_t cbData) const
+{
+    uint64_t nRedactions = 0;
+    for (const Pattern_t& pattern : m_patterns)
+        nRedactions += RedactPattern(pattern, pData, cbData);
+    if (m_cchEntropyMin > 0)
+        nRedactions += RedactHighEntropy(pData, cbData);
+    return nRedactions;
+}
+
+void RedactionRules_t::NoteRedactions(uint64_t nRedactions)
+{
+    PlatformLock_t lock(m_mutex);
+    m_nRedactions += nRedactions;
+}
+
+uint64_t RedactionRules_t::Redactions()
+{
+    PlatformLock_t lock(m_mutex);
+    return m_nRedactions;
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirRedactSink_t::RedirRedactSink_t(RedactionRules_t& rules, std::unique_ptr<RedirSink_t> pNext)
+    : m_rules(rules), m_pNext(std::move(pNext))
+{
+}
+
+/// <summary>
+/// Redacts the first cbLines bytes of the pending output, passes them on, and drops them
+/// </summary>
+bool RedirRedactSink_t::RedactAndPass(size_t cbLines, uint32_t& dwError)
+{
+    m_nRedactions += m_rules.Redact(m_pending.data(), cbLines);
+    size_t cbPassed = 0;
+    const bool bOk = m_pNext->Write(m_pending.data(), cbLines, cbPassed, dwError);
+    m_pending.erase(m_pending.begin(), m_pending.begin() + cbLines);
+    return bOk;
+}
+
+bool RedirRedactSink_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    // Everything is consumed, whether it's passed on now or held back
+    cbWritten = cbData;
+    dwError = 0;
+    const size_t cbHeld = m_pending.size();
+    m_pending.insert(m_pending.end(), pData, pData + cbData);
+
+    // Everything through the last line break in the new data is complete lines
+    size_t ixAfterBreak = cbData;
+    while (ixAfterBreak > 0 && '\n' != pData[ixAfterBreak - 1] && '\r' != pData[ixAfterBreak - 1])
+        --ixAfterBreak;
+    if (ixAfterBreak > 0)
+        return RedactAndPass(cbHeld + ixAfterBreak, dwError);
+    // A very long line is redacted in pieces
+    if (m_pending.size() >= RedactMaxLine)
+        return RedactAndPass(m_pending.size(), dwError);
+    return true;
+}
+
+bool RedirRedactSink_t::Finish(uint32_t& dwError)
+{
+    bool bOk = true;
+    dwError = 0;
+    if (!m_pending.empty())
+        bOk = RedactAndPass(m_pending.size(), dwError);
+    m_rules.NoteRedactions(m_nRedactions);
+    uint32_t dwFinishError = 0;
+    if (!m_pNext->Finish(dwFinishError) && bOk)
+    {
+        bOk = false;
+        dwError = dwFinishError;
+    }
+    // Release the buffer; this object won't be written to again
+    std::vector<uint8_t>().swap(m_pending);
+    return bOk;
+}
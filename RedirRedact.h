@@ -0,0 +1,147 @@
+// Redaction of redirected output: masks secrets (passwords, tokens, keys) that target processes print, before
+// the output reaches any file or console, so that operators who can read the output files don't see them.
+//
+// Rules:
+//   prefix=text   : the value that follows text (matched without regard to the case of ASCII letters, and after
+//                   any spaces or tabs), up to the next space, quote, comma, semicolon, ampersand, or angle
+//                   bracket; e.g., prefix=password= or "prefix=Authorization: Bearer". The text itself is kept.
+//   pattern=expr  : anything that matches expr, a small subset of regular expressions: literal characters;
+//                   . (any character); [...] and [^...] (sets, with ranges); \d, \w, \s (digit, word character,
+//                   space or tab); \ before any other character for that character; each optionally followed by
+//                   ?, *, +, {n}, {n,}, or {n,m}. No alternation or groups. Repetition is possessive (it takes as
+//                   many characters as it can and never gives any back), so an attempt at one position never
+//                   backtracks: it takes time proportional to the bytes its items take. After a failed attempt,
+//                   the search resumes past the run the pattern's first item took, if that's a repeat; so a
+//                   pattern that starts with a repeat, or with a byte that's rare in the output, takes time about
+//                   proportional to the output's length. One that starts with a common byte followed by an
+//                   unbounded repeat (e.g., a[a-z]+X) can take time proportional to the length of a line times
+//                   the number of places in it that the pattern starts; lines are at most RedactMaxLine bytes.
+//                   RunAsUsersBench -redactlines measures patterns on long lines. E.g., pattern=AKIA[0-9A-Z]{16}
+//   entropy[=n]   : "words" of letters, digits, and + = _ that look random: at least n characters (default 24)
+//                   with at least 4 bits of entropy per character and both letters and digits; or hexadecimal,
+//                   at least 32 characters with at least 3 bits per character. (Slashes, dashes, and dots end a
+//                   word, so that paths, URLs, and GUIDs aren't taken for secrets.)
+//
+// Each masked byte is replaced with '*', so the output keeps its length (and its line structure). Output is
+// redacted a line at a time: bytes after the last line break are held back until the line is complete (or
+// RedactMaxLine bytes have accumulated), so that a secret split between two reads is still found. No rule
+// matches across a line break.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "RedirPump.h"
+
+/// <summary>
+/// Longest partial line held back; a longer line is redacted in pieces of this size
+/// </summary>
+const size_t RedactMaxLine = 64 * 1024;
+
+/// <summary>
+/// Default minimum length of a token for the entropy rule
+/// </summary>
+const size_t RedactDefaultEntropyLength = 24;
+
+/// <summary>
+/// A run's redaction rules. Built once, then shared (read-only, except for the statistics) by all the run's sinks.
+/// </summary>
+class RedactionRules_t
+{
+public:
+    RedactionRules_t() = default;
+
+    /// <summary>
+    /// Adds a rule, in the form described at the top of this file
+    /// </summary>
+    /// <param name="sRule">Input: the rule</param>
+    /// <param name="sError">Output: what's wrong with the rule, on failure</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Add(const std::string& sRule, std::wstring& sError);
+
+    bool Empty() const { return m_patterns.empty() && 0 == m_cchEntropyMin; }
+
+    /// <summary>
+    /// Masks the secrets in a run of complete lines
+    /// </summary>
+    /// <param name="pData">Input/output: the lines</param>
+    /// <param name="cbData">Input: number of bytes</param>
+    /// <returns>Number of secrets masked</returns>
+    uint64_t Redact(uint8_t* pData, size_t cbData) const;
+
+    /// <summary>
+    /// Statistics: adds a stream's count of secrets masked; and the total so far
+    /// </summary>
+    void NoteRedactions(uint64_t nRedactions);
+    uint64_t Redactions();
+
+private:
+    // One element of a pattern: a set of bytes, repeated nMin to nMax times
+    struct Item_t
+    {
+        bool set[256];
+        uint32_t nMin, nMax;
+    };
+    struct Pattern_t
+    {
+        std::vector<Item_t> vItems;
+        // Items before this one are matched but not masked (the text of a prefix rule)
+        size_t ixFirstMasked;
+        // The bytes a match can start with, if there are only one or two (for finding candidates with memchr);
+        // otherwise none
+        std::vector<uint8_t> vStartBytes;
+    };
+
+    static bool ParsePattern(const std::string& sExpr, Pattern_t& pattern, std::wstring& sError);
+    static void FinishPattern(Pattern_t& pattern);
+    static const uint8_t* MatchAt(const Pattern_t& pattern, const uint8_t* p, const uint8_t* pEnd, const uint8_t*& pMaskStart);
+    uint64_t RedactPattern(const Pattern_t& pattern, uint8_t* pData, size_t cbData) const;
+    uint64_t RedactHighEntropy(uint8_t* pData, size_t cbData) const;
+
+private:
+    std::vector<Pattern_t> m_patterns;
+    // Minimum length of a token for the entropy rule; 0 if there's no entropy rule
+    size_t m_cchEntropyMin = 0;
+    PlatformMutex_t m_mutex;
+    uint64_t m_nRedactions = 0;
+
+private:
+    // Not implemented
+    RedactionRules_t(const RedactionRules_t&) = delete;
+    RedactionRules_t& operator = (const RedactionRules_t&) = delete;
+};
+
+/// <summary>
+/// Sink that masks secrets and passes the output on to the next sink
+/// </summary>
+class RedirRedactSink_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="rules">Input: the run's rules; must outlive this object</param>
+    /// <param name="pNext">Input: where the redacted output goes; now owned by this object</param>
+    RedirRedactSink_t(RedactionRules_t& rules, std::unique_ptr<RedirSink_t> pNext);
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override;
+
+private:
+    bool RedactAndPass(size_t cbLines, uint32_t& dwError);
+
+private:
+    RedactionRules_t& m_rules;
+    std::unique_ptr<RedirSink_t> m_pNext;
+    // Output not yet passed on: complete lines being redacted, followed by the start of a line
+    std::vector<uint8_t> m_pending;
+    uint64_t m_nRedactions = 0;
+
+private:
+    // Not implemented
+    RedirRedactSink_t(const RedirRedactSink_t&) = delete;
+    RedirRedactSink_t& operator = (const RedirRedactSink_t&) = delete;
+};
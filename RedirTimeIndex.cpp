@@ -0,0 +1,218 @@
+// Time indexes of redirected output: see RedirTimeIndex.h.
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include "MonotonicClock.h"
+#include "RedirTimeIndex.h"
+
+static const uint8_t IndexMagic[4] = { 'R', 'A', 'U', 'T' };
+static const uint8_t FormatVersion = 1;
+static const size_t IndexHeaderSize = 16;
+
+// Encoded entries are written to the index once this much has accumulated (and at the end of the output)
+static const size_t IndexFlushSize = 4096;
+
+/// <summary>
+/// Days from 1970-01-01 to a date in the proleptic Gregorian calendar
+/// </summary>
+static int64_t DaysFromCivil(int64_t nYear, unsigned int nMonth, unsigned int nDay)
+{
+    nYear -= (nMonth <= 2) ? 1 : 0;
+    const int64_t nEra = ((nYear >= 0) ? nYear : nYear - 399) / 400;
+    const int64_t nYearOfEra = nYear - nEra * 400;
+    const int64_t nDayOfYear = (153 * (nMonth + ((nMonth > 2) ? -3 : 9)) + 2) / 5 + nDay - 1;
+    const int64_t nDayOfEra = nYearOfEra * 365 + nYearOfEra / 4 - nYearOfEra / 100 + nDayOfYear;
+    return nEra * 146097 + nDayOfEra - 719468;
+}
+
+void TimeIndexBase_t::Capture()
+{
+    PlatformDateTime_t dt;
+    PlatformGetUtcDateTime(dt);
+    ullMonotonic = MonotonicMicroseconds();
+    const int64_t nDays = DaysFromCivil(dt.nYear, dt.nMonth, dt.nDay);
+    const uint64_t ullSeconds = uint64_t(nDays) * 86400 + dt.nHour * 3600 + dt.nMinute * 60 + dt.nSecond;
+    ullUnixMicroseconds = ullSeconds * 1000000 + uint64_t(dt.nMilliseconds) * 1000;
+}
+
+static void Put64(uint8_t* p, uint64_t ull)
+{
+    for (int ix = 0; ix < 8; ++ix)
+        p[ix] = uint8_t(ull >> (8 * ix));
+}
+
+static uint64_t Get64(const uint8_t* p)
+{
+    uint64_t ull = 0;
+    for (int ix = 7; ix >= 0; --ix)
+        ull = (ull << 8) | p[ix];
+    return ull;
+}
+
+static void PutVarint(std::vector<uint8_t>& out, uint64_t ull)
+{
+    while (ull >= 0x80)
+    {
+        out.push_back(uint8_t(ull) | 0x80);
+        ull >>= 7;
+    }
+    out.push_back(uint8_t(ull));
+}
+
+/// <summary>
+/// Decodes an unsigned LEB128 integer; returns false if it's cut off (or too long)
+/// </summary>
+static bool GetVarint(const uint8_t*& p, const uint8_t* pEnd, uint64_t& ull)
+{
+    ull = 0;
+    for (int nShift = 0; p < pEnd && nShift < 64; nShift += 7)
+    {
+        const uint8_t b = *p++;
+        ull |= uint64_t(b & 0x7f) << nShift;
+        if (0 == (b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------
+
+RedirTimeIndexSink_t::RedirTimeIndexSink_t(const TimeIndexBase_t& base, PlatformFile_t hIndex, std::unique_ptr<RedirSink_t> pNext)
+    : m_base(base), m_hIndex(hIndex), m_pNext(std::move(pNext))
+{
+    m_pending.reserve(IndexFlushSize + 32);
+    m_pending.insert(m_pending.end(), IndexMagic, IndexMagic + sizeof(IndexMagic));
+    m_pending.push_back(FormatVersion);
+    m_pending.resize(IndexHeaderSize, 0);
+    Put64(m_pending.data() + 8, m_base.ullUnixMicroseconds);
+}
+
+RedirTimeIndexSink_t::~RedirTimeIndexSink_t()
+{
+    Flush();
+    PlatformClose(m_hIndex);
+}
+
+bool RedirTimeIndexSink_t::Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError)
+{
+    const uint64_t ullNow = MonotonicMicroseconds();
+    const uint64_t ullTime = (ullNow > m_base.ullMonotonic) ? ullNow - m_base.ullMonotonic : 0;
+    // (The first entry is always recorded, so that every byte belongs to one)
+    if (cbData > 0 && (0 == m_nEntries || ullTime >= m_ullLastTime + TimeIndexResolution))
+    {
+        PutVarint(m_pending, m_ullOffset - m_ullLastOffset);
+        PutVarint(m_pending, ullTime - m_ullLastTime);
+        m_ullLastOffset = m_ullOffset;
+        m_ullLastTime = ullTime;
+        ++m_nEntries;
+        if (m_pending.size() >= IndexFlushSize)
+            Flush();
+    }
+    const bool bOk = m_pNext->Write(pData, cbData, cbWritten, dwError);
+    m_ullOffset += cbWritten;
+    return bOk;
+}
+
+bool RedirTimeIndexSink_t::Finish(uint32_t& dwError)
+{
+    Flush();
+    return m_pNext->Finish(dwError);
+}
+
+void RedirTimeIndexSink_t::Flush()
+{
+    // The index is an aid, not part of the output: if it can't be written, stop recording it rather than fail the output
+    if (m_pending.empty() || PlatformInvalidFile == m_hIndex)
+        return;
+    size_t cbWritten = 0;
+    uint32_t dwError = 0;
+    if (PlatformWrite(m_hIndex, m_pending.data(), m_pending.size(), cbWritten, dwError) && cbWritten == m_pending.size())
+        m_cbFlushed += cbWritten;
+    else
+        PlatformClose(m_hIndex);
+    m_pending.clear();
+}
+
+// ------------------------------------------------------------------------------------------
+
+bool TimeIndex_t::Read(const std::wstring& sPath, uint32_t& dwError)
+{
+    ullBaseUnixMicroseconds = 0;
+    vEntries.clear();
+
+    uint64_t ullFileSize = 0;
+    if (!PlatformGetFileSize(sPath, ullFileSize, dwError))
+        return false;
+    PlatformFile_t hFile = PlatformOpenFile(sPath, dwError);
+    if (PlatformInvalidFile == hFile)
+        return false;
+    std::vector<uint8_t> contents(static_cast<size_t>(ullFileSize));
+    bool bRead = true;
+    for (size_t cbDone = 0; bRead && cbDone < contents.size(); )
+    {
+        size_t cbRead = 0;
+        bRead = (PlatformIoResult_t::Success == PlatformRead(hFile, contents.data() + cbDone, contents.size() - cbDone, cbRead, dwError)) && cbRead > 0;
+        cbDone += cbRead;
+    }
+    PlatformClose(hFile);
+    if (!bRead)
+    {
+        if (0 == dwError)
+            dwError = PlatformErrorInvalidData;
+        return false;
+    }
+
+    dwError = PlatformErrorInvalidData;
+    if (contents.size() < IndexHeaderSize || 0 != memcmp(contents.data(), IndexMagic, sizeof(IndexMagic)) || FormatVersion != contents[4])
+        return false;
+    ullBaseUnixMicroseconds = Get64(contents.data() + 8);
+
+    const uint8_t* p = contents.data() + IndexHeaderSize;
+    const uint8_t* const pEnd = contents.data() + contents.size();
+    uint64_t ullOffset = 0, ullTime = 0;
+    while (p < pEnd)
+    {
+        uint64_t ullOffsetDelta = 0, ullTimeDelta = 0;
+        if (!GetVarint(p, pEnd, ullOffsetDelta) || !GetVarint(p, pEnd, ullTimeDelta))
+            break;
+        ullOffset += ullOffsetDelta;
+        ullTime += ullTimeDelta;
+        vEntries.push_back(Entry_t{ ullOffset, ullBaseUnixMicroseconds + ullTime });
+    }
+    dwError = 0;
+    return true;
+}
+
+uint64_t TimeIndex_t::TimeAt(uint64_t ullOffset) const
+{
+    auto it = std::upper_bound(vEntries.begin(), vEntries.end(), ullOffset,
+        [](uint64_t ullValue, const Entry_t& entry) { return ullValue < entry.ullOffset; });
+    if (it == vEntries.begin())
+        return vEntries.empty() ? ullBaseUnixMicroseconds : it->ullUnixMicroseconds;
+    return (it - 1)->ullUnixMicroseconds;
+}
+
+std::wstring UnixMicrosecondsToString(uint64_t ullUnixMicroseconds)
+{
+    // Civil date from days since 1970-01-01 (the inverse of DaysFromCivil)
+    const uint64_t ullSeconds = ullUnixMicroseconds / 1000000;
+    const int64_t nDays = int64_t(ullSeconds / 86400) + 719468;
+    const int64_t nEra = nDays / 146097;
+    const int64_t nDayOfEra = nDays - nEra * 146097;
+    const int64_t nYearOfEra = (nDayOfEra - nDayOfEra / 1460 + nDayOfEra / 36524 - nDayOfEra / 146096) / 365;
+    const int64_t nDayOfYear = nDayOfEra - (365 * nYearOfEra + nYearOfEra / 4 - nYearOfEra / 100);
+    const int64_t nMonthIndex = (5 * nDayOfYear + 2) / 153;
+    const int64_t nDay = nDayOfYear - (153 * nMonthIndex + 2) / 5 + 1;
+    const int64_t nMonth = nMonthIndex + ((nMonthIndex < 10) ? 3 : -9);
+    const int64_t nYear = nYearOfEra + nEra * 400 + ((nMonth <= 2) ? 1 : 0);
+    const uint64_t ullSecondOfDay = ullSeconds % 86400;
+
+    std::wstringstream str;
+    str << std::setfill(L'0')
+        << std::setw(4) << nYear << L"-" << std::setw(2) << nMonth << L"-" << std::setw(2) << nDay
+        << L"T" << std::setw(2) << (ullSecondOfDay / 3600) << L":" << std::setw(2) << (ullSecondOfDay / 60 % 60) << L":" << std::setw(2) << (ullSecondOfDay % 60)
+        << L"." << std::setw(6) << (ullUnixMicroseconds % 1000000) << L"Z";
+    return str.str();
+}
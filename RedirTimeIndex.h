@@ -0,0 +1,130 @@
+// Time indexes of redirected output: a small side file next to each output file that records when each part of
+// the output arrived, so that a capture of a long run still shows whether a line was written one second or fifteen
+// minutes in, and so that the output of many sessions can be merged into one time-ordered view
+// (RunAsUsersOutput merge).
+//
+// Each time the process' output is read, the offset (in the output's original content, i.e., before compression or
+// deduplication) at which the read's data starts is recorded with the time, unless less than TimeIndexResolution has
+// passed since the last entry; the data then belongs to that entry. A line's time is the time of the entry its first
+// byte belongs to. Entries are delta-encoded as variable-length integers, typically two to four bytes each, and
+// buffered, so recording costs a clock read per read of the pipe and a write to the index every few thousand entries.
+//
+// Index layout (integers are little-endian):
+//   Header    : "RAUT", uint8 version (1), uint8 0, uint16 0, uint64 the run's start time (microseconds since
+//               1970-01-01 UTC)
+//   Entries   : offset minus the previous entry's offset, then time (microseconds since the run's start) minus the
+//               previous entry's time, each as an unsigned LEB128 integer
+// All of a run's indexes share its start time and its monotonic clock, so they order correctly against each other
+// even if the system clock is changed during the run. An entry cut off at the end of the file (a run that was cut off)
+// is ignored.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "RedirPump.h"
+
+/// <summary>
+/// File name extension appended to an output file's name for its time index
+/// </summary>
+const wchar_t* const szTimeIndexExtension = L".raut";
+
+/// <summary>
+/// Minimum time between index entries, in microseconds; output that arrives sooner belongs to the previous entry
+/// </summary>
+const uint64_t TimeIndexResolution = 1000;
+
+/// <summary>
+/// The start of a run, on the wall clock and on the monotonic clock. Captured once per run and shared by all its indexes.
+/// </summary>
+struct TimeIndexBase_t
+{
+    uint64_t ullUnixMicroseconds = 0;
+    uint64_t ullMonotonic = 0;
+
+    /// <summary>
+    /// Captures the current time
+    /// </summary>
+    void Capture();
+};
+
+/// <summary>
+/// Sink that records when output arrives in a time index, and passes it on, unchanged, to the next sink
+/// </summary>
+class RedirTimeIndexSink_t : public RedirSink_t
+{
+public:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="base">Input: the run's start; must outlive this object</param>
+    /// <param name="hIndex">Input: the index file, newly created; now owned by this object</param>
+    /// <param name="pNext">Input: where the output goes; now owned by this object</param>
+    RedirTimeIndexSink_t(const TimeIndexBase_t& base, PlatformFile_t hIndex, std::unique_ptr<RedirSink_t> pNext);
+    ~RedirTimeIndexSink_t();
+
+    bool Write(const uint8_t* pData, size_t cbData, size_t& cbWritten, uint32_t& dwError) override;
+    bool Finish(uint32_t& dwError) override;
+
+    /// <summary>
+    /// Number of entries recorded, and size of the index so far (including what's still buffered)
+    /// </summary>
+    uint64_t Entries() const { return m_nEntries; }
+    uint64_t IndexBytes() const { return m_cbFlushed + m_pending.size(); }
+
+private:
+    void Flush();
+
+private:
+    const TimeIndexBase_t& m_base;
+    PlatformFile_t m_hIndex;
+    std::unique_ptr<RedirSink_t> m_pNext;
+    // Encoded entries not yet written to the index
+    std::vector<uint8_t> m_pending;
+    // Offset in the output of the next byte, and the last entry's offset and time (relative to the run's start)
+    uint64_t m_ullOffset = 0, m_ullLastOffset = 0, m_ullLastTime = 0;
+    uint64_t m_nEntries = 0, m_cbFlushed = 0;
+
+private:
+    // Not implemented
+    RedirTimeIndexSink_t(const RedirTimeIndexSink_t&) = delete;
+    RedirTimeIndexSink_t& operator = (const RedirTimeIndexSink_t&) = delete;
+};
+
+/// <summary>
+/// A time index's contents
+/// </summary>
+struct TimeIndex_t
+{
+    struct Entry_t
+    {
+        // Offset in the output's original content
+        uint64_t ullOffset;
+        // Microseconds since 1970-01-01 UTC
+        uint64_t ullUnixMicroseconds;
+    };
+    // The run's start, in microseconds since 1970-01-01 UTC
+    uint64_t ullBaseUnixMicroseconds = 0;
+    std::vector<Entry_t> vEntries;
+
+    /// <summary>
+    /// Reads a time index
+    /// </summary>
+    /// <param name="sPath">Input: path to the index</param>
+    /// <param name="dwError">Output: error code on failure; PlatformErrorInvalidData if it's not a valid time index</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Read(const std::wstring& sPath, uint32_t& dwError);
+
+    /// <summary>
+    /// Returns the time at which the data at an offset arrived: the time of the last entry at or before it
+    /// </summary>
+    uint64_t TimeAt(uint64_t ullOffset) const;
+};
+
+/// <summary>
+/// Formats a time in microseconds since 1970-01-01 UTC, as yyyy-mm-ddThh:mm:ss.ffffffZ
+/// </summary>
+std::wstring UnixMicrosecondsToString(uint64_t ullUnixMicroseconds);
@@ -0,0 +1,65 @@
+// Collection and summarization of resources consumed by target processes
+
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "Psapi.lib")
+#include "ResourceUsage.h"
+
+/// <summary>
+/// Convert a FILETIME to a 64-bit value for arithmetic
+/// </summary>
+static inline ULONGLONG FileTimeToULL(const FILETIME& ft)
+{
+    ULARGE_INTEGER ul;
+    ul.HighPart = ft.dwHighDateTime;
+    ul.LowPart = ft.dwLowDateTime;
+    return ul.QuadPart;
+}
+
+/// <summary>
+/// Capture resource usage information for a process.
+/// The handle must have PROCESS_QUERY_LIMITED_INFORMATION and PROCESS_VM_READ access.
+/// </summary>
+/// <param name="hProcess">Input: handle to the process to inspect</param>
+/// <param name="usage">Output: resource usage information</param>
+/// <returns>true if the process times could be retrieved (other values are best-effort); false otherwise</returns>
+bool GetProcessResourceUsage(HANDLE hProcess, ProcessResourceUsage_t& usage)
+{
+    usage = ProcessResourceUsage_t();
+    if (NULL == hProcess)
+        return false;
+
+    // Process times. Exit time is undefined if the process hasn't exited; use current time in that case.
+    FILETIME ftCreation = { 0 }, ftExit = { 0 }, ftKernel = { 0 }, ftUser = { 0 };
+    if (!GetProcessTimes(hProcess, &ftCreation, &ftExit, &ftKernel, &ftUser))
+        return false;
+
+    usage.bStillRunning = (WAIT_TIMEOUT == WaitForSingleObject(hProcess, 0));
+    if (usage.bStillRunning)
+        GetSystemTimeAsFileTime(&ftExit);
+    ULONGLONG ullCreation = FileTimeToULL(ftCreation), ullExit = FileTimeToULL(ftExit);
+    usage.ullWallTime = (ullExit > ullCreation) ? (ullExit - ullCreation) : 0;
+    usage.ullKernelTime = FileTimeToULL(ftKernel);
+    usage.ullUserTime = FileTimeToULL(ftUser);
+
+    // Memory counters. Still available after the process has exited, as long as we hold a handle to it.
+    PROCESS_MEMORY_COUNTERS pmc = { 0 };
+    pmc.cb = sizeof(pmc);
+    if (GetProcessMemoryInfo(hProcess, &pmc, sizeof(pmc)))
+    {
+        usage.ullPeakWorkingSet = pmc.PeakWorkingSetSize;
+        usage.ullPageFaults = pmc.PageFaultCount;
+    }
+
+    // I/O counters
+    IO_COUNTERS ioCounters = { 0 };
+    if (GetProcessIoCounters(hProcess, &ioCounters))
+    {
+        usage.ullReadBytes = ioCounters.ReadTransferCount;
+        usage.ullWriteBytes = ioCounters.WriteTransferCount;
+        usage.ullOtherBytes = ioCounters.OtherTransferCount;
+    }
+
+    usage.bValid = true;
+    return true;
+}
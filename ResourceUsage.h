@@ -0,0 +1,57 @@
+// Collection and summarization of resources consumed by target processes
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+#include "Statistics.h"
+
+/// <summary>
+/// Resources consumed by a single target process, captured when the process exits
+/// (or at report time, for processes that are still running).
+/// Times are in 100-nanosecond units, same as FILETIME.
+/// </summary>
+struct ProcessResourceUsage_t
+{
+    // set to true after the values have been successfully captured
+    bool bValid = false;
+    // set to true if the values were captured while the process was still running
+    bool bStillRunning = false;
+    // Elapsed time from process creation to exit (or to capture time if still running)
+    ULONGLONG ullWallTime = 0;
+    // CPU time spent in kernel mode and in user mode
+    ULONGLONG ullKernelTime = 0, ullUserTime = 0;
+    // Peak working set, in bytes
+    ULONGLONG ullPeakWorkingSet = 0;
+    // Number of page faults
+    ULONGLONG ullPageFaults = 0;
+    // I/O transfer counts, in bytes
+    ULONGLONG ullReadBytes = 0, ullWriteBytes = 0, ullOtherBytes = 0;
+
+    /// <summary>
+    /// Total CPU time (kernel + user), in 100-nanosecond units
+    /// </summary>
+    ULONGLONG CpuTime() const { return ullKernelTime + ullUserTime; }
+
+    /// <summary>
+    /// Total I/O transfer count (read + write + other), in bytes
+    /// </summary>
+    ULONGLONG IoBytes() const { return ullReadBytes + ullWriteBytes + ullOtherBytes; }
+};
+
+/// <summary>
+/// Capture resource usage information for a process.
+/// The handle must have PROCESS_QUERY_LIMITED_INFORMATION and PROCESS_VM_READ access.
+/// </summary>
+/// <param name="hProcess">Input: handle to the process to inspect</param>
+/// <param name="usage">Output: resource usage information</param>
+/// <returns>true if the process times could be retrieved (other values are best-effort); false otherwise</returns>
+bool GetProcessResourceUsage(HANDLE hProcess, ProcessResourceUsage_t& usage);
+
+/// <summary>
+/// Convert a time value in 100-nanosecond units to seconds
+/// </summary>
+inline double HundredNsToSeconds(ULONGLONG ull100ns)
+{
+    return double(ull100ns) / (10.0 * 1000.0 * 1000.0);
+}
@@ -2,19 +2,19 @@
 //
 
 #include <Windows.h>
-#include <UserEnv.h>
-#pragma comment(lib, "UserEnv.lib")
 #include <WtsApi32.h>
 #pragma comment(lib, "wtsapi32.lib")
 #include <io.h>
 #include <fcntl.h>
 #include <iostream>
+#include <iomanip>
 #include <sstream>
 #include <vector>
 #include "ProcessManager.h"
 #include "SecUtils.h"
 #include "SysErrorMessage.h"
 #include "UtilityFunctions.h"
+#include "Base64.h"
 #include "Wow64FsRedirection.h"
 #include "HEX.h"
 #include "DbgOut.h"
@@ -22,6 +22,23 @@
 #include "StringUtils.h"
 #include "WhoAmI.h"
 #include "Token.h"
+#include "FileOutput.h"
+#include "MonotonicClock.h"
+#include "PhaseTimings.h"
+#include "SoftClose.h"
+#include "ProcThreadAttributes.h"
+#include "ProcessorPlacement.h"
+#include "TargetEnvironment.h"
+#include "SessionSelection.h"
+#include "SessionFilter.h"
+#include "RedirCompress.h"
+#include "RedirDedup.h"
+#include "RedirQuota.h"
+#include "RedirMatch.h"
+#include "RedirRedact.h"
+#include "RedirHash.h"
+#include "RedirTimeIndex.h"
+#include "RedirLineIndex.h"
 
 // Considered adding -o outfile and -o2 errfile command line options, but this process writes to stdout/stderr through 
 // std::wcout/std::wcerr and through WriteFile (see RedirManager.cpp). Unless/until I come up with a way to redirect
@@ -33,6 +50,118 @@
 // precedence over -ExecutionPolicy.
 
 static const wchar_t* const szPowerShellCmd = L"powershell.exe -NoProfile -NoLogo -ExecutionPolicy Bypass";
+// With -pf: has PowerShell read the whole script from stdin, as UTF-8, and run it as one script block. (With -Command -,
+// PowerShell would run stdin a line at a time, as if typed, so that a multi-line statement needs a blank line after it,
+// and it would decode stdin in the console's code page.)
+static const wchar_t* const szStdinScriptCommand = L" -Command \"[Console]::InputEncoding = New-Object System.Text.UTF8Encoding $false; & ([ScriptBlock]::Create([Console]::In.ReadToEnd()))\"";
+
+// Wait time value representing "wait until the processes exit" (-wait inf)
+static const ULONGLONG ullWaitInfinite = ~ULONGLONG(0);
+
+// For the usage stats: how often, and for how long after the launches, to look for the targets' console hosts
+static const DWORD ConsoleHostPollMilliseconds = 100;
+static const ULONGLONG ConsoleHostSearchMilliseconds = 5000;
+
+/// <summary>
+/// Convert a wait time in seconds to milliseconds, preventing arithmetic overflow.
+/// (A wait long enough to overflow might as well be infinite.)
+/// </summary>
+static ULONGLONG WaitSecondsToMilliseconds(ULONGLONG ullSeconds)
+{
+    if (ullSeconds >= ullWaitInfinite / 1000)
+        return ullWaitInfinite;
+    return ullSeconds * 1000;
+}
+
+/// <summary>
+/// Parse a byte count: a number, optionally followed by K, M, or G (multiples of 1024)
+/// </summary>
+/// <returns>true if valid and non-zero; false otherwise</returns>
+static bool ParseByteCount(const wchar_t* szValue, ULONGLONG& ullBytes)
+{
+    // (wcstoull would accept a sign and leading whitespace)
+    if (*szValue < L'0' || *szValue > L'9')
+        return false;
+    wchar_t* pEnd = nullptr;
+    ullBytes = wcstoull(szValue, &pEnd, 10);
+    if (0 == ullBytes)
+        return false;
+    int nShift = 0;
+    switch (*pEnd)
+    {
+    case L'\0': break;
+    case L'K': case L'k': nShift = 10; ++pEnd; break;
+    case L'M': case L'm': nShift = 20; ++pEnd; break;
+    case L'G': case L'g': nShift = 30; ++pEnd; break;
+    default: return false;
+    }
+    if (L'\0' != *pEnd || ullBytes > (~ULONGLONG(0) >> nShift))
+        return false;
+    ullBytes <<= nShift;
+    return true;
+}
+
+/// <summary>
+/// Converts text from the command line to the OEM code page, which is what console programs write when their
+/// output is redirected
+/// </summary>
+/// <returns>true if successful; false otherwise</returns>
+static bool ToOemBytes(const std::wstring& sText, std::string& sBytes)
+{
+    const int cbBytes = WideCharToMultiByte(CP_OEMCP, 0, sText.c_str(), int(sText.length()), nullptr, 0, nullptr, nullptr);
+    if (cbBytes <= 0)
+        return false;
+    sBytes.assign(size_t(cbBytes), '\0');
+    WideCharToMultiByte(CP_OEMCP, 0, sText.c_str(), int(sText.length()), &sBytes[0], cbBytes, nullptr, nullptr);
+    return true;
+}
+
+/// <summary>
+/// Parse a -match argument, action=text, and add the pattern to the set
+/// </summary>
+/// <returns>true if valid; false otherwise</returns>
+static bool ParseMatchPattern(const wchar_t* szValue, PatternSet_t& patterns)
+{
+    const wchar_t* szText = wcschr(szValue, L'=');
+    if (nullptr == szText || L'\0' == szText[1])
+        return false;
+    const std::wstring sAction(szValue, szText - szValue);
+    const std::wstring sText(szText + 1);
+    MatchAction_t action;
+    if (L"count" == sAction)
+        action = MatchAction_t::Count;
+    else if (L"tag" == sAction)
+        action = MatchAction_t::Tag;
+    else if (L"term" == sAction)
+        action = MatchAction_t::Terminate;
+    else
+        return false;
+    std::string sBytes;
+    if (!ToOemBytes(sText, sBytes))
+        return false;
+    return patterns.Add(sText, sBytes, action);
+}
+
+/// <summary>
+/// Fill in the attributes of a session that -filter tests from its session information (the Session stage)
+/// </summary>
+/// <param name="session">Input: the session information</param>
+/// <param name="facts">Output: user, domain, lock state, idle time, and logon age</param>
+static void GetSessionFacts(const SessionInfo_t& session, SessionFacts_t& facts)
+{
+    // FILETIME units (100 ns) per second
+    const LONGLONG llUnitsPerSecond = 10000000;
+    facts.sUser = session.sUser;
+    facts.sDomain = session.sDomain;
+    // Win7/WS2008R2 reports lock state incorrectly; consider its sessions unlocked
+    facts.bLocked = (WTS_SESSIONSTATE_LOCK == session.wtsFlags && !IsWin7orWS2008R2());
+    // With no input since logon, the session has been idle since logon
+    const LARGE_INTEGER& lastActivity = (0 != session.lastInputTime.QuadPart) ? session.lastInputTime : session.logonTime;
+    facts.ullIdleSeconds = (0 != lastActivity.QuadPart && session.currentTime.QuadPart > lastActivity.QuadPart) ?
+        uint64_t((session.currentTime.QuadPart - lastActivity.QuadPart) / llUnitsPerSecond) : 0;
+    facts.ullLogonAgeSeconds = (0 != session.logonTime.QuadPart && session.currentTime.QuadPart > session.logonTime.QuadPart) ?
+        uint64_t((session.currentTime.QuadPart - session.logonTime.QuadPart) / llUnitsPerSecond) : 0;
+}
 
 /// <summary>
 /// Write command-line syntax to stderr (with optional error information) and then exit
@@ -54,11 +183,30 @@ void Usage(const wchar_t* argv0, const wchar_t* szError = nullptr, const wchar_t
         << std::endl
         << L"Usage:" << std::endl
         << std::endl
-        << L"  " << sExe << L" [-s {first|active|all|n}] [-wait n | -wait inf | -term n] [-redirStd directory [-merge]] [-e] [-hide|-min] [-p|-pb64|-pe] [-32] [-q] -c commandline" << std::endl
+        << L"  " << sExe << L" [-s {first|active|all|n}] [-filter expression] [-wait n | -wait inf | -term n [-grace n]] [-deadline class=n]... [-gang all|n,ms] [-redirStd directory [-merge] [-compress n] [-dedup] [-quota size [-quotaKeep head|tail|both]] [-totalQuota size] [-match action=text]... [-redact rule]... [-integrity fast|sha256] [-timeIndex] [-lineIndex n]] [-stats] [-statsJson file] [-phaseTimes file] [-e] [-hide|-min|-noConsole] [-priority class] [-ioPriority level] [-memPriority level] [-eco] [-background] [-spread groups|nodes [-spreadPolicy roundRobin|leastLoaded]] [-p|-pb64|-pe] [-32] [-stdin file] [-envBlock system|cached|verify] [-env name=value]... [-q] {-c commandline | -pf scriptfile}" << std::endl
         << std::endl
         << L"    -c commandline" << std::endl
         << L"      Everything after the first -c becomes the command line to execute, with quotes preserved, etc." << std::endl
         << std::endl
+        << L"    -pf scriptfile" << std::endl
+        << L"      Instead of -c: run the PowerShell script in scriptfile, by starting powershell.exe with a short command" << std::endl
+        << L"      that reads the script from its stdin, and writing the script to each target process' stdin." << std::endl
+        << L"      No encoding, and no command-line length limit. The file is UTF-8 (or ASCII), or UTF-16 with a byte-order mark." << std::endl
+        << L"      Requires -redirStd, and -wait or -term." << std::endl
+        << std::endl
+        << L"    -stdin file" << std::endl
+        << L"      Write the contents of file, unchanged, to each target process' stdin, and then close it. The file is read once" << std::endl
+        << L"      (mapped into memory) and written to all target processes at once, each as fast as it reads it." << std::endl
+        << L"      Without -stdin (or -pf), the target processes' stdin is empty. Requires -redirStd, and -wait or -term." << std::endl
+        << std::endl
+        << L"    -envBlock system|cached|verify" << std::endl
+        << L"      Where the target processes' environment blocks come from: CreateEnvironmentBlock for each one (system; the" << std::endl
+        << L"      default), or the same variables read from the registry once per run and once per user (cached). verify builds" << std::endl
+        << L"      both, reports any difference, and starts the target process with CreateEnvironmentBlock's block." << std::endl
+        << L"    -env name=value" << std::endl
+        << L"      Set an environment variable for the target processes, over the user's; name= (no value) removes it. In the" << std::endl
+        << L"      value, %name% stands for the user's value, e.g., -env \"Path=C:\\Tools;%Path%\". Can be repeated." << std::endl
+        << std::endl
         << L"    -s : desktop session(s) in which to execute:" << std::endl
         << L"        -s first" << std::endl
         << L"          Run the command line only on the first active session found." << std::endl
@@ -69,22 +217,96 @@ void Usage(const wchar_t* argv0, const wchar_t* szError = nullptr, const wchar_t
         << L"        -s n" << std::endl
         << L"          Run the command line in the session with ID \"n\" (where \"n\" is a positive decimal integer)." << std::endl
         << L"      If -s is not used, \"all\" is the default." << std::endl
+        << L"    -filter expression" << std::endl
+        << L"      Of the sessions chosen with -s, use only those whose attributes match the expression, e.g.," << std::endl
+        << L"      \"group=S-1-5-32-544 and (locked or idle>10m) and not client=KIOSK*\". Join comparisons with and, or, not, ( )." << std::endl
+        << L"        user, domain, client   = or != a name; * and ? are wildcards; not case-sensitive" << std::endl
+        << L"        group                  = (member) or != a group SID" << std::endl
+        << L"        locked                 = or != true or false; \"locked\" alone means locked=true" << std::endl
+        << L"        idle, logonAge         = != < <= > >= a duration: n, ns, nm, nh, or nd" << std::endl
+        << L"      Evaluated cheapest attributes first; the user's token is queried only if the session can still match." << std::endl
         << std::endl
         << L"    -wait, -term : whether and how long to wait for process(es) to exit, and report exit code:" << std::endl
         << L"        -term n" << std::endl
-        << L"          Wait up to n seconds for the process(es) to exit; terminate it if it hasn't exited." << std::endl
+        << L"          Wait up to n seconds for each process to exit; terminate it and its child processes if it hasn't exited." << std::endl
         << L"        -wait n" << std::endl
-        << L"          Wait up to n seconds for the process(es) to exit; do not terminate if it hasn't." << std::endl
+        << L"          Wait up to n seconds for each process to exit; do not terminate if it hasn't." << std::endl
         << L"        -wait inf" << std::endl
         << L"          Wait until the process(es) exit and report exit code." << std::endl
+        << L"      Each process' wait time is measured from when that process started." << std::endl
         << L"      If neither -wait or -term is used, " << sExe << L" does not wait for processes to exit," << std::endl
         << L"      and does not report exit codes." << std::endl
+        << L"    -grace n" << std::endl
+        << L"      With -term: when a process' time is up, first send Ctrl+C to its console, then terminate it" << std::endl
+        << L"      and its child processes if it hasn't exited within n more seconds." << std::endl
+        << L"    -deadline class=n" << std::endl
+        << L"      Use a wait time of n seconds (or \"inf\") instead of the -wait/-term value for processes in sessions" << std::endl
+        << L"      of the named class: \"active\" or \"disconnected\". Can be used once per class; requires -wait or -term." << std::endl
+        << std::endl
+        << L"    -gang all | -gang n,ms" << std::endl
+        << L"      Create all of the target processes suspended, with their output redirection ready, and then start them" << std::endl
+        << L"      together: all at once, or n at a time, ms milliseconds apart. Reports the start skew achieved (the" << std::endl
+        << L"      time from the first process started to the last). Deadlines are measured from when each one starts." << std::endl
         << std::endl
         << L"    -redirStd directory" << std::endl
         << L"      Redirect the target processes' stdout and stderr to uniquely-named files in the named directory." << std::endl
         << L"      Use \"-\" as the directory name to output target processes' stdout and stderr through this process' stdout/stderr." << std::endl
         << L"      Add -merge to redirect the target processes' stderr to its stdout." << std::endl
         << L"      -redirStd is applicable only when using -wait or -term to monitor the target process' output." << std::endl
+        << L"    -compress n" << std::endl
+        << L"      With -redirStd directory: compress the output files as they're written, at level n (1 = fastest, 9 = smallest)." << std::endl
+        << L"      The files get a " << szCompressedCaptureExtension << L" extension; read them with RunAsUsersOutput cat or decompress." << std::endl
+        << L"      Compressed output reaches the files in blocks of " << RedirCompressDefaultBlockSize / 1024 << L" KB, and when the process exits." << std::endl
+        << L"    -dedup" << std::endl
+        << L"      With -redirStd directory: store each distinct piece of output once, in a chunk store (" << szChunkStoreExtension << L") shared by" << std::endl
+        << L"      all the target processes, and write a manifest (" << szDedupManifestExtension << L") listing the pieces in place of each output file." << std::endl
+        << L"      Saves space and I/O when many processes write the same output. With -compress, the stored pieces are compressed." << std::endl
+        << L"      Read manifests with RunAsUsersOutput cat or reconstruct." << std::endl
+        << L"    -quota size" << std::endl
+        << L"      With -redirStd: keep at most size bytes (suffix K, M, or G for multiples of 1024) of each target process'" << std::endl
+        << L"      stdout and of its stderr. Output past the limit is read and dropped, and a line reports how much was omitted." << std::endl
+        << L"    -quotaKeep head|tail|both" << std::endl
+        << L"      Which part of output that exceeds -quota to keep: the beginning, the end, or half of each (default: both)." << std::endl
+        << L"      The end is held in memory until the target process exits." << std::endl
+        << L"    -totalQuota size" << std::endl
+        << L"      With -redirStd: keep at most size bytes of output from all target processes together." << std::endl
+        << L"    -match action=text" << std::endl
+        << L"      With -redirStd: look for text in each target process' output as it's redirected (case-sensitive), and:" << std::endl
+        << L"        count : report how many times it appeared when the process exits." << std::endl
+        << L"        tag   : report that it appeared when the process exits." << std::endl
+        << L"        term  : terminate the process and its child processes as soon as it appears (exit code " << MatchTerminationExitCode << L")." << std::endl
+        << L"      Can be used more than once. Output past a quota is still searched." << std::endl
+        << L"    -redact rule" << std::endl
+        << L"      With -redirStd: mask secrets in target processes' output with * before it's written anywhere. Rules:" << std::endl
+        << L"        prefix=text  : the value after text (any case), up to the next space, quote, , ; & < or >." << std::endl
+        << L"        pattern=expr : text matching expr: characters, ., [...], [^...], \\d, \\w, \\s, each with optional ? * + {n} {n,m}." << std::endl
+        << L"        entropy[=n]  : random-looking words of letters and digits at least n characters long (default " << RedactDefaultEntropyLength << L")," << std::endl
+        << L"                       and hexadecimal words at least 32 characters long." << std::endl
+        << L"      Can be used more than once. Output is written a line at a time; -match sees the output before redaction." << std::endl
+        << L"    -integrity fast|sha256" << std::endl
+        << L"      With -redirStd directory: hash each output file as it's written (XXH64; with sha256, SHA-256 too), and when" << std::endl
+        << L"      the run ends, write an integrity manifest (RunAsUsers_integrity_*" << szIntegrityManifestExtension << L") listing each file's name, size, hashes," << std::endl
+        << L"      session, process ID, and exit code. Sign the manifest to make the output tamper-evident." << std::endl
+        << L"    -timeIndex" << std::endl
+        << L"      With -redirStd directory: record when each part of each output file arrived, in a small index next to it" << std::endl
+        << L"      (" << szTimeIndexExtension << L"). RunAsUsersOutput merge shows the output of many sessions as one time-ordered view." << std::endl
+        << L"    -lineIndex n" << std::endl
+        << L"      With -redirStd directory: record where every nth line of each output file starts (e.g., " << LineIndexDefaultInterval << L"), and a checksum" << std::endl
+        << L"      of each " << (LineIndexBlockSize / (1024 * 1024)) << L"MB of it, in a small index next to it (" << szLineIndexExtension << L"). RunAsUsersOutput lines and tail use it" << std::endl
+        << L"      to go straight to any line, or to the end, of a large capture." << std::endl
+        << std::endl
+        << L"    -stats" << std::endl
+        << L"      Report the resources (wall time, CPU time, peak working set, page faults, I/O) consumed by each target" << std::endl
+        << L"      process, highest CPU time first, with percentiles across all target processes; and how long each took" << std::endl
+        << L"      to launch, and the resources its console host (conhost.exe) consumed." << std::endl
+        << L"    -statsJson file" << std::endl
+        << L"      Write the same resource usage information as JSON to the named file." << std::endl
+        << L"      -stats and -statsJson are applicable only when using -wait or -term." << std::endl
+        << L"    -phaseTimes file" << std::endl
+        << L"      Write timings (microseconds) of this program's startup and of each launch/monitoring phase for each" << std::endl
+        << L"      target process to the named CSV file: startup, initialization, session enumeration, time to first launch;" << std::endl
+        << L"      session query, token, environment block, process creation, first output, exit." << std::endl
+        << L"      Without -wait or -term, -phaseTimes omits first output and exit." << std::endl
         << std::endl
         << L"    -e" << std::endl
         << L"      Run the command line with the user's elevated permissions, if any." << std::endl
@@ -93,12 +315,41 @@ void Usage(const wchar_t* argv0, const wchar_t* szError = nullptr, const wchar_t
         << L"      Run the target process hidden (no UI). The default is to run it in its normal state (usually visible)." << std::endl
         << L"    -min" << std::endl
         << L"      Run the target process minimized to the taskbar." << std::endl
+        << L"    -noConsole" << std::endl
+        << L"      Start the target process without a console (DETACHED_PROCESS), so that no console host (conhost.exe) is" << std::endl
+        << L"      started with it. Requires -redirStd, and -wait or -term; not valid with -pf or -grace (there's no console" << std::endl
+        << L"      to send Ctrl+C to)." << std::endl
+        << L"      Console programs that the target process starts get consoles (and windows) of their own, unless it starts" << std::endl
+        << L"      them without." << std::endl
+        << std::endl
+        << L"    -priority idle|belowNormal|normal|aboveNormal" << std::endl
+        << L"      Run the target process with this priority class (inherited by the processes it starts at idle or below normal)." << std::endl
+        << L"    -ioPriority veryLow|low|normal" << std::endl
+        << L"      Run the target process with this I/O priority." << std::endl
+        << L"    -memPriority veryLow|low|medium|belowNormal|normal" << std::endl
+        << L"      Run the target process with this memory priority: how soon its pages leave memory when memory is short." << std::endl
+        << L"    -eco" << std::endl
+        << L"      Run the target process in efficiency mode (EcoQoS): throttled for power efficiency, on efficient cores." << std::endl
+        << L"    -background" << std::endl
+        << L"      Run the target process as if in background processing mode: -ioPriority veryLow and -memPriority veryLow," << std::endl
+        << L"      unless those are given." << std::endl
+        << L"      Priorities are set before the target process starts running. Any that can't be set are reported, and the" << std::endl
+        << L"      process runs without them. -stats and -statsJson report what was set for each process." << std::endl
+        << std::endl
+        << L"    -spread groups|nodes" << std::endl
+        << L"      Spread the target processes across the computer's processor groups or NUMA nodes: each starts on the" << std::endl
+        << L"      processors of one (and with nodes, allocates its memory there first). -stats and -statsJson report where" << std::endl
+        << L"      each was placed." << std::endl
+        << L"    -spreadPolicy roundRobin|leastLoaded" << std::endl
+        << L"      With -spread, place each target process in the next group or node in turn (roundRobin; the default), or" << std::endl
+        << L"      in the one with the fewest target processes per processor (leastLoaded), for groups or nodes of unequal size." << std::endl
         << std::endl
         << L"    -p, -pb64, -pe : runs the command line in the target sessions as a PowerShell command:" << std::endl
         << L"        -p" << std::endl
         << L"          Pass the \"commandline\" argument to powershell.exe as-is with -Command." << std::endl
         << L"        -pb64" << std::endl
         << L"          \"commandline\" is already base-64 encoded; pass it to powershell.exe as-is with -EncodedCommand." << std::endl
+        << L"          It must be valid base64 of UTF-16LE text, or RunAsUsers exits before starting anything." << std::endl
         << L"        -pe" << std::endl
         << L"          Base64-encode the input \"commandline\" and pass the result to powershell.exe with -EncodedCommand." << std::endl
         << L"      With each of the above, PowerShell.exe is invoked with these command-line switches:" << std::endl
@@ -140,6 +391,68 @@ static bool GetTargetCommandLine(std::wstring& sCommandLine)
     return false;
 }
 
+/// <summary>
+/// Reads a -pf script file, as UTF-8: a UTF-8 byte-order mark is removed, and UTF-16LE (with its byte-order mark) is converted.
+/// </summary>
+/// <param name="sPath">Input: path to the script</param>
+/// <param name="content">Output: the script, as UTF-8</param>
+/// <param name="dwError">Output: error code on failure</param>
+/// <returns>true if successful; false otherwise</returns>
+static bool ReadScriptFile(const std::wstring& sPath, std::vector<uint8_t>& content, DWORD& dwError)
+{
+    content.clear();
+    dwError = 0;
+    HANDLE hFile = CreateFileW(sPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    LARGE_INTEGER liSize = { 0 };
+    bool bOk = (FALSE != GetFileSizeEx(hFile, &liSize));
+    // (A script doesn't need to be anywhere near this big; it's only to keep the size in a DWORD)
+    if (bOk && liSize.QuadPart > MAXLONG)
+    {
+        SetLastError(ERROR_FILE_TOO_LARGE);
+        bOk = false;
+    }
+    if (bOk)
+    {
+        content.resize(size_t(liSize.QuadPart));
+        DWORD cbDone = 0;
+        while (bOk && cbDone < content.size())
+        {
+            DWORD cbRead = 0;
+            SetLastError(0);
+            bOk = (FALSE != ReadFile(hFile, content.data() + cbDone, DWORD(content.size()) - cbDone, &cbRead, NULL)) && cbRead > 0;
+            if (bOk)
+                cbDone += cbRead;
+            else if (ERROR_SUCCESS == GetLastError())
+                SetLastError(ERROR_HANDLE_EOF);
+        }
+    }
+    if (!bOk)
+        dwError = GetLastError();
+    CloseHandle(hFile);
+    if (!bOk)
+        return false;
+
+    if (content.size() >= 3 && 0xEF == content[0] && 0xBB == content[1] && 0xBF == content[2])
+    {
+        content.erase(content.begin(), content.begin() + 3);
+    }
+    else if (content.size() >= 2 && 0xFF == content[0] && 0xFE == content[1])
+    {
+        const std::wstring sScript((const wchar_t*)(content.data() + 2), (content.size() - 2) / sizeof(wchar_t));
+        const int cbUtf8 = sScript.empty() ? 0 : WideCharToMultiByte(CP_UTF8, 0, sScript.data(), int(sScript.length()), nullptr, 0, nullptr, nullptr);
+        std::vector<uint8_t> utf8(static_cast<size_t>(cbUtf8));
+        if (cbUtf8 > 0)
+            WideCharToMultiByte(CP_UTF8, 0, sScript.data(), int(sScript.length()), (LPSTR)utf8.data(), cbUtf8, nullptr, nullptr);
+        content.swap(utf8);
+    }
+    return true;
+}
+
 /// <summary>
 /// Return the directory that should be used as the current directory for target processes.
 /// Current implementation uses the system directory (typically C:\Windows\System32), which will work
@@ -161,70 +474,26 @@ static const std::wstring& TargetCurrentDirectory()
     return sTargetCurrentDirectory;
 }
 
-/// <summary>
-/// Enum for the -s option (which session or sessions to execute processes in)
-/// </summary>
-enum class WhichSessions_t {
-    firstActive,
-    allActive,
-    allLoggedOn,
-    oneSessionId
-};
-
-/// <summary>
-/// Convert the WhichSesssions_t enum to corresponding string.
-/// </summary>
-inline std::wstring WhichSessionsToWSZ(WhichSessions_t whichSessions, DWORD nSessionId)
-{
-    switch (whichSessions)
-    {
-    case WhichSessions_t::firstActive:
-        return L"First active";
-    case WhichSessions_t::allActive:
-        return L"All active";
-    case WhichSessions_t::allLoggedOn:
-        return L"All logged on";
-    case WhichSessions_t::oneSessionId:
-    {
-        std::wstringstream str;
-        str << L"Session # " << nSessionId;
-        return str.str();
-    }
-    default:
-        return L"UNEXPECTED/UNDEFINED";
-        break;
-    }
-}
-
-// Commented-out wmainImpl code for stress- and leak-testing
-//int wmainImpl(int argc, wchar_t** argv);
+// For stress- and leak-testing of the launch/monitor/redirect cycle, see the -soak option of RunAsUsersBench.
 
 int wmain(int argc, wchar_t** argv)
-//{
-//    std::wstring s;
-//    std::wcout << L"READY TO START HEAVY TEST. PRESS KEYS AND ENTER: " << std::endl;
-//    std::wcin >> s;
-//
-//    for (size_t ix = 0; ix < 50; ++ix)
-//    {
-//        std::wcout << L"BEGIN ITERATION " << ix << std::endl;
-//        //std::wcout << L"argc = " << argc << L"; ";
-//        //for (int ixArg = 0; ixArg < argc; ++ixArg)
-//        //    std::wcout << argv[ixArg] << L", ";
-//        //std::wcout << std::endl;
-//        wmainImpl(argc, argv);
-//        std::wcout << L"ENDING ITERATION " << ix << std::endl;
-//    }
-//
-//    std::wcout << L"DONE WITH HEAVY TEST. PRESS KEYS AND ENTER: " << std::endl;
-//    std::wcin >> s;
-//    return 0;
-//}
-//int wmainImpl(int argc, wchar_t** argv)
 {
+    // Note when wmain was entered, for the startup phase timings
+    const ULONGLONG ullWmainEntry = MonotonicMicroseconds();
+
     // Default is no debug output; can be changed with hidden options
     dbgOut.WriteToDebugStream(false);
 
+    // Hidden helper mode used for staged termination; see SoftClose.h.
+    // Handled before anything touches this process' (nonexistent) console.
+    if (3 == argc && 0 == wcscmp(szSoftCloseHelperOption, argv[1]))
+    {
+        DWORD dwPID = 0;
+        if (1 != swscanf_s(argv[2], L"%lu", &dwPID))
+            return -1;
+        return int(SoftCloseHelper(dwPID));
+    }
+
     // Set output mode to UTF8.
     if (_setmode(_fileno(stdout), _O_U8TEXT) == -1 || _setmode(_fileno(stderr), _O_U8TEXT) == -1)
     {
@@ -238,29 +507,80 @@ int wmain(int argc, wchar_t** argv)
         sOriginalCommandLine, 
         sActualCommandLine, 
         sRedirStdDirectory,
+        sStatsJsonFile,
+        sPhaseTimesFile,
+        sScriptFile,
+        sStdinFile,
         sDbgLogFname;
     bool
         bQuiet = false,
         bPowerShell = false, bIsBase64 = false, bEncode = false,
         bRedirStd = false,
         bMergeStd = false,
+        bDedup = false,
+        bStats = false,
         bTryElevated = false,
         bHidden = false,
         bMinimized = false,
+        bNoConsole = false,
+        bBackground = false,
         bTerminate = false,
         bWow64FileSystemRedir = false,
         bDebug = false, bDebugF = false;
     DWORD 
-        dwWait = 0, 
         nSessionId = 0,
         nTargetedSessions = 0;
+    // Which of the selected sessions to start target processes in, by their attributes (-filter); and how many
+    // sessions it ruled out at each stage
+    SessionFilter_t sessionFilter;
+    size_t nFilteredOut[3] = { 0 };
+    // Wait time in seconds as specified on the command line; converted to milliseconds after parsing.
+    // 0 means no wait; ullWaitInfinite means wait until all processes exit.
+    ULONGLONG ullWait = 0;
+    // Per-session-class wait times in seconds (converted to milliseconds after parsing); 0 means use ullWait.
+    ULONGLONG ullWaitActive = 0, ullWaitDisconnected = 0;
+    // Grace period in seconds (converted to milliseconds after parsing) between asking a process to exit and terminating it.
+    ULONGLONG ullGrace = 0;
+    // With -gang: hold the targets suspended until all have been created, then start them nGangWave at a time (0 for
+    // all at once), dwGangIntervalMs apart
+    bool bGangStart = false;
+    size_t nGangWave = 0;
+    DWORD dwGangIntervalMs = 0;
+    // Priorities for the target processes (-priority, -ioPriority, -memPriority, -eco; -background fills in the
+    // I/O and memory priorities not given)
+    ProcessPriority_t targetPriority;
+    // Where the target processes' environment blocks come from, and variables to set in them (-envBlock, -env)
+    EnvSource_t envSource = EnvSource_t::System;
+    vecEnvVars_t envOverlays;
+    TargetEnvironment_t targetEnvironment;
+    // Where to place the target processes (-spread, -spreadPolicy)
+    PlacementDomain_t spreadDomain = PlacementDomain_t::None;
+    PlacementPolicy_t spreadPolicy = PlacementPolicy_t::RoundRobin;
+    bool bSpreadPolicySet = false;
+    ProcessorPlacement_t placement;
+    // Compression level for redirected output files; 0 for no compression
+    int nCompressLevel = 0;
+    // Hashes to compute for an integrity manifest of the output files
+    IntegrityHash_t integrityHash = IntegrityHash_t::None;
+    // Whether to record when output arrives, in a time index next to each output file
+    bool bTimeIndex = false;
+    // If non-zero, record where every nth line of each output file starts, in a line index next to it
+    uint32_t nLineIndexInterval = 0;
+    // Output quotas: bytes kept per output stream and for the whole run (QuotaUnlimited for no limit), and what to keep
+    ULONGLONG ullQuota = QuotaUnlimited, ullTotalQuota = QuotaUnlimited;
+    QuotaPolicy_t quotaPolicy = QuotaPolicy_t::HeadTail;
+    bool bQuotaPolicySet = false;
+    // Patterns to look for in redirected output
+    PatternSet_t patterns;
+    // Secrets to mask in redirected output, and the rules as given (for the report)
+    RedactionRules_t redaction;
+    std::vector<std::wstring> vRedactionRules;
     WhichSessions_t whichSessions = WhichSessions_t::allLoggedOn;
 
     DWORD dwLastErr = 0;
 
-    // Get the target command line to execute (everything past the first "-c")
-    if (!GetTargetCommandLine(sOriginalCommandLine))
-        Usage(argv[0], L"Missing command line");
+    // Get the target command line to execute (everything past the first "-c"); not needed with -pf
+    const bool bHaveCommandLine = GetTargetCommandLine(sOriginalCommandLine);
 
     // Parse command-line options
     int ixArg = 1;
@@ -298,6 +618,57 @@ int wmain(int argc, wchar_t** argv)
             bPowerShell = true;
             bEncode = true;
         }
+        else if (0 == wcscmp(L"-pf", argv[ixArg]))
+        {
+            // Can use at most only one PowerShell option
+            if (bPowerShell)
+                Usage(argv[0], L"PowerShell option already specified");
+            // PowerShell script to write to the target processes' stdin
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -pf");
+            sScriptFile = argv[ixArg];
+            bPowerShell = true;
+        }
+        else if (0 == wcscmp(L"-stdin", argv[ixArg]))
+        {
+            // File to write to the target processes' stdin
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -stdin");
+            sStdinFile = argv[ixArg];
+        }
+        else if (0 == wcscmp(L"-envBlock", argv[ixArg]))
+        {
+            // Where the target processes' environment blocks come from
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -envBlock");
+            if (0 == wcscmp(L"system", argv[ixArg]))
+                envSource = EnvSource_t::System;
+            else if (0 == wcscmp(L"cached", argv[ixArg]))
+                envSource = EnvSource_t::Cached;
+            else if (0 == wcscmp(L"verify", argv[ixArg]))
+                envSource = EnvSource_t::Verify;
+            else
+                Usage(argv[0], L"Invalid arg for -envBlock", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-env", argv[ixArg]))
+        {
+            // Environment variable to set for the target processes: name=value
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -env");
+            EnvVar_t overlay;
+            if (!ParseEnvOverlay(argv[ixArg], overlay))
+                Usage(argv[0], L"Invalid arg for -env", argv[ixArg]);
+            envOverlays.push_back(overlay);
+        }
+        else if (0 == wcscmp(L"-filter", argv[ixArg]))
+        {
+            // Expression selecting sessions by their attributes; compiled once, here
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -filter");
+            std::wstring sFilterError;
+            if (!sessionFilter.Compile(argv[ixArg], sFilterError))
+                Usage(argv[0], (L"Invalid arg for -filter: " + sFilterError).c_str(), argv[ixArg]);
+        }
         else if (0 == wcscmp(L"-redirStd", argv[ixArg]))
         {
             // Redirect target process' stdout/stderr to uniquely-named files in named directory
@@ -310,6 +681,109 @@ int wmain(int argc, wchar_t** argv)
         {
             bMergeStd = true;
         }
+        else if (0 == wcscmp(L"-compress", argv[ixArg]))
+        {
+            // Compress redirected output files at the named level
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -compress");
+            if (1 != swscanf_s(argv[ixArg], L"%d", &nCompressLevel) || nCompressLevel < LzMinLevel || nCompressLevel > LzMaxLevel)
+                Usage(argv[0], L"Invalid arg for -compress", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-dedup", argv[ixArg]))
+        {
+            // Store redirected output in a run-wide chunk store, with per-process manifests
+            bDedup = true;
+        }
+        else if (0 == wcscmp(L"-integrity", argv[ixArg]))
+        {
+            // Hash output files as they're written, and write an integrity manifest
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -integrity");
+            if (0 == wcscmp(L"fast", argv[ixArg]))
+                integrityHash = IntegrityHash_t::Fast;
+            else if (0 == wcscmp(L"sha256", argv[ixArg]))
+                integrityHash = IntegrityHash_t::Sha256;
+            else
+                Usage(argv[0], L"Invalid arg for -integrity", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-timeIndex", argv[ixArg]))
+        {
+            // Record when output arrives, next to each output file
+            bTimeIndex = true;
+        }
+        else if (0 == wcscmp(L"-lineIndex", argv[ixArg]))
+        {
+            // Record where every nth line starts, next to each output file
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -lineIndex");
+            if (1 != swscanf_s(argv[ixArg], L"%u", &nLineIndexInterval) || 0 == nLineIndexInterval || nLineIndexInterval > LineIndexMaxInterval)
+                Usage(argv[0], L"Invalid arg for -lineIndex", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-quota", argv[ixArg]) || 0 == wcscmp(L"-totalQuota", argv[ixArg]))
+        {
+            // Most bytes of output to keep per output stream, or for the whole run
+            ULONGLONG& ullLimit = (0 == wcscmp(L"-quota", argv[ixArg])) ? ullQuota : ullTotalQuota;
+            const wchar_t* szOption = argv[ixArg];
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for", szOption);
+            if (!ParseByteCount(argv[ixArg], ullLimit) || QuotaUnlimited == ullLimit)
+                Usage(argv[0], L"Invalid size", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-quotaKeep", argv[ixArg]))
+        {
+            // Which part of output that exceeds the quota to keep
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -quotaKeep");
+            if (0 == wcscmp(L"head", argv[ixArg]))
+                quotaPolicy = QuotaPolicy_t::Head;
+            else if (0 == wcscmp(L"tail", argv[ixArg]))
+                quotaPolicy = QuotaPolicy_t::Tail;
+            else if (0 == wcscmp(L"both", argv[ixArg]))
+                quotaPolicy = QuotaPolicy_t::HeadTail;
+            else
+                Usage(argv[0], L"Invalid arg for -quotaKeep", argv[ixArg]);
+            bQuotaPolicySet = true;
+        }
+        else if (0 == wcscmp(L"-match", argv[ixArg]))
+        {
+            // Pattern to look for in redirected output, and what to do when it appears: action=text
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -match");
+            if (!ParseMatchPattern(argv[ixArg], patterns))
+                Usage(argv[0], L"Invalid arg for -match", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-redact", argv[ixArg]))
+        {
+            // Secrets to mask in redirected output
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -redact");
+            std::string sRule;
+            std::wstring sError;
+            if (!ToOemBytes(argv[ixArg], sRule))
+                Usage(argv[0], L"Invalid arg for -redact", argv[ixArg]);
+            if (!redaction.Add(sRule, sError))
+                Usage(argv[0], (L"Invalid arg for -redact (" + sError + L")").c_str(), argv[ixArg]);
+            vRedactionRules.push_back(argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-stats", argv[ixArg]))
+        {
+            // Report target processes' resource usage
+            bStats = true;
+        }
+        else if (0 == wcscmp(L"-statsJson", argv[ixArg]))
+        {
+            // Write target processes' resource usage as JSON to the named file
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -statsJson");
+            sStatsJsonFile = argv[ixArg];
+        }
+        else if (0 == wcscmp(L"-phaseTimes", argv[ixArg]))
+        {
+            // Write phase timings as CSV to the named file
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -phaseTimes");
+            sPhaseTimesFile = argv[ixArg];
+        }
         else if (0 == wcscmp(L"-e", argv[ixArg]))
         {
             // Run the target executable using each user's elevated token, if possible.
@@ -327,17 +801,81 @@ int wmain(int argc, wchar_t** argv)
             // Note: if both specified, hidden takes precedence over minimized
             bMinimized = true;
         }
+        else if (0 == wcscmp(L"-noConsole", argv[ixArg]))
+        {
+            // Run the target executable without a console (and so without a console host process)
+            bNoConsole = true;
+        }
+        else if (0 == wcscmp(L"-priority", argv[ixArg]))
+        {
+            // Priority class for the target processes
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -priority");
+            if (!targetPriority.ParsePriorityClass(argv[ixArg]))
+                Usage(argv[0], L"Invalid arg for -priority", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-ioPriority", argv[ixArg]))
+        {
+            // I/O priority for the target processes
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -ioPriority");
+            if (!targetPriority.ParseIoPriority(argv[ixArg]))
+                Usage(argv[0], L"Invalid arg for -ioPriority", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-memPriority", argv[ixArg]))
+        {
+            // Memory priority for the target processes
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -memPriority");
+            if (!targetPriority.ParseMemoryPriority(argv[ixArg]))
+                Usage(argv[0], L"Invalid arg for -memPriority", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-eco", argv[ixArg]))
+        {
+            // Run the target processes in efficiency mode (EcoQoS)
+            targetPriority.bEcoQoS = true;
+        }
+        else if (0 == wcscmp(L"-background", argv[ixArg]))
+        {
+            // Run the target processes as if in background processing mode (resolved after parsing)
+            bBackground = true;
+        }
+        else if (0 == wcscmp(L"-spread", argv[ixArg]))
+        {
+            // Spread the target processes across processor groups or NUMA nodes
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -spread");
+            if (0 == wcscmp(L"groups", argv[ixArg]))
+                spreadDomain = PlacementDomain_t::Group;
+            else if (0 == wcscmp(L"nodes", argv[ixArg]))
+                spreadDomain = PlacementDomain_t::Node;
+            else
+                Usage(argv[0], L"Invalid arg for -spread", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-spreadPolicy", argv[ixArg]))
+        {
+            // How to pick the group or node for each target process
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -spreadPolicy");
+            if (0 == wcscmp(L"roundRobin", argv[ixArg]))
+                spreadPolicy = PlacementPolicy_t::RoundRobin;
+            else if (0 == wcscmp(L"leastLoaded", argv[ixArg]))
+                spreadPolicy = PlacementPolicy_t::LeastLoaded;
+            else
+                Usage(argv[0], L"Invalid arg for -spreadPolicy", argv[ixArg]);
+            bSpreadPolicySet = true;
+        }
         else if (0 == wcscmp(L"-term", argv[ixArg]))
         {
             // Terminate the target executable if it hasn't completed within specified wait period
             // 
             // -term/-wait can be used once at most
-            if (0 != dwWait)
+            if (0 != ullWait)
                 Usage(argv[0], L"-term/-wait can be specified once at most");
 
             if (++ixArg >= argc)
                 Usage(argv[0], L"Missing arg for -term");
-            if (1 != swscanf_s(argv[ixArg], L"%lu", &dwWait) || 0 == dwWait)
+            if (1 != swscanf_s(argv[ixArg], L"%llu", &ullWait) || 0 == ullWait)
                 Usage(argv[0], L"Invalid arg for -term", argv[ixArg]);
             bTerminate = true;
         }
@@ -346,16 +884,63 @@ int wmain(int argc, wchar_t** argv)
             // Wait for target executable for specified amount of time to report exit code
             // 
             // -term/-wait can be used once at most
-            if (0 != dwWait)
+            if (0 != ullWait)
                 Usage(argv[0], L"-term/-wait can be specified once at most");
 
             if (++ixArg >= argc)
                 Usage(argv[0], L"Missing arg for -wait");
             if (0 == wcscmp(L"inf", argv[ixArg]))
-                dwWait = INFINITE;
-            else if (1 != swscanf_s(argv[ixArg], L"%lu", &dwWait) || 0 == dwWait)
+                ullWait = ullWaitInfinite;
+            else if (1 != swscanf_s(argv[ixArg], L"%llu", &ullWait) || 0 == ullWait)
                 Usage(argv[0], L"Invalid arg for -wait", argv[ixArg]);
         }
+        else if (0 == wcscmp(L"-grace", argv[ixArg]))
+        {
+            // Ask processes to exit gracefully before terminating them
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -grace");
+            if (1 != swscanf_s(argv[ixArg], L"%llu", &ullGrace) || 0 == ullGrace)
+                Usage(argv[0], L"Invalid arg for -grace", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-deadline", argv[ixArg]))
+        {
+            // Wait time for processes in a particular class of session: class=n
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -deadline");
+            const wchar_t* szValue = wcschr(argv[ixArg], L'=');
+            if (nullptr == szValue)
+                Usage(argv[0], L"Invalid arg for -deadline", argv[ixArg]);
+            const std::wstring sClass(argv[ixArg], szValue - argv[ixArg]);
+            ++szValue;
+            ULONGLONG* pullClassWait = nullptr;
+            if (L"active" == sClass)
+                pullClassWait = &ullWaitActive;
+            else if (L"disconnected" == sClass)
+                pullClassWait = &ullWaitDisconnected;
+            else
+                Usage(argv[0], L"Invalid session class for -deadline", argv[ixArg]);
+            if (0 != *pullClassWait)
+                Usage(argv[0], L"-deadline can be specified once at most for each session class", argv[ixArg]);
+            if (0 == wcscmp(L"inf", szValue))
+                *pullClassWait = ullWaitInfinite;
+            else if (1 != swscanf_s(szValue, L"%llu", pullClassWait) || 0 == *pullClassWait)
+                Usage(argv[0], L"Invalid arg for -deadline", argv[ixArg]);
+        }
+        else if (0 == wcscmp(L"-gang", argv[ixArg]))
+        {
+            // Start the target processes together: all, or n,ms (n at a time, ms milliseconds apart)
+            if (++ixArg >= argc)
+                Usage(argv[0], L"Missing arg for -gang");
+            unsigned int nWave = 0, nIntervalMs = 0;
+            wchar_t chExtra = 0;
+            if (0 == wcscmp(L"all", argv[ixArg]))
+                nWave = 0;
+            else if (2 != swscanf_s(argv[ixArg], L"%u,%u%lc", &nWave, &nIntervalMs, &chExtra, 1) || 0 == nWave)
+                Usage(argv[0], L"Invalid arg for -gang", argv[ixArg]);
+            bGangStart = true;
+            nGangWave = nWave;
+            dwGangIntervalMs = nIntervalMs;
+        }
         else if (0 == wcscmp(L"-s", argv[ixArg]))
         {
             // Which session(s) to run target executables in
@@ -400,22 +985,140 @@ int wmain(int argc, wchar_t** argv)
     }
 
     // A bit more command-line option validation
+    // The command line comes from -c or, with -pf, from a script file
+    if (sScriptFile.empty() && !bHaveCommandLine)
+    {
+        Usage(argv[0], L"Missing command line");
+    }
+    if (!sScriptFile.empty() && bHaveCommandLine)
+    {
+        Usage(argv[0], L"-pf and -c are mutually exclusive");
+    }
+    // With -pf, the script is written to the stdin pipe that -redirStd creates, by threads that are waited for
+    if (!sScriptFile.empty() && (!bRedirStd || 0 == ullWait))
+    {
+        Usage(argv[0], L"-pf is valid only with -redirStd, and -wait or -term");
+    }
+    // -pf takes stdin for the script, and -stdin has the same requirements
+    if (!sStdinFile.empty() && !sScriptFile.empty())
+    {
+        Usage(argv[0], L"-stdin and -pf are mutually exclusive");
+    }
+    if (!sStdinFile.empty() && (!bRedirStd || 0 == ullWait))
+    {
+        Usage(argv[0], L"-stdin is valid only with -redirStd, and -wait or -term");
+    }
+    // Without a console, the target's output has nowhere to go but the -redirStd pipes (which are turned off below
+    // without a wait), and there's no window to hide
+    if (bNoConsole && (!bRedirStd || 0 == ullWait))
+    {
+        Usage(argv[0], L"-noConsole is valid only with -redirStd, and -wait or -term");
+    }
+    if (bNoConsole && (bHidden || bMinimized))
+    {
+        Usage(argv[0], L"-noConsole is not valid with -hide or -min");
+    }
+    // (-pf sets the console's input code page, which fails without a console)
+    if (bNoConsole && !sScriptFile.empty())
+    {
+        Usage(argv[0], L"-noConsole is not valid with -pf");
+    }
+    // (-grace sends Ctrl+C to the target's console, and a DETACHED_PROCESS target has none)
+    if (bNoConsole && 0 != ullGrace)
+    {
+        Usage(argv[0], L"-noConsole is not valid with -grace");
+    }
+    // Background processing mode lowers I/O and memory priority; explicit settings take precedence
+    if (bBackground)
+    {
+        if (-1 == targetPriority.nIoPriority)
+            targetPriority.ParseIoPriority(L"veryLow");
+        if (0 == targetPriority.ulMemoryPriority)
+            targetPriority.ParseMemoryPriority(L"veryLow");
+    }
+    if (bSpreadPolicySet && PlacementDomain_t::None == spreadDomain)
+    {
+        Usage(argv[0], L"-spreadPolicy is not valid without -spread");
+    }
     if (bMergeStd && !bRedirStd)
     {
         Usage(argv[0], L"-merge is not valid without -redirStd");
     }
+    if (0 != nCompressLevel && (!bRedirStd || sRedirStdDirectory == L"-"))
+    {
+        Usage(argv[0], L"-compress is valid only with -redirStd and a directory");
+    }
+    if (bDedup && (!bRedirStd || sRedirStdDirectory == L"-"))
+    {
+        Usage(argv[0], L"-dedup is valid only with -redirStd and a directory");
+    }
+    if (IntegrityHash_t::None != integrityHash && (!bRedirStd || sRedirStdDirectory == L"-"))
+    {
+        Usage(argv[0], L"-integrity is valid only with -redirStd and a directory");
+    }
+    if (bTimeIndex && (!bRedirStd || sRedirStdDirectory == L"-"))
+    {
+        Usage(argv[0], L"-timeIndex is valid only with -redirStd and a directory");
+    }
+    if (0 != nLineIndexInterval && (!bRedirStd || sRedirStdDirectory == L"-"))
+    {
+        Usage(argv[0], L"-lineIndex is valid only with -redirStd and a directory");
+    }
+    if ((QuotaUnlimited != ullQuota || QuotaUnlimited != ullTotalQuota) && !bRedirStd)
+    {
+        Usage(argv[0], L"-quota and -totalQuota are not valid without -redirStd");
+    }
+    if (bQuotaPolicySet && QuotaUnlimited == ullQuota)
+    {
+        Usage(argv[0], L"-quotaKeep is not valid without -quota");
+    }
+    if (!patterns.Empty() && !bRedirStd)
+    {
+        Usage(argv[0], L"-match is not valid without -redirStd");
+    }
+    if (!redaction.Empty() && !bRedirStd)
+    {
+        Usage(argv[0], L"-redact is not valid without -redirStd");
+    }
+
+    // Per-session-class deadlines and grace periods apply only to processes that are being monitored
+    if ((0 != ullWaitActive || 0 != ullWaitDisconnected) && 0 == ullWait)
+    {
+        Usage(argv[0], L"-deadline is not valid without -wait or -term");
+    }
+    if (0 != ullGrace && !bTerminate)
+    {
+        Usage(argv[0], L"-grace is not valid without -term");
+    }
 
     // Redirection of standard out/err handles isn't effective if no wait time specified
     //TODO: should this be an error? Should it imply "-wait inf?"
-    if (bRedirStd && 0 == dwWait)
+    if (bRedirStd && 0 == ullWait)
     {
         bRedirStd = false;
         sRedirStdDirectory.clear();
+        nCompressLevel = 0;
+        bDedup = false;
+        integrityHash = IntegrityHash_t::None;
+        bTimeIndex = false;
+        nLineIndexInterval = 0;
+        ullQuota = ullTotalQuota = QuotaUnlimited;
         std::wcerr
             << L"Redirection of target process stdout/stderr is useful only when a wait time is specified with -wait or -term." << std::endl
             << L"Turning off stdout/stderr redirection." << std::endl;
     }
 
+    // Resource usage is captured as processes exit, so it is available only when waiting for them.
+    // (Phase timings are available without waiting, but without the first-output and exit phases.)
+    if ((bStats || sStatsJsonFile.length() > 0) && 0 == ullWait)
+    {
+        bStats = false;
+        sStatsJsonFile.clear();
+        std::wcerr
+            << L"Resource usage reporting is available only when a wait time is specified with -wait or -term." << std::endl
+            << L"Turning off resource usage reporting." << std::endl;
+    }
+
     // If sRedirStdDirectory is specified, ensure that it exists and is a directory, unless it's "-", in which case clear it.
     if (sRedirStdDirectory == L"-")
         sRedirStdDirectory.clear();
@@ -435,6 +1138,27 @@ int wmain(int argc, wchar_t** argv)
         }
     }
 
+    // With -pf, read the script once; every target process gets it from this one buffer
+    std::vector<uint8_t> scriptContent;
+    if (!sScriptFile.empty())
+    {
+        DWORD dwReadError = 0;
+        if (!ReadScriptFile(sScriptFile, scriptContent, dwReadError))
+            Usage(argv[0], (L"Cannot read -pf script file (" + SysErrorMessageWithCode(dwReadError) + L")").c_str(), sScriptFile.c_str());
+        if (scriptContent.empty())
+            Usage(argv[0], L"-pf script file is empty", sScriptFile.c_str());
+    }
+
+    // With -stdin, map the file once; every target process gets it from this one mapping. (An empty file maps to
+    // nothing, and the processes get an empty stdin, as they do without -stdin.)
+    PlatformMappedFile_t stdinMapping;
+    if (!sStdinFile.empty())
+    {
+        uint32_t dwMapError = 0;
+        if (!PlatformMapFile(sStdinFile, stdinMapping, dwMapError))
+            Usage(argv[0], (L"Cannot read -stdin file (" + SysErrorMessageWithCode(dwMapError) + L")").c_str(), sStdinFile.c_str());
+    }
+
     // Implement hidden debug options
     if (bDebug)
     {
@@ -454,13 +1178,13 @@ int wmain(int argc, wchar_t** argv)
         }
     }
 
-    // Prevent arithmetic overflow converting seconds to milliseconds.
-    // If wait greater than about 49 days, make it infinite.
-    if (dwWait >= 4294967)
-        dwWait = INFINITE;
     // Convert seconds to milliseconds
-    if (INFINITE != dwWait)
-        dwWait *= 1000;
+    ullWait = WaitSecondsToMilliseconds(ullWait);
+    if (0 != ullWaitActive)
+        ullWaitActive = WaitSecondsToMilliseconds(ullWaitActive);
+    if (0 != ullWaitDisconnected)
+        ullWaitDisconnected = WaitSecondsToMilliseconds(ullWaitDisconnected);
+    ullGrace = WaitSecondsToMilliseconds(ullGrace);
 
     //
     // Build the command line spec
@@ -481,7 +1205,12 @@ int wmain(int argc, wchar_t** argv)
         const std::wstring sEncodedCommand = L" -EncodedCommand ";
         const std::wstring sCommand = L" -Command ";
 
-        if (bEncode)
+        if (!sScriptFile.empty())
+        {
+            // The script is written to stdin; the command line only has PowerShell read it and run it
+            sActualCommandLine = sPowerShellCmd + szStdinScriptCommand;
+        }
+        else if (bEncode)
         {
             // Base64-encode the input command line and run it with -EncodedCommand
             std::wstring sBase64Command;
@@ -496,7 +1225,22 @@ int wmain(int argc, wchar_t** argv)
         }
         else if (bIsBase64)
         {
-            // Input command line is base64-encoded; run it with -EncodedCommand
+            // Input command line is base64-encoded; run it with -EncodedCommand.
+            // Check it here, so that a malformed payload fails once rather than in every session PowerShell starts in.
+            std::vector<uint8_t> decoded;
+            size_t ixError = 0;
+            if (!Base64Decode(sOriginalCommandLine.c_str(), sOriginalCommandLine.length(), decoded, ixError))
+            {
+                std::wstringstream strError;
+                if (ixError < sOriginalCommandLine.length())
+                    strError << L"-pb64 command line is not valid base64 (character " << (ixError + 1) << L")";
+                else
+                    strError << L"-pb64 command line is not valid base64 (its length must be a multiple of 4)";
+                Usage(argv[0], strError.str().c_str());
+            }
+            // -EncodedCommand is UTF-16LE text
+            if (decoded.empty() || 0 != decoded.size() % sizeof(wchar_t))
+                Usage(argv[0], L"-pb64 command line does not decode to a UTF-16LE command");
             sActualCommandLine = sPowerShellCmd + sEncodedCommand + sOriginalCommandLine;
         }
         else
@@ -532,12 +1276,32 @@ int wmain(int argc, wchar_t** argv)
         }
     }
 
+    targetEnvironment.Init(envSource, envOverlays);
+
+    // Look up the processor groups or NUMA nodes to spread the target processes across
+    if (PlacementDomain_t::None != spreadDomain)
+    {
+        DWORD dwError = 0;
+        if (!placement.Init(spreadDomain, spreadPolicy, dwError))
+        {
+            std::wcerr << L"Cannot look up the " << (PlacementDomain_t::Node == spreadDomain ? L"NUMA nodes" : L"processor groups")
+                << L"; not spreading the target processes: " << SysErrorMessageWithCode(dwError) << std::endl;
+            spreadDomain = PlacementDomain_t::None;
+        }
+    }
+
     if (!bQuiet)
     {
         std::wcout << L"Command line : " << sActualCommandLine << std::endl;
-        if (bPowerShell)
+        if (!sScriptFile.empty())
+            std::wcout << L"  Script     : " << sScriptFile << L" (" << scriptContent.size() << L" bytes, written to stdin)" << std::endl;
+        else if (bPowerShell)
             std::wcout << L"  Originally : " << sOriginalCommandLine << std::endl;
+        if (!sStdinFile.empty())
+            std::wcout << L"Stdin        : " << sStdinFile << L" (" << stdinMapping.cbData << L" bytes)" << std::endl;
         std::wcout << L"Sessions     ? " << WhichSessionsToWSZ(whichSessions, nSessionId) << std::endl;
+        if (!sessionFilter.Empty())
+            std::wcout << L"Filter       : " << sessionFilter.Expression() << std::endl;
         std::wcout << L"PowerShell   ? " << (bPowerShell ? L"Yes" : L"No") << std::endl;
         std::wcout << L"Redir Std    ? ";
         if (!bRedirStd)
@@ -554,23 +1318,84 @@ int wmain(int argc, wchar_t** argv)
                 std::wcout << L"               Merging targets' stderr into stdout" << std::endl;
             else
                 std::wcout << L"               Keeping targets' stderr and stdout separate" << std::endl;
+            if (bDedup)
+                std::wcout << L"               Storing distinct output once, with a manifest per output file" << std::endl;
+            if (0 != nCompressLevel)
+                std::wcout << L"               Compressing output " << (bDedup ? L"chunks" : L"files") << L", level " << nCompressLevel << std::endl;
+            if (IntegrityHash_t::None != integrityHash)
+                std::wcout << L"               Hashing output files (" << (IntegrityHash_t::Sha256 == integrityHash ? L"XXH64 and SHA-256" : L"XXH64") << L") for an integrity manifest" << std::endl;
+            if (bTimeIndex)
+                std::wcout << L"               Recording when output arrives, in a time index per output file" << std::endl;
+            if (0 != nLineIndexInterval)
+                std::wcout << L"               Indexing every " << nLineIndexInterval << L" lines of output, in a line index per output file" << std::endl;
+            if (QuotaUnlimited != ullQuota)
+            {
+                std::wcout << L"               Keeping ";
+                if (QuotaPolicy_t::HeadTail == quotaPolicy)
+                    std::wcout << L"the first " << ullQuota / 2 << L" and the last " << ullQuota - ullQuota / 2;
+                else
+                    std::wcout << (QuotaPolicy_t::Head == quotaPolicy ? L"the first " : L"the last ") << ullQuota;
+                std::wcout << L" bytes of each output stream" << std::endl;
+            }
+            if (QuotaUnlimited != ullTotalQuota)
+                std::wcout << L"               Keeping at most " << ullTotalQuota << L" bytes of output in all" << std::endl;
+            for (size_t ixPattern = 0; ixPattern < patterns.Size(); ++ixPattern)
+            {
+                static const wchar_t* const szActions[] = { L"Counting", L"Tagging", L"Terminating on" };
+                std::wcout << L"               " << szActions[size_t(patterns.Action(ixPattern))] << L" \"" << patterns.Label(ixPattern) << L"\"" << std::endl;
+            }
+            for (const std::wstring& sRule : vRedactionRules)
+                std::wcout << L"               Redacting " << sRule << std::endl;
         }
+        if (bStats || sStatsJsonFile.length() > 0)
+        {
+            std::wcout << L"Usage stats  ? " << (bStats ? L"Yes" : L"No") << std::endl;
+            if (sStatsJsonFile.length() > 0)
+                std::wcout << L"               JSON to " << sStatsJsonFile << std::endl;
+        }
+        if (sPhaseTimesFile.length() > 0)
+            std::wcout << L"Phase times  : " << sPhaseTimesFile << std::endl;
         std::wcout << L"Try elevated ? " << (bTryElevated ? L"Yes" : L"No") << std::endl;
         std::wcout << L"WOW64 redir  ? " << (bWow64FileSystemRedir ? L"Enabled" : L"Disabled") << std::endl;
         std::wcout << L"Hidden       ? " << (bHidden ? L"Yes" : L"No") << std::endl;
         std::wcout << L"Minimized    ? " << (bMinimized ? L"Yes" : L"No") << std::endl;
-        if (0 == dwWait)
+        std::wcout << L"Console      ? " << (bNoConsole ? L"No" : L"Yes") << std::endl;
+        std::wcout << L"Priority     : " << (targetPriority.Any() ? targetPriority.Describe() : std::wstring(L"Default")) << std::endl;
+        std::wcout << L"Environment  : " << targetEnvironment.Describe() << std::endl;
+        if (PlacementDomain_t::None != spreadDomain)
+            std::wcout << L"Spread       : " << placement.Describe() << std::endl;
+        if (0 == ullWait)
         {
             std::wcout << L"Wait         ? " << L"No" << std::endl;
         }
         else
         {
-            if (INFINITE == dwWait)
+            if (ullWaitInfinite == ullWait)
                 std::wcout << L"Wait         ? " << L"Yes: infinite." << std::endl;
             else
-                std::wcout << L"Wait         ? " << L"Yes: " << dwWait << L" milliseconds." << std::endl;
+                std::wcout << L"Wait         ? " << L"Yes: " << ullWait << L" milliseconds." << std::endl;
+            // Per-session-class wait times
+            auto reportClassWait = [](const wchar_t* szClass, ULONGLONG ullClassWait) {
+                if (0 == ullClassWait)
+                    return;
+                std::wcout << L"               " << szClass << L" sessions: ";
+                if (ullWaitInfinite == ullClassWait)
+                    std::wcout << L"infinite." << std::endl;
+                else
+                    std::wcout << ullClassWait << L" milliseconds." << std::endl;
+            };
+            reportClassWait(L"Active", ullWaitActive);
+            reportClassWait(L"Disconnected", ullWaitDisconnected);
             std::wcout << L"Terminate    ? " << (bTerminate ? L"Yes" : L"No") << std::endl;
+            if (0 != ullGrace)
+                std::wcout << L"Grace period : " << ullGrace << L" milliseconds after Ctrl+C" << std::endl;
         }
+        if (!bGangStart)
+            std::wcout << L"Gang start   ? No" << std::endl;
+        else if (0 == nGangWave)
+            std::wcout << L"Gang start   ? Yes: all at once." << std::endl;
+        else
+            std::wcout << L"Gang start   ? Yes: " << nGangWave << L" at a time, " << dwGangIntervalMs << L" milliseconds apart." << std::endl;
         if (bDebug)
         {
             if (bDebugF)
@@ -590,9 +1415,72 @@ int wmain(int argc, wchar_t** argv)
         exit(-2);
     }
 
+    // How target processes' output is redirected. With -dedup, one chunk store serves the whole run, and quotas
+    // and the time indexes' start time are shared by the whole run too; they're declared before processManager so that they outlive the
+    // redirection monitors.
+    ChunkStore_t chunkStore;
+    OutputQuota_t outputQuota(ullQuota, quotaPolicy, ullTotalQuota);
+    TimeIndexBase_t timeIndexBase;
+    RedirOptions_t redirOptions;
+    redirOptions.bRedirStd = bRedirStd;
+    redirOptions.bMergeStd = bMergeStd;
+    redirOptions.sDirectory = sRedirStdDirectory;
+    redirOptions.nCompressLevel = nCompressLevel;
+    redirOptions.integrityHash = integrityHash;
+    if (bTimeIndex)
+    {
+        timeIndexBase.Capture();
+        redirOptions.pTimeIndexBase = &timeIndexBase;
+    }
+    redirOptions.nLineIndexInterval = nLineIndexInterval;
+    if (!scriptContent.empty())
+    {
+        redirOptions.pStdinData = scriptContent.data();
+        redirOptions.cbStdinData = scriptContent.size();
+    }
+    else if (nullptr != stdinMapping.pData)
+    {
+        redirOptions.pStdinData = stdinMapping.pData;
+        redirOptions.cbStdinData = size_t(stdinMapping.cbData);
+    }
+    if (QuotaUnlimited != ullQuota || QuotaUnlimited != ullTotalQuota)
+        redirOptions.pQuota = &outputQuota;
+    // (Redirection might have been turned off after the patterns were parsed)
+    if (bRedirStd && !patterns.Empty())
+    {
+        patterns.Build();
+        redirOptions.pPatterns = &patterns;
+    }
+    if (bRedirStd && !redaction.Empty())
+        redirOptions.pRedaction = &redaction;
+    // Terminating on a pattern terminates the process' descendants too
+    const bool bTrackProcessTrees = bTerminate || (nullptr != redirOptions.pPatterns && patterns.HasAction(MatchAction_t::Terminate));
+    if (bDedup)
+    {
+        std::wstringstream strChunkStore;
+        strChunkStore << sRedirStdDirectory << L"\\RunAsUsers_chunks_" << TimestampUTCforFilepath(false) << szChunkStoreExtension;
+        uint32_t dwError = 0;
+        if (!chunkStore.Create(strChunkStore.str(), nCompressLevel, dwError, integrityHash))
+        {
+            std::wcerr << L"Cannot create chunk store " << strChunkStore.str() << L": " << SysErrorMessageWithCode(dwError) << std::endl;
+            exit(-2);
+        }
+        redirOptions.pChunkStore = &chunkStore;
+    }
+
+    // Instantiate an object to handle processes that get launched.
+    // If reporting phase timings, they're reported relative to the creation of this process, so that the
+    // startup phases can be included. (Getting the process creation time costs a little, so skip it otherwise.)
+    const ULONGLONG ullRunStart = (sPhaseTimesFile.length() > 0) ? ProcessCreationMonotonicMicroseconds() : ullWmainEntry;
+    ProcessManager_t processManager(ullRunStart);
+    processManager.SetTerminationPolicy(bTerminate, ullGrace);
+    processManager.RunPhaseTimes().Record(Phase_t::Startup, ullRunStart, ullWmainEntry);
+    processManager.RunPhaseTimes().Record(Phase_t::Init, ullWmainEntry, MonotonicMicroseconds());
+
     // Start by getting info on all WTS sessions
     PWTS_SESSION_INFOW pSessionInfo = NULL;
     DWORD dwSessionCount = 0;
+    ULONGLONG ullPhaseStart = MonotonicMicroseconds();
     BOOL ret = WTSEnumerateSessionsW(WTS_CURRENT_SERVER_HANDLE, 0, 1, &pSessionInfo, &dwSessionCount);
     if (!ret)
     {
@@ -600,9 +1488,25 @@ int wmain(int argc, wchar_t** argv)
         std::wcerr << L"Cannot enumerate WTS sessions: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
         exit(-3);
     }
-
-    // Instantiate an object to handle processes that get launched
-    ProcessManager_t processManager;
+    processManager.RunPhaseTimes().Record(Phase_t::Enumerate, ullPhaseStart, MonotonicMicroseconds());
+
+    // Once a target has been resumed: note the first launch, and start its deadline and watching for its exit.
+    // Each process' deadline is measured from its own start, so that processes launched later in a long run get
+    // the same amount of time as the first ones.
+    auto StartMonitoring = [&](const ptrSessionProcessInfo_t& pSPI) {
+        if (!processManager.RunPhaseTimes().IsRecorded(Phase_t::FirstLaunch))
+            processManager.RunPhaseTimes().Record(Phase_t::FirstLaunch, ullRunStart, MonotonicMicroseconds());
+        if (0 != ullWait)
+        {
+            ULONGLONG ullProcessWait = ullWait;
+            if (WTSActive == pSPI->session.wtsState && 0 != ullWaitActive)
+                ullProcessWait = ullWaitActive;
+            else if (WTSDisconnected == pSPI->session.wtsState && 0 != ullWaitDisconnected)
+                ullProcessWait = ullWaitDisconnected;
+            processManager.StartDeadline(pSPI, ullProcessWait);
+            processManager.WatchForExit(pSPI);
+        }
+    };
 
     bool bDoneWithSessions = false;
     for (DWORD ixSession = 0; ixSession < dwSessionCount && !bDoneWithSessions; ++ixSession)
@@ -622,6 +1526,7 @@ int wmain(int argc, wchar_t** argv)
             std::wcout << L"Session ID " << pSPI->session.dwSessionId << L", state: " << WtsConnectStateToWSZ(pSPI->session.wtsState) << L"; WinSta name: " << pSessionInfo[ixSession].pWinStationName << std::endl;
 
         // Get more info about this session, including user domain\name, logon time, and whether the session is locked.
+        ullPhaseStart = MonotonicMicroseconds();
         LPWSTR pInfo = nullptr;
         DWORD dwBytesReturned = 0;
         ret = WTSQuerySessionInformationW(WTS_CURRENT_SERVER_HANDLE, pSPI->session.dwSessionId, WTSSessionInfoEx, &pInfo, &dwBytesReturned);
@@ -633,6 +1538,8 @@ int wmain(int argc, wchar_t** argv)
             pSPI->session.sUser = wtsInfo.UserName;
             pSPI->session.wtsFlags = wtsInfo.SessionFlags;
             pSPI->session.logonTime = wtsInfo.LogonTime;
+            pSPI->session.lastInputTime = wtsInfo.LastInputTime;
+            pSPI->session.currentTime = wtsInfo.CurrentTime;
             WTSFreeMemory(pInfo);
 
             if (!bQuiet && pSPI->session.sUser.length() > 0)
@@ -655,6 +1562,10 @@ int wmain(int argc, wchar_t** argv)
                 pSPI->session.sDomain = pWtsInfo->Domain;
                 pSPI->session.sUser = pWtsInfo->UserName;
                 pSPI->session.logonTime = pWtsInfo->LogonTime;
+                pSPI->session.lastInputTime = pWtsInfo->LastInputTime;
+                pSPI->session.currentTime = pWtsInfo->CurrentTime;
+                // No lock state
+                pSPI->session.wtsFlags = WTS_SESSIONSTATE_UNKNOWN;
                 WTSFreeMemory(pInfo);
 
                 if (!bQuiet && pSPI->session.sUser.length() > 0)
@@ -666,43 +1577,51 @@ int wmain(int argc, wchar_t** argv)
                 std::wcerr << L"Could not retrieve session information: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
             }
         }
+        pSPI->process.phaseTimes.Record(Phase_t::SessionQuery, ullPhaseStart, MonotonicMicroseconds());
 
         // Start process in this session, depending on the "whichSessions" setting;
         // Set flag to exit loop if only one session to be targeted.
-        bool bStartProcessInThisSession = false, bExitLoopAfterThisOne = false;
-        switch (whichSessions)
+        const SessionSelection_t selection = SelectSession(whichSessions, nSessionId, pSPI->session.dwSessionId, WtsConnectStateToSessionConnectState(pSPI->session.wtsState));
+        bool bStartProcessInThisSession = selection.bStartProcess;
+        const bool bExitLoopAfterThisOne = selection.bDoneAfterThis;
+        if (selection.bRequestedSessionUnavailable)
         {
-        case WhichSessions_t::firstActive:
-            // Start process if this session is active, then exit the loop.
-            if (WTSActive == pSPI->session.wtsState)
-            {
-                bStartProcessInThisSession = bExitLoopAfterThisOne = true;
-            }
-            break;
-        case WhichSessions_t::allActive:
-            // Start process if this session is active
-            bStartProcessInThisSession = (WTSActive == pSPI->session.wtsState);
-            break;
-        case WhichSessions_t::allLoggedOn:
-            // Start process if this session is active or disconnected
-            bStartProcessInThisSession = (WTSActive == pSPI->session.wtsState || WTSDisconnected == pSPI->session.wtsState);
-            break;
-        case WhichSessions_t::oneSessionId:
-            // Start process if session ID matches the one specified AND the session is active or disconnected.
-            if (nSessionId == pSPI->session.dwSessionId)
+            std::wcerr << L"Session ID " << nSessionId << L" exists but is not active or disconnected." << std::endl;
+        }
+
+        // With -filter, rule the session out as early as its attributes allow: first on the session information
+        // already retrieved, then on the client name, and only then on the user's token (below).
+        SessionFacts_t sessionFacts;
+        FilterResult_t filterResult = FilterResult_t::True;
+        if (bStartProcessInThisSession && !sessionFilter.Empty())
+        {
+            GetSessionFacts(pSPI->session, sessionFacts);
+            filterResult = sessionFilter.Evaluate(sessionFacts, SessionFilterStage_t::Session);
+            if (FilterResult_t::Unknown == filterResult && sessionFilter.Needs(SessionFilterStage_t::Client))
             {
-                // Session ID matches, so no need to continue enumeration
-                bExitLoopAfterThisOne = true;
-                if (WTSActive == pSPI->session.wtsState || WTSDisconnected == pSPI->session.wtsState)
+                if (WTSQuerySessionInformationW(WTS_CURRENT_SERVER_HANDLE, pSPI->session.dwSessionId, WTSClientName, &pInfo, &dwBytesReturned))
                 {
-                    bStartProcessInThisSession = true;
+                    pSPI->session.sClientName = pInfo;
+                    WTSFreeMemory(pInfo);
                 }
                 else
                 {
-                    std::wcerr << L"Session ID " << nSessionId << L" exists but is not active or disconnected." << std::endl;
+                    dwLastErr = GetLastError();
+                    std::wcerr << L"Could not retrieve the session's client name: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
                 }
+                sessionFacts.sClientName = pSPI->session.sClientName;
+                filterResult = sessionFilter.Evaluate(sessionFacts, SessionFilterStage_t::Client);
+                if (FilterResult_t::False == filterResult)
+                    ++nFilteredOut[size_t(SessionFilterStage_t::Client)];
+            }
+            else if (FilterResult_t::False == filterResult)
+                ++nFilteredOut[size_t(SessionFilterStage_t::Session)];
+            if (FilterResult_t::False == filterResult)
+            {
+                bStartProcessInThisSession = false;
+                if (!bQuiet)
+                    std::wcout << L"Session does not match the filter." << std::endl;
             }
-            break;
         }
         if (bStartProcessInThisSession)
         {
@@ -710,19 +1629,41 @@ int wmain(int argc, wchar_t** argv)
 
             // Get the user token associated with the session
             HANDLE hToken = NULL;
+            ullPhaseStart = MonotonicMicroseconds();
             ret = WTSQueryUserToken(pSPI->session.dwSessionId, &hToken);
+            // The filter's last stage: the user's groups, from the token (before looking for a linked token). If the
+            // groups can't be read, the session's membership can't be checked, so it doesn't match.
+            bool bFilteredOut = false;
+            if (ret && FilterResult_t::Unknown == filterResult)
+            {
+                std::wstring sErrorInfo;
+                const bool bGotGroups = Token::GetTokenGroupSids(hToken, sessionFacts.vGroupSids, sErrorInfo);
+                if (!bGotGroups)
+                    std::wcerr << L"Cannot get the user's groups for -filter: " << sErrorInfo << std::endl;
+                if (!bGotGroups || FilterResult_t::True != sessionFilter.Evaluate(sessionFacts, SessionFilterStage_t::Token))
+                {
+                    bFilteredOut = true;
+                    ++nFilteredOut[size_t(SessionFilterStage_t::Token)];
+                    nTargetedSessions--;
+                    CloseHandle(hToken);
+                    hToken = NULL;
+                    if (!bQuiet)
+                        std::wcout << L"Session does not match the filter." << std::endl;
+                }
+            }
             if (!ret)
             {
                 dwLastErr = GetLastError();
                 std::wcerr << L"Cannot query user token: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
             }
-            else
+            else if (!bFilteredOut)
             {
                 // If the try-elevated option is set and there's a higher-IL linked token, get it.
                 if (bTryElevated && Token::GetHighestToken(hToken))
                 {
                     pSPI->process.bElevated = true;
                 }
+                pSPI->process.phaseTimes.Record(Phase_t::Token, ullPhaseStart, MonotonicMicroseconds());
 
                 // Turn off WOW64 file system redirection by default (no-op if this is a 64-bit process or a 32-bit OS)
                 Wow64FsRedirection fsRedir;
@@ -730,15 +1671,25 @@ int wmain(int argc, wchar_t** argv)
                     fsRedir.Disable();
 
                 // Create the appropriate environment block for this user
-                LPVOID pEnv = nullptr;
-                ret = CreateEnvironmentBlock(&pEnv, hToken, FALSE);
+                std::vector<wchar_t> envBlock;
+                std::vector<std::wstring> vEnvDifferences;
+                ullPhaseStart = MonotonicMicroseconds();
+                ret = targetEnvironment.Build(hToken, pSPI->session.dwSessionId, envBlock, vEnvDifferences, dwLastErr);
+                pSPI->process.phaseTimes.Record(Phase_t::EnvBlock, ullPhaseStart, MonotonicMicroseconds());
+                if (!vEnvDifferences.empty())
+                {
+                    std::wcerr << L"Cached environment block for session " << pSPI->session.dwSessionId << L" differs from CreateEnvironmentBlock's:" << std::endl;
+                    for (const std::wstring& sDifference : vEnvDifferences)
+                        std::wcerr << L"  " << sDifference << std::endl;
+                }
                 if (ret)
                 {
                     PROCESS_INFORMATION pi = { 0 };
-                    STARTUPINFOW si = { 0 };
+                    // Extended startup information, for the list of handles the process inherits
+                    STARTUPINFOEXW siEx = { 0 };
+                    STARTUPINFOW& si = siEx.StartupInfo;
                     HANDLE hPipeStdoutWr = NULL, hPipeStderrWr = NULL, hPipeStdinWr = NULL, hPipeStdinRd = NULL;
 
-                    si.cb = sizeof(si);
                     // Implement hidden/minimized options
                     if (bHidden || bMinimized)
                     {
@@ -752,7 +1703,7 @@ int wmain(int argc, wchar_t** argv)
                         // with handles for the child process marked inheritable, and provide those handles to the
                         // child process through the STARTUPINFOW structure.
                         // Hold onto handles for the "read" ends of the stdout and stderr pipes.
-                        // We're not doing anything with stdin but we need to provide all three.
+                        // With -pf or -stdin, the input is written to stdin; otherwise we're not doing anything with stdin but we need to provide all three.
                         // If merging stderr with stdout, create just one pipe for both and provide its write handle for
                         // both stdout and stderr.
 
@@ -774,6 +1725,9 @@ int wmain(int argc, wchar_t** argv)
                         {
                             dwLastErr = GetLastError();
                             std::wcerr << L"Error building pipe; " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+                            // Don't leave the targets already created for -gang suspended
+                            vecSessionProcessInfo_t vResumed;
+                            processManager.GangStart(0, 0, vResumed);
                             //TODO: How should CreatePipe errors be handled? Terminate the process?
                             exit(-3);
                         }
@@ -781,7 +1735,8 @@ int wmain(int argc, wchar_t** argv)
                         // We created the pipes with inheritable handles, as we want the child process to inherit
                         // the stdin "read" and the stdout/stderr "write" handles. We don't want the child process
                         // to inherit the remaining handles, so clear the "inheritable" flag on the handles for 
-                        // the other ends of those pipes.
+                        // the other ends of those pipes. (The child inherits only the handles in its handle list,
+                        // below; this keeps the other ends from any other process that inherits handles.)
                         // (hPipeStderrRd will be NULL if we're using the stdout pipe for both stdout and stderr.)
                         SetHandleInformation(pSPI->process.hPipeStdoutRd, HANDLE_FLAG_INHERIT, 0);
                         if (NULL != pSPI->process.hPipeStderrRd)
@@ -801,23 +1756,43 @@ int wmain(int argc, wchar_t** argv)
                     size_t cmdLineBufSize = sActualCommandLine.length() + 1;
                     wchar_t* szActualCommandLine = new wchar_t[cmdLineBufSize] { 0 };
                     sActualCommandLine._Copy_s(szActualCommandLine, cmdLineBufSize, sActualCommandLine.length());
+                    // The process inherits its own std handles and nothing else: not the pipe ends of any other target
+                    // being launched at the same time, which would keep those pipes open after their targets exit.
+                    ullPhaseStart = MonotonicMicroseconds();
+                    ProcThreadAttributes_t attributes;
+                    if (bRedirStd)
+                        attributes.SetInheritedHandles({ si.hStdInput, si.hStdOutput, si.hStdError });
+                    // With -spread, it starts on the processors of the next group or node
+                    if (PlacementDomain_t::None != spreadDomain)
+                    {
+                        const size_t ixPlace = placement.Next();
+                        attributes.SetGroupAffinity(placement.Affinity(ixPlace));
+                        if (placement.ByNode())
+                            attributes.SetPreferredNode(placement.Number(ixPlace));
+                        pSPI->process.sPlacement = placement.Name(ixPlace);
+                    }
+                    DWORD dwAttributeFlags = 0;
+                    const bool bAttributes = attributes.Build(siEx, dwAttributeFlags, dwLastErr);
+                    if (!bAttributes)
+                        std::wcerr << L"Cannot set up the process attributes (inherited handles, placement): " << SysErrorMessageWithCode(dwLastErr) << std::endl;
                     // Clear the last error prior to invoking the API, in case there's a failure code path that doesn't set the thread's last error value.
                     SetLastError(0);
                     // Start the target process; the token specifies the WTS session in which the process will execute.
                     // Start it with the primary thread suspended until after we set up any required redirection.
-                    ret = CreateProcessAsUserW(
+                    ret = bAttributes && CreateProcessAsUserW(
                         hToken, 
                         nullptr,
                         szActualCommandLine,
                         nullptr, 
                         nullptr, 
-                        TRUE, 
-                        CREATE_BREAKAWAY_FROM_JOB | CREATE_NEW_CONSOLE | CREATE_UNICODE_ENVIRONMENT | CREATE_SUSPENDED,
-                        pEnv, 
+                        attributes.InheritHandles(), 
+                        CREATE_BREAKAWAY_FROM_JOB | (bNoConsole ? DETACHED_PROCESS : CREATE_NEW_CONSOLE) | CREATE_UNICODE_ENVIRONMENT | CREATE_SUSPENDED | dwAttributeFlags,
+                        envBlock.data(), 
                         TargetCurrentDirectory().c_str(),
                         &si, 
                         &pi);
-                    dwLastErr = GetLastError();
+                    if (bAttributes)
+                        dwLastErr = GetLastError();
                     // And delete that buffer now
                     delete[] szActualCommandLine;
                     if (ret)
@@ -825,45 +1800,71 @@ int wmain(int argc, wchar_t** argv)
                         // Get info about the new process.
                         pSPI->process.hProcess = pi.hProcess;
                         pSPI->process.dwPID = pi.dwProcessId;
-                        // Set up redirection and the monitoring of stdout/stderr
-                        SetUpRedirection(pSPI, bRedirStd, bMergeStd, sRedirStdDirectory);
-                        ResumeThread(pi.hThread);
-                        CloseHandle(pi.hThread);
+                        // With -pf or -stdin, the stdin "write" handle goes to the thread that writes the input to it
+                        if (nullptr != redirOptions.pStdinData)
+                        {
+                            pSPI->process.hPipeStdinWr = hPipeStdinWr;
+                            hPipeStdinWr = NULL;
+                        }
+                        // Set up redirection and the monitoring of stdout/stderr, and the writing of the input to stdin
+                        SetUpRedirection(pSPI, redirOptions);
+                        // Lower (or raise) its priorities before it runs any code
+                        if (targetPriority.Any())
+                        {
+                            std::wstring sErrorInfo;
+                            if (!ApplyProcessPriority(pi.hProcess, targetPriority, pSPI->process.priority, sErrorInfo))
+                                std::wcerr << L"Cannot set priorities for PID " << pi.dwProcessId << L": " << sErrorInfo << std::endl;
+                        }
+                        // If it might need to be terminated, put it in a job while it's still suspended, so that
+                        // all of its descendants can be terminated with it.
+                        if (bTrackProcessTrees)
+                            ProcessManager_t::TrackProcessTree(pSPI->process);
+                        // Record the end of the Create phase before resuming, as other phases are measured from here.
+                        pSPI->process.phaseTimes.Record(Phase_t::Create, ullPhaseStart, MonotonicMicroseconds());
+                        if (bGangStart)
+                        {
+                            // Held suspended, with its output already being monitored, until all of the targets
+                            // have been created
+                            processManager.HoldForGangStart(pSPI, pi.hThread);
+                        }
+                        else
+                        {
+                            ResumeThread(pi.hThread);
+                            CloseHandle(pi.hThread);
+                            StartMonitoring(pSPI);
+                        }
 
                         if (!bQuiet)
-                            std::wcout << L"PID " << pSPI->process.dwPID << L" started in session " << pSPI->session.dwSessionId << L" running " << (pSPI->process.bElevated ? L"elevated" : L"non-elevated") << L" as " << pSPI->session.sDomain << L"\\" << pSPI->session.sUser << std::endl;
+                            std::wcout << L"PID " << pSPI->process.dwPID << (bGangStart ? L" created" : L" started") << L" in session " << pSPI->session.dwSessionId << L" running " << (pSPI->process.bElevated ? L"elevated" : L"non-elevated") << L" as " << pSPI->session.sDomain << L"\\" << pSPI->session.sUser
+                                << (pSPI->process.sPlacement.empty() ? L"" : L" on ") << pSPI->process.sPlacement << std::endl;
                     }
-                    else
+                    else if (bAttributes)
                     {
                         std::wcerr << L"CreateProcessAsUserW failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
                     }
                     if (bRedirStd)
                     {
                         // Close the pipe handles we no longer need - the ones inherited by the child process, 
-                        // and the stdin "write" handle as we're not writing to its stdin.
+                        // and the stdin "write" handle unless the script is being written to it (then it's NULL here).
                         CloseHandle(hPipeStdoutWr);
                         CloseHandle(hPipeStderrWr);
                         CloseHandle(hPipeStdinWr);
                         CloseHandle(hPipeStdinRd);
                     }
-                    // Deallocate allocated memory
-                    DestroyEnvironmentBlock(pEnv);
-
                     // Restore previous WOW64 file system redirection state
                     if (!bWow64FileSystemRedir)
                         fsRedir.Revert();
                 }
                 else
                 {
-                    dwLastErr = GetLastError();
                     std::wcerr << L"Cannot create environment block for user: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
                 }
 
                 CloseHandle(hToken);
             }
 
-            // If "first active" only, then exit the loop
-            if (bExitLoopAfterThisOne)
+            // If "first active" only, then exit the loop (unless the filter ruled this one out: then the next one's a candidate)
+            if (bExitLoopAfterThisOne && !bFilteredOut)
             {
                 if (!bQuiet)
                 {
@@ -893,28 +1894,76 @@ int wmain(int argc, wchar_t** argv)
     WTSFreeMemory(pSessionInfo);
     pSessionInfo = nullptr;
 
-    // If waiting for processes, start waiting
-    if (0 != dwWait)
+    if (!sessionFilter.Empty() && !bQuiet)
     {
-        ULARGE_INTEGER ulStartTime;
-        GetSystemTimeAsULargeinteger(ulStartTime);
-        DWORD dwNextWait = dwWait;
+        std::wcout << L"Filter       : " << (nFilteredOut[0] + nFilteredOut[1] + nFilteredOut[2]) << L" session(s) did not match: "
+            << nFilteredOut[size_t(SessionFilterStage_t::Session)] << L" on session information, "
+            << nFilteredOut[size_t(SessionFilterStage_t::Client)] << L" on client name, "
+            << nFilteredOut[size_t(SessionFilterStage_t::Token)] << L" on the user's groups" << std::endl;
+    }
 
+    if (EnvSource_t::System != envSource && !bQuiet)
+    {
+        std::wcout << L"Environment  : " << targetEnvironment.Built() << L" block(s) built from cached variables";
+        if (0 != targetEnvironment.Fallbacks())
+            std::wcout << L"; " << targetEnvironment.Fallbacks() << L" fell back to CreateEnvironmentBlock";
+        if (EnvSource_t::Verify == envSource)
+            std::wcout << L"; " << targetEnvironment.Mismatches() << L" differed from CreateEnvironmentBlock's";
+        std::wcout << std::endl;
+    }
+
+    // With -gang, start all of the targets now, as close together as possible
+    if (bGangStart)
+    {
+        vecSessionProcessInfo_t vResumed;
+        const GangStartStats_t gangStats = processManager.GangStart(nGangWave, dwGangIntervalMs, vResumed);
+        for (auto iter = vResumed.begin(); iter != vResumed.end(); ++iter)
+            StartMonitoring(*iter);
+        const std::ios_base::fmtflags oldFlags = std::wcout.flags();
+        const std::streamsize oldPrecision = std::wcout.precision();
+        std::wcout
+            << L"Gang start   : " << gangStats.nResumed << L" process(es) resumed in " << gangStats.nWaves << L" wave(s); start skew "
+            << std::fixed << std::setprecision(3) << double(gangStats.ullSkew) / 1000.0 << L" ms";
+        if (gangStats.nWaves > 1)
+            std::wcout << L" (" << double(gangStats.ullWaveSkew) / 1000.0 << L" ms within a wave)";
+        std::wcout << L"; held up to " << double(gangStats.ullMaxHeld) / 1000.0 << L" ms while the rest were created" << std::endl;
+        std::wcout.flags(oldFlags);
+        std::wcout.precision(oldPrecision);
+    }
+
+    // If waiting for processes, start waiting
+    if (0 != ullWait)
+    {
+        // For the usage stats: each target's console host appears shortly after the target is resumed. Look for them
+        // every so often until they've all been found, or for a few seconds at most.
+        bool bFindConsoleHosts = !bNoConsole && (bStats || sStatsJsonFile.length() > 0);
+        const ULONGLONG ullFindConsoleHostsUntil = MonotonicMicroseconds() + ConsoleHostSearchMilliseconds * 1000;
         bool bKeepMonitoring = true;
         while (bKeepMonitoring)
         {
-            // Wait for any of the launched processes to exit; report exit code.
+            DWORD dwWaitMilliseconds = processManager.NextDeadline().WaitMilliseconds();
+            if (bFindConsoleHosts)
+            {
+                bFindConsoleHosts = (0 != processManager.FindConsoleHosts()) && MonotonicMicroseconds() < ullFindConsoleHostsUntil;
+                if (bFindConsoleHosts && dwWaitMilliseconds > ConsoleHostPollMilliseconds)
+                    dwWaitMilliseconds = ConsoleHostPollMilliseconds;
+            }
+            // Wait for any of the launched processes to exit, or until the next deadline; report exit code.
             // Function returns how many processes were running, how many are still running, and which processes (if any) exited.
             DWORD nRunningProcesses = 0, nNowRunning = 0;
             vecSessionProcessInfo_t v_ExitedProcesses;
-            bool bAnyExited = processManager.WaitForAProcessToExit(dwNextWait, nRunningProcesses, nNowRunning, v_ExitedProcesses);
+            bool bAnyExited = processManager.WaitForAProcessToExit(dwWaitMilliseconds, nRunningProcesses, nNowRunning, v_ExitedProcesses);
             if (bAnyExited)
             {
                 // Report exit code for those that exited.
                 for (auto iter = v_ExitedProcesses.begin(); iter != v_ExitedProcesses.end(); ++iter)
                 {
                     const ptrSessionProcessInfo_t& pSPI = *iter;
-                    std::wcout << L"Process " << pSPI->process.dwPID << L" running as " << pSPI->session.sUser << L" in session " << pSPI->session.dwSessionId << L" exited; exit code " << pSPI->process.dwExitCode << std::endl;
+                    std::wcout << L"Process " << pSPI->process.dwPID << L" running as " << pSPI->session.sUser << L" in session " << pSPI->session.dwSessionId << L" exited; exit code " << pSPI->process.dwExitCode;
+                    // (Match counts are reported once all the output has been read)
+                    if (pSPI->process.pMatches && pSPI->process.pMatches->Terminated())
+                        std::wcout << L"; terminated on a -match term pattern";
+                    std::wcout << std::endl;
                 }
             }
             else
@@ -925,26 +1974,38 @@ int wmain(int argc, wchar_t** argv)
             bKeepMonitoring = (nNowRunning > 0);
             if (bKeepMonitoring)
             {
-                // Calculate remaining wait time. If "INFINITE" it's still infinite.
-                if (INFINITE != dwWait)
+                // Act on processes whose deadlines (or grace periods) have passed: stop monitoring them, ask them
+                // to exit, or terminate them.
+                vecSessionProcessInfo_t v_DeadlineProcesses;
+                if (processManager.HandleDueDeadlines(v_DeadlineProcesses))
                 {
-                    // How long since we started monitoring
-                    DWORD dwMsSince = MillisecondsSince(ulStartTime);
-                    if (dwWait > dwMsSince)
-                    {
-                        // If there's time left, that's the new wait time.
-                        dwNextWait = dwWait - dwMsSince;
-                    }
-                    else
+                    DWORD nNoLongerMonitored = 0;
+                    for (auto iter = v_DeadlineProcesses.begin(); iter != v_DeadlineProcesses.end(); ++iter)
                     {
-                        // No time remaining; stop the remaining monitors, and optionally terminate the processes.
-                        if (bTerminate)
-                            std::wcout << L"Timeout expired; terminating " << nNowRunning << L" remaining process(es)" << std::endl;
-                        else
-                            std::wcout << L"Timeout expired; " << nNowRunning << L" process(es) still running" << std::endl;
-                        bKeepMonitoring = false;
-                        processManager.StopAllRedirectionMonitors(bTerminate);
+                        const ptrSessionProcessInfo_t& pSPI = *iter;
+                        std::wcout << L"Process " << pSPI->process.dwPID << L" running as " << pSPI->session.sUser << L" in session " << pSPI->session.dwSessionId;
+                        switch (pSPI->process.terminationStage)
+                        {
+                        case TerminationStage_t::Released:
+                            std::wcout << L": timeout expired; still running" << std::endl;
+                            ++nNoLongerMonitored;
+                            break;
+                        case TerminationStage_t::SoftClosed:
+                            if (0 == pSPI->process.dwSoftCloseResult)
+                                std::wcout << L": timeout expired; sent Ctrl+C, terminating in " << ullGrace / 1000 << L" seconds if still running" << std::endl;
+                            else
+                                std::wcout << L": timeout expired; could not send Ctrl+C (" << SysErrorMessageWithCode(pSPI->process.dwSoftCloseResult) << L"), terminating in " << ullGrace / 1000 << L" seconds if still running" << std::endl;
+                            break;
+                        case TerminationStage_t::Killed:
+                            std::wcout << L": timeout expired; terminated" << std::endl;
+                            ++nNoLongerMonitored;
+                            break;
+                        case TerminationStage_t::None:
+                            std::wcout << std::endl;
+                            break;
+                        }
                     }
+                    bKeepMonitoring = (nNowRunning > nNoLongerMonitored);
                 }
             }
         }
@@ -952,6 +2013,109 @@ int wmain(int argc, wchar_t** argv)
         // Wait for the redirection monitors to exit before allowing processManager and other objects to go
         // out of scope, deallocating global objects, etc.
         processManager.WaitForRedirectionMonitors();
+        // That includes the threads writing the -stdin file
+        PlatformUnmapFile(stdinMapping);
+
+        // With all the output written, list the output files and their hashes
+        if (IntegrityHash_t::None != integrityHash)
+        {
+            std::vector<IntegrityEntry_t> vEntries;
+            processManager.GetIntegrityEntries(vEntries);
+            IntegrityEntry_t storeEntry;
+            if (bDedup && chunkStore.Hashes(storeEntry.hashes))
+            {
+                storeEntry.sFile.assign(chunkStore.FileName().begin(), chunkStore.FileName().end());
+                storeEntry.sContent = L"chunks";
+                vEntries.push_back(storeEntry);
+            }
+            std::wstringstream strManifest;
+            strManifest << sRedirStdDirectory << L"\\RunAsUsers_integrity_" << TimestampUTCforFilepath(false) << szIntegrityManifestExtension;
+            // UTF-8 without BOM, for the benefit of JSON parsers and signing tools
+            std::wofstream fManifest(strManifest.str());
+            if (fManifest.fail())
+            {
+                dwLastErr = GetLastError();
+                std::wcerr << L"Cannot create " << strManifest.str() << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+            }
+            else
+            {
+                ImbueStreamUtf8(fManifest, false);
+                WriteIntegrityManifest(fManifest, TimestampUTC(false), vEntries);
+                if (!bQuiet)
+                    std::wcout << L"Integrity manifest: " << strManifest.str() << L" (" << vEntries.size() << L" files)" << std::endl;
+            }
+        }
+
+        // Report how much the deduplication saved
+        if (bDedup && !bQuiet)
+        {
+            const ChunkStore_t::Stats_t stats = chunkStore.Stats();
+            std::wcout
+                << L"Deduplicated output: " << stats.ullBytes << L" bytes in " << stats.nChunks << L" chunks; "
+                << stats.nUniqueChunks << L" distinct chunks (" << stats.ullUniqueBytes << L" bytes) stored in "
+                << stats.ullStoreSize << L" bytes" << std::endl;
+        }
+        // Report how much output the quotas dropped
+        if (nullptr != redirOptions.pQuota && !bQuiet)
+        {
+            uint64_t nTruncated = 0, ullOmitted = 0;
+            outputQuota.GetStats(nTruncated, ullOmitted);
+            if (nTruncated > 0)
+                std::wcout << L"Output quota: " << ullOmitted << L" bytes omitted from " << nTruncated << L" output streams" << std::endl;
+        }
+
+        // Report how many secrets were masked
+        if (nullptr != redirOptions.pRedaction && !bQuiet)
+            std::wcout << L"Redaction: " << redaction.Redactions() << L" secrets masked" << std::endl;
+
+        // Report pattern matches, now that all the output has been read
+        if (nullptr != redirOptions.pPatterns && !bQuiet)
+        {
+            for (auto iter = processManager.ConstIter(); !processManager.IterAtEnd(iter); ++iter)
+            {
+                const ptrSessionProcessInfo_t& pSPI = *iter;
+                if (!pSPI->process.pMatches)
+                    continue;
+                const std::wstring sMatches = pSPI->process.pMatches->Summary();
+                std::wcout << L"Process " << pSPI->process.dwPID << L" in session " << pSPI->session.dwSessionId << L": " << (sMatches.empty() ? L"no matches" : L"output matched " + sMatches) << std::endl;
+            }
+        }
+
+        // Report resources consumed by the target processes
+        if (bStats)
+        {
+            processManager.ReportResourceUsage(std::wcout);
+        }
+        if (sStatsJsonFile.length() > 0)
+        {
+            // UTF-8 without BOM, for the benefit of JSON parsers
+            std::wofstream fJson(sStatsJsonFile);
+            if (fJson.fail())
+            {
+                dwLastErr = GetLastError();
+                std::wcerr << L"Cannot create " << sStatsJsonFile << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+            }
+            else
+            {
+                ImbueStreamUtf8(fJson, false);
+                processManager.ReportResourceUsageJson(fJson);
+            }
+        }
+    }
+
+    if (sPhaseTimesFile.length() > 0)
+    {
+        std::wofstream fCsv(sPhaseTimesFile);
+        if (fCsv.fail())
+        {
+            dwLastErr = GetLastError();
+            std::wcerr << L"Cannot create " << sPhaseTimesFile << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+        }
+        else
+        {
+            ImbueStreamUtf8(fCsv, false);
+            processManager.ReportPhaseTimingsCsv(fCsv);
+        }
     }
 
     if (0 == nTargetedSessions)
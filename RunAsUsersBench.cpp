@@ -0,0 +1,1890 @@
+// Benchmark for the launch / exit-monitoring / output-redirection pipeline.
+//
+// Drives the code RunAsUsers.exe uses to select sessions (SessionSelection), schedule deadlines
+// (DeadlineWheel), detect exits (ExitQueue), and copy redirected output (RedirPump), against a set of fake
+// sessions and synthetic "child processes": threads that write to pipes at a configurable rate for a
+// configurable lifetime and then exit, closing their ends of the pipes as a process' exit would. With
+// -processes, the children are real processes (this program, run in a hidden child mode) started through
+// PlatformStartProcess, so that process creation, exit detection, and termination are measured too.
+// Reports throughput, latency percentiles, and the benchmark process' peak thread count, handle count,
+// and memory. Builds on Windows and on Linux (see CMakeLists.txt), so that it can run on ordinary CI agents.
+//
+// With -soak, repeats the whole cycle (with debug logging to a file through DbgOut_t) thousands of times
+// and checks after each iteration that handle count, thread count, heap bytes, and the number of log
+// files held open by WofstreamManager_t haven't grown past what they were after the first iteration.
+//
+// With -compress, redirected output goes through the streaming compressor (RedirCompress) on its way to the
+// destination files; -codec measures the compressor alone on realistic script output. With -dedup, it goes
+// through the deduplicator (RedirDedup) into one chunk store per iteration, with a manifest per destination.
+// With -quota or -totalquota, it goes through the output quota (RedirQuota) first; with -redact, through
+// secret redaction (RedirRedact) before that; and with -match, through the pattern matcher (RedirMatch) first of all.
+// With -integrity, what reaches each destination is hashed (RedirHash) on the way, and with -out, each iteration
+// writes an integrity manifest. With -timeindex, when output arrives is recorded in a time index (RedirTimeIndex) per
+// destination, and with -lineindex, where lines start in a line index (RedirLineIndex) per destination. With -script,
+// each child first reads a generated script from its stdin, written to it from one shared buffer (FeedPipe), as
+// RunAsUsers.exe -pf does. -redactlines measures -redact rules on single long lines. -base64
+// measures the Base64 codec that RunAsUsers.exe -pe and -pb64 use, on scripts of 1 KB to 1 MB. -envblock measures
+// building target processes' environment blocks (EnvBlock), as RunAsUsers.exe -envBlock cached and -env do; on Windows,
+// also with CreateEnvironmentBlock and from cached variables (TargetEnvironment), for this process' own token.
+//
+// Run with -? for the command-line options.
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "MonotonicClock.h"
+#include "PhaseTimings.h"
+#include "SessionSelection.h"
+#include "TerminationSchedule.h"
+#include "ExitQueue.h"
+#include "RedirPump.h"
+#include "RedirCompress.h"
+#include "RedirDedup.h"
+#include "RedirQuota.h"
+#include "RedirMatch.h"
+#include "RedirRedact.h"
+#include "RedirHash.h"
+#include "RedirTimeIndex.h"
+#include "RedirLineIndex.h"
+#include "Base64.h"
+#include "EnvBlock.h"
+#include "Statistics.h"
+#include "StringUtils.h"
+#include "DbgOut.h"
+#ifdef _WIN32
+#include <wincrypt.h>
+#include "TargetEnvironment.h"
+#endif
+
+// ------------------------------------------------------------------------------------------
+// Heap accounting for the soak test: every operator new/delete in the process goes through these,
+// and the header in front of each block remembers its size so that delete can subtract it.
+
+/// <summary>
+/// Bytes currently allocated with operator new and not yet deleted
+/// </summary>
+static std::atomic<int64_t> g_llHeapBytes{ 0 };
+
+// Keeps the returned memory aligned as malloc's is
+static const size_t HeapHeaderBytes = 16;
+
+// The counting functions aren't inlined into the operators: if they were, GCC would see free() called on memory
+// returned by operator new, and a header read before the start of a new[]'d array, and warn about both.
+#ifdef _MSC_VER
+#define HEAP_COUNTER_NOINLINE __declspec(noinline)
+#else
+#define HEAP_COUNTER_NOINLINE __attribute__((noinline))
+#endif
+
+static HEAP_COUNTER_NOINLINE void* CountedAlloc(size_t cb) noexcept
+{
+    uint8_t* pBlock = (uint8_t*)malloc(cb + HeapHeaderBytes);
+    if (nullptr == pBlock)
+        return nullptr;
+    *(size_t*)pBlock = cb;
+    g_llHeapBytes += int64_t(cb);
+    return pBlock + HeapHeaderBytes;
+}
+
+static HEAP_COUNTER_NOINLINE void CountedFree(void* pv) noexcept
+{
+    if (nullptr == pv)
+        return;
+    uint8_t* pBlock = (uint8_t*)pv - HeapHeaderBytes;
+    g_llHeapBytes -= int64_t(*(size_t*)pBlock);
+    free(pBlock);
+}
+
+// Over-aligned allocations (alignas greater than malloc's; C++17 and later): the size and the start of the
+// malloc'd block are kept just before the aligned memory returned
+#ifdef __cpp_aligned_new
+static HEAP_COUNTER_NOINLINE void* CountedAlignedAlloc(size_t cb, std::align_val_t alignment) noexcept
+{
+    const size_t cbAlign = std::max(size_t(alignment), HeapHeaderBytes);
+    uint8_t* pBlock = (uint8_t*)malloc(cb + cbAlign + HeapHeaderBytes);
+    if (nullptr == pBlock)
+        return nullptr;
+    uint8_t* pAligned = (uint8_t*)((uintptr_t(pBlock) + HeapHeaderBytes + cbAlign - 1) & ~uintptr_t(cbAlign - 1));
+    ((size_t*)pAligned)[-1] = cb;
+    ((uint8_t**)pAligned)[-2] = pBlock;
+    g_llHeapBytes += int64_t(cb);
+    return pAligned;
+}
+
+static HEAP_COUNTER_NOINLINE void CountedAlignedFree(void* pv) noexcept
+{
+    if (nullptr == pv)
+        return;
+    g_llHeapBytes -= int64_t(((size_t*)pv)[-1]);
+    free(((uint8_t**)pv)[-2]);
+}
+#endif
+
+void* operator new(size_t cb)
+{
+    void* pv = CountedAlloc(cb);
+    if (nullptr == pv)
+        throw std::bad_alloc();
+    return pv;
+}
+void* operator new[](size_t cb) { return operator new(cb); }
+void* operator new(size_t cb, const std::nothrow_t&) noexcept { return CountedAlloc(cb); }
+void* operator new[](size_t cb, const std::nothrow_t&) noexcept { return CountedAlloc(cb); }
+void operator delete(void* pv) noexcept { CountedFree(pv); }
+void operator delete[](void* pv) noexcept { CountedFree(pv); }
+void operator delete(void* pv, const std::nothrow_t&) noexcept { CountedFree(pv); }
+void operator delete[](void* pv, const std::nothrow_t&) noexcept { CountedFree(pv); }
+void operator delete(void* pv, size_t) noexcept { CountedFree(pv); }
+void operator delete[](void* pv, size_t) noexcept { CountedFree(pv); }
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t cb, std::align_val_t alignment)
+{
+    void* pv = CountedAlignedAlloc(cb, alignment);
+    if (nullptr == pv)
+        throw std::bad_alloc();
+    return pv;
+}
+void* operator new[](size_t cb, std::align_val_t alignment) { return operator new(cb, alignment); }
+void* operator new(size_t cb, std::align_val_t alignment, const std::nothrow_t&) noexcept { return CountedAlignedAlloc(cb, alignment); }
+void* operator new[](size_t cb, std::align_val_t alignment, const std::nothrow_t&) noexcept { return CountedAlignedAlloc(cb, alignment); }
+void operator delete(void* pv, std::align_val_t) noexcept { CountedAlignedFree(pv); }
+void operator delete[](void* pv, std::align_val_t) noexcept { CountedAlignedFree(pv); }
+void operator delete(void* pv, std::align_val_t, const std::nothrow_t&) noexcept { CountedAlignedFree(pv); }
+void operator delete[](void* pv, std::align_val_t, const std::nothrow_t&) noexcept { CountedAlignedFree(pv); }
+void operator delete(void* pv, size_t, std::align_val_t) noexcept { CountedAlignedFree(pv); }
+void operator delete[](void* pv, size_t, std::align_val_t) noexcept { CountedAlignedFree(pv); }
+#endif
+
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Benchmark settings, from the command line
+/// </summary>
+struct BenchOptions_t
+{
+    // Number of fake sessions
+    uint32_t nSessions = 64;
+    // Percentage of fake sessions that are disconnected, and that are in some other (not logged-on) state
+    uint32_t nDisconnectedPct = 25, nOtherPct = 10;
+    // Which sessions to launch in
+    WhichSessions_t whichSessions = WhichSessions_t::allLoggedOn;
+    uint32_t nSessionId = 0;
+    // Synthetic child output rate (bytes per second; 0 = as fast as possible), write size, and lifetime
+    uint64_t ullRate = 1024 * 1024;
+    uint64_t ullChunk = 4096;
+    uint64_t ullLifetimeMs = 500;
+    // Deadline after which children are terminated; ~0 for none
+    uint64_t ullTimeoutMs = ~uint64_t(0);
+    // Whether stderr is merged into stdout
+    bool bMerge = false;
+    // Directory for redirected output files; empty to discard output
+    std::wstring sOutDirectory;
+    // Number of times to repeat the run
+    uint32_t nIterations = 1;
+    // Write the summary as a CSV header and row instead of the text report
+    bool bCsv = false;
+    // Soak/leak test instead of a benchmark; heap growth tolerated, in bytes
+    bool bSoak = false;
+    uint64_t ullHeapSlack = 64 * 1024;
+    // Run children as real processes, by running this program (sSelf) in child mode
+    bool bProcesses = false;
+    std::wstring sSelf;
+    // Compression level for redirected output; 0 for none
+    int nCompressLevel = 0;
+    // Store redirected output in a chunk store, with a manifest per destination
+    bool bDedup = false;
+    // Hash what reaches the destinations, for an integrity manifest
+    IntegrityHash_t integrityHash = IntegrityHash_t::None;
+    // Record when output arrives, in a time index per destination
+    bool bTimeIndex = false;
+    // If non-zero, record where every nth line starts, in a line index per destination
+    uint32_t nLineIndexInterval = 0;
+    // Output quotas: bytes kept per stream and per iteration, and what to keep
+    uint64_t ullQuota = QuotaUnlimited, ullTotalQuota = QuotaUnlimited;
+    QuotaPolicy_t quotaPolicy = QuotaPolicy_t::HeadTail;
+    // Patterns to look for in redirected output (built after parsing)
+    PatternSet_t patterns;
+    // Redaction rules (compiled for each iteration)
+    std::vector<std::string> vRedactionRules;
+    // With -script, bytes of generated script each child reads from its stdin before writing output, and the script
+    // (generated after parsing)
+    uint64_t ullScriptBytes = 0;
+    std::string sScript;
+    // Measure the compressor alone, on this many bytes of generated text, instead of running the pipeline
+    bool bCodec = false;
+    uint64_t ullCodecBytes = 64 * 1024 * 1024;
+    // Measure the Base64 codec alone instead, encoding this many bytes at each script size
+    bool bBase64 = false;
+    // Measure building environment blocks instead
+    bool bEnvBlock = false;
+    // Measure redaction of single long lines instead
+    bool bRedactLines = false;
+};
+
+/// <summary>
+/// Hidden command-line option that runs this program as a child process for -processes
+/// </summary>
+static const char* const szChildModeOption = "-child";
+
+/// <summary>
+/// A synthetic child process and everything needed to launch, monitor, and redirect it
+/// </summary>
+struct BenchChild_t
+{
+    const BenchOptions_t* pOptions = nullptr;
+    ExitQueue_t<BenchChild_t*>* pExitQueue = nullptr;
+    uint32_t dwSessionId = 0;
+
+    // Write ends (owned by the child until it exits), read ends, and redirection destinations
+    PlatformFile_t hStdoutWr = PlatformInvalidFile, hStderrWr = PlatformInvalidFile;
+    PlatformFile_t hStdoutRd = PlatformInvalidFile, hStderrRd = PlatformInvalidFile;
+    // With -script, the child's stdin: the read end (owned by the child) and the write end (owned by stdinFeeder)
+    PlatformFile_t hStdinRd = PlatformInvalidFile, hStdinWr = PlatformInvalidFile;
+    PlatformFile_t hStdoutDest = PlatformInvalidFile, hStderrDest = PlatformInvalidFile;
+    // With -match, the child's pattern matches (declared before the sinks, which refer to it)
+    std::unique_ptr<MatchResults_t> pMatches;
+    // What the monitors write to: the destinations, possibly through a quota and a compressor or a deduplicator;
+    // and the compressor or deduplicator, if any (part of the sink chain), for counting the bytes stored
+    std::unique_ptr<RedirSink_t> pStdoutSink, pStderrSink;
+    RedirSink_t* pStdoutStage = nullptr, * pStderrStage = nullptr;
+    // With -integrity, the destinations' names (without the directory) and the sinks that hash them (part of the sink chain)
+    std::wstring sStdoutDest, sStderrDest;
+    RedirHashSink_t* pStdoutHash = nullptr, * pStderrHash = nullptr;
+    // With -timeindex, the iteration's start, and the sinks that record the destinations' time indexes (part of the sink chain)
+    const TimeIndexBase_t* pTimeIndexBase = nullptr;
+    RedirTimeIndexSink_t* pStdoutTimeIndex = nullptr, * pStderrTimeIndex = nullptr;
+    // With -lineindex, the sinks that record the destinations' line indexes (part of the sink chain)
+    RedirLineIndexSink_t* pStdoutLineIndex = nullptr, * pStderrLineIndex = nullptr;
+    // With -dedup, the iteration's chunk store; with quotas, the iteration's quota
+    ChunkStore_t* pChunkStore = nullptr;
+    OutputQuota_t* pQuota = nullptr;
+    // With -redact, the iteration's redaction rules
+    RedactionRules_t* pRedaction = nullptr;
+
+    // With -processes, childThread waits for the child process to exit
+    PlatformThread_t childThread, stdoutMonitor, stderrMonitor, stdinFeeder;
+    PlatformProcess_t process;
+
+    PhaseTimings_t phaseTimes;
+    // Set to make the child exit early (the equivalent of terminating the process)
+    std::atomic<bool> bKill{ false };
+    // When the child ended, for measuring how long exit detection took
+    uint64_t ullEnded = 0;
+    // With -script, bytes of it the child read, and when it had read all of it
+    uint64_t ullScriptRead = 0, ullScriptReceived = 0;
+    // Bytes written by the child, and copied by the monitors
+    uint64_t ullWritten = 0;
+    std::atomic<uint64_t> ullPumped{ 0 };
+    bool bExited = false, bTimedOut = false;
+    // Set (on a monitor thread) when the child is terminated because of a -match term pattern
+    std::atomic<bool> bMatchTerminated{ false };
+
+    ~BenchChild_t()
+    {
+        PlatformClose(hStdoutWr);
+        PlatformClose(hStderrWr);
+        PlatformClose(hStdoutRd);
+        PlatformClose(hStderrRd);
+        PlatformClose(hStdinRd);
+        PlatformClose(hStdinWr);
+        PlatformClose(hStdoutDest);
+        PlatformClose(hStderrDest);
+        PlatformCloseProcess(process);
+    }
+};
+
+typedef std::unique_ptr<BenchChild_t> ptrBenchChild_t;
+
+/// <summary>
+/// Redirection pump observer: records the first output and the number of bytes copied
+/// </summary>
+class BenchPumpObserver_t : public RedirPumpObserver_t
+{
+public:
+    explicit BenchPumpObserver_t(BenchChild_t& child) : m_child(child) {}
+
+    void OnRead(size_t cbRead) override
+    {
+        m_child.phaseTimes.RecordOnce(Phase_t::FirstOutput, m_child.phaseTimes.ullEnd[size_t(Phase_t::Create)], MonotonicMicroseconds());
+        m_child.ullPumped += cbRead;
+    }
+
+    void OnWriteError(size_t cbRead, size_t cbWritten, uint32_t dwError) override
+    {
+        std::wcerr << L"Write error: read " << cbRead << L" bytes, wrote " << cbWritten << L": " << PlatformErrorMessage(dwError) << std::endl;
+    }
+
+    void OnEnd(PlatformIoResult_t result, uint32_t dwError) override
+    {
+        if (PlatformIoResult_t::Error == result)
+            std::wcerr << L"Read error: " << PlatformErrorMessage(dwError) << std::endl;
+        // As in RedirManager.cpp; goes nowhere unless dbgOut has been given a destination (-soak)
+        dbgOut.locked() << L"Redirection for session " << m_child.dwSessionId << L" ended after " << m_child.ullPumped << L" bytes" << std::endl;
+    }
+
+private:
+    BenchChild_t& m_child;
+};
+
+/// <summary>
+/// A child's pattern matches; a match of a Terminate pattern terminates the child, as in RedirManager.cpp
+/// </summary>
+class BenchMatchResults_t : public MatchResults_t
+{
+public:
+    BenchMatchResults_t(const PatternSet_t& patterns, BenchChild_t& child) : MatchResults_t(patterns), m_child(child) {}
+
+protected:
+    void OnTerminalMatch(size_t /*ixPattern*/) override
+    {
+        // A thread child stops at its next write
+        m_child.bMatchTerminated = true;
+        m_child.bKill = true;
+        uint32_t dwError = 0;
+        if (m_child.process.bStarted && !PlatformTerminateProcess(m_child.process, dwError))
+            std::wcerr << L"Cannot terminate process " << m_child.process.dwPID << L": " << PlatformErrorMessage(dwError) << std::endl;
+    }
+
+private:
+    BenchChild_t& m_child;
+};
+
+/// <summary>
+/// Synthetic child output: writes printable, line-oriented content (like typical script output) at the
+/// configured rate, alternating between stdout and stderr unless they're merged, until it's been asked to
+/// stop or, if ullLimit is ~0, its lifetime is over; otherwise, until it has written ullLimit bytes.
+/// </summary>
+/// <returns>Number of bytes written</returns>
+static uint64_t WriteSyntheticOutput(const BenchOptions_t& options, uint32_t dwSessionId, PlatformFile_t hStdout, PlatformFile_t hStderr, const std::atomic<bool>& bStop, uint64_t ullLimit)
+{
+    std::vector<uint8_t> chunk(size_t(options.ullChunk > 0 ? options.ullChunk : 1));
+    for (size_t ix = 0; ix < chunk.size(); ++ix)
+        chunk[ix] = ((ix % 64) == 63) ? '\n' : uint8_t('a' + (ix + dwSessionId) % 26);
+
+    uint64_t ullWritten = 0;
+    const uint64_t ullStart = MonotonicMicroseconds();
+    const uint64_t ullEnd = (~uint64_t(0) == ullLimit) ? ullStart + options.ullLifetimeMs * 1000 : ~uint64_t(0);
+    bool bToStderr = false;
+    for (uint64_t ullNow = ullStart; ullNow < ullEnd && ullWritten < ullLimit && !bStop; ullNow = MonotonicMicroseconds())
+    {
+        // Pace the output: don't get ahead of the configured rate
+        if (options.ullRate > 0 && ullWritten >= (ullNow - ullStart) * options.ullRate / 1000000)
+        {
+            PlatformSleepMilliseconds(1);
+            continue;
+        }
+        PlatformFile_t hOut = (bToStderr && PlatformInvalidFile != hStderr) ? hStderr : hStdout;
+        bToStderr = !bToStderr;
+        const size_t cbToWrite = (ullLimit - ullWritten < chunk.size()) ? size_t(ullLimit - ullWritten) : chunk.size();
+        size_t cbWritten = 0;
+        uint32_t dwError = 0;
+        if (!PlatformWrite(hOut, chunk.data(), cbToWrite, cbWritten, dwError))
+            break;
+        ullWritten += cbWritten;
+    }
+    return ullWritten;
+}
+
+/// <summary>
+/// Number of bytes each child process writes with -processes: what the configured rate produces over
+/// the configured lifetime. (The parent can't count a process' writes, so the amount is fixed in advance.)
+/// </summary>
+static uint64_t ChildProcessOutputBytes(const BenchOptions_t& options)
+{
+    return options.ullRate * options.ullLifetimeMs / 1000;
+}
+
+/// <summary>
+/// Thread function for the synthetic child: writes output until its lifetime is over or it's killed,
+/// then "exits": closes its pipe ends and posts its exit.
+/// </summary>
+static void ChildThread(void* pvParam)
+{
+    BenchChild_t& child = *(BenchChild_t*)pvParam;
+    if (PlatformInvalidFile != child.hStdinRd)
+    {
+        // With -script, read it all first, as powershell.exe reads the script RunAsUsers.exe -pf writes to its stdin
+        std::vector<uint8_t> buffer(64 * 1024);
+        size_t cbRead = 0;
+        uint32_t dwError = 0;
+        while (PlatformIoResult_t::Success == PlatformRead(child.hStdinRd, buffer.data(), buffer.size(), cbRead, dwError))
+            child.ullScriptRead += cbRead;
+        child.ullScriptReceived = MonotonicMicroseconds();
+        PlatformClose(child.hStdinRd);
+    }
+    child.ullWritten = WriteSyntheticOutput(*child.pOptions, child.dwSessionId, child.hStdoutWr, child.hStderrWr, child.bKill, ~uint64_t(0));
+
+    // Closing the write ends is what the monitors see when a real process exits
+    PlatformClose(child.hStdoutWr);
+    PlatformClose(child.hStderrWr);
+    child.ullEnded = MonotonicMicroseconds();
+    child.pExitQueue->Post(&child);
+}
+
+/// <summary>
+/// Thread function that writes the script to a child's stdin and closes it, as RedirManager.cpp's StdinFeeder does
+/// </summary>
+static void StdinFeederThread(void* pvParam)
+{
+    BenchChild_t& child = *(BenchChild_t*)pvParam;
+    const std::string& sScript = child.pOptions->sScript;
+    size_t cbWritten = 0;
+    uint32_t dwError = 0;
+    if (!FeedPipe(child.hStdinWr, (const uint8_t*)sScript.data(), sScript.size(), cbWritten, dwError))
+        std::wcerr << L"Could not write all of the script to session " << child.dwSessionId << L" (" << cbWritten << L" of " << sScript.size() << L" bytes): " << PlatformErrorMessage(dwError) << std::endl;
+    PlatformClose(child.hStdinWr);
+}
+
+/// <summary>
+/// Thread function that waits for a child process to exit and posts its exit: the equivalent of the
+/// thread-pool wait that ProcessManager_t::WatchForExit registers.
+/// </summary>
+static void ProcessWaitThread(void* pvParam)
+{
+    BenchChild_t& child = *(BenchChild_t*)pvParam;
+    PlatformWaitForProcess(child.process, PlatformWaitForever);
+    child.ullEnded = MonotonicMicroseconds();
+    child.pExitQueue->Post(&child);
+}
+
+/// <summary>
+/// Child mode for -processes: write the synthetic output to this process' stdout and stderr.
+/// Arguments: session ID, rate, chunk size, lifetime, and 1 if stderr is merged into stdout.
+/// </summary>
+static int RunAsChildProcess(int argc, char** argv)
+{
+    if (7 != argc)
+        return -1;
+    BenchOptions_t options;
+    const uint32_t dwSessionId = uint32_t(strtoul(argv[2], nullptr, 10));
+    options.ullRate = strtoull(argv[3], nullptr, 10);
+    options.ullChunk = strtoull(argv[4], nullptr, 10);
+    options.ullLifetimeMs = strtoull(argv[5], nullptr, 10);
+    const bool bMerged = ('1' == argv[6][0]);
+    const std::atomic<bool> bStop{ false };
+    const uint64_t ullLimit = ChildProcessOutputBytes(options);
+    const uint64_t ullWritten = WriteSyntheticOutput(options, dwSessionId, PlatformStandardOutput(false), bMerged ? PlatformInvalidFile : PlatformStandardOutput(true), bStop, ullLimit);
+    return (ullWritten == ullLimit) ? 0 : 1;
+}
+
+/// <summary>
+/// Parameters for a redirection monitor thread
+/// </summary>
+struct BenchMonitorParam_t
+{
+    BenchChild_t* pChild;
+    PlatformFile_t hPipe;
+    RedirSink_t* pSink;
+};
+
+/// <summary>
+/// Thread function for a redirection monitor, as in RedirManager.cpp
+/// </summary>
+static void MonitorThread(void* pvParam)
+{
+    std::unique_ptr<BenchMonitorParam_t> pParam((BenchMonitorParam_t*)pvParam);
+    BenchPumpObserver_t observer(*pParam->pChild);
+    PumpPipeToSink(pParam->hPipe, *pParam->pSink, observer);
+}
+
+/// <summary>
+/// Samples the process' resource counters periodically and keeps the peak values
+/// </summary>
+struct BenchSampler_t
+{
+    std::atomic<bool> bStop{ false };
+    PlatformProcessCounters_t peak;
+    PlatformThread_t thread;
+
+    static void ThreadProc(void* pvParam)
+    {
+        BenchSampler_t& sampler = *(BenchSampler_t*)pvParam;
+        while (!sampler.bStop)
+        {
+            sampler.Sample();
+            PlatformSleepMilliseconds(5);
+        }
+        sampler.Sample();
+    }
+
+    void Sample()
+    {
+        PlatformProcessCounters_t counters;
+        PlatformGetProcessCounters(counters);
+        if (counters.nHandles > peak.nHandles) peak.nHandles = counters.nHandles;
+        if (counters.nThreads > peak.nThreads) peak.nThreads = counters.nThreads;
+        if (counters.ullPeakMemory > peak.ullPeakMemory) peak.ullPeakMemory = counters.ullPeakMemory;
+    }
+};
+
+/// <summary>
+/// Measurements accumulated across all iterations
+/// </summary>
+struct BenchResults_t
+{
+    uint64_t nSessions = 0, nSelected = 0, nLaunched = 0, nLaunchFailures = 0, nExited = 0, nTimedOut = 0;
+    uint64_t ullBytesWritten = 0, ullBytesPumped = 0;
+    // Bytes that reached the destinations, including chunk stores (differs from ullBytesPumped only when compressing,
+    // deduplicating, or applying quotas)
+    uint64_t ullBytesStored = 0;
+    // With quotas, streams that had output omitted, and the bytes omitted
+    uint64_t nTruncated = 0, ullBytesOmitted = 0;
+    // With -match, pattern matches, and children terminated because of them
+    uint64_t nMatches = 0, nMatchTerminated = 0;
+    // With -redact, secrets masked
+    uint64_t nRedactions = 0;
+    // With -integrity, bytes hashed
+    uint64_t ullBytesHashed = 0;
+    // With -timeindex, entries recorded and bytes of time index written
+    uint64_t nTimeIndexEntries = 0, ullTimeIndexBytes = 0;
+    // With -lineindex, line breaks indexed and bytes of line index written
+    uint64_t ullLinesIndexed = 0, ullLineIndexBytes = 0;
+    uint64_t ullElapsed = 0;
+    // With -script, bytes of it the children read
+    uint64_t ullScriptBytesRead = 0;
+    // Latency samples, in microseconds; with -script, how long each child took to get all of it
+    std::vector<uint64_t> vCreate, vFirstOutput, vExit, vExitDetect, vScriptIn;
+    PlatformProcessCounters_t baseline, peak;
+};
+
+/// <summary>
+/// Connection state of a fake session; deterministic, so runs are comparable
+/// </summary>
+static SessionConnectState_t FakeSessionState(const BenchOptions_t& options, uint32_t ixSession)
+{
+    // Spread the states evenly rather than in blocks, so that "first active" isn't trivially the first session
+    const uint32_t nBucket = (ixSession * 37) % 100;
+    if (nBucket < options.nOtherPct)
+        return SessionConnectState_t::Other;
+    if (nBucket < options.nOtherPct + options.nDisconnectedPct)
+        return SessionConnectState_t::Disconnected;
+    return SessionConnectState_t::Active;
+}
+
+/// <summary>
+/// Opens the redirection destination for one of a child's streams
+/// </summary>
+/// <param name="sFile">Output: the destination's file name, without the directory; empty for the null device</param>
+static PlatformFile_t OpenDestination(const BenchOptions_t& options, uint32_t dwSessionId, const wchar_t* szStream, uint32_t nIteration, std::wstring& sFile, uint32_t& dwError)
+{
+    sFile.clear();
+    if (options.sOutDirectory.empty())
+        return PlatformOpenNullDevice(dwError);
+    std::wstringstream strFile;
+    strFile << L"S_" << dwSessionId << L"_I_" << nIteration << L"_" << szStream << L".txt";
+    if (options.bDedup)
+        strFile << szDedupManifestExtension;
+    else if (options.nCompressLevel > 0)
+        strFile << szCompressedCaptureExtension;
+    sFile = strFile.str();
+    return PlatformCreateFile(options.sOutDirectory + L"/" + sFile, dwError);
+}
+
+/// <summary>
+/// The sink a monitor writes to, as SetUpRedirection sets it up: the destination, possibly through a
+/// deduplicator or a compressor, behind the quota, redaction, and the pattern matcher if there are any
+/// </summary>
+/// <param name="pStage">Output: the deduplicator or compressor; nullptr if neither</param>
+/// <param name="pHash">Output: the sink that hashes what reaches the destination; nullptr if not hashing</param>
+/// <param name="sDestination">Input: the destination's file name, for its time index; empty for the null device</param>
+/// <param name="pTimeIndex">Output: the sink that records the destination's time index; nullptr if not recording one</param>
+/// <param name="pLineIndex">Output: the sink that records the destination's line index; nullptr if not recording one</param>
+static std::unique_ptr<RedirSink_t> MakeSink(const BenchOptions_t& options, const BenchChild_t& child, PlatformFile_t hDestination, RedirSink_t*& pStage, RedirHashSink_t*& pHash,
+    const std::wstring& sDestination, RedirTimeIndexSink_t*& pTimeIndex, RedirLineIndexSink_t*& pLineIndex)
+{
+    std::unique_ptr<RedirSink_t> pSink(new RedirFileSink_t(hDestination));
+    pHash = nullptr;
+    if (IntegrityHash_t::None != options.integrityHash)
+    {
+        pHash = new RedirHashSink_t(options.integrityHash, std::move(pSink));
+        pSink.reset(pHash);
+    }
+    if (nullptr != child.pChunkStore)
+        pSink.reset(new RedirDedupSink_t(*child.pChunkStore, std::move(pSink)));
+    else if (options.nCompressLevel > 0)
+        pSink.reset(new RedirCompressor_t(std::move(pSink), options.nCompressLevel));
+    pStage = (options.bDedup || options.nCompressLevel > 0) ? pSink.get() : nullptr;
+    // (Without -out, the indexes are written to the null device, like the destination)
+    pLineIndex = nullptr;
+    if (0 != options.nLineIndexInterval)
+    {
+        uint32_t dwError = 0;
+        PlatformFile_t hIndex = sDestination.empty() ? PlatformOpenNullDevice(dwError) : PlatformCreateFile(options.sOutDirectory + L"/" + sDestination + szLineIndexExtension, dwError);
+        if (PlatformInvalidFile != hIndex)
+        {
+            pLineIndex = new RedirLineIndexSink_t(options.nLineIndexInterval, hIndex, std::move(pSink));
+            pSink.reset(pLineIndex);
+        }
+    }
+    pTimeIndex = nullptr;
+    if (nullptr != child.pTimeIndexBase)
+    {
+        uint32_t dwError = 0;
+        PlatformFile_t hIndex = sDestination.empty() ? PlatformOpenNullDevice(dwError) : PlatformCreateFile(options.sOutDirectory + L"/" + sDestination + szTimeIndexExtension, dwError);
+        if (PlatformInvalidFile != hIndex)
+        {
+            pTimeIndex = new RedirTimeIndexSink_t(*child.pTimeIndexBase, hIndex, std::move(pSink));
+            pSink.reset(pTimeIndex);
+        }
+    }
+    if (nullptr != child.pQuota)
+        pSink.reset(new RedirQuotaSink_t(*child.pQuota, std::move(pSink)));
+    if (nullptr != child.pRedaction)
+        pSink.reset(new RedirRedactSink_t(*child.pRedaction, std::move(pSink)));
+    if (child.pMatches)
+        pSink.reset(new RedirMatchSink_t(options.patterns, *child.pMatches, std::move(pSink)));
+    return pSink;
+}
+
+/// <summary>
+/// Set up redirection and start a synthetic child in a session: the equivalent of CreateProcessAsUserW,
+/// SetUpRedirection, and ResumeThread.
+/// </summary>
+static bool LaunchChild(BenchChild_t& child, uint32_t nIteration)
+{
+    const BenchOptions_t& options = *child.pOptions;
+    const uint64_t ullPhaseStart = MonotonicMicroseconds();
+    uint32_t dwError = 0;
+
+    if (!options.patterns.Empty())
+        child.pMatches.reset(new BenchMatchResults_t(options.patterns, child));
+    bool bOk = PlatformCreatePipe(child.hStdoutRd, child.hStdoutWr, dwError);
+    if (bOk && !options.bMerge)
+        bOk = PlatformCreatePipe(child.hStderrRd, child.hStderrWr, dwError);
+    if (bOk && 0 != options.ullScriptBytes)
+        bOk = PlatformCreatePipe(child.hStdinRd, child.hStdinWr, dwError);
+    if (bOk)
+    {
+        child.hStdoutDest = OpenDestination(options, child.dwSessionId, options.bMerge ? L"stdout+stderr" : L"stdout", nIteration, child.sStdoutDest, dwError);
+        bOk = (PlatformInvalidFile != child.hStdoutDest);
+        child.pStdoutSink = MakeSink(options, child, child.hStdoutDest, child.pStdoutStage, child.pStdoutHash, child.sStdoutDest, child.pStdoutTimeIndex, child.pStdoutLineIndex);
+    }
+    if (bOk && !options.bMerge)
+    {
+        child.hStderrDest = OpenDestination(options, child.dwSessionId, L"stderr", nIteration, child.sStderrDest, dwError);
+        bOk = (PlatformInvalidFile != child.hStderrDest);
+        child.pStderrSink = MakeSink(options, child, child.hStderrDest, child.pStderrStage, child.pStderrHash, child.sStderrDest, child.pStderrTimeIndex, child.pStderrLineIndex);
+    }
+    if (!bOk)
+    {
+        std::wcerr << L"Cannot set up redirection for session " << child.dwSessionId << L": " << PlatformErrorMessage(dwError) << std::endl;
+        return false;
+    }
+
+    if (options.bProcesses)
+    {
+        std::vector<std::wstring> vArgs;
+        vArgs.push_back(options.sSelf);
+        vArgs.push_back(std::wstring(szChildModeOption, szChildModeOption + strlen(szChildModeOption)));
+        for (uint64_t ullArg : { uint64_t(child.dwSessionId), options.ullRate, options.ullChunk, options.ullLifetimeMs, uint64_t(options.bMerge ? 1 : 0) })
+            vArgs.push_back(std::to_wstring(ullArg));
+        bOk = PlatformStartProcess(child.process, vArgs, child.hStdoutWr, child.hStderrWr, dwError);
+        // The child has its own copies now; the monitors see end-of-file when it exits.
+        PlatformClose(child.hStdoutWr);
+        PlatformClose(child.hStderrWr);
+    }
+    // Record the end of the Create phase before the monitors start and the child "resumes," as other
+    // phases are measured from here. (A child process' output waits in the pipe until the monitors start.)
+    child.phaseTimes.Record(Phase_t::Create, ullPhaseStart, MonotonicMicroseconds());
+    if (bOk)
+        bOk = PlatformStartThread(child.stdoutMonitor, MonitorThread, new BenchMonitorParam_t{ &child, child.hStdoutRd, child.pStdoutSink.get() }, dwError);
+    if (bOk && !options.bMerge)
+        bOk = PlatformStartThread(child.stderrMonitor, MonitorThread, new BenchMonitorParam_t{ &child, child.hStderrRd, child.pStderrSink.get() }, dwError);
+    if (bOk && 0 != options.ullScriptBytes)
+        bOk = PlatformStartThread(child.stdinFeeder, StdinFeederThread, &child, dwError);
+    if (bOk)
+        bOk = PlatformStartThread(child.childThread, options.bProcesses ? ProcessWaitThread : ChildThread, &child, dwError);
+    if (!bOk)
+    {
+        std::wcerr << L"Cannot start " << (options.bProcesses ? L"process" : L"thread") << L" for session " << child.dwSessionId << L": " << PlatformErrorMessage(dwError) << std::endl;
+        // Let any monitor that did start see end-of-file (and a feeder that did start, that there's no reader)
+        PlatformClose(child.hStdoutWr);
+        PlatformClose(child.hStderrWr);
+        if (!child.stdinFeeder.bStarted)
+            PlatformClose(child.hStdinWr);
+        PlatformClose(child.hStdinRd);
+        if (child.process.bStarted)
+        {
+            PlatformTerminateProcess(child.process, dwError);
+            PlatformWaitForProcess(child.process, PlatformWaitForever);
+        }
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Writes an iteration's integrity manifest to the output directory, as RunAsUsers.exe does at the end of a run
+/// </summary>
+static void WriteBenchIntegrityManifest(const BenchOptions_t& options, uint32_t nIteration, const std::vector<ptrBenchChild_t>& vChildren, ChunkStore_t* pChunkStore)
+{
+    std::vector<IntegrityEntry_t> vEntries;
+    for (const ptrBenchChild_t& pChild : vChildren)
+    {
+        auto addEntry = [&](const std::wstring& sFile, const wchar_t* szContent, const RedirHashSink_t* pHash) {
+            if (nullptr == pHash || sFile.empty())
+                return;
+            IntegrityEntry_t entry;
+            entry.sFile = sFile;
+            entry.sContent = szContent;
+            entry.bHasProcess = true;
+            entry.dwSessionId = pChild->dwSessionId;
+            // (In-process children have no process ID, and exit with 0)
+            entry.dwPID = pChild->process.dwPID;
+            entry.bExited = pChild->bExited;
+            entry.dwExitCode = pChild->process.dwExitCode;
+            entry.hashes = pHash->Hashes();
+            vEntries.push_back(entry);
+        };
+        addEntry(pChild->sStdoutDest, options.bMerge ? L"stdout+stderr" : L"stdout", pChild->pStdoutHash);
+        addEntry(pChild->sStderrDest, L"stderr", pChild->pStderrHash);
+    }
+    IntegrityEntry_t storeEntry;
+    if (nullptr != pChunkStore && pChunkStore->Hashes(storeEntry.hashes))
+    {
+        storeEntry.sFile.assign(pChunkStore->FileName().begin(), pChunkStore->FileName().end());
+        storeEntry.sContent = L"chunks";
+        vEntries.push_back(storeEntry);
+    }
+
+    std::wstringstream strManifest;
+    WriteIntegrityManifest(strManifest, L"iteration " + std::to_wstring(nIteration), vEntries);
+    // (Everything in it is ASCII)
+    const std::wstring sManifest = strManifest.str();
+    const std::string sBytes(sManifest.begin(), sManifest.end());
+    std::wstringstream strPath;
+    strPath << options.sOutDirectory << L"/integrity_I_" << nIteration << szIntegrityManifestExtension;
+    uint32_t dwError = 0;
+    size_t cbWritten = 0;
+    PlatformFile_t hFile = PlatformCreateFile(strPath.str(), dwError);
+    if (PlatformInvalidFile == hFile || !PlatformWrite(hFile, (const uint8_t*)sBytes.data(), sBytes.length(), cbWritten, dwError))
+        std::wcerr << L"Cannot write integrity manifest " << strPath.str() << L": " << PlatformErrorMessage(dwError) << std::endl;
+    PlatformClose(hFile);
+}
+
+/// <summary>
+/// One complete run: select sessions, launch, monitor until all have exited or timed out, and clean up.
+/// </summary>
+static void RunIteration(const BenchOptions_t& options, uint32_t nIteration, BenchResults_t& results)
+{
+    ExitQueue_t<BenchChild_t*> exitQueue;
+    // Deadlines terminate children (as RunAsUsers.exe -term does)
+    TerminationSchedule_t<BenchChild_t*> terminationSchedule;
+    terminationSchedule.SetPolicy(true, 0);
+    // With -dedup, one chunk store for all of the iteration's children, as RunAsUsers.exe has one per run.
+    // (Without -out, it's written to the null device, like the other destinations.)
+    ChunkStore_t chunkStore;
+    if (options.bDedup)
+    {
+        std::wstringstream strPath;
+        if (options.sOutDirectory.empty())
+            strPath << PlatformNullDevicePath;
+        else
+            strPath << options.sOutDirectory << L"/chunks_I_" << nIteration << szChunkStoreExtension;
+        uint32_t dwError = 0;
+        if (!chunkStore.Create(strPath.str(), options.nCompressLevel, dwError, options.integrityHash))
+        {
+            std::wcerr << L"Cannot create chunk store " << strPath.str() << L": " << PlatformErrorMessage(dwError) << std::endl;
+            ++results.nLaunchFailures;
+            return;
+        }
+    }
+
+    // With quotas, one quota for all of the iteration's children, as RunAsUsers.exe has one per run
+    OutputQuota_t outputQuota(options.ullQuota, options.quotaPolicy, options.ullTotalQuota);
+    const bool bQuota = (QuotaUnlimited != options.ullQuota || QuotaUnlimited != options.ullTotalQuota);
+    // With -redact, the rules (validated when the command line was parsed), compiled for the iteration
+    RedactionRules_t redaction;
+    for (const std::string& sRule : options.vRedactionRules)
+    {
+        std::wstring sError;
+        redaction.Add(sRule, sError);
+    }
+
+    // With -timeindex, the iteration's start, shared by all its time indexes as RunAsUsers.exe's run start is
+    TimeIndexBase_t timeIndexBase;
+    timeIndexBase.Capture();
+
+    std::vector<ptrBenchChild_t> vChildren;
+
+    const uint64_t ullRunStart = MonotonicMicroseconds();
+
+    // Session selection and launch
+    for (uint32_t ixSession = 0; ixSession < options.nSessions; ++ixSession)
+    {
+        // Session 0 is never a user session
+        const uint32_t dwSessionId = ixSession + 1;
+        ++results.nSessions;
+        const SessionSelection_t selection = SelectSession(options.whichSessions, options.nSessionId, dwSessionId, FakeSessionState(options, ixSession));
+        if (selection.bStartProcess)
+        {
+            ++results.nSelected;
+            ptrBenchChild_t pChild(new BenchChild_t);
+            pChild->pOptions = &options;
+            pChild->pExitQueue = &exitQueue;
+            pChild->dwSessionId = dwSessionId;
+            pChild->pChunkStore = options.bDedup ? &chunkStore : nullptr;
+            pChild->pQuota = bQuota ? &outputQuota : nullptr;
+            pChild->pRedaction = redaction.Empty() ? nullptr : &redaction;
+            pChild->pTimeIndexBase = options.bTimeIndex ? &timeIndexBase : nullptr;
+            if (LaunchChild(*pChild, nIteration))
+            {
+                ++results.nLaunched;
+                terminationSchedule.Start(pChild.get(), Deadline_t::AfterMilliseconds(options.ullTimeoutMs, pChild->phaseTimes.ullEnd[size_t(Phase_t::Create)]));
+            }
+            else
+            {
+                ++results.nLaunchFailures;
+            }
+            vChildren.push_back(std::move(pChild));
+        }
+        if (selection.bDoneAfterThis)
+            break;
+    }
+
+    // Exit monitoring, as in RunAsUsers.cpp and ProcessManager_t::WaitForAProcessToExit
+    size_t nRunning = 0;
+    for (const ptrBenchChild_t& pChild : vChildren)
+    {
+        if (pChild->childThread.bStarted)
+            ++nRunning;
+    }
+    std::vector<BenchChild_t*> vExited;
+    std::vector<TerminationSchedule_t<BenchChild_t*>::Action_t> vActions;
+    while (nRunning > 0)
+    {
+        exitQueue.Wait(terminationSchedule.NextDeadline().WaitMilliseconds(), vExited);
+        for (BenchChild_t* pChild : vExited)
+        {
+            if (pChild->bExited || pChild->bTimedOut)
+                continue;
+            pChild->phaseTimes.Record(Phase_t::Exit, pChild->phaseTimes.ullEnd[size_t(Phase_t::Create)], MonotonicMicroseconds());
+            pChild->bExited = true;
+            --nRunning;
+        }
+        terminationSchedule.Advance(MonotonicMicroseconds(), [](BenchChild_t* pChild) { return !(pChild->bExited || pChild->bTimedOut); }, vActions);
+        for (const auto& action : vActions)
+        {
+            // Terminate: a thread child stops at its next write
+            BenchChild_t* pChild = action.item;
+            pChild->bTimedOut = true;
+            pChild->bKill = true;
+            uint32_t dwError = 0;
+            if (pChild->process.bStarted && !PlatformTerminateProcess(pChild->process, dwError))
+                std::wcerr << L"Cannot terminate process " << pChild->process.dwPID << L": " << PlatformErrorMessage(dwError) << std::endl;
+            --nRunning;
+        }
+    }
+
+    // Wait for the children and redirection monitors, as in ProcessManager_t::WaitForRedirectionMonitors
+    for (const ptrBenchChild_t& pChild : vChildren)
+    {
+        PlatformJoinThread(pChild->childThread);
+        PlatformJoinThread(pChild->stdoutMonitor);
+        PlatformJoinThread(pChild->stderrMonitor);
+        PlatformJoinThread(pChild->stdinFeeder);
+    }
+    results.ullElapsed += MonotonicMicroseconds() - ullRunStart;
+
+    for (const ptrBenchChild_t& pChild : vChildren)
+    {
+        const PhaseTimings_t& times = pChild->phaseTimes;
+        // A process' writes can't be counted from here: a process that exited by itself wrote the fixed
+        // amount (or there will be a discrepancy); one that was terminated wrote whatever got redirected.
+        if (pChild->process.bStarted)
+            pChild->ullWritten = (pChild->bTimedOut || pChild->bMatchTerminated) ? uint64_t(pChild->ullPumped) : ChildProcessOutputBytes(options);
+        results.ullBytesWritten += pChild->ullWritten;
+        results.ullBytesPumped += pChild->ullPumped;
+        if (options.bDedup)
+        {
+            // MakeSink put a deduplicator in front of each destination; the chunk store is counted below
+            for (RedirSink_t* pStage : { pChild->pStdoutStage, pChild->pStderrStage })
+            {
+                if (nullptr != pStage)
+                    results.ullBytesStored += static_cast<RedirDedupSink_t*>(pStage)->ManifestBytes();
+            }
+        }
+        else if (options.nCompressLevel > 0)
+        {
+            // MakeSink put a compressor in front of each destination
+            for (RedirSink_t* pStage : { pChild->pStdoutStage, pChild->pStderrStage })
+            {
+                if (nullptr != pStage)
+                    results.ullBytesStored += static_cast<RedirCompressor_t*>(pStage)->StoredBytes();
+            }
+        }
+        else
+        {
+            results.ullBytesStored += pChild->ullPumped;
+        }
+        if (pChild->pMatches)
+        {
+            for (uint64_t nCount : pChild->pMatches->Counts())
+                results.nMatches += nCount;
+            if (pChild->bMatchTerminated)
+                ++results.nMatchTerminated;
+        }
+        if (IntegrityHash_t::None != options.integrityHash)
+        {
+            for (const RedirHashSink_t* pHash : { pChild->pStdoutHash, pChild->pStderrHash })
+            {
+                if (nullptr != pHash)
+                    results.ullBytesHashed += pHash->Hashes().ullSize;
+            }
+        }
+        for (const RedirTimeIndexSink_t* pTimeIndex : { pChild->pStdoutTimeIndex, pChild->pStderrTimeIndex })
+        {
+            if (nullptr != pTimeIndex)
+            {
+                results.nTimeIndexEntries += pTimeIndex->Entries();
+                results.ullTimeIndexBytes += pTimeIndex->IndexBytes();
+            }
+        }
+        for (const RedirLineIndexSink_t* pLineIndex : { pChild->pStdoutLineIndex, pChild->pStderrLineIndex })
+        {
+            if (nullptr != pLineIndex)
+            {
+                results.ullLinesIndexed += pLineIndex->LineBreaks();
+                results.ullLineIndexBytes += pLineIndex->IndexBytes();
+            }
+        }
+        if (0 != options.ullScriptBytes)
+        {
+            results.ullScriptBytesRead += pChild->ullScriptRead;
+            if (0 != pChild->ullScriptReceived)
+                results.vScriptIn.push_back(pChild->ullScriptReceived - pChild->phaseTimes.ullEnd[size_t(Phase_t::Create)]);
+        }
+        if (pChild->bTimedOut)
+            ++results.nTimedOut;
+        if (pChild->bExited)
+            ++results.nExited;
+        if (times.IsRecorded(Phase_t::Create))
+            results.vCreate.push_back(times.Duration(Phase_t::Create));
+        if (times.IsRecorded(Phase_t::FirstOutput))
+            results.vFirstOutput.push_back(times.Duration(Phase_t::FirstOutput));
+        if (times.IsRecorded(Phase_t::Exit))
+        {
+            results.vExit.push_back(times.Duration(Phase_t::Exit));
+            results.vExitDetect.push_back(times.ullEnd[size_t(Phase_t::Exit)] - pChild->ullEnded);
+        }
+    }
+    if (options.bDedup)
+        results.ullBytesStored += chunkStore.Stats().ullStoreSize;
+    results.nRedactions += redaction.Redactions();
+    if (IntegrityHash_t::None != options.integrityHash)
+    {
+        OutputHashes_t storeHashes;
+        if (options.bDedup && chunkStore.Hashes(storeHashes))
+            results.ullBytesHashed += storeHashes.ullSize;
+        if (!options.sOutDirectory.empty())
+            WriteBenchIntegrityManifest(options, nIteration, vChildren, options.bDedup ? &chunkStore : nullptr);
+    }
+    if (bQuota)
+    {
+        uint64_t nTruncated = 0, ullOmitted = 0;
+        outputQuota.GetStats(nTruncated, ullOmitted);
+        results.nTruncated += nTruncated;
+        results.ullBytesOmitted += ullOmitted;
+        // Plain destinations got what was redirected, less what was omitted (not counting the marker lines)
+        if (!options.bDedup && 0 == options.nCompressLevel)
+            results.ullBytesStored -= ullOmitted;
+    }
+}
+
+/// <summary>
+/// Write a row of latency percentiles, in milliseconds
+/// </summary>
+static void WriteLatencyRow(std::wostream& os, const wchar_t* szName, std::vector<uint64_t>& values)
+{
+    os << std::left << std::setw(14) << szName << std::right << std::setw(8) << values.size();
+    for (double pct : { 50.0, 90.0, 99.0, 100.0 })
+        os << std::setw(12) << std::fixed << std::setprecision(3) << MicrosecondsToMilliseconds(Percentile(values, pct));
+    os << std::endl;
+}
+
+/// <summary>
+/// Write the summary report
+/// </summary>
+static void Report(std::wostream& os, const BenchOptions_t& options, BenchResults_t& results)
+{
+    const double dElapsedSeconds = double(results.ullElapsed) / 1000000.0;
+    const double dMB = double(results.ullBytesPumped) / (1024.0 * 1024.0);
+    const double dThroughput = (dElapsedSeconds > 0) ? dMB / dElapsedSeconds : 0;
+    const double dLaunchRate = (dElapsedSeconds > 0) ? double(results.nLaunched) / dElapsedSeconds : 0;
+
+    if (options.bCsv)
+    {
+        os << L"iterations,sessions,launched,launchFailures,exited,timedOut,elapsedSeconds,bytesWritten,bytesPumped,throughputMBps,launchesPerSecond,"
+            << L"createP50us,createP99us,firstOutputP50us,firstOutputP99us,exitP50us,exitP99us,exitDetectP50us,exitDetectP99us,"
+            << L"peakThreads,peakHandles,peakMemoryBytes,bytesStored,bytesOmitted,matches,redactions,bytesHashed,timeIndexEntries,timeIndexBytes,linesIndexed,lineIndexBytes,scriptBytesRead,scriptInP50us,scriptInP99us" << std::endl;
+        os << options.nIterations << L"," << results.nSessions << L"," << results.nLaunched << L"," << results.nLaunchFailures << L","
+            << results.nExited << L"," << results.nTimedOut << L"," << dElapsedSeconds << L","
+            << results.ullBytesWritten << L"," << results.ullBytesPumped << L"," << dThroughput << L"," << dLaunchRate << L","
+            << Percentile(results.vCreate, 50) << L"," << Percentile(results.vCreate, 99) << L","
+            << Percentile(results.vFirstOutput, 50) << L"," << Percentile(results.vFirstOutput, 99) << L","
+            << Percentile(results.vExit, 50) << L"," << Percentile(results.vExit, 99) << L","
+            << Percentile(results.vExitDetect, 50) << L"," << Percentile(results.vExitDetect, 99) << L","
+            << results.peak.nThreads << L"," << results.peak.nHandles << L"," << results.peak.ullPeakMemory << L"," << results.ullBytesStored << L"," << results.ullBytesOmitted << L"," << results.nMatches << L"," << results.nRedactions << L"," << results.ullBytesHashed << L"," << results.nTimeIndexEntries << L"," << results.ullTimeIndexBytes << L"," << results.ullLinesIndexed << L"," << results.ullLineIndexBytes << L","
+            << results.ullScriptBytesRead << L"," << Percentile(results.vScriptIn, 50) << L"," << Percentile(results.vScriptIn, 99) << std::endl;
+        return;
+    }
+
+    os << L"Iterations   : " << options.nIterations << std::endl;
+    os << L"Sessions     : " << results.nSessions << L" (" << WhichSessionsToWSZ(options.whichSessions, options.nSessionId) << L": " << results.nSelected << L" selected)" << std::endl;
+    os << L"Launched     : " << results.nLaunched << L" (" << results.nLaunchFailures << L" failed); exited " << results.nExited << L", timed out " << results.nTimedOut << std::endl;
+    os << L"Elapsed      : " << std::fixed << std::setprecision(3) << dElapsedSeconds << L" s" << std::endl;
+    os << L"Launch rate  : " << std::setprecision(1) << dLaunchRate << L" per second" << std::endl;
+    os << L"Output       : " << results.ullBytesWritten << L" bytes written, " << results.ullBytesPumped << L" bytes redirected" << std::endl;
+    if (options.bDedup)
+        os << L"Deduplicated : " << results.ullBytesStored << L" bytes stored, including manifests (" << ((options.nCompressLevel > 0) ? L"compressed, " : L"") << L"ratio " << std::setprecision(2)
+            << ((results.ullBytesStored > 0) ? double(results.ullBytesPumped) / double(results.ullBytesStored) : 0.0) << L")" << std::endl;
+    else if (options.nCompressLevel > 0)
+        os << L"Compressed   : " << results.ullBytesStored << L" bytes stored (level " << options.nCompressLevel << L", ratio " << std::setprecision(2)
+            << ((results.ullBytesStored > 0) ? double(results.ullBytesPumped) / double(results.ullBytesStored) : 0.0) << L")" << std::endl;
+    if (QuotaUnlimited != options.ullQuota || QuotaUnlimited != options.ullTotalQuota)
+        os << L"Quota        : " << results.ullBytesOmitted << L" bytes omitted from " << results.nTruncated << L" streams" << std::endl;
+    if (!options.patterns.Empty())
+        os << L"Matches      : " << results.nMatches << L" (" << options.patterns.Size() << L" patterns); " << results.nMatchTerminated << L" children terminated on a match" << std::endl;
+    if (!options.vRedactionRules.empty())
+        os << L"Redacted     : " << results.nRedactions << L" secrets (" << options.vRedactionRules.size() << L" rules)" << std::endl;
+    if (IntegrityHash_t::None != options.integrityHash)
+        os << L"Hashed       : " << results.ullBytesHashed << L" bytes stored (" << (IntegrityHash_t::Sha256 == options.integrityHash ? L"XXH64 and SHA-256" : L"XXH64") << L")" << std::endl;
+    if (options.bTimeIndex)
+        os << L"Time index   : " << results.nTimeIndexEntries << L" entries, " << results.ullTimeIndexBytes << L" bytes" << std::endl;
+    if (0 != options.nLineIndexInterval)
+        os << L"Line index   : " << results.ullLinesIndexed << L" lines, " << results.ullLineIndexBytes << L" bytes" << std::endl;
+    if (0 != options.ullScriptBytes)
+        os << L"Script       : " << options.ullScriptBytes << L" bytes to each child on stdin; " << results.ullScriptBytesRead << L" bytes read" << std::endl;
+    os << L"Throughput   : " << std::setprecision(2) << dThroughput << L" MB/s" << std::endl;
+    os << L"Peak threads : " << results.peak.nThreads << L" (baseline " << results.baseline.nThreads << L")" << std::endl;
+    os << L"Peak handles : " << results.peak.nHandles << L" (baseline " << results.baseline.nHandles << L")" << std::endl;
+    os << L"Peak memory  : " << std::setprecision(1) << double(results.peak.ullPeakMemory) / (1024.0 * 1024.0) << L" MB" << std::endl;
+    os << std::endl;
+    os << std::left << std::setw(14) << L"Latency (ms)" << std::right << std::setw(8) << L"Count"
+        << std::setw(12) << L"p50" << std::setw(12) << L"p90" << std::setw(12) << L"p99" << std::setw(12) << L"max" << std::endl;
+    WriteLatencyRow(os, L"create", results.vCreate);
+    WriteLatencyRow(os, L"firstOutput", results.vFirstOutput);
+    WriteLatencyRow(os, L"exit", results.vExit);
+    WriteLatencyRow(os, L"exitDetect", results.vExitDetect);
+    if (0 != options.ullScriptBytes)
+        WriteLatencyRow(os, L"scriptIn", results.vScriptIn);
+}
+
+/// <summary>
+/// Resources that must not grow from one soak iteration to the next
+/// </summary>
+struct SoakCounters_t
+{
+    uint64_t nHandles = 0, nThreads = 0;
+    int64_t llHeapBytes = 0;
+    size_t nLogFiles = 0;
+};
+
+static void GetSoakCounters(SoakCounters_t& counters)
+{
+    PlatformProcessCounters_t processCounters;
+    PlatformGetProcessCounters(processCounters);
+    counters.nHandles = processCounters.nHandles;
+    counters.nThreads = processCounters.nThreads;
+    counters.llHeapBytes = g_llHeapBytes;
+    counters.nLogFiles = DbgOut_t::OpenLogFileCount();
+}
+
+static void WriteSoakCounters(std::wostream& os, uint32_t nIteration, const SoakCounters_t& counters)
+{
+    os << L"Iteration " << std::setw(6) << nIteration
+        << L": handles " << counters.nHandles
+        << L", threads " << counters.nThreads
+        << L", heap bytes " << counters.llHeapBytes
+        << L", log files " << counters.nLogFiles << std::endl;
+}
+
+/// <summary>
+/// Soak/leak test: runs the launch/monitor/redirect cycle repeatedly in this process, logging through
+/// dbgOut and a second DbgOut_t sharing its log file, as RunAsUsers.exe does with -dbglog. After every
+/// iteration, all threads have been joined and all handles closed, so the counters should return to
+/// exactly where they were after the first (warm-up) iteration, which initializes the function-local
+/// statics, locales, and stream buffers that are allocated once per process.
+/// </summary>
+/// <returns>true if nothing grew; false otherwise</returns>
+static bool Soak(const BenchOptions_t& options)
+{
+    // Log to a file in the output directory, or to the null device (still going through WofstreamManager_t)
+    const std::wstring sLogFile = options.sOutDirectory.empty() ? std::wstring(PlatformNullDevicePath) : options.sOutDirectory + L"/RunAsUsersBench.soak.log";
+    const uint32_t nProgressInterval = (options.nIterations >= 10) ? options.nIterations / 10 : 1;
+
+    SoakCounters_t baseline, current;
+    for (uint32_t nIteration = 0; nIteration < options.nIterations; ++nIteration)
+    {
+        {
+            // As each RunAsUsers.exe invocation with -dbglog does
+            dbgOut.WriteToDebugStream(false);
+            dbgOut.PrependTimestamp(true);
+            if (!dbgOut.WriteToFile(sLogFile.c_str()))
+            {
+                std::wcerr << L"Cannot open soak log file " << sLogFile << std::endl;
+                return false;
+            }
+            DbgOut_t iterationLog;
+            iterationLog.WriteToDebugStream(false);
+            iterationLog.PrependTimestamp(true);
+            iterationLog.WriteToFile(sLogFile.c_str(), true);
+            iterationLog << L"BEGIN ITERATION " << nIteration << std::endl;
+
+            BenchResults_t results;
+            RunIteration(options, nIteration, results);
+
+            iterationLog << L"END ITERATION " << nIteration << L": launched " << results.nLaunched << L", redirected " << results.ullBytesPumped << L" bytes" << std::endl;
+            if (results.nLaunchFailures > 0 || results.ullBytesWritten != results.ullBytesPumped)
+            {
+                std::wcerr << L"Iteration " << nIteration << L" failed: " << results.nLaunchFailures << L" launch failures, "
+                    << results.ullBytesWritten << L" bytes written, " << results.ullBytesPumped << L" bytes redirected" << std::endl;
+                return false;
+            }
+        }
+
+        GetSoakCounters(current);
+        if (0 == nIteration)
+        {
+            baseline = current;
+        }
+        else if (current.nHandles > baseline.nHandles || current.nThreads > baseline.nThreads ||
+            current.llHeapBytes > baseline.llHeapBytes + int64_t(options.ullHeapSlack) || current.nLogFiles > baseline.nLogFiles)
+        {
+            std::wcerr << L"Resource growth detected" << std::endl;
+            WriteSoakCounters(std::wcerr, 0, baseline);
+            WriteSoakCounters(std::wcerr, nIteration, current);
+            return false;
+        }
+        if (0 == nIteration || 0 == (nIteration + 1) % nProgressInterval)
+            WriteSoakCounters(std::wcout, nIteration, current);
+    }
+    dbgOut.WriteToFile(nullptr);
+    std::wcout << L"No resource growth in " << options.nIterations << L" iterations" << std::endl;
+    return true;
+}
+
+/// <summary>
+/// Generates text like the output of the scripts RunAsUsers typically runs: timestamped log lines, software
+/// inventory dumps (Format-List style), and event exports (CSV), with realistic variation in the fields.
+/// Deterministic, so that runs are comparable.
+/// </summary>
+static std::string GenerateScriptOutput(uint64_t cbTarget)
+{
+    static const char* const szLevels[] = { "INFO ", "INFO ", "INFO ", "WARN ", "ERROR", "DEBUG" };
+    static const char* const szComponents[] = { "ServiceHost", "PolicyAgent", "Inventory", "UpdateClient", "ScriptRunner", "NetworkProbe" };
+    static const char* const szMessages[] = {
+        "Processed request %s for user CONTOSO\\user%u in %u ms",
+        "Connection to https://update.contoso.com/api/v2/status returned %u after %u ms",
+        "Registry value HKLM\\SOFTWARE\\Policies\\Contoso\\Agent\\Setting%u = %u",
+        "Scanned %u files under C:\\Users\\user%u\\AppData\\Local\\Temp",
+        "Retrying operation %s (attempt %u of 5)",
+    };
+    static const char* const szProducts[] = {
+        "Microsoft Visual C++ 2015-2022 Redistributable (x64)", "Microsoft Edge", "Contoso Endpoint Agent",
+        "7-Zip 23.01 (x64)", "Microsoft 365 Apps for enterprise - en-us", "Git", "Python 3.12.1 (64-bit)",
+    };
+    static const char* const szPublishers[] = { "Microsoft Corporation", "Contoso Ltd.", "Igor Pavlov", "The Git Development Community", "Python Software Foundation" };
+    static const char* const szEvents[] = { "An account was successfully logged on.", "An account was logged off.", "A logon was attempted using explicit credentials.", "Special privileges assigned to new logon." };
+
+    std::mt19937 rng(12345);
+    std::string sText;
+    sText.reserve(size_t(cbTarget) + 1024);
+    char szLine[512], szHex[32];
+    uint32_t nHour = 8, nMinute = 0, nSecond = 0, nMs = 0;
+    while (sText.size() < cbTarget)
+    {
+        const uint32_t nKind = rng() % 10;
+        if (nKind < 6)
+        {
+            // A burst of log lines
+            for (uint32_t n = 0; n < 20; ++n)
+            {
+                nMs += rng() % 200;
+                nSecond += nMs / 1000; nMs %= 1000;
+                nMinute += nSecond / 60; nSecond %= 60;
+                nHour = (nHour + nMinute / 60) % 24; nMinute %= 60;
+                snprintf(szHex, sizeof(szHex), "0x%08x", unsigned(rng()));
+                char szMessage[256];
+                snprintf(szMessage, sizeof(szMessage), szMessages[rng() % 5], szHex, unsigned(rng() % 500), unsigned(rng() % 1000));
+                if (strstr(szMessage, "%s"))
+                    snprintf(szMessage, sizeof(szMessage), "Retrying operation %s (attempt %u of 5)", szHex, unsigned(1 + rng() % 5));
+                snprintf(szLine, sizeof(szLine), "2024-05-01 %02u:%02u:%02u.%03u [%s] %s[%u]: %s\r\n",
+                    nHour, nMinute, nSecond, nMs, szLevels[rng() % 6], szComponents[rng() % 6], unsigned(1000 + rng() % 9000), szMessage);
+                sText += szLine;
+            }
+        }
+        else if (nKind < 8)
+        {
+            // An inventory entry
+            snprintf(szLine, sizeof(szLine),
+                "DisplayName     : %s\r\nDisplayVersion  : %u.%u.%u.%u\r\nPublisher       : %s\r\nInstallDate     : 2024%02u%02u\r\n"
+                "InstallLocation : C:\\Program Files\\Vendor%u\\\r\nEstimatedSize   : %u\r\n\r\n",
+                szProducts[rng() % 7], unsigned(rng() % 30), unsigned(rng() % 100), unsigned(rng() % 50000), unsigned(rng() % 1000),
+                szPublishers[rng() % 5], unsigned(1 + rng() % 12), unsigned(1 + rng() % 28), unsigned(rng() % 100), unsigned(rng() % 2000000));
+            sText += szLine;
+        }
+        else
+        {
+            // Event export rows
+            for (uint32_t n = 0; n < 10; ++n)
+            {
+                snprintf(szLine, sizeof(szLine), "\"%u\",\"2024-05-01T%02u:%02u:%02u.%07uZ\",\"Security\",\"%s\",\"S-1-5-21-3623811015-3361044348-30300820-%u\",\"0x%x\"\r\n",
+                    unsigned(4624 + rng() % 50), nHour, nMinute, nSecond, unsigned(rng() % 10000000), szEvents[rng() % 4], unsigned(1000 + rng() % 5000), unsigned(rng()));
+                sText += szLine;
+            }
+        }
+    }
+    sText.resize(size_t(cbTarget));
+    return sText;
+}
+
+/// <summary>
+/// Measures the compressor on generated script output at each level, in blocks as RedirCompressor_t
+/// compresses them: compression ratio, and compression and decompression throughput.
+/// </summary>
+/// <returns>false if any block failed to decompress to its original content</returns>
+static bool CodecBenchmark(std::wostream& os, const BenchOptions_t& options)
+{
+    const std::string sText = GenerateScriptOutput(options.ullCodecBytes);
+    const uint8_t* pText = (const uint8_t*)sText.data();
+    const size_t cbBlock = RedirCompressDefaultBlockSize;
+    const size_t nBlocks = (sText.size() + cbBlock - 1) / cbBlock;
+    std::vector<uint8_t> compressed(nBlocks * LzCompressBound(cbBlock));
+    std::vector<size_t> vCompressedSize(nBlocks);
+    std::vector<uint8_t> decompressed(cbBlock);
+    const double dMB = double(sText.size()) / (1024.0 * 1024.0);
+
+    if (options.bCsv)
+        os << L"level,originalBytes,compressedBytes,ratio,compressMBps,decompressMBps" << std::endl;
+    else
+        os << L"Compressing " << sText.size() << L" bytes of generated script output in " << cbBlock << L"-byte blocks" << std::endl
+            << std::endl << std::left << std::setw(8) << L"Level" << std::right << std::setw(16) << L"Compressed" << std::setw(10) << L"Ratio"
+            << std::setw(16) << L"Compress MB/s" << std::setw(18) << L"Decompress MB/s" << std::endl;
+
+    bool bOk = true;
+    for (int nLevel = LzMinLevel; nLevel <= LzMaxLevel; ++nLevel)
+    {
+        uint64_t ullCompressed = 0;
+        uint64_t ullStart = MonotonicMicroseconds();
+        for (size_t ixBlock = 0; ixBlock < nBlocks; ++ixBlock)
+        {
+            const size_t cbThis = (sText.size() - ixBlock * cbBlock < cbBlock) ? sText.size() - ixBlock * cbBlock : cbBlock;
+            vCompressedSize[ixBlock] = LzCompress(pText + ixBlock * cbBlock, cbThis, compressed.data() + ixBlock * LzCompressBound(cbBlock), LzCompressBound(cbBlock), nLevel);
+            ullCompressed += vCompressedSize[ixBlock];
+        }
+        const uint64_t ullCompressTime = MonotonicMicroseconds() - ullStart;
+
+        uint64_t ullDecompressTime = 0;
+        for (size_t ixBlock = 0; ixBlock < nBlocks; ++ixBlock)
+        {
+            const size_t cbThis = (sText.size() - ixBlock * cbBlock < cbBlock) ? sText.size() - ixBlock * cbBlock : cbBlock;
+            ullStart = MonotonicMicroseconds();
+            const bool bDecompressed = LzDecompress(compressed.data() + ixBlock * LzCompressBound(cbBlock), vCompressedSize[ixBlock], decompressed.data(), cbThis);
+            ullDecompressTime += MonotonicMicroseconds() - ullStart;
+            if (!bDecompressed || 0 != memcmp(decompressed.data(), pText + ixBlock * cbBlock, cbThis))
+            {
+                std::wcerr << L"Level " << nLevel << L", block " << ixBlock << L" did not decompress to its original content" << std::endl;
+                bOk = false;
+            }
+        }
+
+        const double dRatio = (ullCompressed > 0) ? double(sText.size()) / double(ullCompressed) : 0.0;
+        const double dCompressMBps = (ullCompressTime > 0) ? dMB * 1000000.0 / double(ullCompressTime) : 0.0;
+        const double dDecompressMBps = (ullDecompressTime > 0) ? dMB * 1000000.0 / double(ullDecompressTime) : 0.0;
+        if (options.bCsv)
+            os << nLevel << L"," << sText.size() << L"," << ullCompressed << L"," << dRatio << L"," << dCompressMBps << L"," << dDecompressMBps << std::endl;
+        else
+            os << std::left << std::setw(8) << nLevel << std::right << std::setw(16) << ullCompressed << std::fixed << std::setprecision(2) << std::setw(10) << dRatio
+                << std::setprecision(1) << std::setw(16) << dCompressMBps << std::setw(18) << dDecompressMBps << std::endl;
+    }
+    return bOk;
+}
+
+#ifdef _WIN32
+/// <summary>
+/// How RunAsUsers.exe -pe encoded command lines before Base64.h: CryptBinaryToStringW (a size probe, then the
+/// encoding, with line breaks), copied into a string, and the line breaks removed. The baseline for -base64.
+/// </summary>
+static bool CryptBase64Encode(const uint8_t* pData, size_t cbData, std::wstring& sOutput)
+{
+    sOutput.clear();
+    DWORD cchOutput = 0;
+    CryptBinaryToStringW(pData, DWORD(cbData), CRYPT_STRING_BASE64, nullptr, &cchOutput);
+    if (0 == cchOutput)
+        return false;
+    std::vector<wchar_t> vChars(cchOutput + 8);
+    if (!CryptBinaryToStringW(pData, DWORD(cbData), CRYPT_STRING_BASE64, vChars.data(), &cchOutput))
+        return false;
+    sOutput = vChars.data();
+    sOutput = replaceStringAll(sOutput, L"\r\n", L"");
+    return true;
+}
+#endif
+
+/// <summary>
+/// Measures the Base64 codec on generated scripts (as the UTF-16LE that -pe encodes) of 1 KB to 1 MB: encoding and
+/// decoding throughput and, on Windows, encoding throughput of CryptBinaryToStringW as RunAsUsers.exe used it.
+/// </summary>
+/// <returns>false if any encoding didn't decode to its original content, or (on Windows) differed from CryptBinaryToStringW's</returns>
+static bool Base64Benchmark(std::wostream& os, const BenchOptions_t& options)
+{
+    static const size_t ScriptSizes[] = { 1024, 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+    const size_t cbLargest = ScriptSizes[sizeof(ScriptSizes) / sizeof(ScriptSizes[0]) - 1];
+    const std::string sText = GenerateScriptOutput(cbLargest / 2);
+    std::vector<uint8_t> script(cbLargest);
+    for (size_t ix = 0; ix < sText.size(); ++ix)
+    {
+        script[2 * ix] = uint8_t(sText[ix]);
+        script[2 * ix + 1] = 0;
+    }
+
+    if (options.bCsv)
+        os << L"scriptBytes,encodedChars,iterations,encodeMBps,decodeMBps,cryptEncodeMBps" << std::endl;
+    else
+        os << L"Encoding generated scripts, " << options.ullCodecBytes << L" bytes at each size" << std::endl
+            << std::endl << std::left << std::setw(12) << L"Script" << std::right << std::setw(12) << L"Encoded" << std::setw(12) << L"Iterations"
+            << std::setw(14) << L"Encode MB/s" << std::setw(14) << L"Decode MB/s" << std::setw(26) << L"CryptBinaryToString MB/s" << std::endl;
+
+    // Malformed payloads are reported at the character that's out of place, as -pb64 reports them
+    bool bOk = true;
+    static const struct { const wchar_t* szText; size_t ixError; } Malformed[] = {
+        { L"T=E=", 1 }, { L"AAAAT=E=", 5 }, { L"T===", 1 }, { L"AB=C", 2 }, { L"AAA*", 3 }, { L"AB==AAAA", 2 } };
+    for (const auto& malformed : Malformed)
+    {
+        std::vector<uint8_t> decoded;
+        size_t ixError = 0;
+        if (Base64Decode(malformed.szText, wcslen(malformed.szText), decoded, ixError) || malformed.ixError != ixError)
+        {
+            std::wcerr << L"\"" << malformed.szText << L"\" was not reported as malformed at character " << malformed.ixError << std::endl;
+            bOk = false;
+        }
+    }
+
+    for (const size_t cbScript : ScriptSizes)
+    {
+        const uint64_t nIterations = (options.ullCodecBytes + cbScript - 1) / cbScript;
+        const double dMB = double(cbScript) * double(nIterations) / (1024.0 * 1024.0);
+        std::wstring sEncoded;
+        std::vector<uint8_t> decoded;
+
+        // As UtilityFunctions' Base64Encode does, into a new string each time
+        uint64_t ullStart = MonotonicMicroseconds();
+        for (uint64_t n = 0; n < nIterations; ++n)
+        {
+            std::wstring sOutput;
+            Base64Encode(script.data(), cbScript, sOutput);
+            if (0 == n)
+                sEncoded.swap(sOutput);
+        }
+        const uint64_t ullEncodeTime = MonotonicMicroseconds() - ullStart;
+
+        ullStart = MonotonicMicroseconds();
+        size_t ixError = 0;
+        for (uint64_t n = 0; n < nIterations; ++n)
+            Base64Decode(sEncoded.c_str(), sEncoded.length(), decoded, ixError);
+        const uint64_t ullDecodeTime = MonotonicMicroseconds() - ullStart;
+        if (decoded.size() != cbScript || 0 != memcmp(decoded.data(), script.data(), cbScript))
+        {
+            std::wcerr << L"The encoding of the " << cbScript << L"-byte script did not decode to its original content" << std::endl;
+            bOk = false;
+        }
+
+        uint64_t ullCryptTime = 0;
+#ifdef _WIN32
+        ullStart = MonotonicMicroseconds();
+        for (uint64_t n = 0; n < nIterations; ++n)
+        {
+            std::wstring sOutput;
+            CryptBase64Encode(script.data(), cbScript, sOutput);
+            if (0 == n && sOutput != sEncoded)
+            {
+                std::wcerr << L"The encoding of the " << cbScript << L"-byte script differs from CryptBinaryToStringW's" << std::endl;
+                bOk = false;
+            }
+        }
+        ullCryptTime = MonotonicMicroseconds() - ullStart;
+#endif
+
+        const double dEncodeMBps = (ullEncodeTime > 0) ? dMB * 1000000.0 / double(ullEncodeTime) : 0.0;
+        const double dDecodeMBps = (ullDecodeTime > 0) ? dMB * 1000000.0 / double(ullDecodeTime) : 0.0;
+        const double dCryptMBps = (ullCryptTime > 0) ? dMB * 1000000.0 / double(ullCryptTime) : 0.0;
+        if (options.bCsv)
+            os << cbScript << L"," << sEncoded.length() << L"," << nIterations << L"," << dEncodeMBps << L"," << dDecodeMBps << L"," << dCryptMBps << std::endl;
+        else
+        {
+            os << std::left << std::setw(12) << cbScript << std::right << std::setw(12) << sEncoded.length() << std::setw(12) << nIterations
+                << std::fixed << std::setprecision(1) << std::setw(14) << dEncodeMBps << std::setw(14) << dDecodeMBps;
+            if (ullCryptTime > 0)
+                os << std::setw(26) << dCryptMBps << std::endl;
+            else
+                os << std::setw(26) << L"n/a" << std::endl;
+        }
+    }
+    return bOk;
+}
+
+/// <summary>
+/// Measures redaction of single long lines (up to RedactMaxLine, the longest held back), with patterns that make a
+/// backtracking or rescanning matcher slow: a repeat that runs through most of the line and then fails. Redaction
+/// runs on the thread reading the target's pipe, so it has to keep well ahead of it.
+/// </summary>
+/// <returns>false if a rule couldn't be compiled</returns>
+static bool RedactLinesBenchmark(std::wostream& os, const BenchOptions_t& options)
+{
+    static const size_t LineSizes[] = { 4 * 1024, 16 * 1024, RedactMaxLine };
+    static const char* const Rules[] = { "pattern=[a-z]+X", "pattern=\\w+=\\d{6}", "pattern=AKIA[0-9A-Z]{16}", "prefix=password=", "entropy" };
+    // Lower-case letters with a space now and then: long runs for [a-z]+ and \w+, and no secrets to find
+    std::mt19937 rng(12345);
+    std::string sLine(RedactMaxLine, 'a');
+    for (char& ch : sLine)
+        ch = (0 == rng() % 512) ? ' ' : char('a' + rng() % 26);
+
+    if (options.bCsv)
+        os << L"rule,lineBytes,iterations,MBps" << std::endl;
+    else
+        os << L"Redacting single long lines" << std::endl
+            << std::endl << std::left << std::setw(28) << L"Rule" << std::right << std::setw(12) << L"Line" << std::setw(12) << L"Iterations"
+            << std::setw(12) << L"MB/s" << std::endl;
+
+    bool bOk = true;
+    std::vector<uint8_t> line;
+    for (const char* szRule : Rules)
+    {
+        RedactionRules_t redaction;
+        std::wstring sError;
+        if (!redaction.Add(szRule, sError))
+        {
+            std::wcerr << L"Cannot compile " << szRule << L": " << sError << std::endl;
+            bOk = false;
+            continue;
+        }
+        for (const size_t cbLine : LineSizes)
+        {
+            // About 64 MB of lines at each size
+            const uint64_t nIterations = (64 * 1024 * 1024 + cbLine - 1) / cbLine;
+            uint64_t ullTime = 0;
+            for (uint64_t n = 0; n < nIterations; ++n)
+            {
+                line.assign(sLine.begin(), sLine.begin() + cbLine);
+                const uint64_t ullStart = MonotonicMicroseconds();
+                redaction.Redact(line.data(), line.size());
+                ullTime += MonotonicMicroseconds() - ullStart;
+            }
+            const double dMB = double(cbLine) * double(nIterations) / (1024.0 * 1024.0);
+            const double dMBps = (ullTime > 0) ? dMB * 1000000.0 / double(ullTime) : 0.0;
+            const std::wstring sRule(szRule, szRule + strlen(szRule));
+            if (options.bCsv)
+                os << L"\"" << sRule << L"\"," << cbLine << L"," << nIterations << L"," << dMBps << std::endl;
+            else
+                os << std::left << std::setw(28) << sRule << std::right << std::setw(12) << cbLine << std::setw(12) << nIterations
+                    << std::fixed << std::setprecision(1) << std::setw(12) << dMBps << std::endl;
+        }
+    }
+    return bOk;
+}
+
+/// <summary>
+/// Variables like those of a user's environment block, in layers as TargetEnvironment reads them: the machine's,
+/// the system's (Session Manager\Environment), the user's profile, the user's, and the user's volatile variables
+/// </summary>
+static void GenerateEnvLayers(std::vector<vecEnvVars_t>& vLayers)
+{
+    vLayers.assign(5, vecEnvVars_t());
+    const std::wstring sProfile = L"C:\\Users\\someone.with.a.long.name";
+    vLayers[0] = {
+        { L"ALLUSERSPROFILE", L"C:\\ProgramData" }, { L"CommonProgramFiles", L"C:\\Program Files\\Common Files" },
+        { L"CommonProgramFiles(x86)", L"C:\\Program Files (x86)\\Common Files" }, { L"CommonProgramW6432", L"C:\\Program Files\\Common Files" },
+        { L"COMPUTERNAME", L"RDSHOST042" }, { L"ProgramData", L"C:\\ProgramData" }, { L"ProgramFiles", L"C:\\Program Files" },
+        { L"ProgramFiles(x86)", L"C:\\Program Files (x86)" }, { L"ProgramW6432", L"C:\\Program Files" }, { L"PUBLIC", L"C:\\Users\\Public" },
+        { L"SystemDrive", L"C:" }, { L"SystemRoot", L"C:\\Windows" } };
+    vLayers[1] = {
+        { L"ComSpec", L"C:\\Windows\\system32\\cmd.exe" }, { L"DriverData", L"C:\\Windows\\System32\\Drivers\\DriverData" },
+        { L"NUMBER_OF_PROCESSORS", L"64" }, { L"OS", L"Windows_NT" },
+        { L"Path", L"C:\\Windows\\system32;C:\\Windows;C:\\Windows\\System32\\Wbem;C:\\Windows\\System32\\WindowsPowerShell\\v1.0\\;"
+            L"C:\\Windows\\System32\\OpenSSH\\;C:\\Program Files\\dotnet\\;C:\\Program Files\\Git\\cmd;C:\\Program Files\\PowerShell\\7\\;"
+            L"C:\\Program Files (x86)\\Microsoft SQL Server\\160\\Tools\\Binn\\;C:\\Program Files\\Microsoft SQL Server\\Client SDK\\ODBC\\170\\Tools\\Binn\\" },
+        { L"PATHEXT", L".COM;.EXE;.BAT;.CMD;.VBS;.VBE;.JS;.JSE;.WSF;.WSH;.MSC" }, { L"PROCESSOR_ARCHITECTURE", L"AMD64" },
+        { L"PROCESSOR_IDENTIFIER", L"Intel64 Family 6 Model 106 Stepping 6, GenuineIntel" }, { L"PROCESSOR_LEVEL", L"6" },
+        { L"PROCESSOR_REVISION", L"6a06" }, { L"PSModulePath", L"C:\\Program Files\\WindowsPowerShell\\Modules;C:\\Windows\\system32\\WindowsPowerShell\\v1.0\\Modules" },
+        { L"TEMP", L"C:\\Windows\\TEMP" }, { L"TMP", L"C:\\Windows\\TEMP" }, { L"USERNAME", L"SYSTEM" }, { L"windir", L"C:\\Windows" } };
+    vLayers[2] = { { L"USERPROFILE", sProfile } };
+    vLayers[3] = {
+        { L"OneDrive", sProfile + L"\\OneDrive" }, { L"Path", sProfile + L"\\AppData\\Local\\Microsoft\\WindowsApps;" },
+        { L"TEMP", sProfile + L"\\AppData\\Local\\Temp" }, { L"TMP", sProfile + L"\\AppData\\Local\\Temp" } };
+    vLayers[4] = {
+        { L"APPDATA", sProfile + L"\\AppData\\Roaming" }, { L"HOMEDRIVE", L"C:" }, { L"HOMEPATH", L"\\Users\\someone.with.a.long.name" },
+        { L"LOCALAPPDATA", sProfile + L"\\AppData\\Local" }, { L"LOGONSERVER", L"\\\\DC01" }, { L"USERDOMAIN", L"CONTOSO" },
+        { L"USERDOMAIN_ROAMINGPROFILE", L"CONTOSO" }, { L"USERNAME", L"someone.with.a.long.name" } };
+    for (vecEnvVars_t& layer : vLayers)
+        SortEnvVars(layer);
+}
+
+/// <summary>
+/// Time a way of building an environment block, returning the median and 99th percentile in microseconds
+/// </summary>
+template <typename Build_t>
+static bool TimeEnvBlocks(uint64_t nBlocks, Build_t build, uint64_t& ullP50, uint64_t& ullP99)
+{
+    std::vector<uint64_t> vTimes;
+    vTimes.reserve(size_t(nBlocks));
+    for (uint64_t n = 0; n < nBlocks; ++n)
+    {
+        const uint64_t ullStart = MonotonicMicroseconds();
+        if (!build())
+            return false;
+        vTimes.push_back(MonotonicMicroseconds() - ullStart);
+    }
+    ullP50 = Percentile(vTimes, 50.0);
+    ullP99 = Percentile(vTimes, 99.0);
+    return true;
+}
+
+/// <summary>
+/// Measures building environment blocks: merging a typical user's layers of variables with -env overlays, as
+/// RunAsUsers.exe -envBlock cached does after its first block for a user; and on Windows, for this process' own token,
+/// CreateEnvironmentBlock (-envBlock system, the baseline) and TargetEnvironment with cached variables, checking that
+/// they build the same block.
+/// </summary>
+/// <returns>false if a block couldn't be built, or (on Windows) the cached block differed from CreateEnvironmentBlock's</returns>
+static bool EnvBlockBenchmark(std::wostream& os, const BenchOptions_t& options)
+{
+    const uint64_t MergeBlocks = 100000;
+    std::vector<vecEnvVars_t> vLayers;
+    GenerateEnvLayers(vLayers);
+    vecEnvVars_t overlays = { { L"Path", L"C:\\Tools;%Path%" }, { L"RUNASUSERS_JOB", L"inventory" }, { L"OneDrive", L"" } };
+    SortEnvVars(overlays);
+    std::vector<EnvLayer_t> layers = {
+        { &vLayers[0], EnvMerge_t::Replace }, { &vLayers[1], EnvMerge_t::Replace }, { &vLayers[2], EnvMerge_t::Replace },
+        { &vLayers[3], EnvMerge_t::AppendPathLists }, { &vLayers[4], EnvMerge_t::Replace }, { &overlays, EnvMerge_t::Overlay } };
+
+    if (options.bCsv)
+        os << L"method,blocks,blockChars,p50us,p99us" << std::endl;
+    else
+        os << L"Building environment blocks" << std::endl
+            << std::endl << std::left << std::setw(36) << L"Method" << std::right << std::setw(10) << L"Blocks" << std::setw(10) << L"Chars"
+            << std::setw(10) << L"p50(us)" << std::setw(10) << L"p99(us)" << std::endl;
+    auto report = [&os, &options](const wchar_t* szMethod, uint64_t nBlocks, size_t cchBlock, uint64_t ullP50, uint64_t ullP99) {
+        if (options.bCsv)
+            os << szMethod << L"," << nBlocks << L"," << cchBlock << L"," << ullP50 << L"," << ullP99 << std::endl;
+        else
+            os << std::left << std::setw(36) << szMethod << std::right << std::setw(10) << nBlocks << std::setw(10) << cchBlock
+                << std::setw(10) << ullP50 << std::setw(10) << ullP99 << std::endl;
+    };
+
+    bool bOk = true;
+    std::vector<wchar_t> block;
+    uint64_t ullP50 = 0, ullP99 = 0;
+    TimeEnvBlocks(MergeBlocks, [&]() { MergeEnvLayers(layers, block); return true; }, ullP50, ullP99);
+    report(L"Merge layers and overlays", MergeBlocks, block.size(), ullP50, ullP99);
+
+#ifdef _WIN32
+    const uint64_t SystemBlocks = 1000;
+    HANDLE hToken = NULL;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY | TOKEN_DUPLICATE | TOKEN_IMPERSONATE, &hToken))
+    {
+        std::wcerr << L"Cannot open this process' token" << std::endl;
+        return false;
+    }
+    DWORD dwSessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &dwSessionId);
+    std::vector<std::wstring> vDifferences;
+    DWORD dwError = 0;
+    const vecEnvVars_t noOverlays;
+    const EnvSource_t Sources[] = { EnvSource_t::System, EnvSource_t::Cached };
+    for (const EnvSource_t source : Sources)
+    {
+        TargetEnvironment_t environment;
+        environment.Init(source, noOverlays);
+        if (!TimeEnvBlocks(SystemBlocks, [&]() { return environment.Build(hToken, dwSessionId, block, vDifferences, dwError); }, ullP50, ullP99))
+        {
+            std::wcerr << L"Cannot build an environment block (" << environment.Describe() << L"): error " << dwError << std::endl;
+            bOk = false;
+            continue;
+        }
+        report((EnvSource_t::System == source) ? L"CreateEnvironmentBlock" : L"Cached variables", SystemBlocks, block.size(), ullP50, ullP99);
+        if (0 != environment.Fallbacks())
+            std::wcerr << L"Cached variables couldn't be read; those blocks came from CreateEnvironmentBlock" << std::endl;
+    }
+
+    // Check that they build the same block
+    TargetEnvironment_t verify;
+    verify.Init(EnvSource_t::Verify, noOverlays);
+    if (!verify.Build(hToken, dwSessionId, block, vDifferences, dwError) || 0 != verify.Fallbacks() || !vDifferences.empty())
+    {
+        std::wcerr << L"The block built from cached variables differs from CreateEnvironmentBlock's:" << std::endl;
+        for (const std::wstring& sDifference : vDifferences)
+            std::wcerr << L"  " << sDifference << std::endl;
+        bOk = false;
+    }
+    CloseHandle(hToken);
+#endif
+    return bOk;
+}
+
+/// <summary>
+/// Write command-line syntax and exit
+/// </summary>
+static void Usage(const char* szExe)
+{
+    std::wcerr
+        << std::endl
+        << L"Usage:" << std::endl
+        << std::endl
+        << L"    " << szExe << L" [options]" << std::endl
+        << std::endl
+        << L"  -sessions n       : number of fake sessions (default 64)" << std::endl
+        << L"  -disconnected pct : percentage of sessions that are disconnected (default 25)" << std::endl
+        << L"  -other pct        : percentage of sessions that are neither active nor disconnected (default 10)" << std::endl
+        << L"  -s which          : sessions to launch in: first, active, all, or a session ID (default all)" << std::endl
+        << L"  -rate n           : bytes per second each child writes; 0 for as fast as possible (default 1048576)" << std::endl
+        << L"  -chunk n          : bytes per write (default 4096)" << std::endl
+        << L"  -lifetime n       : milliseconds each child runs (default 500)" << std::endl
+        << L"  -timeout n        : milliseconds after which children are terminated (default none)" << std::endl
+        << L"  -merge            : merge stderr into stdout" << std::endl
+        << L"  -out directory    : write redirected output to files in directory (default: discard)" << std::endl
+        << L"  -iterations n     : number of times to repeat the run (default 1)" << std::endl
+        << L"  -csv              : write the summary as CSV, for tracking over time" << std::endl
+        << L"  -processes        : run children as real processes (requires -rate > 0; each writes rate x lifetime bytes)" << std::endl
+        << L"  -soak n           : leak test: run n iterations, failing if handles, threads, heap, or open log files grow" << std::endl
+        << L"  -heapslack n      : with -soak, heap growth in bytes to tolerate (default 65536)" << std::endl
+        << L"  -compress level   : compress redirected output (level 1-9) on its way to the destination" << std::endl
+        << L"  -dedup            : store redirected output once per distinct chunk, with a manifest per destination (with -compress, compressed chunks)" << std::endl
+        << L"  -quota n          : keep at most n bytes of each redirected stream" << std::endl
+        << L"  -quotakeep which  : with -quota, the part to keep: head, tail, or both (default both)" << std::endl
+        << L"  -totalquota n     : keep at most n bytes of redirected output per iteration" << std::endl
+        << L"  -match action=text: look for text in redirected output; action is count, tag, or term (terminate the child)" << std::endl
+        << L"  -redact rule      : mask secrets in redirected output; rule is prefix=text, pattern=expr, or entropy[=n], as in RunAsUsers.exe" << std::endl
+        << L"  -timeindex        : record when output arrives in a time index per destination, as RunAsUsers.exe -timeIndex does" << std::endl
+        << L"  -lineindex n      : record where every nth line starts in a line index per destination, as RunAsUsers.exe -lineIndex does" << std::endl
+        << L"  -script n         : each child first reads an n-byte generated script from its stdin, as with RunAsUsers.exe -pf or -stdin (not with -processes)" << std::endl
+        << L"  -integrity which  : hash what's stored (fast: XXH64; sha256: XXH64 and SHA-256); with -out, write an integrity manifest per iteration" << std::endl
+        << L"  -codec            : instead of the pipeline, measure compression of generated script output at each level" << std::endl
+        << L"  -codecbytes n     : with -codec, bytes of text to compress; with -base64, bytes to encode at each size (default 67108864)" << std::endl
+        << L"  -base64           : instead of the pipeline, measure the Base64 codec (RunAsUsers.exe -pe and -pb64) on 1 KB to 1 MB scripts" << std::endl
+        << L"  -envblock         : instead of the pipeline, measure building environment blocks (RunAsUsers.exe -envBlock and -env)" << std::endl
+        << L"  -redactlines      : instead of the pipeline, measure redaction (RunAsUsers.exe -redact) of single lines of 4 KB to 64 KB" << std::endl
+        << std::endl;
+    exit(-1);
+}
+
+/// <summary>
+/// Parse a non-negative integer command-line value
+/// </summary>
+static bool ParseNumber(const char* szValue, uint64_t& ullValue)
+{
+    char* pEnd = nullptr;
+    ullValue = strtoull(szValue, &pEnd, 10);
+    return pEnd != szValue && '\0' == *pEnd;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && 0 == strcmp(szChildModeOption, argv[1]))
+        return RunAsChildProcess(argc, argv);
+
+#ifndef _WIN32
+    // Writing to a pipe whose reader has gone (a script to a child that failed to start) fails, as on Windows,
+    // rather than ending the benchmark
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    BenchOptions_t options;
+    const std::string sSelf = argv[0];
+    options.sSelf.assign(sSelf.begin(), sSelf.end());
+    for (int ixArg = 1; ixArg < argc; ++ixArg)
+    {
+        const std::string sArg = argv[ixArg];
+        const bool bHasValue = (ixArg + 1 < argc);
+        uint64_t ullValue = 0;
+        if ("-merge" == sArg)
+            options.bMerge = true;
+        else if ("-processes" == sArg)
+            options.bProcesses = true;
+        else if ("-csv" == sArg)
+            options.bCsv = true;
+        else if ("-codec" == sArg)
+            options.bCodec = true;
+        else if ("-base64" == sArg)
+            options.bBase64 = true;
+        else if ("-envblock" == sArg)
+            options.bEnvBlock = true;
+        else if ("-redactlines" == sArg)
+            options.bRedactLines = true;
+        else if ("-dedup" == sArg)
+            options.bDedup = true;
+        else if ("-timeindex" == sArg)
+            options.bTimeIndex = true;
+        else if (!bHasValue)
+            Usage(argv[0]);
+        else if ("-out" == sArg)
+        {
+            const std::string sDir = argv[++ixArg];
+            options.sOutDirectory.assign(sDir.begin(), sDir.end());
+        }
+        else if ("-quotakeep" == sArg)
+        {
+            const std::string sWhich = argv[++ixArg];
+            if ("head" == sWhich)
+                options.quotaPolicy = QuotaPolicy_t::Head;
+            else if ("tail" == sWhich)
+                options.quotaPolicy = QuotaPolicy_t::Tail;
+            else if ("both" == sWhich)
+                options.quotaPolicy = QuotaPolicy_t::HeadTail;
+            else
+                Usage(argv[0]);
+        }
+        else if ("-lineindex" == sArg)
+        {
+            if (!ParseNumber(argv[++ixArg], ullValue) || 0 == ullValue || ullValue > LineIndexMaxInterval)
+                Usage(argv[0]);
+            options.nLineIndexInterval = uint32_t(ullValue);
+        }
+        else if ("-integrity" == sArg)
+        {
+            const std::string sWhich = argv[++ixArg];
+            if ("fast" == sWhich)
+                options.integrityHash = IntegrityHash_t::Fast;
+            else if ("sha256" == sWhich)
+                options.integrityHash = IntegrityHash_t::Sha256;
+            else
+                Usage(argv[0]);
+        }
+        else if ("-match" == sArg)
+        {
+            // action=text, as in RunAsUsers.exe
+            const std::string sMatch = argv[++ixArg];
+            const size_t ixEquals = sMatch.find('=');
+            const std::string sAction = sMatch.substr(0, ixEquals);
+            const std::string sText = (std::string::npos == ixEquals) ? std::string() : sMatch.substr(ixEquals + 1);
+            MatchAction_t action = MatchAction_t::Count;
+            if ("tag" == sAction)
+                action = MatchAction_t::Tag;
+            else if ("term" == sAction)
+                action = MatchAction_t::Terminate;
+            else if ("count" != sAction)
+                Usage(argv[0]);
+            if (!options.patterns.Add(std::wstring(sText.begin(), sText.end()), sText, action))
+                Usage(argv[0]);
+        }
+        else if ("-redact" == sArg)
+        {
+            // prefix=text, pattern=expr, or entropy[=n], as in RunAsUsers.exe; validated by compiling it once
+            const std::string sRule = argv[++ixArg];
+            RedactionRules_t redaction;
+            std::wstring sError;
+            if (!redaction.Add(sRule, sError))
+                Usage(argv[0]);
+            options.vRedactionRules.push_back(sRule);
+        }
+        else if ("-s" == sArg)
+        {
+            const std::string sWhich = argv[++ixArg];
+            if ("first" == sWhich)
+                options.whichSessions = WhichSessions_t::firstActive;
+            else if ("active" == sWhich)
+                options.whichSessions = WhichSessions_t::allActive;
+            else if ("all" == sWhich)
+                options.whichSessions = WhichSessions_t::allLoggedOn;
+            else if (ParseNumber(sWhich.c_str(), ullValue))
+            {
+                options.whichSessions = WhichSessions_t::oneSessionId;
+                options.nSessionId = uint32_t(ullValue);
+            }
+            else
+                Usage(argv[0]);
+        }
+        else if (!ParseNumber(argv[++ixArg], ullValue))
+            Usage(argv[0]);
+        else if ("-sessions" == sArg)
+            options.nSessions = uint32_t(ullValue);
+        else if ("-disconnected" == sArg && ullValue <= 100)
+            options.nDisconnectedPct = uint32_t(ullValue);
+        else if ("-other" == sArg && ullValue <= 100)
+            options.nOtherPct = uint32_t(ullValue);
+        else if ("-rate" == sArg)
+            options.ullRate = ullValue;
+        else if ("-chunk" == sArg && ullValue > 0)
+            options.ullChunk = ullValue;
+        else if ("-lifetime" == sArg)
+            options.ullLifetimeMs = ullValue;
+        else if ("-timeout" == sArg)
+            options.ullTimeoutMs = ullValue;
+        else if ("-iterations" == sArg && ullValue > 0)
+            options.nIterations = uint32_t(ullValue);
+        else if ("-soak" == sArg && ullValue > 0)
+        {
+            options.bSoak = true;
+            options.nIterations = uint32_t(ullValue);
+        }
+        else if ("-heapslack" == sArg)
+            options.ullHeapSlack = ullValue;
+        else if ("-compress" == sArg && ullValue >= uint64_t(LzMinLevel) && ullValue <= uint64_t(LzMaxLevel))
+            options.nCompressLevel = int(ullValue);
+        else if ("-quota" == sArg && ullValue > 0)
+            options.ullQuota = ullValue;
+        else if ("-totalquota" == sArg && ullValue > 0)
+            options.ullTotalQuota = ullValue;
+        else if ("-script" == sArg && ullValue > 0)
+            options.ullScriptBytes = ullValue;
+        else if ("-codecbytes" == sArg && ullValue > 0)
+            options.ullCodecBytes = ullValue;
+        else
+            Usage(argv[0]);
+    }
+    if (options.nDisconnectedPct + options.nOtherPct > 100 || (options.bProcesses && 0 == options.ullRate) || (options.bProcesses && 0 != options.ullScriptBytes))
+        Usage(argv[0]);
+
+    options.patterns.Build();
+    if (0 != options.ullScriptBytes)
+        options.sScript = GenerateScriptOutput(options.ullScriptBytes);
+
+    if (options.bCodec)
+        return CodecBenchmark(std::wcout, options) ? 0 : 1;
+    if (options.bBase64)
+        return Base64Benchmark(std::wcout, options) ? 0 : 1;
+    if (options.bEnvBlock)
+        return EnvBlockBenchmark(std::wcout, options) ? 0 : 1;
+    if (options.bRedactLines)
+        return RedactLinesBenchmark(std::wcout, options) ? 0 : 1;
+    if (options.bSoak)
+        return Soak(options) ? 0 : 1;
+
+    BenchResults_t results;
+    PlatformGetProcessCounters(results.baseline);
+
+    BenchSampler_t sampler;
+    uint32_t dwError = 0;
+    if (!PlatformStartThread(sampler.thread, BenchSampler_t::ThreadProc, &sampler, dwError))
+    {
+        std::wcerr << L"Cannot start sampler thread: " << PlatformErrorMessage(dwError) << std::endl;
+        return -2;
+    }
+
+    for (uint32_t nIteration = 0; nIteration < options.nIterations; ++nIteration)
+        RunIteration(options, nIteration, results);
+
+    sampler.bStop = true;
+    PlatformJoinThread(sampler.thread);
+    results.peak = sampler.peak;
+
+    Report(std::wcout, options, results);
+
+    // Nonzero exit code if anything went wrong, for CI
+    const bool bAllCopied = (results.ullBytesWritten == results.ullBytesPumped);
+    if (!bAllCopied)
+        std::wcerr << L"Redirected output is incomplete: " << results.ullBytesWritten << L" bytes written, " << results.ullBytesPumped << L" bytes redirected" << std::endl;
+    return (bAllCopied && 0 == results.nLaunchFailures) ? 0 : 1;
+}
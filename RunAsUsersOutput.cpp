@@ -0,0 +1,931 @@
+// Reads the output files that RunAsUsers -redirStd creates, including compressed captures (-compress) and
+// deduplicated captures (-dedup).
+//
+//   RunAsUsersOutput cat [-offset n] [-length n] file...
+//   RunAsUsersOutput decompress file [outfile]
+//   RunAsUsersOutput reconstruct manifest [outfile]
+//   RunAsUsersOutput info file...
+//   RunAsUsersOutput merge [-relative] file...
+//   RunAsUsersOutput lines [-verify] file first[-[last]]
+//   RunAsUsersOutput tail [-n count] [-verify] file
+//
+// Builds on Windows and on Linux (see CMakeLists.txt), so captures can be examined wherever they're collected.
+// Run with -? for the command-line syntax.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "RedirCompress.h"
+#include "RedirDedup.h"
+#include "RedirLineIndex.h"
+#include "RedirTimeIndex.h"
+
+/// <summary>
+/// Write command-line syntax and exit
+/// </summary>
+static void Usage(const char* szExe)
+{
+    std::wcerr
+        << std::endl
+        << L"Usage:" << std::endl
+        << std::endl
+        << L"    " << szExe << L" cat [-offset n] [-length n] file..." << std::endl
+        << L"      Write the files' original content to stdout, decompressing compressed captures and reassembling" << std::endl
+        << L"      deduplicated ones from their chunk stores." << std::endl
+        << L"      -offset and -length select a byte range of the original content; with a compressed or deduplicated" << std::endl
+        << L"      capture, only the blocks or chunks containing that range are read." << std::endl
+        << std::endl
+        << L"    " << szExe << L" decompress file [outfile]" << std::endl
+        << L"      Decompress a compressed capture to outfile (default: the file name without " << szCompressedCaptureExtension << L")." << std::endl
+        << std::endl
+        << L"    " << szExe << L" reconstruct manifest [outfile]" << std::endl
+        << L"      Reassemble a deduplicated capture from its chunk store, verifying each chunk's SHA-256 digest," << std::endl
+        << L"      to outfile (default: the manifest's name without " << szDedupManifestExtension << L")." << std::endl
+        << std::endl
+        << L"    " << szExe << L" info file..." << std::endl
+        << L"      Report the original and compressed sizes, block count, and compression level of compressed captures;" << std::endl
+        << L"      the original size, chunk count, and chunk store of manifests; and the contents of chunk stores." << std::endl
+        << std::endl
+        << L"    " << szExe << L" merge [-relative] file..." << std::endl
+        << L"      Write the files' lines to stdout in the order they arrived, each prefixed with its arrival time and the" << std::endl
+        << L"      file's name, using the time indexes that RunAsUsers -timeIndex writes next to them (file" << szTimeIndexExtension << L")." << std::endl
+        << L"      -relative shows times as seconds since the earliest output instead of as UTC date and time." << std::endl
+        << std::endl
+        << L"    " << szExe << L" lines [-verify] file first[-[last]]" << std::endl
+        << L"      Write lines first through last (numbered from 1; last defaults to first, and first- means through the end)" << std::endl
+        << L"      of a file's original content, starting at the nearest checkpoint in the line index that RunAsUsers" << std::endl
+        << L"      -lineIndex writes next to it (file" << szLineIndexExtension << L"), so that the content before it isn't read." << std::endl
+        << L"      -verify checks the blocks that were read against the index's checksums." << std::endl
+        << std::endl
+        << L"    " << szExe << L" tail [-n count] [-verify] file" << std::endl
+        << L"      Write the last count lines (default 10) of a file's original content, using its line index." << std::endl
+        << std::endl;
+    exit(-1);
+}
+
+/// <summary>
+/// Parse a non-negative integer command-line value
+/// </summary>
+static bool ParseNumber(const char* szValue, uint64_t& ullValue)
+{
+    char* pEnd = nullptr;
+    ullValue = strtoull(szValue, &pEnd, 10);
+    return pEnd != szValue && '\0' == *pEnd;
+}
+
+static std::wstring ToWString(const char* sz)
+{
+    const std::string s = sz;
+    return std::wstring(s.begin(), s.end());
+}
+
+/// <summary>
+/// Writes all of a buffer to a file
+/// </summary>
+static bool WriteAll(PlatformFile_t hOut, const uint8_t* pData, size_t cbData, uint32_t& dwError)
+{
+    size_t cbWritten = 0;
+    return PlatformWrite(hOut, pData, cbData, cbWritten, dwError) && cbWritten == cbData;
+}
+
+/// <summary>
+/// Copies a byte range of a compressed capture's original content to hOut, reading only the blocks it spans
+/// </summary>
+static bool CatCompressed(const std::wstring& sPath, uint64_t ullOffset, uint64_t ullLength, PlatformFile_t hOut)
+{
+    CompressedCaptureReader_t reader;
+    uint32_t dwError = 0;
+    if (!reader.Open(sPath, dwError))
+    {
+        std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+        return false;
+    }
+    if (!reader.Complete())
+        std::wcerr << L"Warning: " << sPath << L" is incomplete; reading its " << reader.BlockCount() << L" complete blocks" << std::endl;
+
+    const uint64_t ullSize = reader.OriginalSize();
+    const uint64_t ullEnd = (ullOffset >= ullSize || ullLength >= ullSize - ullOffset) ? ullSize : ullOffset + ullLength;
+    std::vector<uint8_t> block;
+    for (size_t ixBlock = reader.BlockForOffset(ullOffset); ixBlock < reader.BlockCount() && reader.BlockOffset(ixBlock) < ullEnd; ++ixBlock)
+    {
+        if (!reader.ReadBlock(ixBlock, block, dwError))
+        {
+            std::wcerr << L"Cannot read block " << ixBlock << L" of " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+            return false;
+        }
+        const uint64_t ullBlockStart = reader.BlockOffset(ixBlock);
+        const size_t ixFirst = (ullOffset > ullBlockStart) ? size_t(ullOffset - ullBlockStart) : 0;
+        const size_t ixLast = (ullEnd - ullBlockStart < block.size()) ? size_t(ullEnd - ullBlockStart) : block.size();
+        if (!WriteAll(hOut, block.data() + ixFirst, ixLast - ixFirst, dwError))
+        {
+            std::wcerr << L"Write error: " << PlatformErrorMessage(dwError) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// Copies a byte range of a deduplicated capture's original content to hOut, reading only the chunks it spans
+/// </summary>
+static bool CatManifest(const std::wstring& sPath, uint64_t ullOffset, uint64_t ullLength, PlatformFile_t hOut)
+{
+    DedupManifest_t manifest;
+    ChunkStoreReader_t store;
+    uint32_t dwError = 0;
+    if (!manifest.Read(sPath, dwError))
+    {
+        std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+        return false;
+    }
+    if (!store.Open(manifest.sStorePath, dwError))
+    {
+        std::wcerr << L"Cannot read chunk store " << manifest.sStorePath << L": " << PlatformErrorMessage(dwError) << std::endl;
+        return false;
+    }
+    if (!manifest.bComplete)
+        std::wcerr << L"Warning: " << sPath << L" is incomplete; reading its " << manifest.vEntries.size() << L" complete chunks" << std::endl;
+
+    const uint64_t ullSize = manifest.ullOriginalSize;
+    const uint64_t ullEnd = (ullOffset >= ullSize || ullLength >= ullSize - ullOffset) ? ullSize : ullOffset + ullLength;
+    std::vector<uint8_t> chunk;
+    uint64_t ullChunkStart = 0;
+    for (size_t ixChunk = 0; ixChunk < manifest.vEntries.size() && ullChunkStart < ullEnd; ullChunkStart += manifest.vEntries[ixChunk++].cbChunk)
+    {
+        const DedupManifest_t::Entry_t& entry = manifest.vEntries[ixChunk];
+        if (ullChunkStart + entry.cbChunk <= ullOffset)
+            continue;
+        if (!store.ReadChunk(entry.ullRecordOffset, chunk, dwError) || chunk.size() != entry.cbChunk)
+        {
+            std::wcerr << L"Cannot read chunk " << ixChunk << L" of " << sPath << L" from " << manifest.sStorePath << L": "
+                << PlatformErrorMessage((0 != dwError) ? dwError : PlatformErrorInvalidData) << std::endl;
+            return false;
+        }
+        const size_t ixFirst = (ullOffset > ullChunkStart) ? size_t(ullOffset - ullChunkStart) : 0;
+        const size_t ixLast = (ullEnd - ullChunkStart < chunk.size()) ? size_t(ullEnd - ullChunkStart) : chunk.size();
+        if (!WriteAll(hOut, chunk.data() + ixFirst, ixLast - ixFirst, dwError))
+        {
+            std::wcerr << L"Write error: " << PlatformErrorMessage(dwError) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// Copies a byte range of an uncompressed file to hOut
+/// </summary>
+static bool CatPlain(const std::wstring& sPath, uint64_t ullOffset, uint64_t ullLength, PlatformFile_t hOut)
+{
+    uint32_t dwError = 0;
+    PlatformFile_t hIn = PlatformOpenFile(sPath, dwError);
+    if (PlatformInvalidFile == hIn || !PlatformSetFilePosition(hIn, ullOffset, dwError))
+    {
+        std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+        PlatformClose(hIn);
+        return false;
+    }
+    std::vector<uint8_t> buffer(RedirPumpBufferSize);
+    bool bOk = true;
+    while (bOk && ullLength > 0)
+    {
+        size_t cbRead = 0;
+        const size_t cbToRead = (ullLength < buffer.size()) ? size_t(ullLength) : buffer.size();
+        const PlatformIoResult_t result = PlatformRead(hIn, buffer.data(), cbToRead, cbRead, dwError);
+        if (PlatformIoResult_t::EndOfFile == result)
+            break;
+        if (PlatformIoResult_t::Success != result)
+        {
+            std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+            bOk = false;
+        }
+        else if (!WriteAll(hOut, buffer.data(), cbRead, dwError))
+        {
+            std::wcerr << L"Write error: " << PlatformErrorMessage(dwError) << std::endl;
+            bOk = false;
+        }
+        ullLength -= cbRead;
+    }
+    PlatformClose(hIn);
+    return bOk;
+}
+
+static bool Cat(const std::wstring& sPath, uint64_t ullOffset, uint64_t ullLength, PlatformFile_t hOut)
+{
+    if (CompressedCaptureReader_t::IsCompressedCapture(sPath))
+        return CatCompressed(sPath, ullOffset, ullLength, hOut);
+    if (DedupManifest_t::IsManifest(sPath))
+        return CatManifest(sPath, ullOffset, ullLength, hOut);
+    return CatPlain(sPath, ullOffset, ullLength, hOut);
+}
+
+static bool InfoManifest(const std::wstring& sPath)
+{
+    DedupManifest_t manifest;
+    uint32_t dwError = 0;
+    if (!manifest.Read(sPath, dwError))
+    {
+        std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+        return false;
+    }
+    std::wcout
+        << sPath << std::endl
+        << L"  Original size   : " << manifest.ullOriginalSize << L" bytes" << std::endl
+        << L"  Chunks          : " << manifest.vEntries.size() << (manifest.bComplete ? L"" : L" (incomplete capture)") << std::endl
+        << L"  Chunk store     : " << manifest.sStorePath << std::endl;
+    return true;
+}
+
+static bool InfoChunkStore(const std::wstring& sPath)
+{
+    ChunkStoreReader_t store;
+    uint32_t dwError = 0;
+    uint64_t nChunks = 0, ullChunkBytes = 0, ullStoredBytes = 0;
+    if (!store.Open(sPath, dwError) || !store.Count(nChunks, ullChunkBytes, ullStoredBytes, dwError))
+    {
+        std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+        return false;
+    }
+    std::wcout
+        << sPath << std::endl
+        << L"  Distinct chunks : " << nChunks << L", " << ullChunkBytes << L" bytes" << std::endl
+        << L"  Stored size     : " << ullStoredBytes << L" bytes" << std::endl
+        << L"  Level           : " << store.Level() << std::endl;
+    return true;
+}
+
+static bool Info(const std::wstring& sPath)
+{
+    if (DedupManifest_t::IsManifest(sPath))
+        return InfoManifest(sPath);
+    ChunkStoreReader_t store;
+    uint32_t dwError = 0;
+    if (store.Open(sPath, dwError))
+    {
+        store.Close();
+        return InfoChunkStore(sPath);
+    }
+
+    CompressedCaptureReader_t reader;
+    uint64_t ullFileSize = 0;
+    if (!PlatformGetFileSize(sPath, ullFileSize, dwError) || !reader.Open(sPath, dwError))
+    {
+        std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+        return false;
+    }
+    const double dRatio = (0 == ullFileSize) ? 0.0 : double(reader.OriginalSize()) / double(ullFileSize);
+    std::wcout
+        << sPath << std::endl
+        << L"  Original size   : " << reader.OriginalSize() << L" bytes" << std::endl
+        << L"  Compressed size : " << ullFileSize << L" bytes (ratio " << dRatio << L")" << std::endl
+        << L"  Blocks          : " << reader.BlockCount() << (reader.Complete() ? L"" : L" (incomplete capture)") << std::endl
+        << L"  Level           : " << reader.Level() << std::endl;
+    return true;
+}
+
+/// <summary>
+/// Reads a captured output file's original content a line at a time, and gives each line its arrival time from
+/// the file's time index
+/// </summary>
+class MergeSource_t
+{
+public:
+    /// <summary>
+    /// Opens the file and reads its time index
+    /// </summary>
+    bool Open(const std::wstring& sPath)
+    {
+        uint32_t dwError = 0;
+        const std::wstring sIndexPath = sPath + szTimeIndexExtension;
+        if (!m_index.Read(sIndexPath, dwError))
+        {
+            std::wcerr << L"Cannot read time index " << sIndexPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+            return false;
+        }
+        if (CompressedCaptureReader_t::IsCompressedCapture(sPath))
+        {
+            m_bCompressed = m_compressed.Open(sPath, dwError);
+            if (!m_bCompressed)
+            {
+                std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+        }
+        else if (DedupManifest_t::IsManifest(sPath))
+        {
+            m_bManifest = m_manifest.Read(sPath, dwError);
+            if (!m_bManifest || !m_store.Open(m_manifest.sStorePath, dwError))
+            {
+                std::wcerr << L"Cannot read " << (m_bManifest ? m_manifest.sStorePath : sPath) << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            m_hPlain = PlatformOpenFile(sPath, dwError);
+            if (PlatformInvalidFile == m_hPlain)
+            {
+                std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+        }
+        m_sPath = sPath;
+        // The label is the file name, without its directory or extensions
+        const size_t ixName = sPath.find_last_of(L"\\/");
+        const std::wstring sName = (std::wstring::npos == ixName) ? sPath : sPath.substr(ixName + 1);
+        m_sLabel.assign(sName.begin(), sName.begin() + std::min(sName.find(L'.'), sName.length()));
+        return true;
+    }
+
+    ~MergeSource_t() { PlatformClose(m_hPlain); }
+
+    /// <summary>
+    /// Reads the next line, including its line break if it has one
+    /// </summary>
+    /// <returns>true if there is a line; false at the end of the content or on error</returns>
+    bool NextLine()
+    {
+        // Bytes of the line already searched for a line break (ReadMore moves the line to the start of m_data)
+        size_t cbScanned = 0;
+        for (;;)
+        {
+            const size_t ixScan = m_ixLine + cbScanned;
+            const void* pBreak = (ixScan < m_data.size()) ? memchr(m_data.data() + ixScan, '\n', m_data.size() - ixScan) : nullptr;
+            if (nullptr != pBreak)
+            {
+                m_ixLineEnd = size_t((const uint8_t*)pBreak - m_data.data()) + 1;
+                break;
+            }
+            cbScanned = m_data.size() - m_ixLine;
+            if (!ReadMore())
+            {
+                m_ixLineEnd = m_data.size();
+                if (m_ixLineEnd == m_ixLine)
+                    return false;
+                break;
+            }
+        }
+        m_ullLineTime = m_index.TimeAt(m_ullDataOffset + m_ixLine);
+        return true;
+    }
+
+    /// <summary>
+    /// Moves past the current line
+    /// </summary>
+    void ConsumeLine() { m_ixLine = m_ixLineEnd; }
+
+    const uint8_t* Line() const { return m_data.data() + m_ixLine; }
+    size_t LineLength() const { return m_ixLineEnd - m_ixLine; }
+    uint64_t LineTime() const { return m_ullLineTime; }
+    const std::string& Label() const { return m_sLabel; }
+    uint64_t FirstTime() const { return m_index.vEntries.empty() ? m_index.ullBaseUnixMicroseconds : m_index.vEntries.front().ullUnixMicroseconds; }
+
+private:
+    /// <summary>
+    /// Appends the next block, chunk, or buffer of content to m_data, first dropping the lines already consumed
+    /// </summary>
+    bool ReadMore()
+    {
+        m_data.erase(m_data.begin(), m_data.begin() + m_ixLine);
+        m_ullDataOffset += m_ixLine;
+        m_ixLine = 0;
+
+        uint32_t dwError = 0;
+        if (m_bCompressed)
+        {
+            if (m_ixNext >= m_compressed.BlockCount())
+                return false;
+            if (!m_compressed.ReadBlock(m_ixNext++, m_piece, dwError))
+            {
+                std::wcerr << L"Cannot read block " << (m_ixNext - 1) << L" of " << m_sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+        }
+        else if (m_bManifest)
+        {
+            if (m_ixNext >= m_manifest.vEntries.size())
+                return false;
+            const DedupManifest_t::Entry_t& entry = m_manifest.vEntries[m_ixNext++];
+            if (!m_store.ReadChunk(entry.ullRecordOffset, m_piece, dwError) || m_piece.size() != entry.cbChunk)
+            {
+                std::wcerr << L"Cannot read chunk " << (m_ixNext - 1) << L" of " << m_sPath << L" from " << m_manifest.sStorePath << L": "
+                    << PlatformErrorMessage((0 != dwError) ? dwError : PlatformErrorInvalidData) << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            m_piece.resize(RedirPumpBufferSize);
+            size_t cbRead = 0;
+            const PlatformIoResult_t result = PlatformRead(m_hPlain, m_piece.data(), m_piece.size(), cbRead, dwError);
+            if (PlatformIoResult_t::Success != result)
+            {
+                if (PlatformIoResult_t::EndOfFile != result)
+                    std::wcerr << L"Cannot read " << m_sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+            m_piece.resize(cbRead);
+        }
+        m_data.insert(m_data.end(), m_piece.begin(), m_piece.end());
+        return true;
+    }
+
+private:
+    std::wstring m_sPath;
+    std::string m_sLabel;
+    TimeIndex_t m_index;
+    bool m_bCompressed = false, m_bManifest = false;
+    CompressedCaptureReader_t m_compressed;
+    DedupManifest_t m_manifest;
+    ChunkStoreReader_t m_store;
+    PlatformFile_t m_hPlain = PlatformInvalidFile;
+    // Next block or chunk to read
+    size_t m_ixNext = 0;
+    // Content read but not yet consumed, starting at m_ullDataOffset in the original content; the current line
+    // is m_data[m_ixLine] up to m_data[m_ixLineEnd]
+    std::vector<uint8_t> m_data, m_piece;
+    uint64_t m_ullDataOffset = 0;
+    size_t m_ixLine = 0, m_ixLineEnd = 0;
+    uint64_t m_ullLineTime = 0;
+};
+
+/// <summary>
+/// Writes the lines of several captured output files in the order they arrived
+/// </summary>
+static bool Merge(const std::vector<std::wstring>& vPaths, bool bRelative, PlatformFile_t hOut)
+{
+    std::vector<std::unique_ptr<MergeSource_t>> vSources;
+    bool bOk = true;
+    for (const std::wstring& sPath : vPaths)
+    {
+        std::unique_ptr<MergeSource_t> pSource(new MergeSource_t);
+        if (pSource->Open(sPath))
+            vSources.push_back(std::move(pSource));
+        else
+            bOk = false;
+    }
+
+    // Earliest line first; lines that arrived at the same time in the order of the files on the command line
+    typedef std::pair<uint64_t, size_t> Next_t;
+    std::priority_queue<Next_t, std::vector<Next_t>, std::greater<Next_t>> queue;
+    uint64_t ullStart = ~uint64_t(0);
+    for (size_t ix = 0; ix < vSources.size(); ++ix)
+    {
+        ullStart = std::min(ullStart, vSources[ix]->FirstTime());
+        if (vSources[ix]->NextLine())
+            queue.push(Next_t(vSources[ix]->LineTime(), ix));
+    }
+
+    std::string sOut;
+    uint32_t dwError = 0;
+    while (!queue.empty())
+    {
+        MergeSource_t& source = *vSources[queue.top().second];
+        const size_t ixSource = queue.top().second;
+        queue.pop();
+        std::wstringstream strTime;
+        if (bRelative)
+            strTime << L"+" << std::fixed << std::setprecision(6) << double(source.LineTime() - ullStart) / 1000000.0;
+        else
+            strTime << UnixMicrosecondsToString(source.LineTime());
+        const std::wstring sTime = strTime.str();
+        sOut.append(sTime.begin(), sTime.end());
+        sOut.append(" ").append(source.Label()).append(": ");
+        sOut.append((const char*)source.Line(), source.LineLength());
+        if (0 == source.LineLength() || '\n' != source.Line()[source.LineLength() - 1])
+            sOut.push_back('\n');
+        source.ConsumeLine();
+        if (source.NextLine())
+            queue.push(Next_t(source.LineTime(), ixSource));
+        if (sOut.length() >= RedirPumpBufferSize || queue.empty())
+        {
+            if (!WriteAll(hOut, (const uint8_t*)sOut.data(), sOut.length(), dwError))
+            {
+                std::wcerr << L"Write error: " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+            sOut.clear();
+        }
+    }
+    return bOk;
+}
+
+/// <summary>
+/// Random access to a captured output file's original content: memory-mapped for an uncompressed file, and a block
+/// or chunk at a time for a compressed or deduplicated capture
+/// </summary>
+class CaptureContent_t
+{
+public:
+    ~CaptureContent_t() { PlatformUnmapFile(m_mapped); }
+
+    bool Open(const std::wstring& sPath)
+    {
+        uint32_t dwError = 0;
+        m_sPath = sPath;
+        if (CompressedCaptureReader_t::IsCompressedCapture(sPath))
+        {
+            m_bCompressed = m_compressed.Open(sPath, dwError);
+            if (!m_bCompressed)
+            {
+                std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+            m_ullSize = m_compressed.OriginalSize();
+        }
+        else if (DedupManifest_t::IsManifest(sPath))
+        {
+            m_bManifest = m_manifest.Read(sPath, dwError);
+            if (!m_bManifest || !m_store.Open(m_manifest.sStorePath, dwError))
+            {
+                std::wcerr << L"Cannot read " << (m_bManifest ? m_manifest.sStorePath : sPath) << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+            m_vChunkStarts.push_back(0);
+            for (const DedupManifest_t::Entry_t& entry : m_manifest.vEntries)
+                m_vChunkStarts.push_back(m_vChunkStarts.back() + entry.cbChunk);
+            m_ullSize = m_manifest.ullOriginalSize;
+        }
+        else
+        {
+            if (!PlatformMapFile(sPath, m_mapped, dwError))
+            {
+                std::wcerr << L"Cannot read " << sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+                return false;
+            }
+            m_ullSize = m_mapped.cbData;
+        }
+        return true;
+    }
+
+    uint64_t Size() const { return m_ullSize; }
+
+    /// <summary>
+    /// Gets contiguous content starting at an offset: through the end of its block or chunk, or of the file
+    /// </summary>
+    /// <param name="ullOffset">Input: offset in the original content; less than Size()</param>
+    /// <param name="pData">Output: the content; valid until the next call</param>
+    /// <param name="cbData">Output: number of bytes; at least 1</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Get(uint64_t ullOffset, const uint8_t*& pData, size_t& cbData)
+    {
+        uint32_t dwError = 0;
+        if (m_bCompressed)
+        {
+            const size_t ixBlock = m_compressed.BlockForOffset(ullOffset);
+            if (ixBlock != m_ixCached && !m_compressed.ReadBlock(ixBlock, m_cached, dwError))
+            {
+                std::wcerr << L"Cannot read block " << ixBlock << L" of " << m_sPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+                m_ixCached = SIZE_MAX;
+                return false;
+            }
+            m_ixCached = ixBlock;
+            const size_t ixFirst = size_t(ullOffset - m_compressed.BlockOffset(ixBlock));
+            pData = m_cached.data() + ixFirst;
+            cbData = m_cached.size() - ixFirst;
+        }
+        else if (m_bManifest)
+        {
+            const size_t ixChunk = size_t(std::upper_bound(m_vChunkStarts.begin(), m_vChunkStarts.end(), ullOffset) - m_vChunkStarts.begin()) - 1;
+            const DedupManifest_t::Entry_t& entry = m_manifest.vEntries[ixChunk];
+            if (ixChunk != m_ixCached && (!m_store.ReadChunk(entry.ullRecordOffset, m_cached, dwError) || m_cached.size() != entry.cbChunk))
+            {
+                std::wcerr << L"Cannot read chunk " << ixChunk << L" of " << m_sPath << L" from " << m_manifest.sStorePath << L": "
+                    << PlatformErrorMessage((0 != dwError) ? dwError : PlatformErrorInvalidData) << std::endl;
+                m_ixCached = SIZE_MAX;
+                return false;
+            }
+            m_ixCached = ixChunk;
+            const size_t ixFirst = size_t(ullOffset - m_vChunkStarts[ixChunk]);
+            pData = m_cached.data() + ixFirst;
+            cbData = m_cached.size() - ixFirst;
+        }
+        else
+        {
+            pData = m_mapped.pData + ullOffset;
+            cbData = size_t(m_mapped.cbData - ullOffset);
+        }
+        return true;
+    }
+
+private:
+    std::wstring m_sPath;
+    uint64_t m_ullSize = 0;
+    bool m_bCompressed = false, m_bManifest = false;
+    CompressedCaptureReader_t m_compressed;
+    DedupManifest_t m_manifest;
+    ChunkStoreReader_t m_store;
+    // Offset at which each chunk of a deduplicated capture starts
+    std::vector<uint64_t> m_vChunkStarts;
+    PlatformMappedFile_t m_mapped;
+    // The block or chunk last read
+    size_t m_ixCached = SIZE_MAX;
+    std::vector<uint8_t> m_cached;
+};
+
+/// <summary>
+/// Reads a file's line index; without one, returns an index with only the start of the file, so that lines are found
+/// by reading from the start
+/// </summary>
+static void ReadLineIndex(const std::wstring& sPath, const CaptureContent_t& content, LineIndex_t& index)
+{
+    uint32_t dwError = 0;
+    const std::wstring sIndexPath = sPath + szLineIndexExtension;
+    if (!index.Read(sIndexPath, dwError))
+    {
+        std::wcerr << L"Warning: cannot read line index " << sIndexPath << L" (" << PlatformErrorMessage(dwError) << L"); reading " << sPath << L" from the start" << std::endl;
+        index = LineIndex_t();
+        index.nInterval = LineIndexDefaultInterval;
+        index.vCheckpoints.push_back(0);
+        return;
+    }
+    // Ignore what describes content the file doesn't have (e.g., an index left over from an earlier capture)
+    if (index.bComplete && index.ullSize != content.Size())
+        index.bComplete = false;
+    while (index.vCheckpoints.size() > 1 && index.vCheckpoints.back() > content.Size())
+        index.vCheckpoints.pop_back();
+}
+
+/// <summary>
+/// Finds where a line starts, reading forward from the nearest checkpoint before it
+/// </summary>
+/// <param name="ullLine">Input: line number, from 0</param>
+/// <param name="ullOffset">Output: where the line starts; the content's size if there's no such line</param>
+/// <returns>true if successful; false on a read error</returns>
+static bool FindLine(CaptureContent_t& content, const LineIndex_t& index, uint64_t ullLine, uint64_t& ullOffset)
+{
+    const size_t ixCheckpoint = size_t(std::min<uint64_t>(ullLine / index.nInterval, index.vCheckpoints.size() - 1));
+    uint64_t ullAt = uint64_t(ixCheckpoint) * index.nInterval;
+    ullOffset = index.vCheckpoints[ixCheckpoint];
+    while (ullAt < ullLine && ullOffset < content.Size())
+    {
+        const uint8_t* pData = nullptr;
+        size_t cbData = 0;
+        if (!content.Get(ullOffset, pData, cbData))
+            return false;
+        const uint8_t* p = pData;
+        const uint8_t* const pEnd = pData + cbData;
+        while (ullAt < ullLine && p < pEnd)
+        {
+            const uint8_t* pBreak = (const uint8_t*)memchr(p, '\n', size_t(pEnd - p));
+            if (nullptr == pBreak)
+            {
+                p = pEnd;
+                break;
+            }
+            p = pBreak + 1;
+            ++ullAt;
+        }
+        ullOffset += uint64_t(p - pData);
+    }
+    return true;
+}
+
+/// <summary>
+/// Counts the lines in the content, reading only what follows the last checkpoint (or nothing, if the index is complete)
+/// </summary>
+static bool CountLines(CaptureContent_t& content, const LineIndex_t& index, uint64_t& ullLines)
+{
+    if (index.bComplete)
+    {
+        ullLines = index.ullLines;
+        return true;
+    }
+    ullLines = uint64_t(index.vCheckpoints.size() - 1) * index.nInterval;
+    uint64_t ullOffset = index.vCheckpoints.back();
+    bool bEndsWithBreak = true;
+    while (ullOffset < content.Size())
+    {
+        const uint8_t* pData = nullptr;
+        size_t cbData = 0;
+        if (!content.Get(ullOffset, pData, cbData))
+            return false;
+        ullLines += uint64_t(std::count(pData, pData + cbData, uint8_t('\n')));
+        bEndsWithBreak = ('\n' == pData[cbData - 1]);
+        ullOffset += cbData;
+    }
+    if (!bEndsWithBreak)
+        ++ullLines;
+    return true;
+}
+
+/// <summary>
+/// Checks the blocks that a range of the content falls in against the index's checksums
+/// </summary>
+static bool VerifyRange(const std::wstring& sPath, CaptureContent_t& content, const LineIndex_t& index, uint64_t ullStart, uint64_t ullEnd)
+{
+    if (index.vChecksums.empty() || ullStart >= ullEnd)
+        return true;
+    bool bOk = true;
+    for (uint64_t ixBlock = ullStart / index.cbBlock; ixBlock * index.cbBlock < ullEnd && ixBlock < index.vChecksums.size(); ++ixBlock)
+    {
+        const uint64_t ullBlockEnd = std::min<uint64_t>((ixBlock + 1) * index.cbBlock, content.Size());
+        Xxh64_t hash;
+        for (uint64_t ullOffset = ixBlock * index.cbBlock; ullOffset < ullBlockEnd; )
+        {
+            const uint8_t* pData = nullptr;
+            size_t cbData = 0;
+            if (!content.Get(ullOffset, pData, cbData))
+                return false;
+            cbData = size_t(std::min<uint64_t>(cbData, ullBlockEnd - ullOffset));
+            hash.Update(pData, cbData);
+            ullOffset += cbData;
+        }
+        if (hash.Final() != index.vChecksums[size_t(ixBlock)])
+        {
+            std::wcerr << L"Checksum mismatch in " << sPath << L" at offset " << ixBlock * index.cbBlock << L" (block " << ixBlock << L")" << std::endl;
+            bOk = false;
+        }
+    }
+    return bOk;
+}
+
+/// <summary>
+/// Writes lines first through last (numbered from 0) of a file's original content to hOut
+/// </summary>
+static bool Lines(const std::wstring& sPath, uint64_t ullFirst, uint64_t ullLast, bool bTail, bool bVerify, PlatformFile_t hOut)
+{
+    CaptureContent_t content;
+    if (!content.Open(sPath))
+        return false;
+    LineIndex_t index;
+    ReadLineIndex(sPath, content, index);
+
+    // For tail, ullFirst is the number of lines
+    if (bTail)
+    {
+        uint64_t ullLines = 0;
+        if (!CountLines(content, index, ullLines))
+            return false;
+        ullFirst = (ullLines > ullFirst) ? ullLines - ullFirst : 0;
+        ullLast = ~uint64_t(0);
+    }
+
+    uint64_t ullStart = 0;
+    if (!FindLine(content, index, ullFirst, ullStart))
+        return false;
+    uint64_t ullOffset = ullStart, ullAt = ullFirst;
+    uint32_t dwError = 0;
+    while (ullAt <= ullLast && ullOffset < content.Size())
+    {
+        const uint8_t* pData = nullptr;
+        size_t cbData = 0;
+        if (!content.Get(ullOffset, pData, cbData))
+            return false;
+        const uint8_t* p = pData;
+        const uint8_t* const pEnd = pData + cbData;
+        if (~uint64_t(0) == ullLast)
+        {
+            p = pEnd;
+        }
+        else
+        {
+            while (ullAt <= ullLast && p < pEnd)
+            {
+                const uint8_t* pBreak = (const uint8_t*)memchr(p, '\n', size_t(pEnd - p));
+                p = (nullptr == pBreak) ? pEnd : pBreak + 1;
+                if (nullptr != pBreak)
+                    ++ullAt;
+            }
+        }
+        if (!WriteAll(hOut, pData, size_t(p - pData), dwError))
+        {
+            std::wcerr << L"Write error: " << PlatformErrorMessage(dwError) << std::endl;
+            return false;
+        }
+        ullOffset += uint64_t(p - pData);
+    }
+    return !bVerify || VerifyRange(sPath, content, index, ullStart, ullOffset);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+        Usage(argv[0]);
+    const std::string sCommand = argv[1];
+
+    if ("cat" == sCommand)
+    {
+        uint64_t ullOffset = 0, ullLength = ~uint64_t(0);
+        int ixArg = 2;
+        for (; ixArg + 1 < argc && '-' == argv[ixArg][0]; ixArg += 2)
+        {
+            uint64_t ullValue = 0;
+            if (!ParseNumber(argv[ixArg + 1], ullValue))
+                Usage(argv[0]);
+            if (0 == strcmp("-offset", argv[ixArg]))
+                ullOffset = ullValue;
+            else if (0 == strcmp("-length", argv[ixArg]))
+                ullLength = ullValue;
+            else
+                Usage(argv[0]);
+        }
+        if (ixArg >= argc)
+            Usage(argv[0]);
+        bool bOk = true;
+        for (; ixArg < argc; ++ixArg)
+            bOk = Cat(ToWString(argv[ixArg]), ullOffset, ullLength, PlatformStandardOutput(false)) && bOk;
+        return bOk ? 0 : 1;
+    }
+
+    const bool bDecompress = ("decompress" == sCommand), bReconstruct = ("reconstruct" == sCommand);
+    if ((bDecompress || bReconstruct) && argc <= 4)
+    {
+        const std::wstring sPath = ToWString(argv[2]);
+        const std::wstring sExtension = bDecompress ? szCompressedCaptureExtension : szDedupManifestExtension;
+        std::wstring sOutPath;
+        if (4 == argc)
+            sOutPath = ToWString(argv[3]);
+        else if (sPath.length() > sExtension.length() && sPath.substr(sPath.length() - sExtension.length()) == sExtension)
+            sOutPath = sPath.substr(0, sPath.length() - sExtension.length());
+        else
+            Usage(argv[0]);
+        if (bDecompress ? !CompressedCaptureReader_t::IsCompressedCapture(sPath) : !DedupManifest_t::IsManifest(sPath))
+        {
+            std::wcerr << sPath << (bDecompress ? L" is not a compressed capture" : L" is not a manifest") << std::endl;
+            return 1;
+        }
+        uint32_t dwError = 0;
+        PlatformFile_t hOut = PlatformCreateFile(sOutPath, dwError);
+        if (PlatformInvalidFile == hOut)
+        {
+            std::wcerr << L"Cannot create " << sOutPath << L": " << PlatformErrorMessage(dwError) << std::endl;
+            return 1;
+        }
+        const bool bOk = bDecompress ? CatCompressed(sPath, 0, ~uint64_t(0), hOut) : CatManifest(sPath, 0, ~uint64_t(0), hOut);
+        PlatformClose(hOut);
+        return bOk ? 0 : 1;
+    }
+
+    if ("merge" == sCommand)
+    {
+        int ixArg = 2;
+        const bool bRelative = (0 == strcmp("-relative", argv[ixArg]));
+        if (bRelative)
+            ++ixArg;
+        if (ixArg >= argc)
+            Usage(argv[0]);
+        std::vector<std::wstring> vPaths;
+        for (; ixArg < argc; ++ixArg)
+            vPaths.push_back(ToWString(argv[ixArg]));
+        return Merge(vPaths, bRelative, PlatformStandardOutput(false)) ? 0 : 1;
+    }
+
+    if ("lines" == sCommand || "tail" == sCommand)
+    {
+        const bool bTail = ("tail" == sCommand);
+        bool bVerify = false;
+        uint64_t ullFirst = 10, ullLast = 0;
+        int ixArg = 2;
+        for (; ixArg < argc && '-' == argv[ixArg][0]; ++ixArg)
+        {
+            if (0 == strcmp("-verify", argv[ixArg]))
+                bVerify = true;
+            else if (bTail && 0 == strcmp("-n", argv[ixArg]) && ixArg + 1 < argc && ParseNumber(argv[ixArg + 1], ullFirst))
+                ++ixArg;
+            else
+                Usage(argv[0]);
+        }
+        if (ixArg + (bTail ? 1 : 2) != argc)
+            Usage(argv[0]);
+        if (!bTail)
+        {
+            // first, first-last, or first-
+            std::string sRange = argv[ixArg + 1];
+            const size_t ixDash = sRange.find('-');
+            if (!ParseNumber(sRange.substr(0, ixDash).c_str(), ullFirst) || 0 == ullFirst)
+                Usage(argv[0]);
+            if (std::string::npos == ixDash)
+                ullLast = ullFirst;
+            else if (ixDash + 1 == sRange.length())
+                ullLast = ~uint64_t(0);
+            else if (!ParseNumber(sRange.substr(ixDash + 1).c_str(), ullLast) || ullLast < ullFirst)
+                Usage(argv[0]);
+            // Numbered from 0 from here on
+            --ullFirst;
+            if (~uint64_t(0) != ullLast)
+                --ullLast;
+        }
+        return Lines(ToWString(argv[ixArg]), ullFirst, ullLast, bTail, bVerify, PlatformStandardOutput(false)) ? 0 : 1;
+    }
+
+    if ("info" == sCommand)
+    {
+        bool bOk = true;
+        for (int ixArg = 2; ixArg < argc; ++ixArg)
+            bOk = Info(ToWString(argv[ixArg])) && bOk;
+        return bOk ? 0 : 1;
+    }
+
+    Usage(argv[0]);
+    return -1;
+}
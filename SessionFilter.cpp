@@ -0,0 +1,426 @@
+// Session filter expressions (-filter): see SessionFilter.h.
+
+#include <algorithm>
+#include <cwctype>
+#include <sstream>
+#include "SessionFilter.h"
+
+/// <summary>
+/// Upper-case a string, for case-insensitive comparison
+/// </summary>
+static std::wstring ToUpper(const std::wstring& s)
+{
+    std::wstring sUpper(s);
+    for (wchar_t& ch : sUpper)
+        ch = wchar_t(towupper(wint_t(ch)));
+    return sUpper;
+}
+
+/// <summary>
+/// Match text against a pattern with wildcards (* any run of characters, ? any one character), case-insensitively.
+/// The pattern is already upper case.
+/// </summary>
+static bool WildcardMatch(const std::wstring& sText, const std::wstring& sPattern)
+{
+    // Greedy, backtracking only to the most recent *
+    size_t ixText = 0, ixPattern = 0, ixStar = std::wstring::npos, ixStarText = 0;
+    while (ixText < sText.length())
+    {
+        const wchar_t chText = wchar_t(towupper(wint_t(sText[ixText])));
+        if (ixPattern < sPattern.length() && (L'?' == sPattern[ixPattern] || chText == sPattern[ixPattern]))
+        {
+            ++ixText;
+            ++ixPattern;
+        }
+        else if (ixPattern < sPattern.length() && L'*' == sPattern[ixPattern])
+        {
+            ixStar = ixPattern++;
+            ixStarText = ixText;
+        }
+        else if (std::wstring::npos != ixStar)
+        {
+            ixPattern = ixStar + 1;
+            ixText = ++ixStarText;
+        }
+        else
+            return false;
+    }
+    while (ixPattern < sPattern.length() && L'*' == sPattern[ixPattern])
+        ++ixPattern;
+    return ixPattern == sPattern.length();
+}
+
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Recursive-descent parser: expression := and ("or" and)*; and := unary ("and" unary)*;
+/// unary := "not" unary | "(" expression ")" | comparison
+/// </summary>
+class SessionFilter_t::Parser_t
+{
+public:
+    Parser_t(const std::wstring& sText, std::vector<Node_t>& nodes) : m_sText(sText), m_nodes(nodes) {}
+
+    bool Parse(std::wstring& sError)
+    {
+        Next();
+        if (!ParseBinary(NodeKind_t::Or) || !Expect(TokenKind_t::End, L"end of expression"))
+        {
+            sError = m_sError;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    enum class TokenKind_t { Word, String, Operator, LParen, RParen, End, Invalid };
+
+    bool Fail(const std::wstring& sMessage)
+    {
+        if (m_sError.empty())
+        {
+            std::wstringstream strError;
+            strError << sMessage << L" at position " << (m_ixToken + 1);
+            m_sError = strError.str();
+        }
+        return false;
+    }
+
+    bool Expect(TokenKind_t kind, const wchar_t* szWhat)
+    {
+        if (m_token != kind)
+            return Fail(std::wstring(L"Expected ") + szWhat);
+        return true;
+    }
+
+    bool IsKeyword(const wchar_t* szKeyword) const
+    {
+        return TokenKind_t::Word == m_token && ToUpper(m_sToken) == szKeyword;
+    }
+
+    // Read the next token into m_token, m_sToken, and m_ixToken
+    void Next()
+    {
+        while (m_ixNext < m_sText.length() && iswspace(wint_t(m_sText[m_ixNext])))
+            ++m_ixNext;
+        m_ixToken = m_ixNext;
+        m_sToken.clear();
+        if (m_ixNext >= m_sText.length())
+        {
+            m_token = TokenKind_t::End;
+            return;
+        }
+        const wchar_t ch = m_sText[m_ixNext];
+        if (L'(' == ch || L')' == ch)
+        {
+            m_token = (L'(' == ch) ? TokenKind_t::LParen : TokenKind_t::RParen;
+            ++m_ixNext;
+        }
+        else if (L'=' == ch || L'!' == ch || L'<' == ch || L'>' == ch)
+        {
+            // =, !=, <, <=, >, >=
+            m_token = TokenKind_t::Operator;
+            m_sToken = ch;
+            ++m_ixNext;
+            if (m_ixNext < m_sText.length() && L'=' == m_sText[m_ixNext] && L'=' != ch)
+                m_sToken += m_sText[m_ixNext++];
+            if (L"!" == m_sToken)
+                m_token = TokenKind_t::Invalid;
+        }
+        else if (L'"' == ch)
+        {
+            // Quoted string; "" stands for a quote
+            m_token = TokenKind_t::Invalid;
+            for (++m_ixNext; m_ixNext < m_sText.length(); ++m_ixNext)
+            {
+                if (L'"' == m_sText[m_ixNext])
+                {
+                    if (m_ixNext + 1 < m_sText.length() && L'"' == m_sText[m_ixNext + 1])
+                        ++m_ixNext;
+                    else
+                    {
+                        ++m_ixNext;
+                        m_token = TokenKind_t::String;
+                        break;
+                    }
+                }
+                m_sToken += m_sText[m_ixNext];
+            }
+        }
+        else
+        {
+            m_token = TokenKind_t::Word;
+            while (m_ixNext < m_sText.length() && !iswspace(wint_t(m_sText[m_ixNext])) && nullptr == wcschr(L"()=!<>\"", m_sText[m_ixNext]))
+                m_sToken += m_sText[m_ixNext++];
+        }
+    }
+
+    size_t AddNode(Node_t&& node)
+    {
+        m_nodes.push_back(std::move(node));
+        return m_nodes.size() - 1;
+    }
+
+    // Operands of "and" or "or", flattened into one node and sorted cheapest first
+    bool ParseBinary(NodeKind_t kind)
+    {
+        const wchar_t* szKeyword = (NodeKind_t::Or == kind) ? L"OR" : L"AND";
+        std::vector<size_t> vOperands;
+        for (;;)
+        {
+            if (!((NodeKind_t::Or == kind) ? ParseBinary(NodeKind_t::And) : ParseUnary()))
+                return false;
+            vOperands.push_back(m_ixResult);
+            if (!IsKeyword(szKeyword))
+                break;
+            Next();
+        }
+        if (1 == vOperands.size())
+            return true;
+
+        Node_t node;
+        node.kind = kind;
+        std::stable_sort(vOperands.begin(), vOperands.end(),
+            [this](size_t ix1, size_t ix2) { return m_nodes[ix1].stage < m_nodes[ix2].stage; });
+        node.stage = m_nodes[vOperands.back()].stage;
+        node.vChildren.swap(vOperands);
+        m_ixResult = AddNode(std::move(node));
+        return true;
+    }
+
+    bool ParseUnary()
+    {
+        if (IsKeyword(L"NOT"))
+        {
+            Next();
+            if (!ParseUnary())
+                return false;
+            Node_t node;
+            node.kind = NodeKind_t::Not;
+            node.stage = m_nodes[m_ixResult].stage;
+            node.vChildren.push_back(m_ixResult);
+            m_ixResult = AddNode(std::move(node));
+            return true;
+        }
+        if (TokenKind_t::LParen == m_token)
+        {
+            Next();
+            if (!ParseBinary(NodeKind_t::Or) || !Expect(TokenKind_t::RParen, L")"))
+                return false;
+            Next();
+            return true;
+        }
+        return ParseComparison();
+    }
+
+    bool ParseComparison()
+    {
+        if (!Expect(TokenKind_t::Word, L"an attribute"))
+            return false;
+        static const struct { const wchar_t* szName; Attribute_t attribute; SessionFilterStage_t stage; } Attributes[] = {
+            { L"USER", Attribute_t::User, SessionFilterStage_t::Session },
+            { L"DOMAIN", Attribute_t::Domain, SessionFilterStage_t::Session },
+            { L"LOCKED", Attribute_t::Locked, SessionFilterStage_t::Session },
+            { L"IDLE", Attribute_t::Idle, SessionFilterStage_t::Session },
+            { L"LOGONAGE", Attribute_t::LogonAge, SessionFilterStage_t::Session },
+            { L"CLIENT", Attribute_t::Client, SessionFilterStage_t::Client },
+            { L"GROUP", Attribute_t::Group, SessionFilterStage_t::Token },
+        };
+        Node_t node;
+        const std::wstring sName = m_sToken, sAttribute = ToUpper(m_sToken);
+        auto iter = std::find_if(std::begin(Attributes), std::end(Attributes), [&sAttribute](const decltype(Attributes[0])& a) { return sAttribute == a.szName; });
+        if (std::end(Attributes) == iter)
+            return Fail(L"Unknown attribute \"" + sName + L"\"");
+        node.attribute = iter->attribute;
+        node.stage = iter->stage;
+        Next();
+
+        // "locked" alone
+        if (Attribute_t::Locked == node.attribute && TokenKind_t::Operator != m_token)
+        {
+            node.ullValue = 1;
+            m_ixResult = AddNode(std::move(node));
+            return true;
+        }
+
+        if (!Expect(TokenKind_t::Operator, L"an operator"))
+            return false;
+        static const struct { const wchar_t* szOp; Operator_t op; } Operators[] = {
+            { L"=", Operator_t::Equal }, { L"!=", Operator_t::NotEqual }, { L"<", Operator_t::Less },
+            { L"<=", Operator_t::LessOrEqual }, { L">", Operator_t::Greater }, { L">=", Operator_t::GreaterOrEqual },
+        };
+        for (const auto& op : Operators)
+            if (m_sToken == op.szOp)
+                node.op = op.op;
+        const bool bOrdered = (Attribute_t::Idle == node.attribute || Attribute_t::LogonAge == node.attribute);
+        if (!bOrdered && Operator_t::Equal != node.op && Operator_t::NotEqual != node.op)
+            return Fail(L"Only = and != can be used with \"" + sName + L"\"");
+        Next();
+
+        if (TokenKind_t::Word != m_token && TokenKind_t::String != m_token)
+            return Fail(L"Expected a value");
+        switch (node.attribute)
+        {
+        case Attribute_t::User:
+        case Attribute_t::Domain:
+        case Attribute_t::Client:
+            node.sValue = ToUpper(m_sToken);
+            break;
+
+        case Attribute_t::Group:
+            node.sValue = ToUpper(m_sToken);
+            if (0 != node.sValue.compare(0, 2, L"S-"))
+                return Fail(L"Expected a SID (S-1-...)");
+            break;
+
+        case Attribute_t::Locked:
+        {
+            const std::wstring sValue = ToUpper(m_sToken);
+            if (L"TRUE" == sValue)
+                node.ullValue = 1;
+            else if (L"FALSE" != sValue)
+                return Fail(L"Expected true or false");
+            break;
+        }
+
+        case Attribute_t::Idle:
+        case Attribute_t::LogonAge:
+        {
+            // A number of seconds, minutes, hours, or days
+            size_t ixChar = 0;
+            for (; ixChar < m_sToken.length() && iswdigit(wint_t(m_sToken[ixChar])); ++ixChar)
+            {
+                if (node.ullValue > (UINT64_MAX - 9) / 10)
+                    return Fail(L"Duration too large");
+                node.ullValue = node.ullValue * 10 + uint64_t(m_sToken[ixChar] - L'0');
+            }
+            const std::wstring sUnit = ToUpper(m_sToken.substr(ixChar));
+            const uint64_t ullMultiplier = (sUnit.empty() || L"S" == sUnit) ? 1 : (L"M" == sUnit) ? 60 : (L"H" == sUnit) ? 3600 : (L"D" == sUnit) ? 86400 : 0;
+            if (0 == ixChar || 0 == ullMultiplier)
+                return Fail(L"Expected a duration (e.g., 90s, 10m, 2h, 1d)");
+            if (node.ullValue > UINT64_MAX / ullMultiplier)
+                return Fail(L"Duration too large");
+            node.ullValue *= ullMultiplier;
+            break;
+        }
+        }
+        Next();
+        m_ixResult = AddNode(std::move(node));
+        return true;
+    }
+
+private:
+    const std::wstring& m_sText;
+    std::vector<Node_t>& m_nodes;
+    size_t m_ixNext = 0;
+    TokenKind_t m_token = TokenKind_t::End;
+    std::wstring m_sToken;
+    size_t m_ixToken = 0;
+    // The node most recently parsed
+    size_t m_ixResult = 0;
+    std::wstring m_sError;
+};
+
+// ------------------------------------------------------------------------------------------
+
+bool SessionFilter_t::Compile(const std::wstring& sExpression, std::wstring& sError)
+{
+    m_nodes.clear();
+    m_sExpression = sExpression;
+    Parser_t parser(m_sExpression, m_nodes);
+    if (!parser.Parse(sError))
+    {
+        m_nodes.clear();
+        return false;
+    }
+    return true;
+}
+
+bool SessionFilter_t::Needs(SessionFilterStage_t stage) const
+{
+    return std::any_of(m_nodes.begin(), m_nodes.end(),
+        [stage](const Node_t& node) { return NodeKind_t::Compare == node.kind && stage == node.stage; });
+}
+
+FilterResult_t SessionFilter_t::Evaluate(const SessionFacts_t& facts, SessionFilterStage_t stageAvailable) const
+{
+    if (m_nodes.empty())
+        return FilterResult_t::True;
+    return EvaluateNode(m_nodes.size() - 1, facts, stageAvailable);
+}
+
+FilterResult_t SessionFilter_t::EvaluateNode(size_t ixNode, const SessionFacts_t& facts, SessionFilterStage_t stageAvailable) const
+{
+    const Node_t& node = m_nodes[ixNode];
+    switch (node.kind)
+    {
+    case NodeKind_t::And:
+    case NodeKind_t::Or:
+    {
+        // An operand that decides it (False for and, True for or) decides it, even if others are unknown. Every
+        // operand is evaluated, even one that tests a later stage's attributes: a group of operands can still be
+        // decided by its cheap ones. The operands are in stage order, so the cheapest are evaluated first.
+        const FilterResult_t decisive = (NodeKind_t::And == node.kind) ? FilterResult_t::False : FilterResult_t::True;
+        FilterResult_t result = (NodeKind_t::And == node.kind) ? FilterResult_t::True : FilterResult_t::False;
+        for (const size_t ixChild : node.vChildren)
+        {
+            const FilterResult_t childResult = EvaluateNode(ixChild, facts, stageAvailable);
+            if (decisive == childResult)
+                return decisive;
+            if (FilterResult_t::Unknown == childResult)
+                result = FilterResult_t::Unknown;
+        }
+        return result;
+    }
+
+    case NodeKind_t::Not:
+    {
+        const FilterResult_t childResult = EvaluateNode(node.vChildren[0], facts, stageAvailable);
+        return (FilterResult_t::Unknown == childResult) ? childResult : ((FilterResult_t::True == childResult) ? FilterResult_t::False : FilterResult_t::True);
+    }
+
+    case NodeKind_t::Compare:
+    default:
+        if (node.stage > stageAvailable)
+            return FilterResult_t::Unknown;
+        return Compare(node, facts) ? FilterResult_t::True : FilterResult_t::False;
+    }
+}
+
+bool SessionFilter_t::Compare(const Node_t& node, const SessionFacts_t& facts) const
+{
+    bool bEqual = false;
+    uint64_t ullActual = 0;
+    switch (node.attribute)
+    {
+    case Attribute_t::User:
+        bEqual = WildcardMatch(facts.sUser, node.sValue);
+        break;
+    case Attribute_t::Domain:
+        bEqual = WildcardMatch(facts.sDomain, node.sValue);
+        break;
+    case Attribute_t::Client:
+        bEqual = WildcardMatch(facts.sClientName, node.sValue);
+        break;
+    case Attribute_t::Group:
+        bEqual = std::any_of(facts.vGroupSids.begin(), facts.vGroupSids.end(),
+            [&node](const std::wstring& sSid) { return ToUpper(sSid) == node.sValue; });
+        break;
+    case Attribute_t::Locked:
+        bEqual = (facts.bLocked == (0 != node.ullValue));
+        break;
+    case Attribute_t::Idle:
+    case Attribute_t::LogonAge:
+        ullActual = (Attribute_t::Idle == node.attribute) ? facts.ullIdleSeconds : facts.ullLogonAgeSeconds;
+        switch (node.op)
+        {
+        case Operator_t::Less: return ullActual < node.ullValue;
+        case Operator_t::LessOrEqual: return ullActual <= node.ullValue;
+        case Operator_t::Greater: return ullActual > node.ullValue;
+        case Operator_t::GreaterOrEqual: return ullActual >= node.ullValue;
+        default: bEqual = (ullActual == node.ullValue); break;
+        }
+        break;
+    }
+    return (Operator_t::NotEqual == node.op) ? !bEqual : bEqual;
+}
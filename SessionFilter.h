@@ -0,0 +1,130 @@
+// Session filter expressions (-filter): which of the sessions chosen with -s to start target processes in, by
+// attributes of the session and its user, e.g.
+//
+//     group=S-1-5-32-544 and (locked or idle>10m) and not client=KIOSK*
+//
+// The expression is compiled once. Its attributes cost different amounts to get: the user, domain, lock state, idle
+// time, and logon age come with the session information queried for every session; the client name takes another
+// query; and group membership takes the user's token. Evaluation is staged, cheapest attributes first: an
+// expression evaluates to "unknown" while it depends on attributes not fetched yet, so that each session is ruled
+// out as soon as it can be, and the token is acquired only for sessions that can still match.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Groups of attributes, in the order in which they're fetched (cheapest first)
+/// </summary>
+enum class SessionFilterStage_t
+{
+    // user, domain, locked, idle, logonAge: from the session information
+    Session,
+    // client: the client computer's name, queried separately
+    Client,
+    // group: from the user's token
+    Token
+};
+
+/// <summary>
+/// Result of evaluating a filter: it matches, it doesn't, or it depends on attributes not fetched yet
+/// </summary>
+enum class FilterResult_t
+{
+    False,
+    True,
+    Unknown
+};
+
+/// <summary>
+/// The attributes of a session that a filter can test
+/// </summary>
+struct SessionFacts_t
+{
+    // SessionFilterStage_t::Session
+    std::wstring sUser, sDomain;
+    bool bLocked = false;
+    uint64_t ullIdleSeconds = 0, ullLogonAgeSeconds = 0;
+    // SessionFilterStage_t::Client: empty for the console session
+    std::wstring sClientName;
+    // SessionFilterStage_t::Token: SIDs of the user's groups, in string form (S-1-5-32-544)
+    std::vector<std::wstring> vGroupSids;
+};
+
+/// <summary>
+/// A compiled session filter expression.
+///
+/// Syntax: comparisons joined with "and", "or", and "not" (in order of increasing precedence), and parentheses.
+/// A comparison is an attribute, an operator, and a value; a value is a word or a "quoted string".
+///   user, domain, client   = or != ; value may contain wildcards * and ?; case-insensitive
+///   group                  = (is a member) or != ; value is a SID, e.g., S-1-5-32-544
+///   locked                 = or != true or false; "locked" alone means locked=true
+///   idle, logonAge         = != < <= > >= ; value is a duration: a number, with s (the default), m, h, or d
+/// </summary>
+class SessionFilter_t
+{
+public:
+    SessionFilter_t() = default;
+
+    /// <summary>
+    /// Compile a filter expression
+    /// </summary>
+    /// <param name="sExpression">Input: the expression</param>
+    /// <param name="sError">Output: on failure, what's wrong and where</param>
+    /// <returns>true if valid; false otherwise</returns>
+    bool Compile(const std::wstring& sExpression, std::wstring& sError);
+
+    /// <summary>
+    /// Returns true if no filter has been compiled (every session matches)
+    /// </summary>
+    bool Empty() const { return m_nodes.empty(); }
+
+    /// <summary>
+    /// Returns true if the filter tests any attribute of a stage
+    /// </summary>
+    bool Needs(SessionFilterStage_t stage) const;
+
+    /// <summary>
+    /// Evaluate the filter for a session
+    /// </summary>
+    /// <param name="facts">Input: the session's attributes, through stageAvailable</param>
+    /// <param name="stageAvailable">Input: the latest stage whose attributes have been fetched</param>
+    /// <returns>True or False if that's decided; Unknown if it depends on attributes of a later stage</returns>
+    FilterResult_t Evaluate(const SessionFacts_t& facts, SessionFilterStage_t stageAvailable) const;
+
+    /// <summary>
+    /// The expression, as compiled
+    /// </summary>
+    const std::wstring& Expression() const { return m_sExpression; }
+
+private:
+    enum class NodeKind_t { And, Or, Not, Compare };
+    enum class Attribute_t { User, Domain, Client, Group, Locked, Idle, LogonAge };
+    enum class Operator_t { Equal, NotEqual, Less, LessOrEqual, Greater, GreaterOrEqual };
+
+    struct Node_t
+    {
+        NodeKind_t kind = NodeKind_t::Compare;
+        // The latest stage of the attributes it tests
+        SessionFilterStage_t stage = SessionFilterStage_t::Session;
+        // And, Or, Not: the operands, cheapest first
+        std::vector<size_t> vChildren;
+        // Compare
+        Attribute_t attribute = Attribute_t::User;
+        Operator_t op = Operator_t::Equal;
+        // The value: a string (upper case), a number of seconds, or a boolean, depending on the attribute
+        std::wstring sValue;
+        uint64_t ullValue = 0;
+    };
+
+    class Parser_t;
+    FilterResult_t EvaluateNode(size_t ixNode, const SessionFacts_t& facts, SessionFilterStage_t stageAvailable) const;
+    bool Compare(const Node_t& node, const SessionFacts_t& facts) const;
+
+private:
+    std::wstring m_sExpression;
+    // The expression tree; the root is the last node
+    std::vector<Node_t> m_nodes;
+};
@@ -0,0 +1,70 @@
+// Deciding which sessions to start target processes in (the -s option)
+
+#include <sstream>
+#include "SessionSelection.h"
+
+/// <summary>
+/// Convert the WhichSesssions_t enum to corresponding string.
+/// </summary>
+std::wstring WhichSessionsToWSZ(WhichSessions_t whichSessions, uint32_t nSessionId)
+{
+    switch (whichSessions)
+    {
+    case WhichSessions_t::firstActive:
+        return L"First active";
+    case WhichSessions_t::allActive:
+        return L"All active";
+    case WhichSessions_t::allLoggedOn:
+        return L"All logged on";
+    case WhichSessions_t::oneSessionId:
+    {
+        std::wstringstream str;
+        str << L"Session # " << nSessionId;
+        return str.str();
+    }
+    default:
+        return L"UNEXPECTED/UNDEFINED";
+        break;
+    }
+}
+
+/// <summary>
+/// Decide whether to start the target process in a session, and whether to keep enumerating sessions.
+/// </summary>
+/// <param name="whichSessions">Input: the -s option</param>
+/// <param name="nRequestedSessionId">Input: session ID specified with -s, if whichSessions is oneSessionId</param>
+/// <param name="dwSessionId">Input: ID of the session being considered</param>
+/// <param name="state">Input: connection state of the session being considered</param>
+SessionSelection_t SelectSession(WhichSessions_t whichSessions, uint32_t nRequestedSessionId, uint32_t dwSessionId, SessionConnectState_t state)
+{
+    SessionSelection_t selection;
+    switch (whichSessions)
+    {
+    case WhichSessions_t::firstActive:
+        // Start process if this session is active, then exit the loop.
+        if (SessionConnectState_t::Active == state)
+        {
+            selection.bStartProcess = selection.bDoneAfterThis = true;
+        }
+        break;
+    case WhichSessions_t::allActive:
+        // Start process if this session is active
+        selection.bStartProcess = (SessionConnectState_t::Active == state);
+        break;
+    case WhichSessions_t::allLoggedOn:
+        // Start process if this session is active or disconnected
+        selection.bStartProcess = (SessionConnectState_t::Other != state);
+        break;
+    case WhichSessions_t::oneSessionId:
+        // Start process if session ID matches the one specified AND the session is active or disconnected.
+        if (nRequestedSessionId == dwSessionId)
+        {
+            // Session ID matches, so no need to continue enumeration
+            selection.bDoneAfterThis = true;
+            selection.bStartProcess = (SessionConnectState_t::Other != state);
+            selection.bRequestedSessionUnavailable = !selection.bStartProcess;
+        }
+        break;
+    }
+    return selection;
+}
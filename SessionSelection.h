@@ -0,0 +1,52 @@
+// Deciding which sessions to start target processes in (the -s option)
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/// <summary>
+/// Enum for the -s option (which session or sessions to execute processes in)
+/// </summary>
+enum class WhichSessions_t {
+    firstActive,
+    allActive,
+    allLoggedOn,
+    oneSessionId
+};
+
+/// <summary>
+/// Convert the WhichSesssions_t enum to corresponding string.
+/// </summary>
+std::wstring WhichSessionsToWSZ(WhichSessions_t whichSessions, uint32_t nSessionId);
+
+/// <summary>
+/// The connection states that matter for session selection; all other WTS_CONNECTSTATE_CLASS values are "Other".
+/// </summary>
+enum class SessionConnectState_t {
+    Active,
+    Disconnected,
+    Other
+};
+
+/// <summary>
+/// Result of considering one session during enumeration
+/// </summary>
+struct SessionSelection_t
+{
+    // Start the target process in this session
+    bool bStartProcess = false;
+    // Don't look at any more sessions after this one
+    bool bDoneAfterThis = false;
+    // The specifically-requested session was found, but can't be used because of its state
+    bool bRequestedSessionUnavailable = false;
+};
+
+/// <summary>
+/// Decide whether to start the target process in a session, and whether to keep enumerating sessions.
+/// </summary>
+/// <param name="whichSessions">Input: the -s option</param>
+/// <param name="nRequestedSessionId">Input: session ID specified with -s, if whichSessions is oneSessionId</param>
+/// <param name="dwSessionId">Input: ID of the session being considered</param>
+/// <param name="state">Input: connection state of the session being considered</param>
+SessionSelection_t SelectSession(WhichSessions_t whichSessions, uint32_t nRequestedSessionId, uint32_t dwSessionId, SessionConnectState_t state);
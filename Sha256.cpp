@@ -0,0 +1,133 @@
+#include <cstring>
+#include "Sha256.h"
+
+static const uint32_t Sha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t RotateRight(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t LoadBigEndian32(const uint8_t* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void Sha256_t::Reset()
+{
+    static const uint32_t initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memcpy(m_state, initial, sizeof(m_state));
+    m_cbBuffered = 0;
+    m_ullLength = 0;
+}
+
+void Sha256_t::Transform(const uint8_t* pBlock, size_t nBlocks)
+{
+    for (; nBlocks > 0; --nBlocks, pBlock += 64)
+    {
+        uint32_t w[64];
+        for (int ix = 0; ix < 16; ++ix)
+            w[ix] = LoadBigEndian32(pBlock + ix * 4);
+        for (int ix = 16; ix < 64; ++ix)
+        {
+            const uint32_t s0 = RotateRight(w[ix - 15], 7) ^ RotateRight(w[ix - 15], 18) ^ (w[ix - 15] >> 3);
+            const uint32_t s1 = RotateRight(w[ix - 2], 17) ^ RotateRight(w[ix - 2], 19) ^ (w[ix - 2] >> 10);
+            w[ix] = w[ix - 16] + s0 + w[ix - 7] + s1;
+        }
+
+        uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+        uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+        for (int ix = 0; ix < 64; ++ix)
+        {
+            const uint32_t S1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+            const uint32_t ch = (e & f) ^ (~e & g);
+            const uint32_t t1 = h + S1 + ch + Sha256RoundConstants[ix] + w[ix];
+            const uint32_t S0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+            const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            const uint32_t t2 = S0 + maj;
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+        m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+    }
+}
+
+void Sha256_t::Update(const uint8_t* pData, size_t cbData)
+{
+    m_ullLength += cbData;
+    // Top up a partial block first
+    if (m_cbBuffered > 0)
+    {
+        const size_t cbCopy = (cbData < 64 - m_cbBuffered) ? cbData : 64 - m_cbBuffered;
+        memcpy(m_buffer + m_cbBuffered, pData, cbCopy);
+        m_cbBuffered += cbCopy;
+        pData += cbCopy;
+        cbData -= cbCopy;
+        if (64 == m_cbBuffered)
+        {
+            Transform(m_buffer, 1);
+            m_cbBuffered = 0;
+        }
+    }
+    // Whole blocks directly from the input
+    if (cbData >= 64)
+    {
+        Transform(pData, cbData / 64);
+        pData += cbData & ~size_t(63);
+        cbData &= 63;
+    }
+    if (cbData > 0)
+    {
+        memcpy(m_buffer, pData, cbData);
+        m_cbBuffered = cbData;
+    }
+}
+
+void Sha256_t::Final(uint8_t digest[Sha256DigestSize])
+{
+    // Padding: a 1 bit, zeros, and the message length in bits as a big-endian 64-bit number
+    const uint64_t ullBits = m_ullLength * 8;
+    uint8_t padding[72] = { 0x80 };
+    const size_t cbPadding = ((m_cbBuffered < 56) ? 56 : 120) - m_cbBuffered;
+    for (int ix = 0; ix < 8; ++ix)
+        padding[cbPadding + ix] = uint8_t(ullBits >> (56 - ix * 8));
+    Update(padding, cbPadding + 8);
+
+    for (int ix = 0; ix < 8; ++ix)
+    {
+        digest[ix * 4] = uint8_t(m_state[ix] >> 24);
+        digest[ix * 4 + 1] = uint8_t(m_state[ix] >> 16);
+        digest[ix * 4 + 2] = uint8_t(m_state[ix] >> 8);
+        digest[ix * 4 + 3] = uint8_t(m_state[ix]);
+    }
+}
+
+void Sha256_t::Compute(const uint8_t* pData, size_t cbData, uint8_t digest[Sha256DigestSize])
+{
+    Sha256_t sha;
+    sha.Update(pData, cbData);
+    sha.Final(digest);
+}
+
+std::wstring Sha256ToString(const uint8_t digest[Sha256DigestSize])
+{
+    static const wchar_t szHexDigits[] = L"0123456789abcdef";
+    std::wstring sHex;
+    sHex.reserve(Sha256DigestSize * 2);
+    for (size_t ix = 0; ix < Sha256DigestSize; ++ix)
+    {
+        sHex += szHexDigits[digest[ix] >> 4];
+        sHex += szHexDigits[digest[ix] & 0x0F];
+    }
+    return sHex;
+}
@@ -0,0 +1,56 @@
+// SHA-256 (FIPS 180-4), computed incrementally, for identifying chunks of captured output by content.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/// <summary>
+/// Size of a SHA-256 digest, in bytes
+/// </summary>
+const size_t Sha256DigestSize = 32;
+
+/// <summary>
+/// Computes a SHA-256 digest over data supplied in any number of pieces.
+/// </summary>
+class Sha256_t
+{
+public:
+    Sha256_t() { Reset(); }
+
+    /// <summary>
+    /// Starts a new digest
+    /// </summary>
+    void Reset();
+
+    /// <summary>
+    /// Adds data to the digest
+    /// </summary>
+    void Update(const uint8_t* pData, size_t cbData);
+
+    /// <summary>
+    /// Completes the digest. Call Reset before using the object again.
+    /// </summary>
+    /// <param name="digest">Output: the digest</param>
+    void Final(uint8_t digest[Sha256DigestSize]);
+
+    /// <summary>
+    /// Computes the digest of a single buffer
+    /// </summary>
+    static void Compute(const uint8_t* pData, size_t cbData, uint8_t digest[Sha256DigestSize]);
+
+private:
+    void Transform(const uint8_t* pBlock, size_t nBlocks);
+
+private:
+    uint32_t m_state[8];
+    uint8_t m_buffer[64];
+    size_t m_cbBuffered;
+    uint64_t m_ullLength;
+};
+
+/// <summary>
+/// Lowercase hexadecimal representation of a digest
+/// </summary>
+std::wstring Sha256ToString(const uint8_t digest[Sha256DigestSize]);
@@ -0,0 +1,118 @@
+// Asking a console process in another session to exit gracefully.
+
+#include <sstream>
+#include <vector>
+#include "SoftClose.h"
+#include "SysErrorMessage.h"
+
+#include "DbgOut.h"
+
+/// <summary>
+/// Hidden command-line option that runs this executable as the soft-close helper: -ctrlc pid
+/// </summary>
+const wchar_t* const szSoftCloseHelperOption = L"-ctrlc";
+
+/// <summary>
+/// Start a helper process in the target's session to send Ctrl+C to the console of the specified process. Does not
+/// wait for it, so that helpers for many targets can run at once; get its result with FinishSoftClose.
+/// </summary>
+/// <param name="dwPID">Input: PID of the target process</param>
+/// <param name="dwSessionId">Input: session the target process runs in</param>
+/// <param name="hHelper">Output: handle to the helper process, for FinishSoftClose</param>
+/// <param name="dwError">Output: Win32 error code on failure</param>
+/// <returns>true if the helper process was started; false otherwise</returns>
+bool StartSoftClose(DWORD dwPID, DWORD dwSessionId, HANDLE& hHelper, DWORD& dwError)
+{
+    hHelper = NULL;
+    dwError = 0;
+    wchar_t szPath[MAX_PATH * 2] = { 0 };
+    if (0 == GetModuleFileNameW(NULL, szPath, sizeof(szPath) / sizeof(szPath[0])))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+
+    std::wstringstream strCmdLine;
+    strCmdLine << L"\"" << szPath << L"\" " << szSoftCloseHelperOption << L" " << dwPID;
+    // CreateProcessAsUserW can modify the command-line buffer, so it can't be a const string.
+    std::wstring sCmdLine = strCmdLine.str();
+    std::vector<wchar_t> vCmdLine(sCmdLine.begin(), sCmdLine.end());
+    vCmdLine.push_back(L'\0');
+
+    // A primary token like this process' own, in the target's session (setting the session requires SeTcbPrivilege,
+    // which SYSTEM has)
+    HANDLE hProcessToken = NULL, hHelperToken = NULL;
+    const DWORD dwTokenAccess = TOKEN_ASSIGN_PRIMARY | TOKEN_DUPLICATE | TOKEN_QUERY | TOKEN_ADJUST_DEFAULT | TOKEN_ADJUST_SESSIONID;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_DUPLICATE | TOKEN_QUERY, &hProcessToken) ||
+        !DuplicateTokenEx(hProcessToken, dwTokenAccess, nullptr, SecurityImpersonation, TokenPrimary, &hHelperToken) ||
+        !SetTokenInformation(hHelperToken, TokenSessionId, &dwSessionId, sizeof(dwSessionId)))
+    {
+        dwError = GetLastError();
+        dbgOut.locked() << L"Cannot create a token in session " << dwSessionId << L" for the soft-close helper for PID " << dwPID << L": " << SysErrorMessageWithCode(dwError) << std::endl;
+        if (NULL != hHelperToken)
+            CloseHandle(hHelperToken);
+        if (NULL != hProcessToken)
+            CloseHandle(hProcessToken);
+        return false;
+    }
+    CloseHandle(hProcessToken);
+
+    // DETACHED_PROCESS: the helper must not have a console, so that it's free to attach to the target's.
+    PROCESS_INFORMATION pi = { 0 };
+    STARTUPINFOW si = { 0 };
+    si.cb = sizeof(si);
+    const BOOL bStarted = CreateProcessAsUserW(hHelperToken, szPath, vCmdLine.data(), nullptr, nullptr, FALSE, DETACHED_PROCESS, nullptr, nullptr, &si, &pi);
+    if (!bStarted)
+        dwError = GetLastError();
+    CloseHandle(hHelperToken);
+    if (!bStarted)
+    {
+        dbgOut.locked() << L"Cannot start soft-close helper for PID " << dwPID << L": " << SysErrorMessageWithCode(dwError) << std::endl;
+        return false;
+    }
+    CloseHandle(pi.hThread);
+    hHelper = pi.hProcess;
+    return true;
+}
+
+/// <summary>
+/// Wait for a helper started with StartSoftClose to finish, and close its handle
+/// </summary>
+/// <param name="dwPID">Input: PID of the target process (for debug output)</param>
+/// <param name="hHelper">Input: handle to the helper process</param>
+/// <param name="dwTimeoutMs">Input: how long to wait</param>
+/// <returns>0 if Ctrl+C was delivered; otherwise the helper's exit code (WAIT_TIMEOUT if it didn't finish in time)</returns>
+DWORD FinishSoftClose(DWORD dwPID, HANDLE hHelper, DWORD dwTimeoutMs)
+{
+    // The helper's exit code is SoftCloseHelper's result
+    DWORD dwError = 0;
+    if (WAIT_OBJECT_0 != WaitForSingleObject(hHelper, dwTimeoutMs))
+        dwError = WAIT_TIMEOUT;
+    else if (!GetExitCodeProcess(hHelper, &dwError))
+        dwError = GetLastError();
+    CloseHandle(hHelper);
+    if (0 != dwError)
+        dbgOut.locked() << L"Soft-close helper for PID " << dwPID << L" did not deliver Ctrl+C: " << SysErrorMessageWithCode(dwError) << std::endl;
+    return dwError;
+}
+
+/// <summary>
+/// Implementation of the helper: attach to the target process' console and send Ctrl+C to every
+/// process attached to it. This process must not have a console of its own.
+/// </summary>
+/// <param name="dwPID">Input: PID of the target process</param>
+/// <returns>0 if successful; Win32 error code otherwise</returns>
+DWORD SoftCloseHelper(DWORD dwPID)
+{
+    if (!AttachConsole(dwPID))
+        return GetLastError();
+
+    // Don't let the event terminate this process before it's been delivered to the others.
+    SetConsoleCtrlHandler(NULL, TRUE);
+    // Process group 0: all processes attached to the console
+    DWORD dwRet = 0;
+    if (!GenerateConsoleCtrlEvent(CTRL_C_EVENT, 0))
+        dwRet = GetLastError();
+    FreeConsole();
+    return dwRet;
+}
@@ -0,0 +1,53 @@
+// Asking a console process in another session to exit gracefully.
+//
+// The closest thing Windows has to a "please exit" signal for a console process is a Ctrl+C event, which
+// gives the process (and anything else attached to its console) a chance to run its cleanup code.
+// GenerateConsoleCtrlEvent delivers events only to processes attached to the caller's console, so the caller
+// must detach from its own console and attach to the target's. This process can't do that without disrupting
+// its own console output, so the work is done by a short-lived, console-less instance of this executable,
+// started with a hidden command-line option. A console can only be attached to from the same session, so the
+// helper runs in the target's session, with a copy of this process' (SYSTEM) token moved into that session.
+//
+// GUI processes have no console; for them the request has no effect and the caller's grace period simply elapses.
+
+#pragma once
+
+#include <Windows.h>
+
+/// <summary>
+/// Hidden command-line option that runs this executable as the soft-close helper: -ctrlc pid
+/// </summary>
+extern const wchar_t* const szSoftCloseHelperOption;
+
+/// <summary>
+/// How long to wait for soft-close helpers to report whether they delivered Ctrl+C
+/// </summary>
+const DWORD SoftCloseHelperTimeoutMs = 5000;
+
+/// <summary>
+/// Start a helper process in the target's session to send Ctrl+C to the console of the specified process. Does not
+/// wait for it, so that helpers for many targets can run at once; get its result with FinishSoftClose.
+/// </summary>
+/// <param name="dwPID">Input: PID of the target process</param>
+/// <param name="dwSessionId">Input: session the target process runs in</param>
+/// <param name="hHelper">Output: handle to the helper process, for FinishSoftClose</param>
+/// <param name="dwError">Output: Win32 error code on failure</param>
+/// <returns>true if the helper process was started; false otherwise</returns>
+bool StartSoftClose(DWORD dwPID, DWORD dwSessionId, HANDLE& hHelper, DWORD& dwError);
+
+/// <summary>
+/// Wait for a helper started with StartSoftClose to finish, and close its handle
+/// </summary>
+/// <param name="dwPID">Input: PID of the target process (for debug output)</param>
+/// <param name="hHelper">Input: handle to the helper process</param>
+/// <param name="dwTimeoutMs">Input: how long to wait</param>
+/// <returns>0 if Ctrl+C was delivered; otherwise the helper's exit code (WAIT_TIMEOUT if it didn't finish in time)</returns>
+DWORD FinishSoftClose(DWORD dwPID, HANDLE hHelper, DWORD dwTimeoutMs);
+
+/// <summary>
+/// Implementation of the helper: attach to the target process' console and send Ctrl+C to every
+/// process attached to it. This process must not have a console of its own.
+/// </summary>
+/// <param name="dwPID">Input: PID of the target process</param>
+/// <returns>0 if successful; Win32 error code otherwise</returns>
+DWORD SoftCloseHelper(DWORD dwPID);
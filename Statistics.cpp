@@ -0,0 +1,25 @@
+// Summary statistics over collections of measurements
+
+#include <algorithm>
+#include <cmath>
+#include "Statistics.h"
+
+/// <summary>
+/// Returns the value at the specified percentile of the input values, using the nearest-rank method.
+/// Sorts the input collection in place. Returns 0 if the collection is empty.
+/// </summary>
+/// <param name="values">Input/output: collection of values; sorted on return</param>
+/// <param name="percentile">Input: percentile, from 0 to 100</param>
+uint64_t Percentile(std::vector<uint64_t>& values, double percentile)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    // Nearest rank: the smallest value such that at least "percentile" percent of the values are less than or equal to it.
+    size_t rank = size_t(std::ceil(percentile / 100.0 * double(values.size())));
+    if (rank < 1)
+        rank = 1;
+    if (rank > values.size())
+        rank = values.size();
+    return values[rank - 1];
+}
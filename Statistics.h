@@ -0,0 +1,14 @@
+// Summary statistics over collections of measurements
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/// <summary>
+/// Returns the value at the specified percentile of the input values, using the nearest-rank method.
+/// Sorts the input collection in place. Returns 0 if the collection is empty.
+/// </summary>
+/// <param name="values">Input/output: collection of values; sorted on return</param>
+/// <param name="percentile">Input: percentile, from 0 to 100</param>
+uint64_t Percentile(std::vector<uint64_t>& values, double percentile);
@@ -1,6 +1,5 @@
 // String utilities
 
-#include <Windows.h>
 #include <sstream>
 #include <locale>
 
@@ -53,36 +52,95 @@ std::wstring& WString_To_Upper(std::wstring& str)
 	return str;
 }
 
+// ------------------------------------------------------------------------------------------
+/// <summary>
+/// Escape a string for use as a JSON string value (without the surrounding quotes):
+/// backslash, double quote, and control characters are escaped.
+/// </summary>
+/// <param name="str">Input string</param>
+/// <returns>String with replacements made</returns>
+std::wstring JsonEscape(const std::wstring& str)
+{
+	std::wstring sResult;
+	sResult.reserve(str.length() + 8);
+	for (wchar_t ch : str)
+	{
+		switch (ch)
+		{
+		case L'\\': sResult += L"\\\\"; break;
+		case L'"': sResult += L"\\\""; break;
+		case L'\r': sResult += L"\\r"; break;
+		case L'\n': sResult += L"\\n"; break;
+		case L'\t': sResult += L"\\t"; break;
+		default:
+			if (ch < 0x20)
+			{
+				wchar_t szEscape[8];
+				swprintf(szEscape, sizeof(szEscape) / sizeof(szEscape[0]), L"\\u%04x", unsigned(ch));
+				sResult += szEscape;
+			}
+			else
+			{
+				sResult += ch;
+			}
+			break;
+		}
+	}
+	return sResult;
+}
+
 // ----------------------------------------------------------------------------------------------------
 // Date/time-related string manipulation
 
 /// <summary>
-/// Convert input system time structure to an alpha-sortable date/time string, optionally including 
+/// Convert input date/time to an alpha-sortable date/time string, optionally including 
 /// milliseconds, and optionally including only characters that are valid in directory and file names.
 /// </summary>
-/// <param name="st">Input: SYSTEMTIME structure representing the date/time to convert to a string</param>
+/// <param name="dt">Input: the date/time to convert to a string</param>
 /// <param name="bIncludeMilliseconds">Input: true to include milliseconds, false otherwise</param>
 /// <param name="bForFileSystem">Input: true to limit to file-object-valid characters</param>
 /// <returns>Timestamp string with a format like yyyy-MM-dd HH:mm:ss.fff</returns>
-std::wstring SystemTimeToWString(const SYSTEMTIME& st, bool bIncludeMilliseconds, bool bForFileSystem)
+std::wstring DateTimeToWString(const PlatformDateTime_t& dt, bool bIncludeMilliseconds, bool bForFileSystem)
 {
 	wchar_t szTimestamp[32];
 	const size_t bufferSize = sizeof(szTimestamp) / sizeof(szTimestamp[0]);
 	if (bIncludeMilliseconds)
 	{
 		swprintf(szTimestamp, bufferSize, 
-			bForFileSystem ? L"%04d%02d%02d_%02d%02d%02d_%03d" : L"%04d-%02d-%02d %02d:%02d:%02d.%03d",
-			st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds);
+			bForFileSystem ? L"%04u%02u%02u_%02u%02u%02u_%03u" : L"%04u-%02u-%02u %02u:%02u:%02u.%03u",
+			dt.nYear, dt.nMonth, dt.nDay, dt.nHour, dt.nMinute, dt.nSecond, dt.nMilliseconds);
 	}
 	else
 	{
 		swprintf(szTimestamp, bufferSize, 
-			bForFileSystem ? L"%04d%02d%02d_%02d%02d%02d" : L"%04d-%02d-%02d %02d:%02d:%02d",
-			st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+			bForFileSystem ? L"%04u%02u%02u_%02u%02u%02u" : L"%04u-%02u-%02u %02u:%02u:%02u",
+			dt.nYear, dt.nMonth, dt.nDay, dt.nHour, dt.nMinute, dt.nSecond);
 	}
 	return szTimestamp;
 }
 
+#ifdef _WIN32
+/// <summary>
+/// Convert input system time structure to an alpha-sortable date/time string, optionally including 
+/// milliseconds, and optionally including only characters that are valid in directory and file names.
+/// </summary>
+/// <param name="st">Input: SYSTEMTIME structure representing the date/time to convert to a string</param>
+/// <param name="bIncludeMilliseconds">Input: true to include milliseconds, false otherwise</param>
+/// <param name="bForFileSystem">Input: true to limit to file-object-valid characters</param>
+/// <returns>Timestamp string with a format like yyyy-MM-dd HH:mm:ss.fff</returns>
+std::wstring SystemTimeToWString(const SYSTEMTIME& st, bool bIncludeMilliseconds, bool bForFileSystem)
+{
+	PlatformDateTime_t dt;
+	dt.nYear = st.wYear;
+	dt.nMonth = st.wMonth;
+	dt.nDay = st.wDay;
+	dt.nHour = st.wHour;
+	dt.nMinute = st.wMinute;
+	dt.nSecond = st.wSecond;
+	dt.nMilliseconds = st.wMilliseconds;
+	return DateTimeToWString(dt, bIncludeMilliseconds, bForFileSystem);
+}
+
 /// <summary>
 /// Convert input filetime structure to an alpha-sortable date/time string, optionally including
 /// milliseconds and optionally including only characters that are valid in directory and file names.
@@ -117,6 +175,7 @@ std::wstring LargeIntegerToDateTimeString(const LARGE_INTEGER& l, bool bIncludeM
 	ft.dwLowDateTime = l.LowPart;
 	return FileTimeToWString(ft, bIncludeMilliseconds, szIfZero);
 }
+#endif
 
 /// <summary>
 /// Creates and returns an alpha-sortable timestamp string from the current time, optionally including milliseconds
@@ -125,10 +184,9 @@ std::wstring LargeIntegerToDateTimeString(const LARGE_INTEGER& l, bool bIncludeM
 /// <returns>Alpha-sortable timestamp string</returns>
 std::wstring TimestampUTC(bool bIncludeMilliseconds /*= false*/)
 {
-	//wchar_t szTimestamp[32];
-	SYSTEMTIME st;
-	GetSystemTime(&st);
-	return SystemTimeToWString(st, bIncludeMilliseconds, false);
+	PlatformDateTime_t dt;
+	PlatformGetUtcDateTime(dt);
+	return DateTimeToWString(dt, bIncludeMilliseconds, false);
 }
 
 /// <summary>
@@ -139,10 +197,9 @@ std::wstring TimestampUTC(bool bIncludeMilliseconds /*= false*/)
 /// <returns>Alpha-sortable timestamp string</returns>
 std::wstring TimestampUTCforFilepath(bool bIncludeMilliseconds /*= false*/)
 {
-	//wchar_t szTimestamp[32];
-	SYSTEMTIME st;
-	GetSystemTime(&st);
-	return SystemTimeToWString(st, bIncludeMilliseconds, true);
+	PlatformDateTime_t dt;
+	PlatformGetUtcDateTime(dt);
+	return DateTimeToWString(dt, bIncludeMilliseconds, true);
 }
 
 // ------------------------------------------------------------------------------------------
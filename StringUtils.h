@@ -3,6 +3,8 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <cwchar>
+#include "Platform.h"
 
 // ------------------------------------------------------------------------------------------
 // StartsWith, EndsWith, SplitStringToVector
@@ -23,7 +25,11 @@ inline bool StartsWith(const std::wstring& str, const std::wstring& with, bool b
 	}
 	else
 	{
+#ifdef _WIN32
 		return (0 == _wcsnicmp(str.c_str(), with.c_str(), with.length()));
+#else
+		return (0 == wcsncasecmp(str.c_str(), with.c_str(), with.length()));
+#endif
 	}
 }
 
@@ -174,9 +180,28 @@ inline std::string escapeCrLfTabNul(const std::string& str)
     return replaceEmbeddedNuls(escapeCrLfTab(str));
 }
 
+/// <summary>
+/// Escape a string for use as a JSON string value (without the surrounding quotes):
+/// backslash, double quote, and control characters are escaped.
+/// </summary>
+/// <param name="str">Input string</param>
+/// <returns>String with replacements made</returns>
+std::wstring JsonEscape(const std::wstring& str);
+
 // ------------------------------------------------------------------------------------------
 // Date/time-related string manipulation
 
+/// <summary>
+/// Convert input date/time to an alpha-sortable date/time string, optionally including 
+/// milliseconds, and optionally including only characters that are valid in directory and file names.
+/// </summary>
+/// <param name="dt">Input: the date/time to convert to a string</param>
+/// <param name="bIncludeMilliseconds">Input: true to include milliseconds, false otherwise</param>
+/// <param name="bForFileSystem">Input: true to limit to file-object-valid characters</param>
+/// <returns>Timestamp string with a format like yyyy-MM-dd HH:mm:ss.fff</returns>
+std::wstring DateTimeToWString(const PlatformDateTime_t& dt, bool bIncludeMilliseconds, bool bForFileSystem = false);
+
+#ifdef _WIN32
 /// <summary>
 /// Convert input system time structure to an alpha-sortable date/time string, optionally including 
 /// milliseconds, and optionally including only characters that are valid in directory and file names.
@@ -207,6 +232,7 @@ std::wstring FileTimeToWString(const FILETIME& ft, bool bIncludeMilliseconds, co
 /// <param name="szIfZero">Input (optional): the string to return if the ft is zero.</param>
 /// <returns>Timestamp string with a format like yyyy-MM-dd HH:mm:ss.fff, or alternate string value</returns>
 std::wstring LargeIntegerToDateTimeString(const LARGE_INTEGER& l, bool bIncludeMilliseconds = true, const wchar_t* szIfZero = L"");
+#endif
 
 /// <summary>
 /// Creates and returns an alpha-sortable timestamp string from the current time, optionally including milliseconds
@@ -0,0 +1,274 @@
+// Environment blocks for target processes: see TargetEnvironment.h.
+
+#include <UserEnv.h>
+#include <algorithm>
+#include <sddl.h>
+#include <sstream>
+#include "TargetEnvironment.h"
+#include "DbgOut.h"
+#include "SysErrorMessage.h"
+
+#pragma comment(lib, "UserEnv.lib")
+
+/// <summary>
+/// Variables that CreateEnvironmentBlock sets from the computer's configuration rather than the registry's
+/// environment keys. They're the same for every user, and this process (running as SYSTEM) has them too.
+/// </summary>
+static const wchar_t* const ComputedMachineVars[] = {
+    L"ALLUSERSPROFILE", L"CommonProgramFiles", L"CommonProgramFiles(x86)", L"CommonProgramW6432", L"COMPUTERNAME",
+    L"ProgramData", L"ProgramFiles", L"ProgramFiles(x86)", L"ProgramW6432", L"PUBLIC", L"SystemDrive", L"SystemRoot",
+};
+
+/// <summary>
+/// Read the string values of a registry key as variables, in registry order; REG_EXPAND_SZ values are expanded
+/// against the layers before them and the values already read
+/// </summary>
+/// <param name="hRoot">Input: the root key</param>
+/// <param name="sSubkey">Input: the key under it</param>
+/// <param name="layers">Input: the layers that values can refer to</param>
+/// <param name="vars">Output: the variables, sorted</param>
+/// <returns>ERROR_SUCCESS if successful; Win32 error code otherwise</returns>
+static LSTATUS ReadRegistryVars(HKEY hRoot, const std::wstring& sSubkey, const std::vector<EnvLayer_t>& layers, vecEnvVars_t& vars)
+{
+    vars.clear();
+    HKEY hKey = NULL;
+    LSTATUS status = RegOpenKeyExW(hRoot, sSubkey.c_str(), 0, KEY_READ, &hKey);
+    if (ERROR_SUCCESS != status)
+        return status;
+
+    DWORD cchMaxName = 0, cbMaxData = 0;
+    status = RegQueryInfoKeyW(hKey, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &cchMaxName, &cbMaxData, NULL, NULL);
+    std::vector<wchar_t> name(size_t(cchMaxName) + 1);
+    std::vector<wchar_t> data(cbMaxData / sizeof(wchar_t) + 1);
+    // Earlier values of this key can be referred to, too
+    std::vector<EnvLayer_t> expansionLayers(layers);
+    vecEnvVars_t sortedSoFar;
+    expansionLayers.push_back(EnvLayer_t{ &sortedSoFar, EnvMerge_t::Replace });
+    auto nameLess = [](const EnvVar_t& var1, const EnvVar_t& var2) { return CompareEnvNames(var1.sName, var2.sName) < 0; };
+    for (DWORD dwIndex = 0; ERROR_SUCCESS == status; ++dwIndex)
+    {
+        DWORD cchName = DWORD(name.size()), dwType = 0, cbData = DWORD(data.size() * sizeof(wchar_t));
+        status = RegEnumValueW(hKey, dwIndex, name.data(), &cchName, NULL, &dwType, reinterpret_cast<LPBYTE>(data.data()), &cbData);
+        if (ERROR_SUCCESS != status || (REG_SZ != dwType && REG_EXPAND_SZ != dwType))
+            continue;
+        // The data isn't necessarily null-terminated
+        std::wstring sValue(data.data(), cbData / sizeof(wchar_t));
+        while (!sValue.empty() && L'\0' == sValue.back())
+            sValue.pop_back();
+        if (REG_EXPAND_SZ == dwType)
+            sValue = ExpandEnvReferences(sValue, expansionLayers);
+        vars.push_back(EnvVar_t{ std::wstring(name.data(), cchName), sValue });
+        vecEnvVars_t::iterator iterSorted = std::lower_bound(sortedSoFar.begin(), sortedSoFar.end(), vars.back(), nameLess);
+        if (sortedSoFar.end() != iterSorted && 0 == CompareEnvNames(iterSorted->sName, vars.back().sName))
+            *iterSorted = vars.back();
+        else
+            sortedSoFar.insert(iterSorted, vars.back());
+    }
+    RegCloseKey(hKey);
+    SortEnvVars(vars);
+    return (ERROR_NO_MORE_ITEMS == status) ? ERROR_SUCCESS : status;
+}
+
+/// <summary>
+/// Get the string form of the SID of a token's user
+/// </summary>
+static bool GetTokenUserSidString(HANDLE hToken, std::wstring& sSid, DWORD& dwError)
+{
+    DWORD cbTokenUser = 0;
+    GetTokenInformation(hToken, TokenUser, NULL, 0, &cbTokenUser);
+    std::vector<BYTE> tokenUser(cbTokenUser);
+    LPWSTR szSid = NULL;
+    if (0 == cbTokenUser ||
+        !GetTokenInformation(hToken, TokenUser, tokenUser.data(), cbTokenUser, &cbTokenUser) ||
+        !ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER*>(tokenUser.data())->User.Sid, &szSid))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    sSid = szSid;
+    LocalFree(szSid);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------
+
+void TargetEnvironment_t::Init(EnvSource_t source, const vecEnvVars_t& overlays)
+{
+    m_source = source;
+    m_overlays = overlays;
+    SortEnvVars(m_overlays);
+}
+
+std::wstring TargetEnvironment_t::Describe() const
+{
+    std::wstringstream strDescription;
+    switch (m_source)
+    {
+    case EnvSource_t::System:
+        strDescription << L"CreateEnvironmentBlock";
+        break;
+    case EnvSource_t::Cached:
+        strDescription << L"cached";
+        break;
+    case EnvSource_t::Verify:
+        strDescription << L"cached, verified against CreateEnvironmentBlock";
+        break;
+    }
+    if (!m_overlays.empty())
+        strDescription << L", " << m_overlays.size() << L" overlay(s)";
+    return strDescription.str();
+}
+
+bool TargetEnvironment_t::Build(HANDLE hToken, DWORD dwSessionId, std::vector<wchar_t>& block, std::vector<std::wstring>& vDifferences, DWORD& dwError)
+{
+    dwError = 0;
+    vDifferences.clear();
+    if (EnvSource_t::System == m_source)
+        return BuildFromSystem(hToken, block, dwError);
+
+    ++m_nBuilt;
+    std::vector<wchar_t> cachedBlock;
+    const bool bCached = BuildFromCache(hToken, dwSessionId, cachedBlock, dwError);
+    if (!bCached)
+    {
+        ++m_nFallbacks;
+        dbgOut.locked() << L"Cannot build the environment block for session " << dwSessionId << L" from cached variables; using CreateEnvironmentBlock: " << SysErrorMessageWithCode(dwError) << std::endl;
+    }
+    if (EnvSource_t::Cached == m_source && bCached)
+    {
+        block.swap(cachedBlock);
+        return true;
+    }
+
+    if (!BuildFromSystem(hToken, block, dwError))
+        return false;
+    if (bCached)
+    {
+        vecEnvVars_t expected, actual;
+        ParseEnvBlock(block.data(), expected);
+        ParseEnvBlock(cachedBlock.data(), actual);
+        SortEnvVars(expected);
+        SortEnvVars(actual);
+        if (!CompareEnvVars(expected, actual, vDifferences))
+            ++m_nMismatches;
+    }
+    return true;
+}
+
+bool TargetEnvironment_t::BuildFromSystem(HANDLE hToken, std::vector<wchar_t>& block, DWORD& dwError)
+{
+    LPVOID pEnv = nullptr;
+    if (!CreateEnvironmentBlock(&pEnv, hToken, FALSE))
+    {
+        dwError = GetLastError();
+        return false;
+    }
+    if (m_overlays.empty())
+    {
+        // Copy it as it is
+        const wchar_t* pEnd = static_cast<const wchar_t*>(pEnv);
+        while (L'\0' != pEnd[0] || L'\0' != pEnd[1])
+            ++pEnd;
+        block.assign(static_cast<const wchar_t*>(pEnv), pEnd + 2);
+    }
+    else
+    {
+        vecEnvVars_t vars;
+        ParseEnvBlock(static_cast<const wchar_t*>(pEnv), vars);
+        SortEnvVars(vars);
+        MergeEnvLayers({ { &vars, EnvMerge_t::Replace }, { &m_overlays, EnvMerge_t::Overlay } }, block);
+    }
+    DestroyEnvironmentBlock(pEnv);
+    return true;
+}
+
+bool TargetEnvironment_t::BuildFromCache(HANDLE hToken, DWORD dwSessionId, std::vector<wchar_t>& block, DWORD& dwError)
+{
+    std::wstring sSid;
+    if (!LoadMachineVars(dwError) || !GetTokenUserSidString(hToken, sSid, dwError))
+        return false;
+    const UserVars_t* pUser = LoadUserVars(hToken, sSid, dwError);
+    if (nullptr == pUser)
+        return false;
+
+    // The session's own volatile variables: HKEY_USERS\sid\Volatile Environment\n
+    vecEnvVars_t sessionVars;
+    const LSTATUS status = ReadRegistryVars(HKEY_USERS, sSid + L"\\Volatile Environment\\" + std::to_wstring(dwSessionId), {}, sessionVars);
+    if (ERROR_SUCCESS != status && ERROR_FILE_NOT_FOUND != status)
+    {
+        dwError = DWORD(status);
+        return false;
+    }
+
+    MergeEnvLayers({
+        { &m_computed, EnvMerge_t::Replace },
+        { &m_system, EnvMerge_t::Replace },
+        { &pUser->identity, EnvMerge_t::Replace },
+        { &pUser->user, EnvMerge_t::AppendPathLists },
+        { &pUser->volatileVars, EnvMerge_t::Replace },
+        { &sessionVars, EnvMerge_t::Replace },
+        { &m_overlays, EnvMerge_t::Overlay } }, block);
+    return true;
+}
+
+bool TargetEnvironment_t::LoadMachineVars(DWORD& dwError)
+{
+    if (m_bMachineLoaded)
+        return true;
+
+    m_computed.clear();
+    std::vector<wchar_t> value(MAX_PATH);
+    for (const wchar_t* szName : ComputedMachineVars)
+    {
+        DWORD cchValue = GetEnvironmentVariableW(szName, value.data(), DWORD(value.size()));
+        if (cchValue >= value.size())
+        {
+            value.resize(cchValue);
+            cchValue = GetEnvironmentVariableW(szName, value.data(), DWORD(value.size()));
+        }
+        if (cchValue > 0 && cchValue < value.size())
+            m_computed.push_back(EnvVar_t{ szName, std::wstring(value.data(), cchValue) });
+    }
+    SortEnvVars(m_computed);
+
+    const LSTATUS status = ReadRegistryVars(HKEY_LOCAL_MACHINE, L"SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Environment",
+        { { &m_computed, EnvMerge_t::Replace } }, m_system);
+    if (ERROR_SUCCESS != status)
+    {
+        dwError = DWORD(status);
+        return false;
+    }
+    m_bMachineLoaded = true;
+    return true;
+}
+
+const TargetEnvironment_t::UserVars_t* TargetEnvironment_t::LoadUserVars(HANDLE hToken, const std::wstring& sSid, DWORD& dwError)
+{
+    std::map<std::wstring, UserVars_t>::const_iterator iter = m_users.find(sSid);
+    if (m_users.end() != iter)
+        return &iter->second;
+
+    UserVars_t userVars;
+    wchar_t szProfile[MAX_PATH] = { 0 };
+    DWORD cchProfile = MAX_PATH;
+    if (!GetUserProfileDirectoryW(hToken, szProfile, &cchProfile))
+    {
+        dwError = GetLastError();
+        return nullptr;
+    }
+    userVars.identity.push_back(EnvVar_t{ L"USERPROFILE", szProfile });
+
+    // The user's variables can refer to the machine's, and to the profile directory. The user's hive is loaded
+    // while the user is logged on; if it isn't, this fails and CreateEnvironmentBlock is used instead.
+    const std::vector<EnvLayer_t> layers = {
+        { &m_computed, EnvMerge_t::Replace }, { &m_system, EnvMerge_t::Replace }, { &userVars.identity, EnvMerge_t::Replace } };
+    LSTATUS status = ReadRegistryVars(HKEY_USERS, sSid + L"\\Environment", layers, userVars.user);
+    if (ERROR_SUCCESS == status)
+        status = ReadRegistryVars(HKEY_USERS, sSid + L"\\Volatile Environment", layers, userVars.volatileVars);
+    if (ERROR_SUCCESS != status)
+    {
+        dwError = DWORD(status);
+        return nullptr;
+    }
+    return &(m_users[sSid] = std::move(userVars));
+}
@@ -0,0 +1,101 @@
+// Environment blocks for target processes (-envBlock, -env).
+//
+// CreateEnvironmentBlock reads the system's and the user's variables from the registry, and works out the
+// user's profile paths, for every target process. With -envBlock cached, the block is built from the same sources,
+// read once: the system's variables once per run, and each user's variables once per user; only the session's own
+// volatile variables (CLIENTNAME, SESSIONNAME) are read for each target. -envBlock verify builds both and reports
+// any difference, launching with CreateEnvironmentBlock's. -env overlays are merged in, in the same pass.
+
+#pragma once
+
+#include <Windows.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "EnvBlock.h"
+
+/// <summary>
+/// Where target processes' environment blocks come from
+/// </summary>
+enum class EnvSource_t
+{
+    // CreateEnvironmentBlock, for each target
+    System,
+    // Built from cached variables, falling back to CreateEnvironmentBlock if they can't be read
+    Cached,
+    // Both, compared; the target gets CreateEnvironmentBlock's
+    Verify
+};
+
+/// <summary>
+/// Builds the environment blocks for target processes
+/// </summary>
+class TargetEnvironment_t
+{
+public:
+    TargetEnvironment_t() = default;
+
+    /// <summary>
+    /// Set where blocks come from, and the variables to overlay on them
+    /// </summary>
+    /// <param name="source">Input: where blocks come from</param>
+    /// <param name="overlays">Input: the -env variables, in command-line order</param>
+    void Init(EnvSource_t source, const vecEnvVars_t& overlays);
+
+    /// <summary>
+    /// Build the environment block for a target process
+    /// </summary>
+    /// <param name="hToken">Input: the user's token</param>
+    /// <param name="dwSessionId">Input: the session the target runs in</param>
+    /// <param name="block">Output: the environment block (Unicode)</param>
+    /// <param name="vDifferences">Output: with Verify, how the cached block differs from CreateEnvironmentBlock's</param>
+    /// <param name="dwError">Output: Win32 error code on failure</param>
+    /// <returns>true if successful; false otherwise</returns>
+    bool Build(HANDLE hToken, DWORD dwSessionId, std::vector<wchar_t>& block, std::vector<std::wstring>& vDifferences, DWORD& dwError);
+
+    /// <summary>
+    /// Describes the source and overlays, for the settings report, e.g., "cached, 2 overlay(s)"
+    /// </summary>
+    std::wstring Describe() const;
+
+    // Blocks built from cached variables; of those, ones that fell back to CreateEnvironmentBlock; and with Verify,
+    // ones that differed from CreateEnvironmentBlock's
+    size_t Built() const { return m_nBuilt; }
+    size_t Fallbacks() const { return m_nFallbacks; }
+    size_t Mismatches() const { return m_nMismatches; }
+
+private:
+    /// <summary>
+    /// The variables of one user, expanded
+    /// </summary>
+    struct UserVars_t
+    {
+        // USERPROFILE, from the token
+        vecEnvVars_t identity;
+        // HKEY_USERS\sid\Environment
+        vecEnvVars_t user;
+        // HKEY_USERS\sid\Volatile Environment
+        vecEnvVars_t volatileVars;
+    };
+
+    bool BuildFromSystem(HANDLE hToken, std::vector<wchar_t>& block, DWORD& dwError);
+    bool BuildFromCache(HANDLE hToken, DWORD dwSessionId, std::vector<wchar_t>& block, DWORD& dwError);
+    bool LoadMachineVars(DWORD& dwError);
+    const UserVars_t* LoadUserVars(HANDLE hToken, const std::wstring& sSid, DWORD& dwError);
+
+private:
+    EnvSource_t m_source = EnvSource_t::System;
+    vecEnvVars_t m_overlays;
+    // Machine-wide variables that CreateEnvironmentBlock takes from the system (ALLUSERSPROFILE, ProgramFiles...)
+    // and from HKLM\...\Session Manager\Environment, expanded; loaded with the first cached block
+    bool m_bMachineLoaded = false;
+    vecEnvVars_t m_computed, m_system;
+    // Users' variables, by SID string
+    std::map<std::wstring, UserVars_t> m_users;
+    size_t m_nBuilt = 0, m_nFallbacks = 0, m_nMismatches = 0;
+
+private:
+    // Not implemented
+    TargetEnvironment_t(const TargetEnvironment_t&) = delete;
+    TargetEnvironment_t& operator = (const TargetEnvironment_t&) = delete;
+};
@@ -0,0 +1,126 @@
+// Bookkeeping for what happens to target processes that reach their deadlines.
+//
+// Depending on the termination policy, a process that reaches its deadline is either released (no longer
+// monitored, left running), or terminated, optionally after first being asked to exit gracefully and
+// given a grace period to do so. This class keeps track of which action is due for which process and
+// when; the caller carries out the actions. The processes are represented by whatever the caller uses to
+// identify them (e.g., a ptrSessionProcessInfo_t), so the same logic drives RunAsUsers.exe and the
+// portable benchmark.
+//
+// Not thread-safe; intended to be driven from the single monitoring thread.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "MonotonicClock.h"
+#include "DeadlineWheel.h"
+
+/// <summary>
+/// What has been done to a target process because it reached its deadline
+/// </summary>
+enum class TerminationStage_t
+{
+    None,       // Deadline not reached (or no deadline)
+    Released,   // Deadline reached; no longer monitored, left running
+    SoftClosed, // Deadline reached; asked to exit gracefully, will be terminated when the grace period ends
+    Killed      // Process and its descendants terminated
+};
+
+template <typename T>
+class TerminationSchedule_t
+{
+public:
+    /// <summary>
+    /// An action that has come due: the process, and the stage it moves to
+    /// </summary>
+    struct Action_t
+    {
+        T item;
+        TerminationStage_t stage;
+    };
+
+    TerminationSchedule_t() = default;
+
+    /// <summary>
+    /// Set what happens to a process when it reaches its deadline. Affects deadlines started afterward.
+    /// </summary>
+    /// <param name="bTerminate">Input: false to stop monitoring the process and leave it running; true to terminate it</param>
+    /// <param name="ullGraceMilliseconds">Input: if terminating and non-zero, first ask the process to exit gracefully, and terminate it this many milliseconds later if it hasn't</param>
+    void SetPolicy(bool bTerminate, uint64_t ullGraceMilliseconds)
+    {
+        m_bTerminate = bTerminate;
+        m_ullGraceMilliseconds = ullGraceMilliseconds;
+    }
+
+    /// <summary>
+    /// Schedule the first action for a process at its deadline. Does nothing if the deadline is infinite.
+    /// </summary>
+    void Start(const T& item, const Deadline_t& deadline)
+    {
+        if (deadline.IsInfinite())
+            return;
+        TerminationStage_t stage = TerminationStage_t::Released;
+        if (m_bTerminate)
+            stage = (m_ullGraceMilliseconds > 0) ? TerminationStage_t::SoftClosed : TerminationStage_t::Killed;
+        m_wheel.Schedule(deadline.Microseconds(), Action_t{ item, stage });
+    }
+
+    /// <summary>
+    /// Returns the time of the next scheduled action (infinite if none).
+    /// Actions for processes that have already exited aren't removed, so this can be earlier than
+    /// necessary; the only cost is an extra wakeup.
+    /// </summary>
+    Deadline_t NextDeadline() const
+    {
+        uint64_t ullWhen = 0;
+        if (m_wheel.NextDue(ullWhen))
+            return Deadline_t::At(ullWhen);
+        return Deadline_t();
+    }
+
+    /// <summary>
+    /// Get the actions that have come due, skipping processes that are no longer being monitored.
+    /// For a process asked to exit gracefully, the caller schedules its termination with StartGracePeriod once it
+    /// has been asked.
+    /// </summary>
+    /// <param name="ullNow">Input: current time, from MonotonicMicroseconds()</param>
+    /// <param name="isMonitored">Input: returns false for a process that has exited or is no longer monitored</param>
+    /// <param name="vActions">Output: actions for the caller to carry out</param>
+    /// <returns>true if any actions are due; false otherwise</returns>
+    template <typename Pred>
+    bool Advance(uint64_t ullNow, Pred isMonitored, std::vector<Action_t>& vActions)
+    {
+        vActions.clear();
+        std::vector<Action_t> vDue;
+        m_wheel.Advance(ullNow, vDue);
+        for (const Action_t& action : vDue)
+        {
+            if (TerminationStage_t::None == action.stage || !isMonitored(action.item))
+                continue;
+            vActions.push_back(action);
+        }
+        return !vActions.empty();
+    }
+
+    /// <summary>
+    /// Schedule the termination of a process that has been asked to exit gracefully, for the end of its grace period.
+    /// The process keeps being monitored meanwhile, so that output and exit code are captured if it does exit.
+    /// </summary>
+    /// <param name="item">Input: the process</param>
+    /// <param name="ullAskedAt">Input: when it was asked to exit, from MonotonicMicroseconds()</param>
+    void StartGracePeriod(const T& item, uint64_t ullAskedAt)
+    {
+        m_wheel.Schedule(Deadline_t::AfterMilliseconds(m_ullGraceMilliseconds, ullAskedAt).Microseconds(), Action_t{ item, TerminationStage_t::Killed });
+    }
+
+private:
+    DeadlineWheel_t<Action_t> m_wheel;
+    bool m_bTerminate = false;
+    uint64_t m_ullGraceMilliseconds = 0;
+
+private:
+    // Not implemented
+    TerminationSchedule_t(const TerminationSchedule_t&) = delete;
+    TerminationSchedule_t& operator = (const TerminationSchedule_t&) = delete;
+};
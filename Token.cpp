@@ -50,6 +50,36 @@ bool Token::GetTokenInfo(HANDLE hToken, TokenInfo_t& tokenInfo, std::wstring& sE
 	return true;
 }
 
+/// <summary>
+/// Retrieve the SIDs of the groups in the input token, in string form (including deny-only groups)
+/// </summary>
+/// <param name="hToken">Input: token to inspect</param>
+/// <param name="vGroupSids">Output: the group SIDs</param>
+/// <param name="sErrorInfo">Output: error information on failure</param>
+/// <returns>true if successful, false otherwise</returns>
+// static
+bool Token::GetTokenGroupSids(HANDLE hToken, std::vector<std::wstring>& vGroupSids, std::wstring& sErrorInfo)
+{
+	vGroupSids.clear();
+	sErrorInfo.clear();
+	DWORD dwReturnLength = 0;
+	GetTokenInformation(hToken, TokenGroups, NULL, 0, &dwReturnLength);
+	std::vector<BYTE> buffer(dwReturnLength);
+	if (0 == dwReturnLength || !GetTokenInformation(hToken, TokenGroups, buffer.data(), dwReturnLength, &dwReturnLength))
+	{
+		sErrorInfo = SysErrorMessageWithCode();
+		return false;
+	}
+
+	const TOKEN_GROUPS* pGroups = reinterpret_cast<const TOKEN_GROUPS*>(buffer.data());
+	vGroupSids.reserve(pGroups->GroupCount);
+	for (DWORD ixGroup = 0; ixGroup < pGroups->GroupCount; ++ixGroup)
+	{
+		vGroupSids.push_back(CSid(pGroups->Groups[ixGroup].Sid).toSidString());
+	}
+	return true;
+}
+
 /// <summary>
 /// Get UAC-linked token, if present.
 /// Caller is responsible for closing the returned handle when done.
@@ -1,5 +1,6 @@
 #pragma once
 #include <Windows.h>
+#include <vector>
 #include "CSid.h"
 
 /// <summary>
@@ -35,6 +36,15 @@ public:
 	/// <returns>true if successful, false otherwise</returns>
 	static bool GetTokenInfo(HANDLE hToken, TokenInfo_t& tokenInfo, std::wstring& sErrorInfo);
 
+	/// <summary>
+	/// Retrieve the SIDs of the groups in the input token, in string form (including deny-only groups)
+	/// </summary>
+	/// <param name="hToken">Input: token to inspect</param>
+	/// <param name="vGroupSids">Output: the group SIDs</param>
+	/// <param name="sErrorInfo">Output: error information on failure</param>
+	/// <returns>true if successful, false otherwise</returns>
+	static bool GetTokenGroupSids(HANDLE hToken, std::vector<std::wstring>& vGroupSids, std::wstring& sErrorInfo);
+
 	/// <summary>
 	/// Get UAC-linked token, if present.
 	/// Caller is responsible for closing the returned handle when done.
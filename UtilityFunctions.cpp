@@ -1,11 +1,10 @@
 // Miscellaneous utility functions
 
 #include <Windows.h>
-#include <wincrypt.h>
-#pragma comment(lib, "crypt32.lib")
 #include <string>
 #include <sstream>
 #include <vector>
+#include "Base64.h"
 #include "SysErrorMessage.h"
 #include "StringUtils.h"
 #include "UtilityFunctions.h"
@@ -19,34 +18,9 @@
 /// <returns>true if successful; false otherwise</returns>
 bool Base64Encode(const std::wstring& sInput, std::wstring& sOutput)
 {
-    bool retval = false;
-    sOutput.clear();
-
-    DWORD cchOutput = 0;
-#pragma warning(push)
-// When compiling for x64, this line triggers C4267 'initializing': conversion from 'size_t' to 'DWORD', possible loss of data
-// No warning when building for x86.
-#pragma warning(disable: 4267)
-    DWORD cbBinary = sInput.length() * sizeof(sInput[0]);
-#pragma warning(pop)
-    // Determine size of buffer we need to allocate.
-    BOOL ret = CryptBinaryToStringW((const BYTE*)sInput.c_str(), cbBinary, CRYPT_STRING_BASE64, nullptr, &cchOutput);
-    DWORD dwLastErr = GetLastError();
-    if (cchOutput > 0)
-    {
-        std::vector<wchar_t> vChars(cchOutput + 8);
-        ret = CryptBinaryToStringW((const BYTE*)sInput.c_str(), cbBinary, CRYPT_STRING_BASE64, vChars.data(), &cchOutput);
-        dwLastErr = GetLastError();
-        if (ret)
-        {
-            sOutput = vChars.data();
-            // Remove CRLF
-            sOutput = replaceStringAll(sOutput, L"\r\n", L"");
-            retval = true;
-        }
-    }
-
-    return retval;
+    // The bytes of the string as it is in memory: UTF-16LE, which is what powershell.exe -EncodedCommand expects
+    Base64Encode((const uint8_t*)sInput.data(), sInput.length() * sizeof(sInput[0]), sOutput);
+    return !sOutput.empty();
 }
 
 /// <summary>
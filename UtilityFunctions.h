@@ -5,6 +5,7 @@
 #include <Windows.h>
 #include <WtsApi32.h>
 #include <locale>
+#include "SessionSelection.h"
 
 /// <summary>
 /// Base64-encode a string
@@ -14,42 +15,6 @@
 /// <returns>true if successful; false otherwise</returns>
 bool Base64Encode(const std::wstring& sInput, std::wstring& sOutput);
 
-/// <summary>
-/// Get the current system time as a 64-bit value representing the number of 100-nanosecond intervals 
-/// since January 1, 1601 (UTC)..
-/// </summary>
-/// <param name="li">Output: current system time as a ULARGE_INTEGER</param>
-inline void GetSystemTimeAsULargeinteger(ULARGE_INTEGER& li)
-{
-    // FILETIME is a pair of DWORDS - a high part and a low part, a 64-bit value representing the 
-    // number of 100-nanosecond intervals since January 1, 1601 (UTC).
-    // ULARGE_INTEGER is a union of the same thing along with a ULONGLONG, which simplifies math.
-    // Use GetSystemTimeAsFileTime rather than GetSystemTimeAsPreciseFileTime to continue to support Win7/WS2008R2
-    FILETIME ft = { 0 };
-    GetSystemTimeAsFileTime(&ft);
-    li.HighPart = ft.dwHighDateTime;
-    li.LowPart = ft.dwLowDateTime;
-}
-
-/// <summary>
-/// The number of milliseconds since the specified time (up to a max of 4,294,967,295 milliseconds -- ~49.7 days)
-/// </summary>
-/// <param name="liStart">Input: the start time to diff the current time against</param>
-/// <returns>Number of milliseconds between current time and that start time (up to ~4 billion milliseconds)</returns>
-inline DWORD MillisecondsSince(const ULARGE_INTEGER& liStart)
-{
-    // Contains a 64-bit value representing the number of 100-nanosecond intervals since January 1, 1601 (UTC).
-    ULARGE_INTEGER liNow = { 0 };
-    GetSystemTimeAsULargeinteger(liNow);
-    ULARGE_INTEGER liDiff = { 0 };
-    // (liNow.QuadPart - liStart.QuadPart) is the number of 100-nanosecond intervals since start time.
-    // Divide by 10,000 to get the number of milliseconds.
-    // liDiff.HighPart will be zero unless the time difference is over 4 billion milliseconds (beyond the
-    // limits of this function's intended use).
-    liDiff.QuadPart = (liNow.QuadPart - liStart.QuadPart) / (10 * 1000);
-    return liDiff.LowPart;
-}
-
 /// <summary>
 /// Convert WTS connection state enum into corresponding string
 /// </summary>
@@ -71,6 +36,19 @@ inline const wchar_t* WtsConnectStateToWSZ(WTS_CONNECTSTATE_CLASS state)
     }
 }
 
+/// <summary>
+/// Convert WTS connection state enum into the platform-independent state used for session selection
+/// </summary>
+inline SessionConnectState_t WtsConnectStateToSessionConnectState(WTS_CONNECTSTATE_CLASS state)
+{
+    switch (state)
+    {
+    case WTSActive: return SessionConnectState_t::Active;
+    case WTSDisconnected: return SessionConnectState_t::Disconnected;
+    default: return SessionConnectState_t::Other;
+    }
+}
+
 
 /// <summary>
 /// Returns true if current system is Windows 7 or Windows Server 2008R2 (some things don't work correctly on that platform)
@@ -21,13 +21,11 @@
 WofstreamSync_t::WofstreamSync_t()
 	: m_uSizeThreshold(0)
 {
-	InitializeCriticalSection(&m_critsec);
 }
 
 // Destructor
 WofstreamSync_t::~WofstreamSync_t()
 {
-	DeleteCriticalSection(&m_critsec);
 	// Close file if still open
 	if (m_fstream.is_open())
 	{
@@ -39,7 +37,7 @@ WofstreamSync_t::~WofstreamSync_t()
 /// Enforces the file's size threshold (if non-zero). If the size has reached or exceeded 
 /// the threshold, closes the stream, renames the file with a timestamp in the file name, 
 /// then opens a new stream with the original file name.
-/// CALLER MUST HAVE ACQUIRED THE CRITICAL SECTION.
+/// CALLER MUST HAVE ACQUIRED THE MUTEX.
 /// </summary>
 void WofstreamSync_t::EnforceSizeThreshold()
 {
@@ -51,14 +49,11 @@ void WofstreamSync_t::EnforceSizeThreshold()
 		{
 			// Get the file size and compare to the max.
 			// If can't acquire file size for any reason, don't do anything
-			WIN32_FILE_ATTRIBUTE_DATA data = { 0 };
-			if (GetFileAttributesExW(m_sCanonicalizedNameCasePreserved.c_str(), GetFileExInfoStandard, &data))
+			uint64_t ullSize = 0;
+			uint32_t dwError = 0;
+			if (PlatformGetFileSize(m_sCanonicalizedNameCasePreserved, ullSize, dwError))
 			{
-				// Get the file size in a form that we can compare to the threshold.
-				ULARGE_INTEGER ul;
-				ul.HighPart = data.nFileSizeHigh;
-				ul.LowPart = data.nFileSizeLow;
-				if (ul.QuadPart >= m_uSizeThreshold)
+				if (ullSize >= m_uSizeThreshold)
 				{
 					// Build the new file name
 					std::wstring sDirectory, sFilenameNoExt, sExtension, sTimestamp;
@@ -71,15 +66,13 @@ void WofstreamSync_t::EnforceSizeThreshold()
 						strNewFilename << L"." << sExtension;
 					}
 					m_fstream.close();
-					BOOL ret = MoveFileW(m_sCanonicalizedNameCasePreserved.c_str(), strNewFilename.str().c_str());
-					if (!ret)
+					if (!PlatformRenameFile(m_sCanonicalizedNameCasePreserved, strNewFilename.str(), dwError))
 					{
-						DWORD dwLastErr = GetLastError();
 						std::wstringstream strError;
-						strError << L"MoveFileW failed, error " << dwLastErr << std::endl
+						strError << L"Rename failed, error " << dwError << std::endl
 							<< L"Source:  " << m_sCanonicalizedNameCasePreserved << std::endl
 							<< L"NewName: " << strNewFilename.str() << std::endl;
-						OutputDebugStringW(strError.str().c_str());
+						PlatformDebugOutput(strError.str());
 					}
 					// Should be new file, but if the rename didn't succeed, append to the old rather than overwrite.
 					CreateFileOutput(m_sCanonicalizedNameCasePreserved.c_str(), m_fstream, true);
@@ -96,9 +89,9 @@ void WofstreamSync_t::EnforceSizeThreshold()
 /// <returns>New reference count</returns>
 size_t WofstreamSync_t::AddRef()
 {
-	EnterCriticalSection(&m_critsec);
+	m_mutex.Lock();
 	++m_refCount;
-	LeaveCriticalSection(&m_critsec);
+	m_mutex.Unlock();
 	return m_refCount;
 }
 
@@ -108,10 +101,10 @@ size_t WofstreamSync_t::AddRef()
 /// <returns>New reference count</returns>
 size_t WofstreamSync_t::Release()
 {
-	EnterCriticalSection(&m_critsec);
+	m_mutex.Lock();
 	if (0 == --m_refCount)
 	{
-		// Exception handling to ensure the Leave API is called.
+		// Exception handling to ensure the mutex is released.
 		try
 		{
 			if (m_fstream.is_open())
@@ -122,7 +115,7 @@ size_t WofstreamSync_t::Release()
 		catch(...)
 		{ }
 	}
-	LeaveCriticalSection(&m_critsec);
+	m_mutex.Unlock();
 	return m_refCount;
 }
 
@@ -133,13 +126,11 @@ size_t WofstreamSync_t::Release()
 // Constructor (note that there should be at most one instance of this object).
 WofstreamManager_t::WofstreamManager_t()
 {
-	InitializeCriticalSection(&m_critsec);
 }
 
 // Destructor
 WofstreamManager_t::~WofstreamManager_t()
 {
-	DeleteCriticalSection(&m_critsec);
 }
 
 /// <summary>
@@ -156,8 +147,8 @@ bool WofstreamManager_t::GetWofstream(const wchar_t* szFilename, WofstreamSync_t
 	bool retval = false;
 	*ppWofstreamSync = nullptr;
 	// Serialize access to the collection
-	EnterCriticalSection(&m_critsec);
-	// Exception handling to ensure the Leave API gets called
+	m_mutex.Lock();
+	// Exception handling to ensure the mutex gets released
 	try
 	{
 		// Get the canonicalized name for the input file name.
@@ -207,7 +198,7 @@ bool WofstreamManager_t::GetWofstream(const wchar_t* szFilename, WofstreamSync_t
 		}
 	}
 	catch (...) {}
-	LeaveCriticalSection(&m_critsec);
+	m_mutex.Unlock();
 	return retval;
 }
 
@@ -219,8 +210,8 @@ bool WofstreamManager_t::GetWofstream(const wchar_t* szFilename, WofstreamSync_t
 void WofstreamManager_t::ReleaseWofstream(WofstreamSync_t* pWofstreamSync)
 {
 	// Serialize access to the collection
-	EnterCriticalSection(&m_critsec);
-	// Exception handling to ensure the Leave API gets called
+	m_mutex.Lock();
+	// Exception handling to ensure the mutex gets released
 	try
 	{
 		// Decrement the reference count (closing the file if it's the last reference).
@@ -237,7 +228,16 @@ void WofstreamManager_t::ReleaseWofstream(WofstreamSync_t* pWofstreamSync)
 		}
 	}
 	catch(...) {}
-	LeaveCriticalSection(&m_critsec);
+	m_mutex.Unlock();
+}
+
+/// <summary>
+/// Number of distinct files currently referenced (for leak detection).
+/// </summary>
+size_t WofstreamManager_t::Count()
+{
+	PlatformLock_t lock(m_mutex);
+	return m_wofstreams.size();
 }
 
 /// <summary>
@@ -253,34 +253,18 @@ bool WofstreamManager_t::CanonicalizedNames(const wchar_t* szFilename, std::wstr
 {
 	sCanonicalizedName.clear();
 	sCanonicalizedNameCasePreserved.clear();
-	const DWORD bufsize = MAX_PATH * 2;
-	wchar_t szFullPathName[bufsize] = { 0 }, szLongPathName[bufsize] = { 0 };
 
-	// Convert a relative path to an absolute path. Note that file might or might not exist.
-	DWORD ret = GetFullPathNameW(szFilename, bufsize, szFullPathName, nullptr);
-	// 0 is failure; ret >= bufsize means the buffer is too small. It *is* possible to create files
-	// with paths longer than MAX_PATH*2, but we're not wasting time on that here. Just fail that.
-	if (0 < ret && ret < bufsize)
+	// Convert a relative path to an absolute path, using the long path name if the file exists.
+	// Note that file might or might not exist.
+	if (PlatformFullPath(szFilename, sCanonicalizedNameCasePreserved))
 	{
-		// If the file exists, get the long path name.
-		ret = GetLongPathNameW(szFullPathName, szLongPathName, bufsize);
-		// 0 is failure; ret >= bufsize means the buffer is too small. It *is* possible to create files
-		// with paths longer than MAX_PATH*2, but we're not wasting time on that here. Just fail that.
-		if (0 < ret && ret < bufsize)
-		{
-			// Got the long path; use that
-			sCanonicalizedName = sCanonicalizedNameCasePreserved = szLongPathName;
-		}
-		else
-		{
-			// No long path - possibly doesn't exist. Use the already-obtained full path
-			sCanonicalizedName = sCanonicalizedNameCasePreserved = szFullPathName;
-		}
-		// Upper-case the canonicalized name so that all future comparisons are case-insensitive.
-		WString_To_Upper(sCanonicalizedName);
+		sCanonicalizedName = sCanonicalizedNameCasePreserved;
+		// Upper-case the canonicalized name so that all future comparisons are case-insensitive
+		// (where the file system is case-insensitive).
+		if (PlatformPathsAreCaseInsensitive)
+			WString_To_Upper(sCanonicalizedName);
 		// Success!
 		return true;
 	}
 	return false;
 }
-
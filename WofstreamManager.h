@@ -8,12 +8,12 @@
 
 #pragma once
 
-#include <Windows.h>
 #include <fstream>
 #include <unordered_map>
+#include "Platform.h"
 
 /// <summary>
-/// Object that encapsulates a std::wofstream, a critical section for serializing access, the
+/// Object that encapsulates a std::wofstream, a mutex for serializing access, the
 /// canonicalized name it's referenced under, a maximum size, and a reference count.
 /// </summary>
 struct WofstreamSync_t
@@ -21,7 +21,7 @@ struct WofstreamSync_t
 public:
 	// public data
 	std::wofstream m_fstream;
-	CRITICAL_SECTION m_critsec;
+	PlatformMutex_t m_mutex;
 	std::wstring m_sCanonicalizedName, m_sCanonicalizedNameCasePreserved;
 	uint64_t m_uSizeThreshold;
 
@@ -34,7 +34,7 @@ public:
 	/// Enforces the file's size threshold (if non-zero). If the size has reached or exceeded 
 	/// the threshold, closes the stream, renames the file with a timestamp in the file name, 
 	/// then opens a new stream with the original file name.
-	/// CALLER MUST HAVE ACQUIRED THE CRITICAL SECTION.
+	/// CALLER MUST HAVE ACQUIRED THE MUTEX.
 	/// </summary>
 	void EnforceSizeThreshold();
 
@@ -98,6 +98,11 @@ public:
 	/// <param name="pWofstreamSync">Input: previously returned pointer to WofstreamSync_t instance.</param>
 	void ReleaseWofstream(WofstreamSync_t* pWofstreamSync);
 
+	/// <summary>
+	/// Number of distinct files currently referenced (for leak detection).
+	/// </summary>
+	size_t Count();
+
 private:
 	/// <summary>
 	/// Canonicalizes input file name so that relative vs. absolute paths, short vs. long filenames, upper vs. lower case
@@ -114,8 +119,8 @@ private:
 	// Collection that maps canonicalized file names to (possibly-shared) WofstreamSync_t instances.
 	WofstreamSyncMap_t m_wofstreams;
 
-	// Critical section to serialize access to the collection.
-	CRITICAL_SECTION m_critsec;
+	// Mutex to serialize access to the collection.
+	PlatformMutex_t m_mutex;
 
 private:
 	WofstreamManager_t(const WofstreamManager_t&) = delete;
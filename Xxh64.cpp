@@ -0,0 +1,149 @@
+#include <cstring>
+#include "Xxh64.h"
+
+static const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t Prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t RotateLeft(uint64_t x, int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+// (Every platform this builds for is little-endian, so a plain load is a little-endian load)
+static inline uint64_t LoadLittleEndian64(const uint8_t* p)
+{
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline uint32_t LoadLittleEndian32(const uint8_t* p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline uint64_t Round(uint64_t ullAcc, uint64_t ullInput)
+{
+    ullAcc += ullInput * Prime2;
+    ullAcc = RotateLeft(ullAcc, 31);
+    return ullAcc * Prime1;
+}
+
+static inline uint64_t MergeRound(uint64_t ullAcc, uint64_t ullLane)
+{
+    ullAcc ^= Round(0, ullLane);
+    return ullAcc * Prime1 + Prime4;
+}
+
+void Xxh64_t::Reset(uint64_t ullSeed)
+{
+    m_ullSeed = ullSeed;
+    m_lanes[0] = ullSeed + Prime1 + Prime2;
+    m_lanes[1] = ullSeed + Prime2;
+    m_lanes[2] = ullSeed;
+    m_lanes[3] = ullSeed - Prime1;
+    m_cbBuffered = 0;
+    m_ullLength = 0;
+}
+
+/// <summary>
+/// Runs each 32-byte stripe through the four lanes
+/// </summary>
+void Xxh64_t::ConsumeStripes(const uint8_t* pData, size_t nStripes)
+{
+    uint64_t v1 = m_lanes[0], v2 = m_lanes[1], v3 = m_lanes[2], v4 = m_lanes[3];
+    for (; nStripes > 0; --nStripes, pData += 32)
+    {
+        v1 = Round(v1, LoadLittleEndian64(pData));
+        v2 = Round(v2, LoadLittleEndian64(pData + 8));
+        v3 = Round(v3, LoadLittleEndian64(pData + 16));
+        v4 = Round(v4, LoadLittleEndian64(pData + 24));
+    }
+    m_lanes[0] = v1;
+    m_lanes[1] = v2;
+    m_lanes[2] = v3;
+    m_lanes[3] = v4;
+}
+
+void Xxh64_t::Update(const uint8_t* pData, size_t cbData)
+{
+    m_ullLength += cbData;
+    // Complete a partial stripe left from the previous call
+    if (m_cbBuffered > 0)
+    {
+        const size_t cbCopy = (cbData < sizeof(m_buffer) - m_cbBuffered) ? cbData : sizeof(m_buffer) - m_cbBuffered;
+        memcpy(m_buffer + m_cbBuffered, pData, cbCopy);
+        m_cbBuffered += cbCopy;
+        pData += cbCopy;
+        cbData -= cbCopy;
+        if (m_cbBuffered < sizeof(m_buffer))
+            return;
+        ConsumeStripes(m_buffer, 1);
+        m_cbBuffered = 0;
+    }
+    // Whole stripes straight from the caller's data; keep the rest for next time
+    const size_t nStripes = cbData / 32;
+    ConsumeStripes(pData, nStripes);
+    pData += nStripes * 32;
+    cbData -= nStripes * 32;
+    memcpy(m_buffer, pData, cbData);
+    m_cbBuffered = cbData;
+}
+
+uint64_t Xxh64_t::Final() const
+{
+    uint64_t ullHash;
+    if (m_ullLength >= 32)
+    {
+        ullHash = RotateLeft(m_lanes[0], 1) + RotateLeft(m_lanes[1], 7) + RotateLeft(m_lanes[2], 12) + RotateLeft(m_lanes[3], 18);
+        for (const uint64_t ullLane : m_lanes)
+            ullHash = MergeRound(ullHash, ullLane);
+    }
+    else
+    {
+        ullHash = m_ullSeed + Prime5;
+    }
+    ullHash += m_ullLength;
+
+    // The bytes that didn't make a whole stripe: 8, then 4, then 1 at a time
+    const uint8_t* p = m_buffer;
+    const uint8_t* const pEnd = m_buffer + m_cbBuffered;
+    for (; p + 8 <= pEnd; p += 8)
+        ullHash = RotateLeft(ullHash ^ Round(0, LoadLittleEndian64(p)), 27) * Prime1 + Prime4;
+    if (p + 4 <= pEnd)
+    {
+        ullHash = RotateLeft(ullHash ^ (uint64_t(LoadLittleEndian32(p)) * Prime1), 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    for (; p < pEnd; ++p)
+        ullHash = RotateLeft(ullHash ^ (uint64_t(*p) * Prime5), 11) * Prime1;
+
+    // Avalanche
+    ullHash ^= ullHash >> 33;
+    ullHash *= Prime2;
+    ullHash ^= ullHash >> 29;
+    ullHash *= Prime3;
+    ullHash ^= ullHash >> 32;
+    return ullHash;
+}
+
+uint64_t Xxh64_t::Compute(const uint8_t* pData, size_t cbData, uint64_t ullSeed)
+{
+    Xxh64_t hash(ullSeed);
+    hash.Update(pData, cbData);
+    return hash.Final();
+}
+
+std::wstring Xxh64ToString(uint64_t ullHash)
+{
+    static const wchar_t szHexDigits[] = L"0123456789abcdef";
+    std::wstring sHex(16, L'0');
+    for (int ix = 15; ix >= 0; --ix, ullHash >>= 4)
+        sHex[size_t(ix)] = szHexDigits[ullHash & 0x0F];
+    return sHex;
+}
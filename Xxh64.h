@@ -0,0 +1,52 @@
+// XXH64 (the 64-bit xxHash), computed incrementally: a fast non-cryptographic hash for checking captured
+// output files against a manifest. Compatible with xxhsum -H1 and other XXH64 implementations (seed 0).
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/// <summary>
+/// Computes an XXH64 hash over data supplied in any number of pieces.
+/// </summary>
+class Xxh64_t
+{
+public:
+    explicit Xxh64_t(uint64_t ullSeed = 0) { Reset(ullSeed); }
+
+    /// <summary>
+    /// Starts a new hash
+    /// </summary>
+    void Reset(uint64_t ullSeed = 0);
+
+    /// <summary>
+    /// Adds data to the hash
+    /// </summary>
+    void Update(const uint8_t* pData, size_t cbData);
+
+    /// <summary>
+    /// Returns the hash of the data added so far. (The object can continue to be updated.)
+    /// </summary>
+    uint64_t Final() const;
+
+    /// <summary>
+    /// Computes the hash of a single buffer
+    /// </summary>
+    static uint64_t Compute(const uint8_t* pData, size_t cbData, uint64_t ullSeed = 0);
+
+private:
+    void ConsumeStripes(const uint8_t* pData, size_t nStripes);
+
+private:
+    uint64_t m_ullSeed;
+    uint64_t m_lanes[4];
+    uint8_t m_buffer[32];
+    size_t m_cbBuffered;
+    uint64_t m_ullLength;
+};
+
+/// <summary>
+/// Hexadecimal representation of a hash, as xxhsum shows it (16 lowercase digits)
+/// </summary>
+std::wstring Xxh64ToString(uint64_t ullHash);